@@ -0,0 +1,55 @@
+#include <commands/ollama_commands.hpp>
+#include <network/chunkedcontentprovider.hpp>
+#include <ollama/json.hpp>
+
+#include <cstddef>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+namespace Benchmarks {
+
+namespace {
+/// @returns Chat with the system prompt and alternating user/assistant messages.
+nlohmann::json MakeChat(std::size_t messagesCount)
+{
+    nlohmann::json chat;
+    chat["model"] = "llama3";
+    chat["stream"] = true;
+    chat["messages"] = nlohmann::json::array();
+    chat["messages"].push_back({{"role", "system"}, {"content", "You are a helpful assistant."}});
+    for (std::size_t i = 0; i < messagesCount; ++i)
+    {
+        const auto letter = static_cast<char>('a' + i % 26);
+        chat["messages"].push_back(
+          {{"role", i % 2 == 0 ? "user" : "assistant"}, {"content", std::string(400, letter)}});
+    }
+    return chat;
+}
+} // namespace
+
+void BM_CreateChatRequest(benchmark::State &state)
+{
+    const auto chat = MakeChat(static_cast<std::size_t>(state.range(0)));
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(CChunkedContentProvider::CreateChatRequest(chat));
+    }
+}
+BENCHMARK(BM_CreateChatRequest)->Arg(2)->Arg(16)->Arg(128);
+
+// Includes copy of the chat, because commands are inserted in place.
+void BM_MakeCommandsAvailForAi(benchmark::State &state)
+{
+    const auto chat = MakeChat(static_cast<std::size_t>(state.range(0)));
+    const auto &aiCommands = GetAiCommandsList();
+    for (auto _ : state)
+    {
+        auto copy = chat;
+        CChunkedContentProvider::MakeCommandsAvailForAi(copy, aiCommands);
+        benchmark::DoNotOptimize(copy);
+    }
+}
+BENCHMARK(BM_MakeCommandsAvailForAi)->Arg(2)->Arg(16)->Arg(128);
+
+} // namespace Benchmarks
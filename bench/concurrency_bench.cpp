@@ -0,0 +1,140 @@
+#include <common/safe_queue.h>
+#include <common/threads_pool.hpp>
+#include <common/work_stealing_pool.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+namespace Benchmarks {
+
+// All threads push to and pop from the same queue.
+void BM_SafeQueuePushPop(benchmark::State &state)
+{
+    static SafeQueue<std::int64_t> queue;
+    std::int64_t value = 0;
+    for (auto _ : state)
+    {
+        queue.push(++value);
+        benchmark::DoNotOptimize(queue.pop());
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SafeQueuePushPop)->ThreadRange(1, 8)->UseRealTime();
+
+// Time from the first enqueue until the batch of empty tasks is executed.
+template <typename taPool>
+void BM_PoolEnqueue(benchmark::State &state)
+{
+    constexpr std::size_t kBatchSize = 1000;
+    taPool pool(static_cast<std::size_t>(state.range(0)));
+    std::atomic<std::size_t> executed{0};
+    for (auto _ : state)
+    {
+        executed = 0;
+        for (std::size_t i = 0; i < kBatchSize; ++i)
+        {
+            pool.enqueue([&executed](const auto &) {
+                executed.fetch_add(1, std::memory_order_relaxed);
+            });
+        }
+        while (executed.load(std::memory_order_relaxed) < kBatchSize)
+        {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * kBatchSize));
+}
+BENCHMARK_TEMPLATE(BM_PoolEnqueue, utility::CThreadPool)->Arg(1)->Arg(4)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_PoolEnqueue, utility::CWorkStealingThreadPool)
+  ->Arg(1)
+  ->Arg(4)
+  ->UseRealTime();
+
+// Many small tasks enqueued concurrently from several producers outside of the pool.
+template <typename taPool>
+void BM_PoolManyProducers(benchmark::State &state)
+{
+    constexpr std::size_t kProducers = 4;
+    constexpr std::size_t kTasksPerProducer = 2500;
+    taPool pool(static_cast<std::size_t>(state.range(0)));
+    std::atomic<std::size_t> executed{0};
+    for (auto _ : state)
+    {
+        executed = 0;
+        std::vector<std::thread> producers;
+        producers.reserve(kProducers);
+        for (std::size_t p = 0; p < kProducers; ++p)
+        {
+            producers.emplace_back([&pool, &executed]() {
+                for (std::size_t i = 0; i < kTasksPerProducer; ++i)
+                {
+                    pool.enqueue([&executed](const auto &) {
+                        executed.fetch_add(1, std::memory_order_relaxed);
+                    });
+                }
+            });
+        }
+        for (auto &producer : producers)
+        {
+            producer.join();
+        }
+        while (executed.load(std::memory_order_relaxed) < kProducers * kTasksPerProducer)
+        {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(
+      static_cast<std::int64_t>(state.iterations() * kProducers * kTasksPerProducer));
+}
+BENCHMARK_TEMPLATE(BM_PoolManyProducers, utility::CThreadPool)->Arg(4)->Arg(8)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_PoolManyProducers, utility::CWorkStealingThreadPool)
+  ->Arg(4)
+  ->Arg(8)
+  ->UseRealTime();
+
+// Fork/join: binary tree of tasks where each inner task spawns 2 children from the worker and
+// the root waits until all leaves are done.
+template <typename taPool>
+void BM_PoolForkJoin(benchmark::State &state)
+{
+    constexpr std::size_t kDepth = 12;
+    constexpr std::size_t kLeaves = std::size_t{1} << kDepth;
+    std::atomic<std::size_t> leaves{0};
+    // Declared before the pool, so it outlives tasks which are still returning from it.
+    std::function<void(std::size_t)> spawn;
+    taPool pool(static_cast<std::size_t>(state.range(0)));
+    spawn = [&](std::size_t depth) {
+        pool.enqueue([&spawn, &leaves, depth](const auto &) {
+            if (depth == 0)
+            {
+                leaves.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+            spawn(depth - 1);
+            spawn(depth - 1);
+        });
+    };
+    for (auto _ : state)
+    {
+        leaves = 0;
+        spawn(kDepth);
+        while (leaves.load(std::memory_order_relaxed) < kLeaves)
+        {
+            std::this_thread::yield();
+        }
+    }
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * (2 * kLeaves - 1)));
+}
+BENCHMARK_TEMPLATE(BM_PoolForkJoin, utility::CThreadPool)->Arg(1)->Arg(4)->UseRealTime();
+BENCHMARK_TEMPLATE(BM_PoolForkJoin, utility::CWorkStealingThreadPool)
+  ->Arg(1)
+  ->Arg(4)
+  ->UseRealTime();
+
+} // namespace Benchmarks
@@ -0,0 +1,75 @@
+#include <network/contentrestorator.hpp>
+#include <ollama/json.hpp>
+#include <ollama/ollama.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+namespace Benchmarks {
+
+namespace {
+constexpr std::size_t kAnswerSize = 4096;
+
+TAssistWords MakeKeywords(std::size_t count)
+{
+    TAssistWords keywords;
+    for (std::size_t i = 0; i < count; ++i)
+    {
+        keywords.emplace_back("BACKEND_COMMAND_" + std::to_string(i));
+    }
+    return keywords;
+}
+
+/// @returns Answer split to Ollama's chunks, the last one is marked as done.
+std::vector<ollama::response> MakeChunks(const std::string &answer, std::size_t chunkSize)
+{
+    std::vector<ollama::response> chunks;
+    for (std::size_t offset = 0; offset < answer.size(); offset += chunkSize)
+    {
+        nlohmann::json json;
+        json["model"] = "llama3";
+        json["done"] = offset + chunkSize >= answer.size();
+        json["message"]["role"] = "assistant";
+        json["message"]["content"] = answer.substr(offset, chunkSize);
+        chunks.emplace_back(json.dump(), ollama::message_type::chat);
+    }
+    return chunks;
+}
+
+void RunStream(benchmark::State &state, const std::string &answer)
+{
+    const auto keywords = MakeKeywords(static_cast<std::size_t>(state.range(0)));
+    const auto chunks = MakeChunks(answer, static_cast<std::size_t>(state.range(1)));
+    CContentRestorator restorator(keywords);
+    for (auto _ : state)
+    {
+        restorator.Reset();
+        for (const auto &chunk : chunks)
+        {
+            benchmark::DoNotOptimize(restorator.Update(chunk));
+        }
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * answer.size()));
+    state.SetItemsProcessed(static_cast<std::int64_t>(state.iterations() * chunks.size()));
+}
+} // namespace
+
+// Plain answer is recognized as text for the user after the first chunks.
+void BM_ContentRestoratorPlainText(benchmark::State &state)
+{
+    RunStream(state, std::string(kAnswerSize, 'a'));
+}
+BENCHMARK(BM_ContentRestoratorPlainText)->ArgsProduct({{1, 4, 16}, {1, 8, 64}});
+
+// Command is held back until Ollama finishes, it is the worst case for the detector.
+void BM_ContentRestoratorCommand(benchmark::State &state)
+{
+    RunStream(state, "BACKEND_COMMAND_0 " + std::string(kAnswerSize, 'a'));
+}
+BENCHMARK(BM_ContentRestoratorCommand)->ArgsProduct({{1, 4, 16}, {1, 8, 64}});
+
+} // namespace Benchmarks
@@ -0,0 +1,94 @@
+#include <network/contentrestorator.hpp>
+#include <network/stream_capture.hpp>
+#include <network/user_ping_generator.hpp>
+#include <ollama/ollama.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+namespace Benchmarks {
+
+namespace {
+// Capture recorded by the proxy with streamCapture.path set.
+constexpr auto kCaptureVariable = "OLLAMA_MITM_CAPTURE";
+
+/// @returns Streams of the capture as Ollama's responses, empty if capture is not set.
+std::vector<std::vector<ollama::response>> LoadCapture(benchmark::State &state)
+{
+    const char *path = std::getenv(kCaptureVariable); // NOLINT
+    if (path == nullptr)
+    {
+        state.SkipWithError("Set OLLAMA_MITM_CAPTURE to the capture file.");
+        return {};
+    }
+    std::vector<std::vector<ollama::response>> streams;
+    for (const auto &captured : CStreamCapture::ReadAll(path))
+    {
+        auto &stream = streams.emplace_back();
+        for (const auto &line : captured.lines)
+        {
+            stream.emplace_back(line.text, ollama::message_type::chat);
+        }
+    }
+    return streams;
+}
+
+std::size_t CountBytes(const std::vector<std::vector<ollama::response>> &streams)
+{
+    std::size_t bytes = 0;
+    for (const auto &stream : streams)
+    {
+        for (const auto &chunk : stream)
+        {
+            bytes += chunk.as_simple_string().size();
+        }
+    }
+    return bytes;
+}
+} // namespace
+
+// Real token sizes, keywords are the default commands.
+void BM_ContentRestoratorReplay(benchmark::State &state)
+{
+    const auto streams = LoadCapture(state);
+    CContentRestorator restorator(GetAiCommandsList());
+    for (auto _ : state)
+    {
+        for (const auto &stream : streams)
+        {
+            restorator.Reset();
+            for (const auto &chunk : stream)
+            {
+                benchmark::DoNotOptimize(restorator.Update(chunk));
+            }
+        }
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * CountBytes(streams)));
+}
+BENCHMARK(BM_ContentRestoratorReplay);
+
+// Every chunk is rewritten, like text released by the restorator.
+void BM_RewriteReplay(benchmark::State &state)
+{
+    const auto streams = LoadCapture(state);
+    for (auto _ : state)
+    {
+        for (const auto &stream : streams)
+        {
+            for (const auto &chunk : stream)
+            {
+                benchmark::DoNotOptimize(
+                  CUserPingGenerator::ReplaceOllamaText(chunk, chunk.as_simple_string()));
+            }
+        }
+    }
+    state.SetBytesProcessed(static_cast<std::int64_t>(state.iterations() * CountBytes(streams)));
+}
+BENCHMARK(BM_RewriteReplay);
+
+} // namespace Benchmarks
@@ -0,0 +1,39 @@
+#include <network/user_ping_generator.hpp>
+#include <ollama/json.hpp>
+#include <ollama/ollama.hpp>
+
+#include <cstddef>
+#include <string>
+
+#include <benchmark/benchmark.h>
+
+namespace Benchmarks {
+
+void BM_ReplaceOllamaText(benchmark::State &state)
+{
+    nlohmann::json json;
+    json["model"] = "llama3";
+    json["created_at"] = "2025-04-26T12:13:59.246926495Z";
+    json["done"] = false;
+    json["message"]["role"] = "assistant";
+    json["message"]["content"] = "token";
+    const ollama::response response(json.dump(), ollama::message_type::chat);
+    const std::string text(static_cast<std::size_t>(state.range(0)), 'a');
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(CUserPingGenerator::ReplaceOllamaText(response, text));
+    }
+}
+BENCHMARK(BM_ReplaceOllamaText)->Arg(8)->Arg(512);
+
+void BM_BuildJsStringForUser(benchmark::State &state)
+{
+    const std::string text(static_cast<std::size_t>(state.range(0)), 'a');
+    for (auto _ : state)
+    {
+        benchmark::DoNotOptimize(CUserPingGenerator::BuildJsStringForUser("llama3", text));
+    }
+}
+BENCHMARK(BM_BuildJsStringForUser)->Arg(8)->Arg(512);
+
+} // namespace Benchmarks
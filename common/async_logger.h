@@ -0,0 +1,481 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace logging {
+
+enum class ELogFormat : std::uint8_t {
+    /// @brief Message followed by key=value fields, one record per line.
+    Text,
+    /// @brief Length-prefixed records, see CAsyncLogger::WriteBinary().
+    Binary,
+};
+
+/// @brief Single structured log record.
+struct TLogRecord
+{
+    std::chrono::system_clock::time_point time;
+    std::uint8_t level{0};
+    std::ostream *destination{nullptr};
+    ELogFormat format{ELogFormat::Text};
+    std::string message;
+    std::vector<std::pair<std::string, std::string>> fields;
+
+    template <typename taValue>
+    TLogRecord &Add(std::string key, const taValue &value)
+    {
+        if constexpr (std::is_convertible_v<const taValue &, std::string>)
+        {
+            fields.emplace_back(std::move(key), value);
+        }
+        else
+        {
+            std::ostringstream os;
+            os << value;
+            fields.emplace_back(std::move(key), os.str());
+        }
+        return *this;
+    }
+};
+
+/// @brief Bounded ring for single producer and single consumer, both sides are wait-free.
+template <typename T>
+class CSpscRing
+{
+  public:
+    NO_COPYMOVE(CSpscRing);
+    CSpscRing() = delete;
+    ~CSpscRing() = default;
+
+    explicit CSpscRing(std::size_t capacity) :
+        slots(capacity + 1)
+    {
+    }
+
+    /// @returns false if ring is full, value is not moved then.
+    bool TryPush(T &value)
+    {
+        const auto currentTail = tail.load(std::memory_order_relaxed);
+        const auto nextTail = Next(currentTail);
+        if (nextTail == head.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        slots[currentTail] = std::move(value);
+        // Sequential consistency pairs with the writer which checks rings before it sleeps.
+        tail.store(nextTail, std::memory_order_seq_cst);
+        return true;
+    }
+
+    std::optional<T> TryPop()
+    {
+        const auto currentHead = head.load(std::memory_order_relaxed);
+        if (currentHead == tail.load(std::memory_order_seq_cst))
+        {
+            return std::nullopt;
+        }
+        std::optional<T> value{std::move(slots[currentHead])};
+        head.store(Next(currentHead), std::memory_order_release);
+        return value;
+    }
+
+    [[nodiscard]]
+    bool IsEmpty() const
+    {
+        return head.load(std::memory_order_relaxed) == tail.load(std::memory_order_seq_cst);
+    }
+
+  private:
+    [[nodiscard]]
+    std::size_t Next(std::size_t index) const
+    {
+        return index + 1 == slots.size() ? 0 : index + 1;
+    }
+
+    std::vector<T> slots;
+    alignas(64) std::atomic<std::size_t> head{0};
+    alignas(64) std::atomic<std::size_t> tail{0};
+};
+
+/// @brief Each thread puts records into own ring, background writer drains rings and writes records
+/// to their streams. Producers never wait for I/O or for each other: if thread's ring is full the
+/// record is dropped and counted.
+class CAsyncLogger
+{
+  public:
+    /// @brief Ring of the thread preallocates that many records, about 360 KiB.
+    static constexpr std::size_t kRecordsPerThread = 4096;
+    /// @brief Rings of the exited threads kept for the new ones, so threads started per chat reuse
+    /// them instead of allocating own.
+    static constexpr std::size_t kSpareRings = 64;
+    // Writer wakes up at least that often even if nobody notified it.
+    static constexpr std::chrono::milliseconds kMaxSleep{100};
+
+    NO_COPYMOVE(CAsyncLogger);
+
+    ~CAsyncLogger()
+    {
+        isStopping = true;
+        WakeUpWriter();
+        writer.join();
+    }
+
+    /// @returns Logger shared by the whole process.
+    static CAsyncLogger &Instance()
+    {
+        static CAsyncLogger logger;
+        return logger;
+    }
+
+    /// @returns false if record was dropped because ring of the current thread is full.
+    bool Submit(TLogRecord record)
+    {
+        if (!GetThreadBuffer().ring.TryPush(record))
+        {
+            droppedCount.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (isWriterSleeping.load(std::memory_order_seq_cst))
+        {
+            WakeUpWriter();
+        }
+        return true;
+    }
+
+    /// @brief Blocks until everything submitted before the call is written.
+    void Flush()
+    {
+        std::unique_lock lock(mutex);
+        // Pass which is running now could miss records, so the next one is awaited.
+        const auto target = passesCount + 2;
+        isFlushRequested = true;
+        wakeUp.notify_all();
+        passDone.wait(lock, [&]() {
+            return passesCount >= target || isStopping;
+        });
+    }
+
+    /// @returns How many rings were allocated since the start.
+    [[nodiscard]]
+    std::size_t GetRingsCount() const
+    {
+        return ringsCount.load(std::memory_order_relaxed);
+    }
+
+    /// @returns Count of the records dropped because producer was faster than writer.
+    [[nodiscard]]
+    std::size_t GetDroppedCount() const
+    {
+        return droppedCount.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Binary record: u32 size of the rest, i64 nanoseconds since epoch, u8 level,
+    /// u32 fields count, then message and key/value strings each as u32 size and bytes. Integers
+    /// are in host byte order.
+    static void WriteBinary(std::ostream &os, const TLogRecord &record)
+    {
+        std::string body;
+        const auto appendInt = [&body](auto value) {
+            body.append(reinterpret_cast<const char *>(&value), sizeof(value));
+        };
+        const auto appendString = [&](const std::string &value) {
+            appendInt(static_cast<std::uint32_t>(value.size()));
+            body.append(value);
+        };
+        appendInt(static_cast<std::int64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(record.time.time_since_epoch())
+            .count()));
+        appendInt(record.level);
+        appendInt(static_cast<std::uint32_t>(record.fields.size()));
+        appendString(record.message);
+        for (const auto &[key, value] : record.fields)
+        {
+            appendString(key);
+            appendString(value);
+        }
+        const auto size = static_cast<std::uint32_t>(body.size());
+        os.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        os.write(body.data(), static_cast<std::streamsize>(body.size()));
+    }
+
+    /// @brief Reads record written by WriteBinary().
+    /// @returns std::nullopt on the end of the stream or on the broken record.
+    static std::optional<TLogRecord> ReadBinary(std::istream &is)
+    {
+        std::uint32_t size = 0;
+        if (!is.read(reinterpret_cast<char *>(&size), sizeof(size)))
+        {
+            return std::nullopt;
+        }
+        std::string body(size, '\0');
+        if (!is.read(body.data(), size))
+        {
+            return std::nullopt;
+        }
+
+        std::size_t offset = 0;
+        bool isBroken = false;
+        const auto readInt = [&](auto &value) {
+            if (offset + sizeof(value) > body.size())
+            {
+                isBroken = true;
+                return;
+            }
+            std::copy_n(body.data() + offset, sizeof(value), reinterpret_cast<char *>(&value));
+            offset += sizeof(value);
+        };
+        const auto readString = [&]() {
+            std::uint32_t length = 0;
+            readInt(length);
+            if (isBroken || offset + length > body.size())
+            {
+                isBroken = true;
+                return std::string{};
+            }
+            std::string value = body.substr(offset, length);
+            offset += length;
+            return value;
+        };
+
+        TLogRecord record;
+        std::int64_t nanoseconds = 0;
+        std::uint32_t fieldsCount = 0;
+        readInt(nanoseconds);
+        readInt(record.level);
+        readInt(fieldsCount);
+        record.time = std::chrono::system_clock::time_point{
+          std::chrono::duration_cast<std::chrono::system_clock::duration>(
+            std::chrono::nanoseconds{nanoseconds})};
+        record.format = ELogFormat::Binary;
+        record.message = readString();
+        for (std::uint32_t i = 0; i < fieldsCount && !isBroken; ++i)
+        {
+            auto key = readString();
+            auto value = readString();
+            record.fields.emplace_back(std::move(key), std::move(value));
+        }
+        if (isBroken)
+        {
+            return std::nullopt;
+        }
+        return record;
+    }
+
+    /// @brief Text record: message, then space separated key=value fields, values with spaces or
+    /// quotes are quoted.
+    static void WriteText(std::ostream &os, const TLogRecord &record)
+    {
+        os << record.message;
+        for (const auto &[key, value] : record.fields)
+        {
+            os << ' ' << key << '=';
+            if (value.find_first_of(" \t\n\"") == std::string::npos && !value.empty())
+            {
+                os << value;
+                continue;
+            }
+            os << '"';
+            for (const char ch : value)
+            {
+                if (ch == '"' || ch == '\\')
+                {
+                    os << '\\';
+                }
+                os << (ch == '\n' ? ' ' : ch);
+            }
+            os << '"';
+        }
+        // Messages made from streams already end by std::endl.
+        if (record.message.empty() || record.message.back() != '\n' || !record.fields.empty())
+        {
+            os << '\n';
+        }
+    }
+
+  private:
+    struct TThreadBuffer
+    {
+        CSpscRing<TLogRecord> ring{kRecordsPerThread};
+        std::atomic<bool> isOwnerAlive{true};
+    };
+
+    // Marks buffer abandoned when its thread exits, writer releases it once drained.
+    struct TThreadBufferOwner
+    {
+        NO_COPYMOVE(TThreadBufferOwner);
+        TThreadBufferOwner() = default;
+        ~TThreadBufferOwner()
+        {
+            if (buffer)
+            {
+                buffer->isOwnerAlive = false;
+            }
+        }
+        std::shared_ptr<TThreadBuffer> buffer;
+    };
+
+    CAsyncLogger() :
+        writer([this]() {
+            WriterLoop();
+        })
+    {
+    }
+
+    TThreadBuffer &GetThreadBuffer()
+    {
+        thread_local TThreadBufferOwner owner;
+        if (owner.buffer)
+        {
+            return *owner.buffer;
+        }
+        const std::lock_guard lock(mutex);
+        // Drained ring of the exited thread, its last pushes happened before it was abandoned.
+        const auto spare = std::find_if(buffers.begin(), buffers.end(), [](const auto &buffer) {
+            return !buffer->isOwnerAlive && buffer->ring.IsEmpty();
+        });
+        if (spare != buffers.end())
+        {
+            (*spare)->isOwnerAlive = true;
+            owner.buffer = *spare;
+            return *owner.buffer;
+        }
+        owner.buffer = std::make_shared<TThreadBuffer>();
+        ringsCount.fetch_add(1, std::memory_order_relaxed);
+        buffers.push_back(owner.buffer);
+        return *owner.buffer;
+    }
+
+    void WakeUpWriter()
+    {
+        const std::lock_guard lock(mutex);
+        wakeUp.notify_all();
+    }
+
+    void WriterLoop()
+    {
+        std::vector<TLogRecord> pass;
+        std::unique_lock lock(mutex);
+        while (true)
+        {
+            const auto snapshot = buffers;
+            const bool isLastPass = isStopping;
+            lock.unlock();
+
+            for (const auto &buffer : snapshot)
+            {
+                while (auto record = buffer->ring.TryPop())
+                {
+                    pass.emplace_back(std::move(*record));
+                }
+            }
+            // Records of the different threads are interleaved by time.
+            std::stable_sort(pass.begin(), pass.end(), [](const auto &a, const auto &b) {
+                return a.time < b.time;
+            });
+            Write(pass);
+            pass.clear();
+
+            lock.lock();
+            ++passesCount;
+            passDone.notify_all();
+            // Drained rings of the exited threads are released above the spare ones.
+            std::size_t spares = 0;
+            buffers.erase(std::remove_if(buffers.begin(), buffers.end(),
+                                         [&spares](const auto &buffer) {
+                                             return !buffer->isOwnerAlive
+                                                    && buffer->ring.IsEmpty()
+                                                    && ++spares > kSpareRings;
+                                         }),
+                          buffers.end());
+            if (isLastPass)
+            {
+                break;
+            }
+            if (isFlushRequested)
+            {
+                isFlushRequested = false;
+                continue;
+            }
+
+            isWriterSleeping.store(true, std::memory_order_seq_cst);
+            const bool hasRecords = std::any_of(buffers.begin(), buffers.end(), [](const auto &b) {
+                return !b->ring.IsEmpty();
+            });
+            if (!hasRecords && !isStopping)
+            {
+                wakeUp.wait_for(lock, kMaxSleep);
+            }
+            isWriterSleeping.store(false, std::memory_order_seq_cst);
+        }
+    }
+
+    void Write(const std::vector<TLogRecord> &records)
+    {
+        std::vector<std::ostream *> touched;
+        for (const auto &record : records)
+        {
+            if (!record.destination)
+            {
+                continue;
+            }
+            if (record.format == ELogFormat::Binary)
+            {
+                WriteBinary(*record.destination, record);
+            }
+            else
+            {
+                WriteText(*record.destination, record);
+            }
+            if (std::find(touched.begin(), touched.end(), record.destination) == touched.end())
+            {
+                touched.push_back(record.destination);
+            }
+        }
+        // Single flush per pass instead of the flush per line.
+        for (auto *os : touched)
+        {
+            os->flush();
+        }
+        const auto dropped = droppedCount.load(std::memory_order_relaxed);
+        if (dropped > reportedDroppedCount && !touched.empty())
+        {
+            *touched.front() << "[WARNING] Log records dropped: " << dropped - reportedDroppedCount
+                             << std::endl;
+            reportedDroppedCount = dropped;
+        }
+    }
+
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable passDone;
+    std::vector<std::shared_ptr<TThreadBuffer>> buffers;
+    std::size_t passesCount{0};
+    bool isFlushRequested{false};
+    std::atomic<bool> isStopping{false};
+    std::atomic<bool> isWriterSleeping{false};
+    std::atomic<std::size_t> droppedCount{0};
+    std::atomic<std::size_t> ringsCount{0};
+    // Used by writer thread only.
+    std::size_t reportedDroppedCount{0};
+    std::thread writer;
+};
+
+} // namespace logging
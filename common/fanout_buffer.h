@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/// @brief Append-only buffer written by single producer and read by many consumers. Each consumer
+/// keeps own cursor, so every consumer receives all elements starting from the one it attached at.
+/// Bounded buffer keeps only the latest elements, cursors stay absolute indexes of the elements.
+/// Elements which attached readers did not read yet are kept even above the capacity, so the bound
+/// applies only to the replay tail behind the slowest of them.
+template <typename taStoredType, typename taMutex = std::mutex>
+class FanOutBuffer
+{
+  public:
+    using size_type = std::size_t;
+    using value_type = taStoredType;
+    using mutex_type = taMutex;
+
+    /// @param capacity how many latest elements are kept, 0 keeps all of them.
+    explicit FanOutBuffer(size_type capacity = 0) :
+        capacity(capacity)
+    {
+    }
+
+    /// @brief Appends new element to the buffer, evicting the oldest ones which are above the
+    /// capacity and read by all attached readers. Ignored if buffer is closed.
+    void push(taStoredType item)
+    {
+        std::lock_guard<taMutex> lock(mutex);
+        if (isClosed)
+        {
+            return;
+        }
+        if (capacity > 0)
+        {
+            size_type slowest = evicted + data.size();
+            for (const auto *reader : readers)
+            {
+                slowest = std::min(slowest, *reader);
+            }
+            while (data.size() >= capacity && evicted < slowest)
+            {
+                data.pop_front();
+                ++evicted;
+            }
+        }
+        data.push_back(std::move(item));
+    }
+
+    /// @brief Keeps elements starting from the cursor until the reader reads them.
+    /// @param cursor must outlive attachment and be advanced only by read().
+    void attach(const size_type &cursor)
+    {
+        std::lock_guard<taMutex> lock(mutex);
+        readers.push_back(&cursor);
+    }
+
+    void detach(const size_type &cursor)
+    {
+        std::lock_guard<taMutex> lock(mutex);
+        readers.erase(std::remove(readers.begin(), readers.end(), &cursor), readers.end());
+    }
+
+    /// @brief Reads element at the cursor without waiting.
+    /// @param cursor index of the element to read, it is advanced on success.
+    /// @returns std::nullopt if there is no such element yet, copy of the element otherwise.
+    /// @throws std::out_of_range if the element was evicted already.
+    [[nodiscard]]
+    std::optional<taStoredType> read(size_type &cursor) const
+    {
+        std::lock_guard<taMutex> lock(mutex);
+        if (cursor < evicted)
+        {
+            throw std::out_of_range("FanOutBuffer: reader fell behind, element was evicted.");
+        }
+        if (cursor - evicted >= data.size())
+        {
+            return std::nullopt;
+        }
+        return data[cursor++ - evicted];
+    }
+
+    /// @returns Copy of the elements which are kept.
+    [[nodiscard]]
+    std::vector<taStoredType> snapshot() const
+    {
+        std::lock_guard<taMutex> lock(mutex);
+        return {data.begin(), data.end()};
+    }
+
+    /// @returns Index of the oldest kept element.
+    [[nodiscard]]
+    size_type first() const
+    {
+        std::lock_guard<taMutex> lock(mutex);
+        return evicted;
+    }
+
+    /// @brief Marks buffer as completed, no more elements will be added.
+    void close()
+    {
+        std::lock_guard<taMutex> lock(mutex);
+        isClosed = true;
+    }
+
+    /// @returns true if producer has finished.
+    [[nodiscard]]
+    bool closed() const
+    {
+        std::lock_guard<taMutex> lock(mutex);
+        return isClosed;
+    }
+
+    /// @returns Number of elements pushed so far, evicted ones are counted too.
+    [[nodiscard]]
+    size_type size() const
+    {
+        std::lock_guard<taMutex> lock(mutex);
+        return evicted + data.size();
+    }
+
+  private:
+    size_type capacity;
+    std::deque<taStoredType> data;
+    size_type evicted{0};
+    /// @brief Cursors of the attached readers.
+    std::vector<const size_type *> readers;
+    bool isClosed{false};
+    mutable taMutex mutex;
+};
@@ -0,0 +1,398 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <shared_mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace metrics {
+
+// Writers are spread over that many shards, so threads rarely touch the same cache line.
+constexpr std::size_t kShards = 16;
+constexpr std::size_t kCacheLine = 64;
+
+/// @returns Shard index of the current thread.
+inline std::size_t CurrentShard()
+{
+    static std::atomic<std::size_t> nextShard{0};
+    thread_local const std::size_t shard =
+      nextShard.fetch_add(1, std::memory_order_relaxed) % kShards;
+    return shard;
+}
+
+/// @brief Monotonic counter, each thread increments own shard with relaxed atomic.
+class CCounter
+{
+  public:
+    void Add(std::uint64_t value = 1)
+    {
+        shards[CurrentShard()].value.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]]
+    std::uint64_t Value() const
+    {
+        std::uint64_t sum = 0;
+        for (const auto &shard : shards)
+        {
+            sum += shard.value.load(std::memory_order_relaxed);
+        }
+        return sum;
+    }
+
+  private:
+    struct alignas(kCacheLine) TShard
+    {
+        std::atomic<std::uint64_t> value{0};
+    };
+    std::array<TShard, kShards> shards;
+};
+
+/// @brief Value which goes up and down, like number of active streams.
+class CGauge
+{
+  public:
+    void Add(std::int64_t delta)
+    {
+        value.fetch_add(delta, std::memory_order_relaxed);
+    }
+
+    void Set(std::int64_t newValue)
+    {
+        value.store(newValue, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]]
+    std::int64_t Value() const
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+
+  private:
+    std::atomic<std::int64_t> value{0};
+};
+
+/// @brief HDR-style histogram of integer values: each power of 2 range is split into
+/// kSubBuckets linear sub-buckets, so relative error is below 1/kSubBuckets. Recording is 2 relaxed
+/// atomics on the shard of the current thread.
+class CHistogram
+{
+  public:
+    static constexpr std::size_t kSubBucketBits = 2;
+    static constexpr std::size_t kSubBuckets = 1u << kSubBucketBits;
+    // Values are clamped below 2^kMaxExponent.
+    static constexpr std::size_t kMaxExponent = 40;
+    static constexpr std::size_t kBuckets = (kMaxExponent - kSubBucketBits + 1) * kSubBuckets;
+
+    void Record(std::uint64_t value)
+    {
+        auto &shard = *shards[CurrentShard()];
+        shard.buckets[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        shard.sum.fetch_add(value, std::memory_order_relaxed);
+    }
+
+    /// @returns Index of the bucket which holds the value.
+    static std::size_t BucketIndex(std::uint64_t value)
+    {
+        value = std::min<std::uint64_t>(value, (std::uint64_t{1} << kMaxExponent) - 1);
+        if (value < kSubBuckets)
+        {
+            return static_cast<std::size_t>(value);
+        }
+        std::size_t exponent = 0;
+        for (auto v = value; v > 1; v >>= 1u)
+        {
+            ++exponent;
+        }
+        const auto subBucket = (value >> (exponent - kSubBucketBits)) & (kSubBuckets - 1);
+        return (exponent - kSubBucketBits + 1) * kSubBuckets + static_cast<std::size_t>(subBucket);
+    }
+
+    /// @returns Exclusive upper bound of the values stored in the bucket.
+    static std::uint64_t BucketUpperBound(std::size_t index)
+    {
+        if (index < kSubBuckets)
+        {
+            return index + 1;
+        }
+        const auto exponent = index / kSubBuckets + kSubBucketBits - 1;
+        const auto subBucket = index % kSubBuckets;
+        return (std::uint64_t{1} << exponent)
+               + (subBucket + 1) * (std::uint64_t{1} << (exponent - kSubBucketBits));
+    }
+
+    struct TSnapshot
+    {
+        std::array<std::uint64_t, kBuckets> buckets{};
+        std::uint64_t count{0};
+        std::uint64_t sum{0};
+    };
+
+    [[nodiscard]]
+    TSnapshot Snapshot() const
+    {
+        TSnapshot snapshot;
+        for (const auto &shard : shards)
+        {
+            for (std::size_t i = 0; i < kBuckets; ++i)
+            {
+                const auto value = shard->buckets[i].load(std::memory_order_relaxed);
+                snapshot.buckets[i] += value;
+                snapshot.count += value;
+            }
+            snapshot.sum += shard->sum.load(std::memory_order_relaxed);
+        }
+        return snapshot;
+    }
+
+  private:
+    struct alignas(kCacheLine) TShard
+    {
+        std::array<std::atomic<std::uint64_t>, kBuckets> buckets{};
+        std::atomic<std::uint64_t> sum{0};
+    };
+
+    // Shards are big, so they are kept on the heap.
+    std::array<std::unique_ptr<TShard>, kShards> shards{MakeShards()};
+
+    static std::array<std::unique_ptr<TShard>, kShards> MakeShards()
+    {
+        std::array<std::unique_ptr<TShard>, kShards> result;
+        for (auto &shard : result)
+        {
+            shard = std::make_unique<TShard>();
+        }
+        return result;
+    }
+};
+
+/// @brief Builds Prometheus labels list: name="value" pairs separated by commas, without braces.
+inline std::string MakeLabels(std::initializer_list<std::pair<std::string, std::string>> labels)
+{
+    std::string result;
+    for (const auto &[name, value] : labels)
+    {
+        if (!result.empty())
+        {
+            result += ',';
+        }
+        result += name;
+        result += "=\"";
+        for (const char ch : value)
+        {
+            switch (ch)
+            {
+                case '\\':
+                    result += "\\\\";
+                    break;
+                case '"':
+                    result += "\\\"";
+                    break;
+                case '\n':
+                    result += "\\n";
+                    break;
+                default:
+                    result += ch;
+            }
+        }
+        result += '"';
+    }
+    return result;
+}
+
+/// @brief Named metrics with labels rendered in Prometheus text format. Getting the metric takes a
+/// lock, so hot paths must keep the reference and then only update it.
+class CRegistry
+{
+  public:
+    /// @brief Writes additional metrics which are computed at scrape time.
+    using TCollector = std::function<void(std::ostream &)>;
+
+    CCounter &GetCounter(const std::string &name, const std::string &help,
+                         const std::string &labels = {})
+    {
+        return Get(counters, name, help, labels, 1.0);
+    }
+
+    CGauge &GetGauge(const std::string &name, const std::string &help,
+                     const std::string &labels = {})
+    {
+        return Get(gauges, name, help, labels, 1.0);
+    }
+
+    /// @param scale recorded values are divided by it on export, e.g. 1e6 for microseconds
+    /// exported as seconds.
+    CHistogram &GetHistogram(const std::string &name, const std::string &help,
+                             const std::string &labels = {}, double scale = 1.0)
+    {
+        return Get(histograms, name, help, labels, scale);
+    }
+
+    /// @returns Id to remove collector later.
+    std::size_t AddCollector(TCollector collector)
+    {
+        const std::unique_lock lock(mutex);
+        collectors.emplace(++lastCollectorId, std::move(collector));
+        return lastCollectorId;
+    }
+
+    void RemoveCollector(std::size_t id)
+    {
+        const std::unique_lock lock(mutex);
+        collectors.erase(id);
+    }
+
+    /// @brief Writes all metrics in Prometheus text exposition format.
+    void Render(std::ostream &os) const
+    {
+        std::vector<TCollector> collectorsCopy;
+        {
+            const std::shared_lock lock(mutex);
+            RenderOwn(os);
+            for (const auto &[id, collector] : collectors)
+            {
+                collectorsCopy.emplace_back(collector);
+            }
+        }
+        // Collectors are called unlocked, so they may use registry too.
+        for (const auto &collector : collectorsCopy)
+        {
+            collector(os);
+        }
+    }
+
+    static void WriteHeader(std::ostream &os, const std::string &name, const std::string &help,
+                            const char *type)
+    {
+        os << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' ' << type << '\n';
+    }
+
+    [[nodiscard]]
+    static std::string Braces(const std::string &labels)
+    {
+        return labels.empty() ? std::string{} : '{' + labels + '}';
+    }
+
+    /// @returns Number formatted without loss of precision on typical values.
+    [[nodiscard]]
+    static std::string FormatNumber(double value)
+    {
+        std::ostringstream ss;
+        ss << std::setprecision(12) << value;
+        return ss.str();
+    }
+
+  private:
+    void RenderOwn(std::ostream &os) const
+    {
+        for (const auto &[name, family] : counters)
+        {
+            WriteHeader(os, name, family.help, "counter");
+            for (const auto &[labels, counter] : family.series)
+            {
+                os << name << Braces(labels) << ' ' << counter->Value() << '\n';
+            }
+        }
+        for (const auto &[name, family] : gauges)
+        {
+            WriteHeader(os, name, family.help, "gauge");
+            for (const auto &[labels, gauge] : family.series)
+            {
+                os << name << Braces(labels) << ' ' << gauge->Value() << '\n';
+            }
+        }
+        for (const auto &[name, family] : histograms)
+        {
+            WriteHeader(os, name, family.help, "histogram");
+            for (const auto &[labels, histogram] : family.series)
+            {
+                WriteHistogram(os, name, labels, family.scale, histogram->Snapshot());
+            }
+        }
+    }
+
+    template <typename taMetric>
+    struct TFamily
+    {
+        std::string help;
+        double scale{1.0};
+        std::map<std::string, std::unique_ptr<taMetric>> series;
+    };
+
+    template <typename taMetric>
+    using TFamilies = std::map<std::string, TFamily<taMetric>>;
+
+    template <typename taMetric>
+    taMetric &Get(TFamilies<taMetric> &families, const std::string &name, const std::string &help,
+                  const std::string &labels, double scale)
+    {
+        {
+            const std::shared_lock lock(mutex);
+            const auto family = families.find(name);
+            if (family != families.end())
+            {
+                const auto it = family->second.series.find(labels);
+                if (it != family->second.series.end())
+                {
+                    return *it->second;
+                }
+            }
+        }
+        const std::unique_lock lock(mutex);
+        auto &family = families[name];
+        family.help = help;
+        family.scale = scale;
+        auto &metric = family.series[labels];
+        if (!metric)
+        {
+            metric = std::make_unique<taMetric>();
+        }
+        return *metric;
+    }
+
+    static void WriteHistogram(std::ostream &os, const std::string &name,
+                               const std::string &labels, double scale,
+                               const CHistogram::TSnapshot &snapshot)
+    {
+        const std::string prefix = labels.empty() ? std::string{} : labels + ',';
+        // Exported boundaries are powers of 2, they match internal buckets exactly.
+        std::uint64_t cumulative = 0;
+        std::size_t bucket = 0;
+        for (std::size_t exponent = 0; exponent <= CHistogram::kMaxExponent; ++exponent)
+        {
+            const auto bound = std::uint64_t{1} << exponent;
+            for (; bucket < CHistogram::kBuckets && CHistogram::BucketUpperBound(bucket) <= bound;
+                 ++bucket)
+            {
+                cumulative += snapshot.buckets[bucket];
+            }
+            os << name << "_bucket{" << prefix << "le=\""
+               << FormatNumber(static_cast<double>(bound) / scale) << "\"} " << cumulative << '\n';
+        }
+        os << name << "_bucket{" << prefix << "le=\"+Inf\"} " << snapshot.count << '\n';
+        os << name << "_sum" << Braces(labels) << ' '
+           << FormatNumber(static_cast<double>(snapshot.sum) / scale) << '\n';
+        os << name << "_count" << Braces(labels) << ' ' << snapshot.count << '\n';
+    }
+
+    mutable std::shared_mutex mutex;
+    TFamilies<CCounter> counters;
+    TFamilies<CGauge> gauges;
+    TFamilies<CHistogram> histograms;
+    std::map<std::size_t, TCollector> collectors;
+    std::size_t lastCollectorId{0};
+};
+
+} // namespace metrics
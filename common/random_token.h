@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+
+namespace utility {
+
+/// @returns Unguessable token of 128 bits as lowercase hex. Every word is taken from
+/// std::random_device, which is the OS CSPRNG, not from a seeded engine whose state leaks.
+inline std::string MakeRandomToken()
+{
+    static constexpr char kHexDigits[] = "0123456789abcdef";
+    static constexpr std::size_t kWords = 4;
+    std::random_device device;
+    std::string token;
+    token.reserve(kWords * 8);
+    for (std::size_t i = 0; i < kWords; ++i)
+    {
+        const std::uint32_t word = device();
+        for (int shift = 28; shift >= 0; shift -= 4)
+        {
+            token.push_back(kHexDigits[(word >> shift) & 0xF]);
+        }
+    }
+    return token;
+}
+
+/// @returns true if tokens are equal, time does not depend on where they differ.
+inline bool IsSameToken(const std::string &expected, const std::string &given)
+{
+    if (expected.size() != given.size())
+    {
+        return false;
+    }
+    unsigned char difference = 0;
+    for (std::size_t i = 0; i < expected.size(); ++i)
+    {
+        difference |= static_cast<unsigned char>(expected[i] ^ given[i]);
+    }
+    return difference == 0;
+}
+
+} // namespace utility
@@ -2,21 +2,202 @@
 
 #include "runners.h" // IWYU pragma: keep
 
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <condition_variable>
 #include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
 #include <iostream>
 #include <memory>
 #include <mutex>
-#include <queue>
+#include <optional>
+#include <stdexcept>
 #include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <utility>
 #include <vector>
 
 namespace utility {
 
-/// @brief Simple threads' pool.
+/// @brief Lanes of the pool, worker always takes the task of the most urgent non-empty lane.
+enum class ETaskPriority : std::uint8_t {
+    Critical = 0, ///< User waits for it right now, like commands of AI.
+    Normal,
+    Background, ///< Nobody waits for it, like writing captures or warming caches.
+};
+
+/// @brief What pool does with queued tasks when it is destroyed.
+enum class EShutdownMode : std::uint8_t {
+    DropQueued, ///< Queued tasks are cancelled, running ones are notified to stop.
+    Drain,      ///< All queued tasks are executed, running ones are not notified.
+};
+
+/// @brief Future of the task which was cancelled or dropped before it started throws this.
+class CTaskCancelled : public std::runtime_error
+{
+  public:
+    CTaskCancelled() :
+        std::runtime_error("Task was cancelled before it started.")
+    {
+    }
+};
+
+namespace detail {
+/// @brief State shared by queued task and its handle.
+class CTaskControl
+{
+  public:
+    enum class EState : std::uint8_t {
+        Queued,
+        Running,
+        Cancelled,
+    };
+
+    CTaskControl() = default;
+    CTaskControl(const CTaskControl &other) = delete;
+    CTaskControl &operator=(const CTaskControl &other) = delete;
+    CTaskControl(CTaskControl &&other) = delete;
+    CTaskControl &operator=(CTaskControl &&other) = delete;
+    virtual ~CTaskControl() = default;
+
+    /// @returns true if task was not started yet and it is cancelled now, its future throws
+    /// CTaskCancelled. Running task is notified by its stopper and false is returned.
+    bool Cancel()
+    {
+        auto expected = EState::Queued;
+        if (state.compare_exchange_strong(expected, EState::Cancelled))
+        {
+            Abandon();
+            return true;
+        }
+        *stopper = true;
+        return false;
+    }
+
+    /// @returns true if worker may run the task, false if it was cancelled.
+    bool TryStart()
+    {
+        auto expected = EState::Queued;
+        return state.compare_exchange_strong(expected, EState::Running);
+    }
+
+    [[nodiscard]]
+    const runnerint_t &GetStopper() const
+    {
+        return stopper;
+    }
+
+  protected:
+    /// @brief Resolves future of the task which will never run.
+    virtual void Abandon()
+    {
+    }
+
+  private:
+    std::atomic<EState> state{EState::Queued};
+    runnerint_t stopper{std::make_shared<std::atomic<bool>>(false)};
+};
+
+template <typename taResult>
+class CFutureTaskControl : public CTaskControl
+{
+  public:
+    std::promise<taResult> promise;
+
+  protected:
+    void Abandon() override
+    {
+        promise.set_exception(std::make_exception_ptr(CTaskCancelled()));
+    }
+};
+} // namespace detail
+
+/// @brief Result of CThreadPool::submit(). Handle can be dropped, task is still executed.
+template <typename taResult>
+class CTaskHandle
+{
+  public:
+    CTaskHandle(std::shared_ptr<detail::CTaskControl> control, std::future<taResult> future) :
+        control_(std::move(control)),
+        future_(std::move(future))
+    {
+    }
+
+    /// @brief Cancels the task, see detail::CTaskControl::Cancel().
+    bool Cancel()
+    {
+        return control_->Cancel();
+    }
+
+    /// @returns Callable which does the same as Cancel(), it can outlive the handle.
+    [[nodiscard]]
+    std::function<bool()> GetCanceller() const
+    {
+        return [control = control_]() {
+            return control->Cancel();
+        };
+    }
+
+    /// @returns Result of the task or rethrows its exception, CTaskCancelled if it was cancelled.
+    taResult get()
+    {
+        return future_.get();
+    }
+
+    template <typename taRep, typename taPeriod>
+    std::future_status wait_for(const std::chrono::duration<taRep, taPeriod> &timeout) const
+    {
+        return future_.wait_for(timeout);
+    }
+
+  private:
+    std::shared_ptr<detail::CTaskControl> control_;
+    std::future<taResult> future_;
+};
+
+/// @brief Size of the pool. Pool with maxThreads above minThreads is elastic: it adds the worker
+/// when the oldest queued task waits too long and retires the worker which is idle too long.
+struct TThreadPoolSizing
+{
+    std::size_t minThreads{1};
+    std::size_t maxThreads{std::thread::hardware_concurrency()};
+    /// @brief Worker is added once the oldest queued task waits longer.
+    std::chrono::microseconds targetQueueWait{std::chrono::milliseconds{10}};
+    /// @brief Worker above the minimum exits after being idle that long.
+    std::chrono::milliseconds idleTimeout{std::chrono::seconds{30}};
+
+    [[nodiscard]]
+    bool IsElastic() const
+    {
+        return maxThreads > minThreads;
+    }
+};
+
+/// @brief Snapshot of the pool for metrics.
+struct TThreadPoolStats
+{
+    std::size_t workers{0};
+    std::size_t idleWorkers{0};
+    std::size_t queued{0};
+    /// @brief How long the oldest queued task waits now.
+    std::chrono::microseconds oldestQueuedWait{0};
+    std::size_t startedTasks{0};
+    /// @brief Sum of queue waits of all started tasks.
+    std::chrono::microseconds totalQueueWait{0};
+    std::size_t spawnedWorkers{0};
+    std::size_t retiredWorkers{0};
+};
+
+/// @brief Simple threads' pool with priority lanes. Each task has own stopper, which is set when
+/// task is cancelled or pool is destroyed.
 class CThreadPool
 {
   public:
@@ -31,104 +212,397 @@ class CThreadPool
     CThreadPool(CThreadPool &&other) = delete;
     CThreadPool &operator=(CThreadPool &&other) = delete;
 
-    /// @brief Constructs thread pool.
+    /// @brief Constructs thread pool of the fixed size.
     /// @param num_threads defines how many threads pool should have.
-    explicit CThreadPool(const std::size_t num_threads)
+    /// @param shutdown_mode defines what happens to queued tasks on destruction.
+    explicit CThreadPool(const std::size_t num_threads,
+                         const EShutdownMode shutdown_mode = EShutdownMode::DropQueued) :
+        CThreadPool(TThreadPoolSizing{num_threads, num_threads}, shutdown_mode)
     {
-        threads_.reserve(num_threads);
-        stop_.reserve(num_threads);
+    }
 
-        // Creating worker threads
-        for (std::size_t i = 0; i < num_threads; ++i)
+    /// @brief Constructs thread pool, it is elastic if sizing allows that.
+    /// @param sizing defines limits of the pool, minThreads are started at once.
+    /// @param shutdown_mode defines what happens to queued tasks on destruction.
+    explicit CThreadPool(const TThreadPoolSizing &sizing,
+                         const EShutdownMode shutdown_mode = EShutdownMode::DropQueued) :
+        sizing_(sizing),
+        shutdown_mode_(shutdown_mode)
+    {
+        const std::lock_guard lock(queue_mutex_);
+        for (std::size_t i = 0; i < sizing_.minThreads; ++i)
         {
-            auto stopper = std::make_shared<std::atomic<bool>>(false);
-            stop_.push_back(stopper);
-
-            threads_.emplace_back(
-              [this, stopper = std::move(stopper)] {
-                  while (!(*stopper))
-                  {
-                      runner_f_t nextTaskToExec;
-                      {
-                          std::unique_lock lock(queue_mutex_);
-                          cv_.wait(lock, [this, &stopper] {
-                              return !tasks_.empty() || *stopper;
-                          });
-                          if (*stopper)
-                          {
-                              break;
-                          }
-                          nextTaskToExec = std::move(tasks_.front());
-                          tasks_.pop();
-                      }
-                      assert(nextTaskToExec && "Empty task to exec was not expected here.");
-                      try
-                      {
-                          nextTaskToExec(stopper);
-                      }
-                      catch (...)
-                      {
-                          std::cerr
-                            << "Exception occurred during task execution. Cought in ThreadPool."
-                            << std::endl;
-                      }
-                  }
-              });
+            SpawnWorker();
+        }
+        if (sizing_.IsElastic())
+        {
+            supervisor_ = std::thread([this] {
+                Supervise();
+            });
         }
     }
 
-    /// @brief Destroys thread pool. Ignores and drops all not-launched yet tasks. Launched
-    /// tasks will be notified to stop and tasks should respect this query.
+    /// @brief Destroys thread pool, see shutdown().
     ~CThreadPool()
     {
-        // Lock the queue to update the stop flag safely
-        for (auto &sp : stop_)
+        shutdown();
+    }
+
+    /// @brief Stops the pool. In DropQueued mode ignores and drops all not-launched yet tasks,
+    /// launched tasks will be notified to stop and tasks should respect this query. In Drain mode
+    /// waits until all queued tasks are executed. Tasks pushed once the pool stopped are cancelled.
+    /// Only the first call waits, the later ones return at once.
+    void shutdown()
+    {
+        std::unique_lock lock(queue_mutex_);
+        if (stopping_)
+        {
+            return;
+        }
+        stopping_ = true;
+        if (!IsDraining())
+        {
+            for (auto &lane : lanes_)
+            {
+                for (auto &queued : lane)
+                {
+                    queued.control->Cancel();
+                }
+                lane.clear();
+            }
+            queued_ = 0;
+            for (auto &[id, worker] : workers_)
+            {
+                if (worker.running)
+                {
+                    *worker.running->GetStopper() = true;
+                }
+            }
+        }
+
+        // Elastic pool can have no workers at all, but drained tasks must be executed.
+        if (workers_.empty() && queued_ > 0)
         {
-            *sp = true;
+            SpawnWorker();
         }
 
         // Notify all threads
         cv_.notify_all();
+        supervisor_cv_.notify_all();
 
-        // Joining all worker threads to ensure they have
-        // completed their tasks
-        for (auto &thread : threads_)
+        // Waiting all worker threads to ensure they have completed their tasks
+        exited_cv_.wait(lock, [this] {
+            return workers_.empty();
+        });
+        JoinExited();
+        lock.unlock();
+        if (supervisor_.joinable())
         {
-            thread.join();
+            supervisor_.join();
         }
     }
 
     /// @brief Enqueue task for execution by the thread pool.
     /// @param task is task to enqueue. It should accept one parameter - stopper.
+    /// @param priority is the lane of the task.
     template <typename taCallable>
-    void enqueue(taCallable &&task)
+    void enqueue(taCallable &&task, const ETaskPriority priority = ETaskPriority::Normal)
     {
         static_assert(std::is_assignable_v<runner_f_t, taCallable>,
                       "Callable should accepts runnerint_t as parameter");
         static_assert(std::is_invocable_v<taCallable, stopper_t>,
                       "Callable should be invocable with runnerint_t as parameter");
+        Push({std::forward<taCallable>(task), std::make_shared<detail::CTaskControl>(), {}},
+             priority);
+    }
+
+    /// @brief Enqueue task which result is needed.
+    /// @param task is task to enqueue. It should accept one parameter - stopper, it can return
+    /// value and throw, both are delivered by the returned handle.
+    /// @param priority is the lane of the task.
+    /// @returns Handle to wait for the result or to cancel the task.
+    template <typename taCallable>
+    auto submit(taCallable &&task, const ETaskPriority priority = ETaskPriority::Normal)
+    {
+        static_assert(std::is_invocable_v<taCallable, stopper_t>,
+                      "Callable should be invocable with runnerint_t as parameter");
+        using result_t = std::invoke_result_t<taCallable, stopper_t>;
+
+        auto control = std::make_shared<detail::CFutureTaskControl<result_t>>();
+        CTaskHandle<result_t> handle(control, control->promise.get_future());
+        Push({[control, task = std::forward<taCallable>(task)](const stopper_t &stopper) mutable {
+                  try
+                  {
+                      if constexpr (std::is_void_v<result_t>)
+                      {
+                          task(stopper);
+                          control->promise.set_value();
+                      }
+                      else
+                      {
+                          control->promise.set_value(task(stopper));
+                      }
+                  }
+                  catch (...)
+                  {
+                      control->promise.set_exception(std::current_exception());
+                  }
+              },
+              control,
+              {}},
+             priority);
+        return handle;
+    }
+
+    /// @returns Count of tasks which wait for the worker, cancelled ones may be included.
+    [[nodiscard]]
+    std::size_t queued() const
+    {
+        const std::lock_guard lock(queue_mutex_);
+        return queued_;
+    }
+
+    /// @returns Current size and queue latency of the pool.
+    [[nodiscard]]
+    TThreadPoolStats stats() const
+    {
+        const std::lock_guard lock(queue_mutex_);
+        auto result = stats_;
+        result.workers = workers_.size();
+        result.idleWorkers = idle_;
+        result.queued = queued_;
+        if (const auto oldest = GetOldestEnqueuedAt())
+        {
+            result.oldestQueuedWait =
+              std::chrono::duration_cast<std::chrono::microseconds>(TClock::now() - *oldest);
+        }
+        return result;
+    }
+
+  private:
+    using TClock = std::chrono::steady_clock;
+    static constexpr std::size_t kLanesCount = 3;
+
+    struct TQueuedTask
+    {
+        runner_f_t task;
+        std::shared_ptr<detail::CTaskControl> control;
+        TClock::time_point enqueuedAt;
+    };
+
+    struct TWorker
+    {
+        std::thread thread;
+        // Task executed by the worker now, it is notified to stop on destruction.
+        std::shared_ptr<detail::CTaskControl> running;
+    };
+
+    void Push(TQueuedTask queued, const ETaskPriority priority)
+    {
+        bool wasEmpty = false;
         {
             const std::unique_lock lock(queue_mutex_);
-            tasks_.emplace(std::forward<taCallable>(task));
+            // Draining pool still accepts tasks while workers remain to execute them, like the
+            // ones spawned by the draining tasks. Once the last worker exited nobody would.
+            if (stopping_ && (!IsDraining() || workers_.empty()))
+            {
+                queued.control->Cancel();
+                return;
+            }
+            queued.enqueuedAt = TClock::now();
+            lanes_.at(static_cast<std::size_t>(priority)).emplace_back(std::move(queued));
+            wasEmpty = queued_++ == 0;
         }
         cv_.notify_one();
+        // Supervisor sleeps without deadline only while queue is empty.
+        if (wasEmpty && sizing_.IsElastic())
+        {
+            supervisor_cv_.notify_one();
+        }
     }
 
-  private:
-    // Vector to store worker threads
-    std::vector<std::thread> threads_;
-    // Flag to indicate whether the thread pool should stop
-    // or not
-    std::vector<stopper_t> stop_;
+    // Must be called under queue_mutex_.
+    void SpawnWorker()
+    {
+        const auto id = next_worker_id_++;
+        auto &worker = workers_[id];
+        worker.thread = std::thread([this, id] {
+            WorkerLoop(id);
+        });
+        ++starting_;
+        ++stats_.spawnedWorkers;
+    }
+
+    void WorkerLoop(const std::size_t id)
+    {
+        std::unique_lock lock(queue_mutex_);
+        --starting_;
+        while (WaitForTask(lock))
+        {
+            auto nextTaskToExec = PopMostUrgent();
+            if (!nextTaskToExec.control->TryStart())
+            {
+                continue;
+            }
+            ++stats_.startedTasks;
+            stats_.totalQueueWait += std::chrono::duration_cast<std::chrono::microseconds>(
+              TClock::now() - nextTaskToExec.enqueuedAt);
+            workers_.at(id).running = nextTaskToExec.control;
+            lock.unlock();
+
+            assert(nextTaskToExec.task && "Empty task to exec was not expected here.");
+            try
+            {
+                nextTaskToExec.task(nextTaskToExec.control->GetStopper());
+            }
+            catch (...)
+            {
+                std::cerr << "Exception occurred during task execution. Cought in ThreadPool."
+                          << std::endl;
+            }
+            nextTaskToExec = {};
+            lock.lock();
+            workers_.at(id).running.reset();
+        }
+        // Thread cannot join itself, it is joined by the supervisor or the destructor.
+        auto node = workers_.extract(id);
+        exited_.emplace_back(std::move(node.mapped().thread));
+        if (!stopping_)
+        {
+            ++stats_.retiredWorkers;
+        }
+        exited_cv_.notify_all();
+        supervisor_cv_.notify_one();
+    }
+
+    /// @returns false if the worker must exit: pool is stopping or worker is retired.
+    bool WaitForTask(std::unique_lock<std::mutex> &lock)
+    {
+        const auto isReady = [this] {
+            return queued_ > 0 || stopping_;
+        };
+        ++idle_;
+        if (!sizing_.IsElastic())
+        {
+            cv_.wait(lock, isReady);
+        }
+        else
+        {
+            while (!cv_.wait_for(lock, sizing_.idleTimeout, isReady))
+            {
+                if (workers_.size() > sizing_.minThreads)
+                {
+                    --idle_;
+                    return false;
+                }
+            }
+        }
+        --idle_;
+        return queued_ > 0 && (!stopping_ || IsDraining());
+    }
+
+    void Supervise()
+    {
+        std::unique_lock lock(queue_mutex_);
+        while (!stopping_)
+        {
+            JoinExited();
+            const auto oldest = GetOldestEnqueuedAt();
+            // Full pool is woken up by the next push into empty queue or exited worker.
+            if (!oldest || workers_.size() >= sizing_.maxThreads)
+            {
+                supervisor_cv_.wait(lock);
+                continue;
+            }
+            const auto deadline = *oldest + sizing_.targetQueueWait;
+            // Idle and just spawned workers are about to take queued tasks, so these are not
+            // counted as late.
+            if (TClock::now() >= deadline && queued_ > idle_ + starting_)
+            {
+                SpawnWorker();
+            }
+            supervisor_cv_.wait_until(lock, std::max(deadline, TClock::now() + kMinRecheck));
+        }
+    }
+
+    // Must be called under queue_mutex_.
+    [[nodiscard]]
+    std::optional<TClock::time_point> GetOldestEnqueuedAt() const
+    {
+        std::optional<TClock::time_point> oldest;
+        for (const auto &lane : lanes_)
+        {
+            if (!lane.empty() && (!oldest || lane.front().enqueuedAt < *oldest))
+            {
+                oldest = lane.front().enqueuedAt;
+            }
+        }
+        return oldest;
+    }
+
+    // Must be called under queue_mutex_.
+    void JoinExited()
+    {
+        for (auto &thread : exited_)
+        {
+            thread.join();
+        }
+        exited_.clear();
+    }
+
+    // Must be called under queue_mutex_ when queued_ > 0.
+    TQueuedTask PopMostUrgent()
+    {
+        for (auto &lane : lanes_)
+        {
+            if (!lane.empty())
+            {
+                auto queued = std::move(lane.front());
+                lane.pop_front();
+                --queued_;
+                return queued;
+            }
+        }
+        assert(false && "Counter of queued tasks is broken.");
+        return {};
+    }
+
+    [[nodiscard]]
+    bool IsDraining() const
+    {
+        return shutdown_mode_ == EShutdownMode::Drain;
+    }
+
+    // Late queue which workers are about to take is rechecked after this pause, so the supervisor
+    // does not spin on the passed deadline.
+    static constexpr auto kMinRecheck = std::chrono::microseconds{100};
+
+    const TThreadPoolSizing sizing_;
+    const EShutdownMode shutdown_mode_;
+
+    // Worker threads by their ids.
+    std::unordered_map<std::size_t, TWorker> workers_;
+    std::size_t next_worker_id_{0};
+    std::size_t idle_{0};
+    // Workers which were spawned, but did not wait for the task yet.
+    std::size_t starting_{0};
+    // Workers which exited, but were not joined yet.
+    std::vector<std::thread> exited_;
+    std::thread supervisor_;
 
-    // Queue of tasks
-    std::queue<runner_f_t> tasks_;
+    // Queues of tasks, one per priority.
+    std::array<std::deque<TQueuedTask>, kLanesCount> lanes_;
+    std::size_t queued_{0};
+    bool stopping_{false};
+    TThreadPoolStats stats_;
 
     // Mutex to synchronize access to shared data
-    std::mutex queue_mutex_;
+    mutable std::mutex queue_mutex_;
 
     // Condition variable to signal changes in the state of
     // the tasks queue
     std::condition_variable cv_;
+    std::condition_variable supervisor_cv_;
+    std::condition_variable exited_cv_;
 };
 } // namespace utility
@@ -0,0 +1,263 @@
+#pragma once
+
+#include "cm_ctors.h" // IWYU pragma: keep
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace utility {
+
+/// @brief Hierarchical timer wheel (Varghese & Lauck) driven by single thread. Scheduling and
+/// cancelling are O(1) no matter how many timers are pending, so thousands of streams can keep
+/// own timers without threads of their own. Timers fire on the thread of the wheel not earlier
+/// than requested and at most one tick later, callbacks must be short. Thread sleeps while no
+/// timer is pending.
+class CTimerWheel
+{
+  public:
+    using TClock = std::chrono::steady_clock;
+    using TTimerId = std::uint64_t;
+    using TCallback = std::function<void()>;
+
+    /// @brief Id which is never returned by Schedule().
+    static constexpr TTimerId kInvalidTimer = 0;
+
+    NO_COPYMOVE(CTimerWheel);
+
+    /// @param tick is resolution of the wheel.
+    explicit CTimerWheel(const std::chrono::milliseconds tick = std::chrono::milliseconds{10}) :
+        tick_(tick.count() > 0 ? tick : std::chrono::milliseconds{1}),
+        started_at_(TClock::now()),
+        thread_([this] {
+            Run();
+        })
+    {
+    }
+
+    /// @brief Stops the wheel, pending timers never fire.
+    ~CTimerWheel()
+    {
+        {
+            const std::lock_guard lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        thread_.join();
+    }
+
+    /// @brief Arms one-shot timer. Can be called from the callbacks.
+    /// @returns Id to cancel the timer.
+    TTimerId Schedule(const TClock::duration delay, TCallback callback)
+    {
+        const std::lock_guard lock(mutex_);
+        if (timers_.empty())
+        {
+            // All slots are empty, so the wheel jumps over the time it slept.
+            current_tick_ = GetTickAt(TClock::now());
+        }
+        const auto id = ++last_id_;
+        auto &timer = timers_[id];
+        timer.callback = std::move(callback);
+        // The next tick boundary, so timer never fires earlier than requested.
+        timer.expiresAt = GetTickAt(TClock::now() + std::max(delay, TClock::duration::zero())) + 1;
+        Place(id, timer);
+        if (timers_.size() == 1)
+        {
+            cv_.notify_one();
+        }
+        return id;
+    }
+
+    /// @brief Disarms the timer. If its callback is running on the other thread, waits for it, so
+    /// callback's captures can be destroyed once this returns.
+    /// @returns true if timer was pending and will not fire.
+    bool Cancel(const TTimerId id)
+    {
+        std::unique_lock lock(mutex_);
+        const auto it = timers_.find(id);
+        if (it != timers_.end())
+        {
+            if (!it->second.isFired)
+            {
+                auto &slot = slots_[it->second.level][it->second.slot];
+                slot.erase(std::find(slot.begin(), slot.end(), id));
+            }
+            timers_.erase(it);
+            return true;
+        }
+        if (std::this_thread::get_id() != thread_.get_id())
+        {
+            fired_cv_.wait(lock, [this, id] {
+                return running_ != id;
+            });
+        }
+        return false;
+    }
+
+    /// @returns Timers which did not fire yet.
+    [[nodiscard]]
+    std::size_t pending() const
+    {
+        const std::lock_guard lock(mutex_);
+        return timers_.size();
+    }
+
+  private:
+    static constexpr std::size_t kLevels = 4;
+    static constexpr unsigned kSlotBits = 6;
+    static constexpr std::size_t kSlots = std::size_t{1} << kSlotBits;
+    static constexpr std::uint64_t kSlotMask = kSlots - 1;
+
+    struct TTimer
+    {
+        TCallback callback;
+        std::uint64_t expiresAt{0};
+        std::size_t level{0};
+        std::size_t slot{0};
+        // Expired and waits for the callbacks of the same tick, it is not in any slot.
+        bool isFired{false};
+    };
+
+    [[nodiscard]]
+    std::uint64_t GetTickAt(const TClock::time_point when) const
+    {
+        return static_cast<std::uint64_t>((when - started_at_) / tick_);
+    }
+
+    // Level N keeps timers expiring within 64^(N+1) ticks, the last one keeps everything else.
+    void Place(const TTimerId id, TTimer &timer)
+    {
+        const auto delta = timer.expiresAt > current_tick_ ? timer.expiresAt - current_tick_ : 0;
+        std::size_t level = 0;
+        while (level + 1 < kLevels && delta >= (std::uint64_t{1} << (kSlotBits * (level + 1))))
+        {
+            ++level;
+        }
+        // Timer beyond the last level waits in its farthest slot and is placed again from there.
+        constexpr auto kHorizon = (std::uint64_t{1} << (kSlotBits * kLevels)) - 1;
+        const auto expiresAt = level + 1 == kLevels
+                                 ? std::min(timer.expiresAt, current_tick_ + kHorizon)
+                                 : timer.expiresAt;
+        timer.level = level;
+        timer.slot = static_cast<std::size_t>((expiresAt >> (kSlotBits * level)) & kSlotMask);
+        slots_[timer.level][timer.slot].push_back(id);
+    }
+
+    // Moves timers of the upper level slot which begins now down the levels.
+    void Cascade(const std::size_t level)
+    {
+        const auto slot =
+          static_cast<std::size_t>((current_tick_ >> (kSlotBits * level)) & kSlotMask);
+        auto ids = std::move(slots_[level][slot]);
+        slots_[level][slot].clear();
+        for (const auto id : ids)
+        {
+            Place(id, timers_.at(id));
+        }
+    }
+
+    // Advances the wheel by one tick and collects timers expired on it.
+    void Advance(std::vector<TTimerId> &expired)
+    {
+        ++current_tick_;
+        for (std::size_t level = kLevels - 1; level > 0; --level)
+        {
+            if ((current_tick_ & ((std::uint64_t{1} << (kSlotBits * level)) - 1)) == 0)
+            {
+                Cascade(level);
+            }
+        }
+        auto &slot = slots_[0][current_tick_ & kSlotMask];
+        for (const auto id : slot)
+        {
+            timers_.at(id).isFired = true;
+        }
+        expired.insert(expired.end(), slot.begin(), slot.end());
+        slot.clear();
+    }
+
+    void Run()
+    {
+        std::vector<TTimerId> expired;
+        std::unique_lock lock(mutex_);
+        while (!stopping_)
+        {
+            if (timers_.empty())
+            {
+                cv_.wait(lock, [this] {
+                    return stopping_ || !timers_.empty();
+                });
+                continue;
+            }
+            const auto nextTickAt = started_at_ + tick_ * (current_tick_ + 1);
+            if (cv_.wait_until(lock, nextTickAt, [this] {
+                    return stopping_;
+                }))
+            {
+                break;
+            }
+            const auto nowTick = GetTickAt(TClock::now());
+            while (current_tick_ < nowTick && !timers_.empty())
+            {
+                Advance(expired);
+            }
+            for (const auto id : expired)
+            {
+                const auto it = timers_.find(id);
+                if (it == timers_.end() || stopping_)
+                {
+                    // Cancelled meanwhile or the wheel stops.
+                    continue;
+                }
+                const auto callback = std::move(it->second.callback);
+                timers_.erase(it);
+                running_ = id;
+                lock.unlock();
+                Execute(callback);
+                lock.lock();
+                running_ = kInvalidTimer;
+                fired_cv_.notify_all();
+            }
+            expired.clear();
+        }
+    }
+
+    static void Execute(const TCallback &callback)
+    {
+        try
+        {
+            callback();
+        }
+        catch (...)
+        {
+            std::cerr << "Exception occurred in the timer callback. Cought in TimerWheel."
+                      << std::endl;
+        }
+    }
+
+    const TClock::duration tick_;
+    const TClock::time_point started_at_;
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    // Cancel() waits on it for the running callback.
+    std::condition_variable fired_cv_;
+    std::array<std::array<std::vector<TTimerId>, kSlots>, kLevels> slots_;
+    std::unordered_map<TTimerId, TTimer> timers_;
+    std::uint64_t current_tick_{0};
+    TTimerId last_id_{kInvalidTimer};
+    TTimerId running_{kInvalidTimer};
+    bool stopping_{false};
+    std::thread thread_;
+};
+} // namespace utility
@@ -0,0 +1,229 @@
+#pragma once
+
+#include "runners.h" // IWYU pragma: keep
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace utility {
+
+/// @brief Threads' pool where each worker owns the deque of tasks. Worker executes own tasks
+/// LIFO (the newest one is still in cache), idle worker steals the oldest tasks of random other
+/// workers, spins for a while and only then parks. Tasks enqueued from the worker go into its own
+/// deque, so fork/join workloads do not touch shared state. API is the same as CThreadPool.
+class CWorkStealingThreadPool
+{
+  public:
+    using stopper_t = runnerint_t;
+
+    CWorkStealingThreadPool() :
+        CWorkStealingThreadPool(std::thread::hardware_concurrency())
+    {
+    }
+    CWorkStealingThreadPool(const CWorkStealingThreadPool &other) = delete;
+    CWorkStealingThreadPool &operator=(const CWorkStealingThreadPool &other) = delete;
+    CWorkStealingThreadPool(CWorkStealingThreadPool &&other) = delete;
+    CWorkStealingThreadPool &operator=(CWorkStealingThreadPool &&other) = delete;
+
+    /// @brief Constructs thread pool.
+    /// @param num_threads defines how many threads pool should have, at least 1 is created.
+    explicit CWorkStealingThreadPool(const std::size_t num_threads)
+    {
+        const auto count = num_threads == 0 ? std::size_t{1} : num_threads;
+        workers_.reserve(count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            workers_.emplace_back(std::make_unique<TWorker>());
+        }
+        // All deques must exist before any thread tries to steal from them.
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            workers_[i]->thread = std::thread([this, i] {
+                Run(i);
+            });
+        }
+    }
+
+    /// @brief Destroys thread pool. Ignores and drops all not-launched yet tasks. Launched
+    /// tasks will be notified to stop and tasks should respect this query.
+    ~CWorkStealingThreadPool()
+    {
+        for (auto &worker : workers_)
+        {
+            *worker->stopper = true;
+        }
+        {
+            // Parking worker checks stoppers under this lock, so it cannot miss the wake up.
+            const std::lock_guard lock(park_mutex_);
+        }
+        park_cv_.notify_all();
+        for (auto &worker : workers_)
+        {
+            worker->thread.join();
+        }
+    }
+
+    /// @brief Enqueue task for execution by the thread pool. Task enqueued from the worker of
+    /// this pool goes into the deque of that worker, others are spread round robin.
+    /// @param task is task to enqueue. It should accept one parameter - stopper.
+    template <typename taCallable>
+    void enqueue(taCallable &&task)
+    {
+        static_assert(std::is_assignable_v<runner_f_t, taCallable>,
+                      "Callable should accepts runnerint_t as parameter");
+        static_assert(std::is_invocable_v<taCallable, stopper_t>,
+                      "Callable should be invocable with runnerint_t as parameter");
+
+        const auto index = current_pool_ == this
+                             ? current_worker_
+                             : next_worker_.fetch_add(1, std::memory_order_relaxed)
+                                 % workers_.size();
+        // Pairs with parking worker which increments sleeping_ and then checks queued_.
+        queued_.fetch_add(1, std::memory_order_seq_cst);
+        {
+            auto &worker = *workers_[index];
+            const std::lock_guard lock(worker.mutex);
+            worker.tasks.emplace_back(std::forward<taCallable>(task));
+        }
+        if (sleeping_.load(std::memory_order_seq_cst) > 0)
+        {
+            {
+                const std::lock_guard lock(park_mutex_);
+            }
+            park_cv_.notify_one();
+        }
+    }
+
+  private:
+    static constexpr int kSpinsBeforeParking = 64;
+
+    struct TWorker
+    {
+        std::mutex mutex;
+        std::deque<runner_f_t> tasks;
+        stopper_t stopper{std::make_shared<std::atomic<bool>>(false)};
+        std::thread thread;
+    };
+
+    void Run(const std::size_t index)
+    {
+        current_pool_ = this;
+        current_worker_ = index;
+        const auto &stopper = workers_[index]->stopper;
+        // Xorshift seeded per worker, so victims of different workers differ.
+        std::uint64_t random = 0x9E3779B97F4A7C15ULL * (index + 1);
+        int idleSpins = 0;
+        while (!(*stopper))
+        {
+            auto nextTaskToExec = PopOwn(index);
+            if (!nextTaskToExec)
+            {
+                nextTaskToExec = Steal(index, random);
+            }
+            if (nextTaskToExec)
+            {
+                idleSpins = 0;
+                queued_.fetch_sub(1, std::memory_order_relaxed);
+                Execute(*nextTaskToExec, stopper);
+                continue;
+            }
+            if (++idleSpins < kSpinsBeforeParking)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            idleSpins = 0;
+            Park(stopper);
+        }
+    }
+
+    std::optional<runner_f_t> PopOwn(const std::size_t index)
+    {
+        auto &worker = *workers_[index];
+        const std::lock_guard lock(worker.mutex);
+        if (worker.tasks.empty())
+        {
+            return std::nullopt;
+        }
+        auto task = std::move(worker.tasks.back());
+        worker.tasks.pop_back();
+        return task;
+    }
+
+    std::optional<runner_f_t> Steal(const std::size_t thief, std::uint64_t &random)
+    {
+        const auto count = workers_.size();
+        random ^= random << 13U;
+        random ^= random >> 7U;
+        random ^= random << 17U;
+        const auto first = static_cast<std::size_t>(random % count);
+        for (std::size_t i = 0; i < count; ++i)
+        {
+            const auto victimIndex = (first + i) % count;
+            if (victimIndex == thief)
+            {
+                continue;
+            }
+            auto &victim = *workers_[victimIndex];
+            // Busy victim is skipped, it is likely to pop the task itself.
+            const std::unique_lock lock(victim.mutex, std::try_to_lock);
+            if (!lock.owns_lock() || victim.tasks.empty())
+            {
+                continue;
+            }
+            auto task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            return task;
+        }
+        return std::nullopt;
+    }
+
+    void Park(const stopper_t &stopper)
+    {
+        std::unique_lock lock(park_mutex_);
+        sleeping_.fetch_add(1, std::memory_order_seq_cst);
+        park_cv_.wait(lock, [this, &stopper] {
+            return queued_.load(std::memory_order_seq_cst) > 0 || *stopper;
+        });
+        sleeping_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    static void Execute(runner_f_t &nextTaskToExec, const stopper_t &stopper)
+    {
+        assert(nextTaskToExec && "Empty task to exec was not expected here.");
+        try
+        {
+            nextTaskToExec(stopper);
+        }
+        catch (...)
+        {
+            std::cerr << "Exception occurred during task execution. Cought in ThreadPool."
+                      << std::endl;
+        }
+    }
+
+    std::vector<std::unique_ptr<TWorker>> workers_;
+    // Round robin for tasks enqueued outside of the pool.
+    std::atomic<std::size_t> next_worker_{0};
+    // Tasks in all deques, parked workers wake up when it is not zero.
+    std::atomic<std::size_t> queued_{0};
+    std::atomic<std::size_t> sleeping_{0};
+    std::mutex park_mutex_;
+    std::condition_variable park_cv_;
+
+    static inline thread_local const CWorkStealingThreadPool *current_pool_{nullptr};
+    static inline thread_local std::size_t current_worker_{0};
+};
+} // namespace utility
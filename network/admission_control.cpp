@@ -0,0 +1,215 @@
+#include "admission_control.hpp" // IWYU pragma: keep
+
+#include <common/threads_pool.hpp>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/httplib.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+
+namespace {
+// Connection which did not fit into the queue waits here for the shedding worker.
+constexpr std::size_t kMaxShedQueuedConnections = 256;
+// Shedding is cheap, but slow clients can hold the worker until the read timeout.
+constexpr std::size_t kSheddingWorkers = 2;
+
+// httplib serves whole connection on one thread, so admitted request is kept per thread.
+struct TAdmitted
+{
+    const CAdmissionControl *owner{nullptr};
+    CAdmissionControl::ERoute route{CAdmissionControl::ERoute::Other};
+};
+thread_local TAdmitted admitted;
+// Set on the shedding workers, all their requests are rejected.
+thread_local bool isShedding = false;
+
+bool StartsWith(const std::string &value, const char *prefix)
+{
+    return value.rfind(prefix, 0) == 0;
+}
+} // namespace
+
+class CAdmissionControl::CBoundedTaskQueue : public httplib::TaskQueue
+{
+  public:
+    explicit CBoundedTaskQueue(CAdmissionControl &owner) :
+        owner(owner),
+        workers(std::make_unique<utility::CThreadPool>(
+          std::max<std::size_t>(owner.limits.workerThreads, 1), utility::EShutdownMode::Drain)),
+        shedders(std::make_unique<utility::CThreadPool>(kSheddingWorkers,
+                                                        utility::EShutdownMode::Drain))
+    {
+    }
+
+    bool enqueue(std::function<void()> fn) override
+    {
+        // Only the listening thread enqueues, so checks and increments do not race.
+        const auto maxQueued = owner.limits.maxQueuedConnections;
+        if (maxQueued == 0 || owner.queuedConnections.load(std::memory_order_relaxed) < maxQueued)
+        {
+            owner.queuedConnections.fetch_add(1, std::memory_order_relaxed);
+            workers->enqueue([&owner = owner, fn = std::move(fn)](const auto &) {
+                owner.queuedConnections.fetch_sub(1, std::memory_order_relaxed);
+                fn();
+            });
+            return true;
+        }
+        if (shedders->queued() < kMaxShedQueuedConnections)
+        {
+            owner.shedConnections.fetch_add(1, std::memory_order_relaxed);
+            shedders->enqueue([fn = std::move(fn)](const auto &) {
+                isShedding = true;
+                fn();
+                isShedding = false;
+            });
+            return true;
+        }
+        // Server closes the socket.
+        owner.droppedConnections.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    void shutdown() override
+    {
+        // Pools are draining, so accepted connections are served.
+        workers.reset();
+        shedders.reset();
+    }
+
+  private:
+    CAdmissionControl &owner;
+    std::unique_ptr<utility::CThreadPool> workers;
+    std::unique_ptr<utility::CThreadPool> shedders;
+};
+
+CAdmissionControl::CAdmissionControl(const TServerLimitsConfig &limits,
+                                     const TMetadataCacheConfig &metadata) :
+    limits(limits),
+    metadata(metadata)
+{
+}
+
+httplib::TaskQueue *CAdmissionControl::CreateTaskQueue()
+{
+    return new CBoundedTaskQueue(*this);
+}
+
+bool CAdmissionControl::Admit(const std::string &path)
+{
+    Finish();
+    if (isShedding)
+    {
+        return false;
+    }
+    const auto route = Classify(path);
+    const auto index = static_cast<std::size_t>(route);
+    const auto limit = GetLimit(route);
+    const auto previous = inFlight.at(index).fetch_add(1, std::memory_order_relaxed);
+    if (limit > 0 && previous >= limit)
+    {
+        inFlight.at(index).fetch_sub(1, std::memory_order_relaxed);
+        rejected.at(index).fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    admitted = {this, route};
+    return true;
+}
+
+void CAdmissionControl::Finish()
+{
+    if (admitted.owner != this)
+    {
+        return;
+    }
+    inFlight.at(static_cast<std::size_t>(admitted.route)).fetch_sub(1, std::memory_order_relaxed);
+    admitted = {};
+}
+
+void CAdmissionControl::Reject(httplib::Response &response) const
+{
+    response.status = 503;
+    response.set_header("Retry-After", std::to_string(limits.retryAfter.count()));
+    // Idle keep-alive connection would hold the worker until the retry, the shedding one would be
+    // served by the shedding worker again.
+    response.set_header("Connection", "close");
+    response.set_content(R"({"error":"Proxy is overloaded, retry later."})", "application/json");
+}
+
+CAdmissionControl::ERoute CAdmissionControl::Classify(const std::string &path) const
+{
+    if (path == "/api/chat" || path == "/api/generate")
+    {
+        return ERoute::Chat;
+    }
+    if (path == "/api/embed" || path == "/api/embeddings")
+    {
+        return ERoute::Embed;
+    }
+    if (metadata.ttlPerPath.count(path) > 0 || path == "/metrics" || StartsWith(path, "/debug/"))
+    {
+        return ERoute::Metadata;
+    }
+    return ERoute::Other;
+}
+
+const char *CAdmissionControl::GetRouteName(ERoute route)
+{
+    switch (route)
+    {
+        case ERoute::Chat:
+            return "chat";
+        case ERoute::Embed:
+            return "embed";
+        case ERoute::Metadata:
+            return "metadata";
+        case ERoute::Other:
+            break;
+    }
+    return "other";
+}
+
+std::size_t CAdmissionControl::GetInFlight(ERoute route) const
+{
+    return inFlight.at(static_cast<std::size_t>(route)).load(std::memory_order_relaxed);
+}
+
+std::size_t CAdmissionControl::GetRejected(ERoute route) const
+{
+    return rejected.at(static_cast<std::size_t>(route)).load(std::memory_order_relaxed);
+}
+
+std::size_t CAdmissionControl::GetQueuedConnections() const
+{
+    return queuedConnections.load(std::memory_order_relaxed);
+}
+
+std::size_t CAdmissionControl::GetShedConnections() const
+{
+    return shedConnections.load(std::memory_order_relaxed);
+}
+
+std::size_t CAdmissionControl::GetDroppedConnections() const
+{
+    return droppedConnections.load(std::memory_order_relaxed);
+}
+
+std::size_t CAdmissionControl::GetLimit(ERoute route) const
+{
+    switch (route)
+    {
+        case ERoute::Chat:
+            return limits.maxChatRequests;
+        case ERoute::Embed:
+            return limits.maxEmbedRequests;
+        case ERoute::Metadata:
+            return limits.maxMetadataRequests;
+        case ERoute::Other:
+            break;
+    }
+    return limits.maxOtherRequests;
+}
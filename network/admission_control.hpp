@@ -0,0 +1,89 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/httplib.h>
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/// @brief Sheds the load of the proxy's HTTP server. It bounds connections waiting for the
+/// workers and requests in flight per route, so long chat streams cannot starve cheap metadata
+/// calls. Rejected requests get 503 with Retry-After at once.
+class CAdmissionControl
+{
+  public:
+    enum class ERoute : std::uint8_t {
+        Chat,     ///< Generations: /api/chat and /api/generate.
+        Embed,    ///< /api/embed and /api/embeddings.
+        Metadata, ///< Cached metadata endpoints, metrics and debug endpoints.
+        Other,    ///< Everything else is forwarded to Ollama as is.
+    };
+    static constexpr std::size_t kRoutesCount = 4;
+
+    NO_COPYMOVE(CAdmissionControl);
+    CAdmissionControl() = delete;
+    ~CAdmissionControl() = default;
+
+    /// @param limits are limits of the server.
+    /// @param metadata defines which paths are metadata ones.
+    CAdmissionControl(const TServerLimitsConfig &limits, const TMetadataCacheConfig &metadata);
+
+    /// @returns Bounded task queue for httplib::Server::new_task_queue, server owns it.
+    /// Connections above the bound are served by the shedding workers, which reject all their
+    /// requests, and closed at once if those are busy too.
+    [[nodiscard]]
+    httplib::TaskQueue *CreateTaskQueue();
+
+    /// @brief Admits request on the thread which serves it. Request which was admitted earlier on
+    /// this thread and was not finished is finished now.
+    /// @returns false if request must be rejected with Reject().
+    bool Admit(const std::string &path);
+
+    /// @brief Finishes the request admitted on this thread, does nothing if there is none.
+    void Finish();
+
+    /// @brief Makes 503 response with Retry-After, connection is closed after it.
+    void Reject(httplib::Response &response) const;
+
+    [[nodiscard]]
+    ERoute Classify(const std::string &path) const;
+
+    [[nodiscard]]
+    static const char *GetRouteName(ERoute route);
+
+    [[nodiscard]]
+    std::size_t GetInFlight(ERoute route) const;
+
+    [[nodiscard]]
+    std::size_t GetRejected(ERoute route) const;
+
+    /// @returns Accepted connections waiting for the worker.
+    [[nodiscard]]
+    std::size_t GetQueuedConnections() const;
+
+    /// @returns Connections above the queue bound which were answered with 503.
+    [[nodiscard]]
+    std::size_t GetShedConnections() const;
+
+    /// @returns Connections closed without a response, shedding workers were busy too.
+    [[nodiscard]]
+    std::size_t GetDroppedConnections() const;
+
+  private:
+    class CBoundedTaskQueue;
+
+    [[nodiscard]]
+    std::size_t GetLimit(ERoute route) const;
+
+    const TServerLimitsConfig &limits;
+    const TMetadataCacheConfig &metadata;
+    std::array<std::atomic<std::size_t>, kRoutesCount> inFlight{};
+    std::array<std::atomic<std::size_t>, kRoutesCount> rejected{};
+    std::atomic<std::size_t> queuedConnections{0};
+    std::atomic<std::size_t> shedConnections{0};
+    std::atomic<std::size_t> droppedConnections{0};
+};
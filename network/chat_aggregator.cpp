@@ -0,0 +1,52 @@
+#include "chat_aggregator.hpp" // IWYU pragma: keep
+
+#include <network/token_ledger.hpp>
+#include <ollama/json.hpp>
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+std::string AggregateChatResponse(const std::vector<std::string> &lines, const TTokenUsage &usage)
+{
+    constexpr auto kMessageKey = "message";
+    constexpr auto kDoneReasonKey = "done_reason";
+
+    // Content is shorter than its lines, so it is never reallocated.
+    std::size_t linesBytes = 0;
+    for (const auto &line : lines)
+    {
+        linesBytes += line.size();
+    }
+    std::string content;
+    content.reserve(linesBytes);
+
+    nlohmann::json response = nlohmann::json::object();
+    std::string doneReason = "stop";
+    for (const auto &line : lines)
+    {
+        auto chunk = nlohmann::json::parse(line, nullptr, false);
+        if (chunk.is_discarded() || !chunk.is_object() || !chunk.contains(kMessageKey))
+        {
+            continue;
+        }
+        content += chunk[kMessageKey].value("content", "");
+        if (chunk.contains(kDoneReasonKey) && chunk[kDoneReasonKey].is_string())
+        {
+            doneReason = chunk[kDoneReasonKey].get<std::string>();
+        }
+        // Model and time are the ones of the last line, as Ollama reports them.
+        response["model"] = std::move(chunk["model"]);
+        response["created_at"] = std::move(chunk["created_at"]);
+    }
+    response[kMessageKey] = {{"role", "assistant"}, {"content", std::move(content)}};
+    response[kDoneReasonKey] = std::move(doneReason);
+    response["done"] = true;
+    response["total_duration"] = usage.totalDuration.count();
+    response["load_duration"] = usage.loadDuration.count();
+    response["prompt_eval_count"] = usage.promptTokens;
+    response["prompt_eval_duration"] = usage.promptEvalDuration.count();
+    response["eval_count"] = usage.evalTokens;
+    response["eval_duration"] = usage.evalDuration.count();
+    return response.dump();
+}
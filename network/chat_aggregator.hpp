@@ -0,0 +1,13 @@
+#pragma once
+
+#include <network/token_ledger.hpp>
+
+#include <string>
+#include <vector>
+
+/// @brief Builds the single response of the "stream": false chat, which is streamed from Ollama
+/// internally, in the shape Ollama answers such chats.
+/// @param lines chat lines sent to the user, lines without message are skipped.
+/// @param usage statistics summed over all round trips of the chat, commands included.
+[[nodiscard]]
+std::string AggregateChatResponse(const std::vector<std::string> &lines, const TTokenUsage &usage);
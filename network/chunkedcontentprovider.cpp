@@ -1,10 +1,22 @@
 #include "chunkedcontentprovider.hpp" // IWYU pragma: keep
 
 #include <commands/ollama_commands.hpp>
+#include <common/cm_ctors.h>
 #include <common/lambda_visitors.h>
+#include <common/metrics.h>
+#include <common/random_token.h>
 #include <common/runners.h>
+#include <common/threads_pool.hpp>
+#include <common/timer_wheel.hpp>
+#include <network/chat_aggregator.hpp>
 #include <network/contentrestorator.hpp>
+#include <network/model_fallback.hpp>
 #include <network/ollama_proxy_config.hpp>
+#include <network/proxy_metrics.hpp>
+#include <network/request_key.hpp>
+#include <network/request_trace.hpp>
+#include <network/stream_watchdog.hpp>
+#include <network/upstream_chat.hpp>
 #include <network/user_ping_generator.hpp>
 #include <ollama/httplib.h>
 #include <ollama/json.hpp>
@@ -15,12 +27,14 @@
 #include <cassert>
 #include <chrono> // IWYU pragma: keep
 #include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <functional>
 #include <future>
 #include <iostream>
 #include <iterator>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <sstream>
 #include <stdexcept>
@@ -29,6 +43,7 @@
 #include <type_traits>
 #include <utility>
 #include <variant>
+#include <vector>
 
 using namespace std::chrono_literals;
 
@@ -51,9 +66,9 @@ struct has_own_assignment_from_json
   public:
     static constexpr bool value = decltype(test<T>(nullptr))::value;
 };
+} // namespace
 
-/// @returns A new ollama::request chat object with the user's JSON data.
-ollama::request CreateChatRequest(const nlohmann::json &userJson)
+ollama::request CChunkedContentProvider::CreateChatRequest(const nlohmann::json &userJson)
 {
     using namespace ollama;
     request req(message_type::chat);
@@ -71,6 +86,7 @@ ollama::request CreateChatRequest(const nlohmann::json &userJson)
     return req;
 }
 
+namespace {
 void ReplaceSubstring(std::string &str, const std::string &from, const std::string &to)
 {
     size_t index = 0;
@@ -91,11 +107,147 @@ void ReplaceSubstring(std::string &str, const std::string &from, const std::stri
     }
 }
 
+std::atomic<std::uint64_t> lastStreamId{0};
+
+std::int64_t NowMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/// @brief Metrics of the single stream, used by Ollama thread only.
+class CStreamMetrics
+{
+  public:
+    NO_COPYMOVE(CStreamMetrics);
+    CStreamMetrics() = delete;
+
+    explicit CStreamMetrics(const std::string &model) :
+        activeStreams(proxy_metrics::ActiveStreams()),
+        timeToFirstToken(proxy_metrics::TimeToFirstToken(model)),
+        tokensPerSecond(proxy_metrics::TokensPerSecond(model)),
+        bufferingDelay(proxy_metrics::RestoratorBufferingDelay(model)),
+        startedAt(std::chrono::steady_clock::now())
+    {
+        activeStreams.Add(1);
+    }
+
+    ~CStreamMetrics()
+    {
+        activeStreams.Add(-1);
+    }
+
+    void OnOllamaResponse(const nlohmann::json &response)
+    {
+        if (!isFirstTokenSeen)
+        {
+            isFirstTokenSeen = true;
+            const auto elapsed = proxy_metrics::MicrosecondsSince(startedAt);
+            timeToFirstToken.Record(elapsed);
+            usage.timeToFirstToken = std::chrono::microseconds(elapsed);
+        }
+        OnCommandAnswered();
+        usage.AddOllamaResponse(response);
+
+        // Final chunk has statistic of the generation, duration is in nanoseconds.
+        constexpr auto kDoneKey = "done";
+        constexpr auto kEvalCountKey = "eval_count";
+        constexpr auto kEvalDurationKey = "eval_duration";
+        constexpr double kNanosecondsInSecond = 1e9;
+        if (response.contains(kDoneKey) && response[kDoneKey] == true
+            && response.contains(kEvalCountKey) && response[kEvalCountKey].is_number()
+            && response.contains(kEvalDurationKey) && response[kEvalDurationKey].is_number())
+        {
+            const auto duration = response[kEvalDurationKey].get<double>();
+            if (duration > 0)
+            {
+                tokensPerSecond.Record(static_cast<std::uint64_t>(
+                  response[kEvalCountKey].get<double>() * kNanosecondsInSecond / duration));
+            }
+        }
+    }
+
+    /// @brief Text is held back by CContentRestorator.
+    void OnBuffering()
+    {
+        if (!bufferingSince)
+        {
+            bufferingSince = std::chrono::steady_clock::now();
+        }
+    }
+
+    /// @brief Held text was sent to the user or recognized as command.
+    /// @returns When text started to be held, std::nullopt if nothing was held.
+    std::optional<std::chrono::steady_clock::time_point> OnReleased()
+    {
+        const auto since = bufferingSince;
+        if (since)
+        {
+            bufferingDelay.Record(proxy_metrics::MicrosecondsSince(*since));
+            bufferingSince = std::nullopt;
+        }
+        return since;
+    }
+
+    void OnCommandDetected(const std::string &keyword)
+    {
+        proxy_metrics::CommandRoundTrips(keyword).Add();
+        ++usage.commandRoundTrips;
+        pendingCommandLatency = &proxy_metrics::CommandRoundTripLatency(keyword);
+        commandDetectedAt = std::chrono::steady_clock::now();
+    }
+
+    void OnCommandAnswered()
+    {
+        if (pendingCommandLatency)
+        {
+            const auto elapsed = proxy_metrics::MicrosecondsSince(commandDetectedAt);
+            pendingCommandLatency->Record(elapsed);
+            pendingCommandLatency = nullptr;
+            usage.commandDuration += std::chrono::microseconds(elapsed);
+        }
+    }
+
+    /// @returns Resources spent by the stream so far.
+    [[nodiscard]]
+    TTokenUsage GetUsage() const
+    {
+        auto result = usage;
+        result.wallDuration =
+          std::chrono::microseconds(proxy_metrics::MicrosecondsSince(startedAt));
+        return result;
+    }
+
+  private:
+    metrics::CGauge &activeStreams;
+    metrics::CHistogram &timeToFirstToken;
+    metrics::CHistogram &tokensPerSecond;
+    metrics::CHistogram &bufferingDelay;
+    const std::chrono::steady_clock::time_point startedAt;
+    bool isFirstTokenSeen{false};
+    std::optional<std::chrono::steady_clock::time_point> bufferingSince;
+    metrics::CHistogram *pendingCommandLatency{nullptr};
+    std::chrono::steady_clock::time_point commandDetectedAt;
+    TTokenUsage usage;
+};
+
+constexpr auto kStreamKey = "stream";
+/// @brief How often the user waiting for the single response is checked to be still connected.
+constexpr std::chrono::milliseconds kUserCheckPeriod{100};
+
+/// @returns false if user asked for the single response.
+bool IsStreamRequested(const nlohmann::json &userJson)
+{
+    return !userJson.contains(kStreamKey) || userJson[kStreamKey] != false;
+}
+
 } // namespace
 
-CChunkedContentProvider::TUserRequest::TUserRequest(const httplib::Request &request) :
+CChunkedContentProvider::TUserRequest::TUserRequest(const httplib::Request &request,
+                                                    nlohmann::json parsed) :
     userRequest(request),
-    parsedUserJson(nlohmann::json::parse(request.body))
+    parsedUserJson(std::move(parsed))
 {
 }
 
@@ -109,13 +261,45 @@ CChunkedContentProvider::~CChunkedContentProvider()
 }
 
 CChunkedContentProvider::CChunkedContentProvider(const httplib::Request &userRequest,
-                                                 const TOllamaProxyConfig &proxyConfig) :
-    userRequest(userRequest),
-    commObject(),
+                                                 const TOllamaProxyConfig &proxyConfig,
+                                                 CModelFallback &modelFallback,
+                                                 CTraceExporter::TTracePtr trace) :
+    CChunkedContentProvider(userRequest, nlohmann::json::parse(userRequest.body), false,
+                            proxyConfig, modelFallback, std::move(trace))
+{
+}
+
+CChunkedContentProvider::CChunkedContentProvider(const httplib::Request &userRequest,
+                                                 nlohmann::json userJson,
+                                                 bool hasAiCommands,
+                                                 const TOllamaProxyConfig &proxyConfig,
+                                                 CModelFallback &modelFallback,
+                                                 CTraceExporter::TTracePtr trace) :
+    userRequest(userRequest, std::move(userJson)),
+    // Single response is built from all lines, so none of them is dropped.
+    commObject(IsStreamRequested(this->userRequest.parsedUserJson)
+                 ? proxyConfig.streamResume.replayLines
+                 : 0),
+    streamId(++lastStreamId),
+    resumeToken(utility::MakeRandomToken()),
+    createdAt(std::chrono::steady_clock::now()),
     proxyConfig(proxyConfig),
+    modelTicket(nullptr),
+    canonicalRequest(std::nullopt),
+    trace(std::move(trace)),
+    onCompleted(nullptr),
+    onUsage(nullptr),
+    onAbandoned(nullptr),
+    onTurnCompleted(nullptr),
+    capture(nullptr),
+    executor(nullptr),
+    timerWheel(nullptr),
+    deadline(std::nullopt),
+    isStreamedToUser(true),
+    aggregated(),
+    startOnce(std::make_unique<std::once_flag>()),
     ollamaThread(nullptr)
 {
-    constexpr auto kStreamKey = "stream";
     auto &parsedUserJson = this->userRequest.parsedUserJson;
 
     if (!parsedUserJson.contains(kStreamKey))
@@ -126,25 +310,207 @@ CChunkedContentProvider::CChunkedContentProvider(const httplib::Request &userReq
     {
         throw std::runtime_error("Expected 'stream' field to be a boolean.");
     }
-    if (parsedUserJson[kStreamKey] == false)
+    isStreamedToUser = IsStreamRequested(parsedUserJson);
+
+    SelectModel(modelFallback);
+    if (!hasAiCommands)
     {
-        throw std::runtime_error("Expected 'stream' field to be true.");
+        const CRequestTrace::CSpan span(this->trace, "inject");
+        MakeCommandsAvailForAi(parsedUserJson, proxyConfig.GetAiCommands());
     }
-
-    MakeCommandsAvailForAi();
+    // Answer depends on the backend commands too, so the key is made of the request sent to Ollama.
+    canonicalRequest = MakeCanonicalRequest(parsedUserJson);
 
     proxyConfig.ExecIfFittingVerbosity(EOllamaProxyVerbosity::Debug, [&parsedUserJson](auto &os) {
         os << "[DEBUG] CChunkedContentProvider::operator(), we have stored request to process: \n"
            << parsedUserJson << std::endl;
     });
+}
+
+void CChunkedContentProvider::Start()
+{
+    std::call_once(*startOnce, [this]() {
+        ollamaThread = RunOllamaThread();
+    });
+}
 
-    ollamaThread = RunOllamaThread();
+void CChunkedContentProvider::SetOnCompleted(TOnCompleted callback)
+{
+    assert(!ollamaThread && "Callback must be set before generation is started.");
+    onCompleted = std::move(callback);
 }
 
-void CChunkedContentProvider::MakeCommandsAvailForAi()
+void CChunkedContentProvider::SetOnUsage(TOnUsage callback)
 {
+    assert(!ollamaThread && "Callback must be set before generation is started.");
+    onUsage = std::move(callback);
+}
+
+void CChunkedContentProvider::SetOnAbandoned(TOnAbandoned callback)
+{
+    assert(!ollamaThread && "Callback must be set before generation is started.");
+    onAbandoned = std::move(callback);
+}
+
+void CChunkedContentProvider::SetOnTurnCompleted(TOnTurnCompleted callback)
+{
+    assert(!ollamaThread && "Callback must be set before generation is started.");
+    onTurnCompleted = std::move(callback);
+}
+
+bool CChunkedContentProvider::IsStreamedToUser() const
+{
+    return isStreamedToUser;
+}
+
+std::optional<std::string>
+CChunkedContentProvider::WaitAggregated(const std::function<bool()> &isUserGone)
+{
+    assert(!isStreamedToUser && "Streamed generation is read by the subscriptions.");
+    auto future = aggregated.get_future();
+    while (future.wait_for(kUserCheckPeriod) != std::future_status::ready)
+    {
+        // Nobody writes to the waiting user, so its leaving is not noticed by the sink.
+        if (isUserGone && isUserGone())
+        {
+            Cancel();
+            break;
+        }
+    }
+    return future.get();
+}
+
+bool CChunkedContentProvider::CanResumeFrom(std::size_t offset) const
+{
+    return commObject.CanReplayFrom(offset);
+}
+
+void CChunkedContentProvider::SetCapture(CStreamCapture *capture)
+{
+    assert(!ollamaThread && "Capture must be set before generation is started.");
+    this->capture = capture && capture->IsEnabled() ? capture : nullptr;
+}
+
+void CChunkedContentProvider::SetExecutor(utility::CThreadPool *executor)
+{
+    assert(!ollamaThread && "Executor must be set before generation is started.");
+    this->executor = executor;
+}
+
+void CChunkedContentProvider::SetTimerWheel(utility::CTimerWheel *timerWheel)
+{
+    assert(!ollamaThread && "Timer wheel must be set before generation is started.");
+    this->timerWheel = timerWheel;
+}
+
+void CChunkedContentProvider::SetDeadline(std::chrono::steady_clock::time_point deadline)
+{
+    assert(!ollamaThread && "Deadline must be set before generation is started.");
+    this->deadline = deadline;
+}
+
+const std::optional<std::string> &CChunkedContentProvider::GetCanonicalRequest() const
+{
+    return canonicalRequest;
+}
+
+bool CChunkedContentProvider::IsInFlight() const
+{
+    return !commObject.IsDisconnected();
+}
+
+void CChunkedContentProvider::SelectModel(CModelFallback &modelFallback)
+{
+    constexpr auto kModelKey = "model";
     auto &parsedUserJson = this->userRequest.parsedUserJson;
-    auto &msgs = parsedUserJson["messages"];
+    if (!parsedUserJson.contains(kModelKey) || !parsedUserJson[kModelKey].is_string())
+    {
+        throw std::runtime_error("Expected 'model' field to be a string.");
+    }
+
+    modelTicket = modelFallback.Acquire(parsedUserJson[kModelKey].get<std::string>());
+    if (modelTicket->IsFallback())
+    {
+        proxyConfig.get().LogFields(
+          EOllamaProxyVerbosity::Warning, "[WARNING] Model is saturated, using fallback.",
+          [&parsedUserJson, this](auto &record) {
+              record.Add("requested", parsedUserJson[kModelKey].template get<std::string>())
+                .Add("model", modelTicket->Model());
+          });
+        parsedUserJson[kModelKey] = modelTicket->Model();
+    }
+}
+
+const std::string &CChunkedContentProvider::GetModel() const
+{
+    return modelTicket->Model();
+}
+
+std::uint64_t CChunkedContentProvider::GetStreamId() const
+{
+    return streamId;
+}
+
+const std::string &CChunkedContentProvider::GetResumeToken() const
+{
+    return resumeToken;
+}
+
+CChunkedContentProvider::TStreamInfo CChunkedContentProvider::GetInfo() const
+{
+    using namespace std::chrono;
+    const auto &status = commObject.GetStatus();
+    const auto now = steady_clock::now();
+    const auto lastActivity =
+      steady_clock::time_point{microseconds{status.lastActivityUs.load(std::memory_order_relaxed)}};
+    return {
+      streamId,
+      GetModel(),
+      status.state.load(std::memory_order_relaxed),
+      duration_cast<milliseconds>(now - createdAt),
+      duration_cast<milliseconds>(now - std::max(lastActivity, createdAt)),
+      status.bytesProduced.load(std::memory_order_relaxed),
+      status.bytesWritten.load(std::memory_order_relaxed),
+      status.subscribers.load(std::memory_order_relaxed),
+    };
+}
+
+void CChunkedContentProvider::Cancel()
+{
+    proxyConfig.get().LogFields(EOllamaProxyVerbosity::Warning, "[WARNING] Stream is cancelled.",
+                                [this](auto &record) {
+                                    record.Add("stream", streamId);
+                                });
+    // Disconnect callback aborts the running upstream call or command, so the slot is freed now.
+    commObject.DisconnectAll();
+}
+
+const char *CChunkedContentProvider::ToString(EStreamState state)
+{
+    switch (state)
+    {
+        case EStreamState::Created:
+            return "created";
+        case EStreamState::WaitingOllama:
+            return "waiting_ollama";
+        case EStreamState::Streaming:
+            return "streaming";
+        case EStreamState::Buffering:
+            return "buffering";
+        case EStreamState::ExecutingCommand:
+            return "executing_command";
+        case EStreamState::Pinging:
+            return "pinging";
+        case EStreamState::Finished:
+            return "finished";
+    }
+    return "unknown";
+}
+
+void CChunkedContentProvider::MakeCommandsAvailForAi(nlohmann::json &userJson,
+                                                     const TAiCommands &aiCommands)
+{
+    auto &msgs = userJson["messages"];
 
     auto it = std::adjacent_find(msgs.begin(), msgs.end(), [](const auto &ja, const auto &jb) {
         return ja["role"] != jb["role"] && ja["role"] == "system";
@@ -161,7 +527,7 @@ void CChunkedContentProvider::MakeCommandsAvailForAi()
                 "keyword as first word in reply to receive real world information\nPrepend keyword "
                 "with any words or symbols to send it to user.\n";
     fullList << "\n\n";
-    for (const auto &aiCommand : proxyConfig.get().GetAiCommands())
+    for (const auto &aiCommand : aiCommands)
     {
         std::string text = aiCommand.second.instructionForAi;
         ReplaceSubstring(text, "${KEYWORD}", aiCommand.first);
@@ -176,12 +542,15 @@ void CChunkedContentProvider::MakeCommandsAvailForAi()
     msgs.insert(it, std::move(js));
 }
 
-bool CChunkedContentProvider::operator()(std::size_t /*offset*/, httplib::DataSink &sink)
+bool CChunkedContentProvider::operator()(std::size_t &readCursor, httplib::DataSink &sink,
+                                         const CTraceExporter::TTracePtr &userTrace)
 {
     // This is communication to the user, called by server wrapper pereodically.
+    // Generation can be shared by many users, so one user leaving must not stop it. It is stopped
+    // when the last subscriber releases this object, unless the stream is parked for resuming.
     try
     {
-        while (const auto what = commObject.GetStringForUser())
+        while (const auto what = commObject.GetStringForUser(readCursor))
         {
             if (!sink.is_writable())
             {
@@ -190,19 +559,21 @@ bool CChunkedContentProvider::operator()(std::size_t /*offset*/, httplib::DataSi
                       os << "[WARNING] Sink is not writable even before asking Ollama."
                          << std::endl;
                   });
-                commObject.DisconnectAll();
                 return false;
             }
             if (!what->empty())
             {
                 try
                 {
-                    std::ostringstream oss;
-                    oss << std::hex << what->size() << "\r\n" << *what << "\r\n";
-                    const std::string chunk = oss.str();
-                    DebugDump("operator() to write to user, sending\n", chunk,
-                              "\n\tOf size: ", chunk.size());
-                    sink.write(chunk.c_str(), chunk.size());
+                    DebugDump("operator() to write to user, sending\n", *what,
+                              "\n\tOf size: ", what->size());
+                    CRequestTrace::CSpan span(userTrace, "sink_write");
+                    span.Arg("bytes", what->size());
+                    WriteLineToUser(*what, sink);
+                    auto &status = commObject.GetStatus();
+                    status.bytesWritten.fetch_add(what->size(), std::memory_order_relaxed);
+                    status.lastWrittenUs.store(NowMicroseconds(), std::memory_order_relaxed);
+                    status.Touch();
                 }
                 catch (std::exception &e)
                 {
@@ -213,6 +584,11 @@ bool CChunkedContentProvider::operator()(std::size_t /*offset*/, httplib::DataSi
                 }
             }
         }
+        if (commObject.IsDrained(readCursor))
+        {
+            // Generation is over or cancelled, this user got everything.
+            sink.done();
+        }
         // Keep channel opened to user.
         return true;
     }
@@ -223,10 +599,17 @@ bool CChunkedContentProvider::operator()(std::size_t /*offset*/, httplib::DataSi
         });
     }
     DebugDump("Finishing CChunkedContentProvider::operator() with false.");
-    commObject.DisconnectAll();
     return false;
 }
 
+void CChunkedContentProvider::WriteLineToUser(const std::string &line, httplib::DataSink &sink)
+{
+    std::ostringstream oss;
+    oss << std::hex << line.size() << "\r\n" << line << "\r\n";
+    const std::string chunk = oss.str();
+    sink.write(chunk.c_str(), chunk.size());
+}
+
 std::shared_ptr<std::thread> CChunkedContentProvider::RunOllamaThread()
 {
     auto threadedOllama = [&](const auto &shouldStopPtr) {
@@ -236,21 +619,73 @@ std::shared_ptr<std::thread> CChunkedContentProvider::RunOllamaThread()
           std::make_shared<CContentRestorator>(proxyConfig.get().GetAiCommands());
 
         CPinger pingGen(commObject);
+        CStreamMetrics streamMetrics(GetModel());
+        std::optional<CStreamWatchdog> watchdog;
+        if (timerWheel)
+        {
+            auto &heartbeats = proxy_metrics::Heartbeats(GetModel());
+            watchdog.emplace(
+              *timerWheel, proxyConfig.get().streamTimers, deadline,
+              CStreamWatchdog::THandlers{
+                [this]() {
+                    return commObject.GetStatus().MakeProbe(createdAt);
+                },
+                [this, &heartbeats]() {
+                    // Nobody reads the stream of the single response, it is sent once it is done.
+                    if (!isStreamedToUser)
+                    {
+                        return;
+                    }
+                    heartbeats.Add();
+                    // Chunk without content keeps the connection and adds nothing to the answer.
+                    commObject.SendPingToUser(
+                      CUserPingGenerator::BuildJsStringForUser(GetModel(), ""));
+                },
+                [this](CStreamWatchdog::EExpiry expiry) {
+                    proxyConfig.get().LogFields(
+                      EOllamaProxyVerbosity::Warning, "[WARNING] Stream timed out.",
+                      [this, expiry](auto &record) {
+                          record.Add("stream", streamId)
+                            .Add("reason", CStreamWatchdog::ToString(expiry));
+                      });
+                    proxy_metrics::StreamTimeouts(CStreamWatchdog::ToString(expiry)).Add();
+                    commObject.DisconnectAll();
+                },
+                [this]() {
+                    return modelTicket->GetExpectedFirstToken();
+                },
+              });
+        }
+        // Ollama's own timings of the current upstream round trip, attached to its span.
+        nlohmann::json upstreamStats = nlohmann::json::object();
+        // Raw lines of the current upstream round trip, if it is recorded.
+        std::optional<TCapturedStream> captured;
+        auto lastLineAt = std::chrono::steady_clock::now();
+        // Set when Ollama finished the answer to the user, not the backend command.
+        bool isCompleted = false;
+        bool hadCommands = false;
+        // Turn of the session: messages of the last Ollama call and the answer to them.
+        nlohmann::json turnMessages;
+        std::string answer;
+        bool isAnsweredByCommand = false;
         const auto ollamaResponseHandler =
-          [commandDetector = commandDetector, this, &pingGen](
-            const ollama::response &ollamaResponse,
+          [commandDetector = commandDetector, this, &pingGen, &isCompleted, &streamMetrics,
+           &upstreamStats, &captured, &lastLineAt, &answer](
+            const ollama::response &ollamaResponse, const std::string &rawLine,
             std::shared_ptr<std::promise<CContentRestorator::TDetected>> detectionPromise) -> bool {
             // We should return true/false from callback to ollama server, AND stop sink if
             // we're done, otherwise client will keep repeating.
             const auto respondToUserAndOllama =
-              [this, &pingGen](CContentRestorator::EReadingBehahve status) {
+              [this, &pingGen, &isCompleted](CContentRestorator::EReadingBehahve status) {
                   switch (status)
                   {
                       case CContentRestorator::EReadingBehahve::OllamaHasMore:
                           return !commObject.IsDisconnected(); // Keep talking to Ollama.
                       case CContentRestorator::EReadingBehahve::CommunicationFailure:
-                          [[fallthrough]];
+                          commObject.DisconnectAll();
+                          break;
                       case CContentRestorator::EReadingBehahve::OllamaSentAll:
+                          isCompleted = !commObject.IsDisconnected();
                           commObject.DisconnectAll();
                           break;
                   }
@@ -268,6 +703,38 @@ std::shared_ptr<std::thread> CChunkedContentProvider::RunOllamaThread()
             {
                 return false;
             }
+            modelTicket->MarkFirstToken();
+            commObject.GetStatus().lastFromOllamaUs.store(NowMicroseconds(),
+                                                          std::memory_order_relaxed);
+            if (captured)
+            {
+                const auto now = std::chrono::steady_clock::now();
+                captured->lines.push_back(
+                  {std::chrono::duration_cast<std::chrono::microseconds>(now - lastLineAt),
+                   rawLine});
+                lastLineAt = now;
+            }
+            streamMetrics.OnOllamaResponse(ollamaResponse.as_json());
+            if (onTurnCompleted)
+            {
+                const auto json = ollamaResponse.as_json();
+                if (json.contains("message"))
+                {
+                    answer += json["message"].value("content", "");
+                }
+            }
+            if (trace)
+            {
+                const auto json = ollamaResponse.as_json();
+                for (const auto *key : {"prompt_eval_count", "prompt_eval_duration", "eval_count",
+                                        "eval_duration", "load_duration", "total_duration"})
+                {
+                    if (json.contains(key))
+                    {
+                        upstreamStats[key] = json[key];
+                    }
+                }
+            }
 
             try
             {
@@ -288,8 +755,11 @@ std::shared_ptr<std::thread> CChunkedContentProvider::RunOllamaThread()
                 // Parsed commulated response from Ollama.
                 const LambdaVisitor visitor{
                   [&](const CContentRestorator::TAlreadyDetected &) {
+                      commObject.GetStatus().SetState(EStreamState::Streaming);
                       DebugDump("CContentRestorator::TAlreadyDetected", ollamaResponse,
-                                "\n\tIsEmpty: ", ollamaResponse.as_json().dump().empty());
+                                "\n\tIsEmpty: ", [&ollamaResponse]() {
+                                    return ollamaResponse.as_json().dump().empty();
+                                });
                       commObject.SendToUser(ollamaResponse);
                       return !commObject.IsDisconnected();
                   },
@@ -298,17 +768,34 @@ std::shared_ptr<std::thread> CChunkedContentProvider::RunOllamaThread()
                       if (data.status == CContentRestorator::EReadingBehahve::OllamaSentAll)
                       {
                           DebugDump("\tCContentRestorator::EReadingBehahve::OllamaSentAll");
+                          streamMetrics.OnReleased();
+                          commObject.GetStatus().SetState(EStreamState::Streaming);
                           sendPlainTextToUser(data.currentlyCollectedString);
                       }
+                      else
+                      {
+                          streamMetrics.OnBuffering();
+                          commObject.GetStatus().SetState(EStreamState::Buffering);
+                      }
                       return !commObject.IsDisconnected();
                   },
                   [&](const CContentRestorator::TPassToUser &pass) {
                       DebugDump("CContentRestorator::TPassToUser");
+                      streamMetrics.OnReleased();
+                      commObject.GetStatus().SetState(EStreamState::Streaming);
                       sendPlainTextToUser(pass.collectedString);
                       return !commObject.IsDisconnected();
                   },
                   [&](CContentRestorator::TDetected detected) {
                       DebugDump("CContentRestorator::TDetected");
+                      const auto heldSince = streamMetrics.OnReleased();
+                      commObject.GetStatus().SetState(EStreamState::ExecutingCommand);
+                      if (trace)
+                      {
+                          const auto now = std::chrono::steady_clock::now();
+                          trace->AddSpan("detection", heldSince.value_or(now), now,
+                                         {{"keyword", detected.whatDetected}});
+                      }
                       // Here we have full ollama's response (request by model) to do
                       // something, It must not be sent to user. It must be served, and sent
                       // as new request to ollama than repeat whole ollamaResponseHandler ()
@@ -334,17 +821,59 @@ std::shared_ptr<std::thread> CChunkedContentProvider::RunOllamaThread()
               CContentRestorator::EReadingBehahve::CommunicationFailure);
         }; // ollamaResponseHandler[]()
 
-        Ollama ollamaServer(proxyConfig.get().CreateOllamaUrl());
-        const auto execOllamaRequest = [&ollamaResponseHandler, this,
-                                        &ollamaServer](ollama::request request) {
+        CUpstreamChat upstreamChat(proxyConfig.get());
+        const auto execOllamaRequest = [&ollamaResponseHandler, this, &upstreamChat,
+                                        &upstreamStats, &captured,
+                                        &lastLineAt](ollama::request request) {
             auto detectionPromise = std::make_shared<std::promise<CContentRestorator::TDetected>>();
             auto fut = detectionPromise->get_future();
 
-            ollamaServer.chat(
-              request, [&, detectionPromise = std::move(detectionPromise)](const auto &r) -> bool {
-                  return ollamaResponseHandler(r, std::move(detectionPromise));
+            CRequestTrace::CSpan span(trace, "upstream");
+            upstreamStats = nlohmann::json::object();
+            if (capture)
+            {
+                captured.emplace();
+                captured->model = GetModel();
+                lastLineAt = std::chrono::steady_clock::now();
+            }
+            // Leaving user or passed deadline shuts the upstream socket down at once, Ollama
+            // stops evaluating the prompt without waiting for its next chunk.
+            commObject.SetOnDisconnect(upstreamChat.GetAborter());
+            const auto result = upstreamChat.Chat(
+              std::move(request),
+              [&, detectionPromise = std::move(detectionPromise)](const auto &r,
+                                                                  const auto &line) -> bool {
+                  return ollamaResponseHandler(r, line, detectionPromise);
               });
-            return std::move(fut);
+            commObject.SetOnDisconnect(nullptr);
+            // Model served by Ollama exists, so it is the bounded metric label from now on.
+            if (upstreamChat.HasResponded())
+            {
+                proxy_metrics::AddKnownModel(GetModel());
+            }
+            if (CUpstreamChat::EResult::Aborted == result)
+            {
+                span.Arg("aborted", true);
+                OnUpstreamAborted(upstreamChat);
+            }
+            for (const auto &stat : upstreamStats.items())
+            {
+                span.Arg(stat.key(), stat.value());
+            }
+            if (captured && executor)
+            {
+                executor->enqueue(
+                  [target = capture, stream = std::move(*captured)](const auto &) {
+                      target->Write(stream);
+                  },
+                  utility::ETaskPriority::Background);
+            }
+            else if (captured)
+            {
+                capture->Write(*captured);
+            }
+            captured.reset();
+            return fut;
         };
 
         const auto isThreadLoopingYet = [&shouldStopPtr, this]() {
@@ -360,59 +889,147 @@ std::shared_ptr<std::thread> CChunkedContentProvider::RunOllamaThread()
                 break;
             }
             const auto model = userRequest.parsedUserJson["model"];
-            pingGen.Restart(model);
+            commObject.GetStatus().SetState(EStreamState::WaitingOllama);
+            // User waiting for the single response gets no pings.
+            if (isStreamedToUser)
+            {
+                pingGen.Restart(model);
+            }
+            if (onTurnCompleted)
+            {
+                // Answer of the previous round trip was the backend command.
+                turnMessages = request["messages"];
+                answer.clear();
+            }
             auto fut = execOllamaRequest(std::move(request));
             request = {};
-            while (isThreadLoopingYet())
+            // Ollama is called synchronously, so the detection promise is set once it returns.
+            // Otherwise answer is over, there is nothing to wait for.
+            if (std::future_status::ready == fut.wait_for(0s) && isThreadLoopingYet())
             {
-                if (std::future_status::ready == fut.wait_for(250ms) && isThreadLoopingYet())
-                {
-                    // Handle request from Ollama, set new value to "request" which would be
-                    // handler's result.
-
-                    CContentRestorator::TDetected aiCommand = std::move(fut.get());
-                    DebugDump("Received request from AI to do something:", aiCommand.whatDetected);
-
-                    const LambdaVisitor visitor{
-                      [&](std::string responseForUser) {
-                          loopDetector.Reset();
-                          auto json = CUserPingGenerator::BuildJsStringForUser(
-                            model, std::move(responseForUser));
-                          pingGen.Finish();
-                          DebugDump("We have response for user:\n", json);
-                          commObject.SendToUser(std::move(json));
-                          std::this_thread::sleep_for(150ms);
-                      },
-                      [&, cmd = aiCommand.whatDetected](ollama::request forOllama) {
-                          loopDetector.Update(cmd);
-                          if (loopDetector.IsLooping())
-                          {
-                              forOllama =
-                                MakeResponseForOllama("You request cannot produce more data than "
-                                                      "you already got. Stop repeating it.");
-                          }
-                          DebugDump("Sending back to AI\n", request);
-                          request = std::move(forOllama);
-                          commandDetector->Reset();
+                // Handle request from Ollama, set new value to "request" which would be
+                // handler's result.
+
+                CContentRestorator::TDetected aiCommand = std::move(fut.get());
+                hadCommands = true;
+                streamMetrics.OnCommandDetected(aiCommand.whatDetected);
+                DebugDump("Received request from AI to do something:", aiCommand.whatDetected);
+
+                const LambdaVisitor visitor{
+                  [&](std::string responseForUser) {
+                      loopDetector.Reset();
+                      answer = responseForUser;
+                      isAnsweredByCommand = true;
+                      auto json = CUserPingGenerator::BuildJsStringForUser(
+                        model, std::move(responseForUser));
+                      pingGen.Finish();
+                      DebugDump("We have response for user:\n", json);
+                      commObject.SendToUser(std::move(json));
+                      streamMetrics.OnCommandAnswered();
+                  },
+                  [&, cmd = aiCommand.whatDetected](ollama::request forOllama) {
+                      loopDetector.Update(cmd);
+                      if (loopDetector.IsLooping())
+                      {
+                          forOllama =
+                            MakeResponseForOllama("You request cannot produce more data than "
+                                                  "you already got. Stop repeating it.");
+                      }
+                      DebugDump("Sending back to AI\n", request);
+                      request = std::move(forOllama);
+                      commandDetector->Reset();
+                  },
+                };
+                auto commandResult = [&]() -> std::optional<TCommandResutl> {
+                    CRequestTrace::CSpan span(trace, "command");
+                    span.Arg("keyword", aiCommand.whatDetected);
+                    if (!executor)
+                    {
+                        return MakeResponseForOllama(std::move(aiCommand), pingGen);
+                    }
+                    auto handle = executor->submit(
+                      [this, &aiCommand, &pingGen](const auto &) {
+                          return MakeResponseForOllama(std::move(aiCommand), pingGen);
                       },
-                    };
-                    std::visit(visitor, MakeResponseForOllama(std::move(aiCommand), pingGen));
-                    break;
+                      utility::ETaskPriority::Critical);
+                    // Cancelled stream drops the queued command at once. Started command uses
+                    // locals of this thread, so it is awaited.
+                    commObject.SetOnDisconnect([cancel = handle.GetCanceller()]() {
+                        cancel();
+                    });
+                    std::optional<TCommandResutl> result;
+                    try
+                    {
+                        result = handle.get();
+                    }
+                    catch (const utility::CTaskCancelled &)
+                    {
+                    }
+                    commObject.SetOnDisconnect(nullptr);
+                    return result;
+                }();
+                if (commandResult)
+                {
+                    std::visit(visitor, std::move(*commandResult));
                 }
             }
-            DebugDump("Finished inner loop of Ollaming...");
+            DebugDump("Finished round trip of Ollaming...");
             pingGen.Finish();
         }
         DebugDump("Finished outer loop of Ollaming...");
         pingGen.Finish();
+        commObject.GetStatus().SetState(EStreamState::Finished);
         commObject.DisconnectAll();
-        std::this_thread::sleep_for(200ms);
+        if (onUsage)
+        {
+            onUsage(streamMetrics.GetUsage());
+        }
+        // Command results (like current time) are not reproducible, such answers are not reported.
+        if (isCompleted && !hadCommands && onCompleted && commObject.CanReplayFrom(0))
+        {
+            onCompleted(commObject.GetAllSentToUser());
+        }
+        if ((isCompleted || isAnsweredByCommand) && onTurnCompleted)
+        {
+            turnMessages.push_back({{"role", "assistant"}, {"content", std::move(answer)}});
+            onTurnCompleted(std::move(turnMessages));
+        }
+        if (!isStreamedToUser)
+        {
+            std::optional<std::string> response;
+            if (isCompleted || isAnsweredByCommand)
+            {
+                response =
+                  AggregateChatResponse(commObject.GetAllSentToUser(), streamMetrics.GetUsage());
+            }
+            aggregated.set_value(std::move(response));
+        }
     };
     // Warning! It is tempting to use pool, but than we need to be sure this object exists until
     // lambda exists in pool.
     return utility::startNewRunner(std::move(threadedOllama));
 }
 
+void CChunkedContentProvider::OnUpstreamAborted(const CUpstreamChat &upstreamChat) const
+{
+    proxy_metrics::UpstreamAborts(GetModel()).Add();
+    DebugDump("Aborted Ollama call, it responded: ", upstreamChat.HasResponded());
+    // Generating Ollama would stop on its next chunk anyway, only the rest of the prompt
+    // evaluation is saved.
+    if (upstreamChat.HasResponded())
+    {
+        return;
+    }
+    const auto left =
+      modelTicket->GetExpectedFirstToken()
+      - std::chrono::duration_cast<std::chrono::microseconds>(upstreamChat.GetElapsed());
+    if (left.count() > 0)
+    {
+        proxy_metrics::UpstreamSavedGpuTime(GetModel())
+          .Record(static_cast<std::uint64_t>(left.count()));
+    }
+}
+
 ollama::request CChunkedContentProvider::MakeResponseForOllama(std::string plainText) const
 {
     auto clone = userRequest.parsedUserJson;
@@ -457,17 +1074,59 @@ CChunkedContentProvider::MakeResponseForOllama(CContentRestorator::TDetected aiC
                       it->second.resultProvider(it->first, std::move(aiCommand.collectedString)));
 }
 
-CChunkedContentProvider::TCommObject::TCommObject() :
-    ollamaToUser(std::make_unique<TQueue>()),
-    disconnectAll(std::make_unique<std::atomic<bool>>(false))
+void CChunkedContentProvider::TStreamStatus::Touch()
+{
+    lastActivityUs.store(NowMicroseconds(), std::memory_order_relaxed);
+}
+
+CStreamWatchdog::TProbe CChunkedContentProvider::TStreamStatus::MakeProbe(
+  const std::chrono::steady_clock::time_point createdAt) const
+{
+    const auto toTime = [createdAt](const std::atomic<std::int64_t> &us) {
+        return std::max(createdAt, std::chrono::steady_clock::time_point{std::chrono::microseconds{
+                                     us.load(std::memory_order_relaxed)}});
+    };
+    const auto current = state.load(std::memory_order_relaxed);
+    CStreamWatchdog::TProbe probe;
+    probe.isSilent = current == EStreamState::WaitingOllama
+                     || current == EStreamState::ExecutingCommand
+                     || current == EStreamState::Pinging;
+    probe.isGenerating = current == EStreamState::Streaming || current == EStreamState::Buffering;
+    // Written bytes are summed over coalesced users, so only the single user is checked exactly.
+    probe.hasUnwritten = subscribers.load(std::memory_order_relaxed) > 0
+                         && bytesWritten.load(std::memory_order_relaxed)
+                              < bytesProduced.load(std::memory_order_relaxed);
+    probe.lastSentToUser = toTime(lastActivityUs);
+    probe.lastFromOllama = toTime(lastFromOllamaUs);
+    probe.lastWritten = toTime(lastWrittenUs);
+    return probe;
+}
+
+CChunkedContentProvider::TCommObject::TCommObject(std::size_t replayLines) :
+    ollamaToUser(std::make_unique<TBuffer>(replayLines)),
+    disconnectAll(std::make_unique<std::atomic<bool>>(false)),
+    status(std::make_unique<TStreamStatus>()),
+    onDisconnect(std::make_unique<TDisconnectHook>())
 {
 }
 
 void CChunkedContentProvider::TCommObject::SendToUser(std::string what) const
 {
-    if (!IsDisconnected() && !what.empty())
+    Push({std::move(what), false});
+}
+
+void CChunkedContentProvider::TCommObject::SendPingToUser(std::string what) const
+{
+    Push({std::move(what), true});
+}
+
+void CChunkedContentProvider::TCommObject::Push(TLine line) const
+{
+    if (!IsDisconnected() && !line.text.empty())
     {
-        ollamaToUser->push(std::move(what));
+        status->bytesProduced.fetch_add(line.text.size(), std::memory_order_relaxed);
+        status->Touch();
+        ollamaToUser->push(std::move(line));
     }
 }
 
@@ -479,6 +1138,35 @@ void CChunkedContentProvider::TCommObject::SendToUser(const ollama::response &ol
 void CChunkedContentProvider::TCommObject::DisconnectAll() const
 {
     disconnectAll->store(true);
+    ollamaToUser->close();
+    std::function<void()> callback;
+    {
+        const std::lock_guard lock(onDisconnect->mutex);
+        callback = std::move(onDisconnect->callback);
+        onDisconnect->callback = nullptr;
+    }
+    if (callback)
+    {
+        callback();
+    }
+}
+
+void CChunkedContentProvider::TCommObject::SetOnDisconnect(std::function<void()> callback) const
+{
+    {
+        // DisconnectAll() sets the flag before it takes the callback, so one of them calls it.
+        const std::lock_guard lock(onDisconnect->mutex);
+        if (!IsDisconnected())
+        {
+            onDisconnect->callback = std::move(callback);
+            return;
+        }
+        onDisconnect->callback = nullptr;
+    }
+    if (callback)
+    {
+        callback();
+    }
 }
 
 bool CChunkedContentProvider::TCommObject::IsDisconnected() const
@@ -486,9 +1174,78 @@ bool CChunkedContentProvider::TCommObject::IsDisconnected() const
     return disconnectAll->load();
 }
 
-std::optional<std::string> CChunkedContentProvider::TCommObject::GetStringForUser() const
+bool CChunkedContentProvider::TCommObject::CanReplayFrom(std::size_t readCursor) const
+{
+    return readCursor >= ollamaToUser->first() && readCursor <= ollamaToUser->size();
+}
+
+std::vector<std::string> CChunkedContentProvider::TCommObject::GetAllSentToUser() const
+{
+    std::vector<std::string> answer;
+    for (auto &line : ollamaToUser->snapshot())
+    {
+        if (!line.isPing)
+        {
+            answer.push_back(std::move(line.text));
+        }
+    }
+    return answer;
+}
+
+void CChunkedContentProvider::TCommObject::AttachReader(const std::size_t &readCursor) const
+{
+    ollamaToUser->attach(readCursor);
+}
+
+void CChunkedContentProvider::TCommObject::DetachReader(const std::size_t &readCursor) const
+{
+    ollamaToUser->detach(readCursor);
+}
+
+std::optional<std::string>
+CChunkedContentProvider::TCommObject::GetStringForUser(std::size_t &readCursor) const
+{
+    auto line = ollamaToUser->read(readCursor);
+    if (!line)
+    {
+        return std::nullopt;
+    }
+    return std::move(line->text);
+}
+
+bool CChunkedContentProvider::TCommObject::IsDrained(std::size_t readCursor) const
+{
+    // Nothing is added once closed, so size is final.
+    return ollamaToUser->closed() && readCursor >= ollamaToUser->size();
+}
+
+CChunkedContentProvider::CSubscription::CSubscription(
+  std::shared_ptr<CChunkedContentProvider> provider, std::size_t readCursor,
+  CTraceExporter::TTracePtr trace) :
+    provider(std::move(provider)),
+    readCursor(readCursor),
+    trace(std::move(trace))
+{
+    this->provider->commObject.AttachReader(this->readCursor);
+    this->provider->commObject.GetStatus().subscribers.fetch_add(1, std::memory_order_relaxed);
+}
+
+CChunkedContentProvider::CSubscription::~CSubscription()
+{
+    const auto &commObject = provider->commObject;
+    commObject.DetachReader(readCursor);
+    const bool isLast =
+      1 == commObject.GetStatus().subscribers.fetch_sub(1, std::memory_order_relaxed);
+    // Otherwise the generation is stopped once this reference is released.
+    if (isLast && provider->onAbandoned && !commObject.IsDrained(readCursor))
+    {
+        provider->onAbandoned(std::move(provider));
+    }
+}
+
+bool CChunkedContentProvider::CSubscription::operator()(httplib::DataSink &sink)
 {
-    return ollamaToUser->pop();
+    return (*provider)(readCursor, sink, trace);
 }
 
 /*
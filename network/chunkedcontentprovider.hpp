@@ -1,23 +1,37 @@
 #pragma once
 
 #include <common/cm_ctors.h>
-#include <common/safe_queue.h>
+#include <common/fanout_buffer.h>
+#include <common/threads_pool.hpp>
+#include <common/timer_wheel.hpp>
 #include <network/contentrestorator.hpp>
+#include <network/model_fallback.hpp>
 #include <network/ollama_proxy_config.hpp>
+#include <network/request_trace.hpp>
+#include <network/stream_capture.hpp>
+#include <network/stream_watchdog.hpp>
+#include <network/token_ledger.hpp>
+#include <network/upstream_chat.hpp>
 #include <network/user_ping_generator.hpp>
 #include <ollama/httplib.h>
 #include <ollama/json.hpp>
 #include <ollama/ollama.hpp>
 
 #include <atomic>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
 #include <optional>
 #include <string>
 #include <thread>
+#include <type_traits>
 #include <utility>
 #include <variant>
+#include <vector>
 
 class CChunkedContentProvider
 {
@@ -26,41 +40,286 @@ class CChunkedContentProvider
     ~CChunkedContentProvider();
     MOVEONLY_ALLOWED(CChunkedContentProvider);
 
+    /// @param trace spans of the request, nullptr if request is not traced.
     explicit CChunkedContentProvider(const httplib::Request &userRequest,
-                                     const TOllamaProxyConfig &proxyConfig);
-    bool operator()(std::size_t offset, httplib::DataSink &sink);
+                                     const TOllamaProxyConfig &proxyConfig,
+                                     CModelFallback &modelFallback,
+                                     CTraceExporter::TTracePtr trace = nullptr);
+
+    /// @brief Serves chat which is parsed already, like the turn of the session.
+    /// @param hasAiCommands chat has the system message with backend commands already.
+    explicit CChunkedContentProvider(const httplib::Request &userRequest,
+                                     nlohmann::json userJson, bool hasAiCommands,
+                                     const TOllamaProxyConfig &proxyConfig,
+                                     CModelFallback &modelFallback,
+                                     CTraceExporter::TTracePtr trace = nullptr);
+
+    /// @brief What generation is doing now.
+    enum class EStreamState : std::uint8_t {
+        Created,
+        WaitingOllama,
+        Streaming,
+        /// @brief CContentRestorator holds text back while checking it for commands.
+        Buffering,
+        ExecutingCommand,
+        /// @brief Command takes long, the user is pinged meanwhile.
+        Pinging,
+        Finished,
+    };
+
+    /// @brief Snapshot of the stream for the introspection.
+    struct TStreamInfo
+    {
+        std::uint64_t id;
+        std::string model;
+        EStreamState state;
+        std::chrono::milliseconds age;
+        std::chrono::milliseconds idle;
+        std::size_t bytesProduced;
+        std::size_t bytesWritten;
+        std::size_t subscribers;
+    };
+
+    /// @brief Single user reading the generation. Many users can read the same generation, each
+    /// one with own cursor.
+    class CSubscription
+    {
+      public:
+        NO_COPYMOVE(CSubscription);
+        CSubscription() = delete;
+        ~CSubscription();
+        /// @param readCursor index of the first line to send, it is above 0 if user resumes.
+        /// @param trace spans of this user's request, it differs from the generation's one if the
+        /// user joined the coalesced chat. nullptr if the request is not traced.
+        explicit CSubscription(std::shared_ptr<CChunkedContentProvider> provider,
+                               std::size_t readCursor = 0,
+                               CTraceExporter::TTracePtr trace = nullptr);
+
+        /// @brief Writes to the user everything generated since the previous call.
+        bool operator()(httplib::DataSink &sink);
+
+      private:
+        std::shared_ptr<CChunkedContentProvider> provider;
+        std::size_t readCursor{0};
+        CTraceExporter::TTracePtr trace;
+    };
+
+    /// @brief Called once generation is completed with all lines sent to the user. It is not called
+    /// if generation failed, was cancelled or executed backend commands.
+    using TOnCompleted = std::function<void(std::vector<std::string> linesSentToUser)>;
+
+    /// @brief Called once generation is over, even if it failed or was cancelled, with resources
+    /// spent on it.
+    using TOnUsage = std::function<void(const TTokenUsage &usage)>;
+
+    /// @brief Called when the last user left without reading the stream to the end, so the stream
+    /// can be kept for the user to resume it.
+    using TOnAbandoned = std::function<void(std::shared_ptr<CChunkedContentProvider> provider)>;
+
+    /// @brief Called once the answer is given to the user, even if backend commands were executed,
+    /// with the messages of the last Ollama call followed by the answer.
+    using TOnTurnCompleted = std::function<void(nlohmann::json messages)>;
+
+    /// @brief Starts generation. Nothing is sent to Ollama until it is called.
+    void Start();
+
+    /// @brief Sets callback for the completed generation. Must be called before Start().
+    void SetOnCompleted(TOnCompleted callback);
+
+    /// @brief Sets callback for the usage report. Must be called before Start().
+    void SetOnUsage(TOnUsage callback);
+
+    /// @brief Records upstream streams of this chat. Must be called before Start().
+    /// @param capture must outlive the generation, nullptr disables recording.
+    void SetCapture(CStreamCapture *capture);
+
+    /// @brief Executes backend commands in the critical lane and writes captures in the background
+    /// lane of the pool. Must be called before Start().
+    /// @param executor must outlive the generation, nullptr executes all on the generation thread.
+    void SetExecutor(utility::CThreadPool *executor);
+
+    /// @brief Drives heartbeats, stall and idle detection and the deadline of the stream. Must be
+    /// called before Start().
+    /// @param timerWheel must outlive the generation, nullptr disables the stream timers.
+    void SetTimerWheel(utility::CTimerWheel *timerWheel);
+
+    /// @brief Sets callback for the abandoned stream. Must be called before Start().
+    void SetOnAbandoned(TOnAbandoned callback);
+
+    /// @brief Sets callback for the answered turn of the session. Must be called before Start().
+    void SetOnTurnCompleted(TOnTurnCompleted callback);
+
+    /// @returns true if lines starting from the offset are kept, so user can resume from it.
+    [[nodiscard]]
+    bool CanResumeFrom(std::size_t offset) const;
+
+    /// @brief Sets the deadline asked by the user, generation is aborted once it passes. It is
+    /// enforced by the timer wheel. Must be called before Start().
+    void SetDeadline(std::chrono::steady_clock::time_point deadline);
+
+    /// @returns false if user asked for the single response with "stream": false.
+    [[nodiscard]]
+    bool IsStreamedToUser() const;
+
+    /// @brief Waits until generation is over, for the user who asked for the single response.
+    /// Ollama is still streamed internally, so backend commands are executed. Can be called once.
+    /// @param isUserGone polled while waiting, generation is cancelled once it returns true.
+    /// @returns Response in the shape of Ollama's non-streaming one, with statistics summed over
+    /// all round trips. std::nullopt if generation failed or was cancelled.
+    [[nodiscard]]
+    std::optional<std::string> WaitAggregated(const std::function<bool()> &isUserGone);
+
+    /// @brief Writes single line to the user in the same format as generated lines are written.
+    static void WriteLineToUser(const std::string &line, httplib::DataSink &sink);
+
+    /// @brief Writes to the user everything generated after the cursor. Many users can subscribe to
+    /// the same generation, each one with own cursor.
+    /// @param readCursor index of the next line to send to this user, it is advanced.
+    /// @param userTrace gets spans of the writes, nullptr if the user's request is not traced.
+    bool operator()(std::size_t &readCursor, httplib::DataSink &sink,
+                    const CTraceExporter::TTracePtr &userTrace);
+
+    /// @returns Canonical form of the deterministic request sent to Ollama, std::nullopt if output
+    /// of this chat can differ between runs.
+    [[nodiscard]]
+    const std::optional<std::string> &GetCanonicalRequest() const;
+
+    /// @returns true while generation can produce more data.
+    [[nodiscard]]
+    bool IsInFlight() const;
+
+    /// @returns Model which actually serves this chat, it can be fallback of the requested one.
+    [[nodiscard]]
+    const std::string &GetModel() const;
+
+    /// @returns Id of the stream unique within the process.
+    [[nodiscard]]
+    std::uint64_t GetStreamId() const;
+
+    /// @returns Unguessable token which the user must present to resume the stream, the id alone
+    /// is sequential.
+    [[nodiscard]]
+    const std::string &GetResumeToken() const;
+
+    [[nodiscard]]
+    TStreamInfo GetInfo() const;
+
+    /// @brief Stops generation and ends streams of all users, the Ollama call is aborted at once.
+    void Cancel();
+
+    [[nodiscard]]
+    static const char *ToString(EStreamState state);
+
+    /// @returns A new ollama::request chat object with the user's JSON data.
+    [[nodiscard]]
+    static ollama::request CreateChatRequest(const nlohmann::json &userJson);
+
+    /// @brief Inserts system message with the backend commands after the leading system messages.
+    static void MakeCommandsAvailForAi(nlohmann::json &userJson, const TAiCommands &aiCommands);
 
   private:
     using TCommandResutl = std::variant<ollama::request, std::string>;
 
     struct TUserRequest
     {
-        explicit TUserRequest(const httplib::Request &request);
+        explicit TUserRequest(const httplib::Request &request, nlohmann::json parsed);
 
         std::reference_wrapper<const httplib::Request> userRequest;
         nlohmann::json parsedUserJson;
     };
 
+    // Counters updated on the hot path, so only relaxed atomics.
+    struct TStreamStatus
+    {
+        std::atomic<EStreamState> state{EStreamState::Created};
+        std::atomic<std::int64_t> lastActivityUs{0};
+        std::atomic<std::int64_t> lastFromOllamaUs{0};
+        std::atomic<std::int64_t> lastWrittenUs{0};
+        std::atomic<std::size_t> bytesProduced{0};
+        std::atomic<std::size_t> bytesWritten{0};
+        std::atomic<std::size_t> subscribers{0};
+
+        void SetState(EStreamState newState)
+        {
+            state.store(newState, std::memory_order_relaxed);
+        }
+
+        void Touch();
+
+        /// @returns Probe of the stream watchdog, times are not before the stream was created.
+        [[nodiscard]]
+        CStreamWatchdog::TProbe MakeProbe(std::chrono::steady_clock::time_point createdAt) const;
+    };
+
     class TCommObject
     {
       public:
-        TCommObject();
+        /// @param replayLines how many latest lines are kept for the users resuming the stream, 0
+        /// keeps all. Lines which subscribers did not read yet are kept anyway.
+        explicit TCommObject(std::size_t replayLines);
 
         // Used by Ollama thread.
         void SendToUser(std::string what) const;
         void SendToUser(const ollama::response &ollamaResponse) const;
+        /// @brief Sends line which is not the part of the answer, like progress pings or
+        /// keep-alive. Such lines are streamed, but not cached and not aggregated.
+        void SendPingToUser(std::string what) const;
+
+        [[nodiscard]]
+        TStreamStatus &GetStatus() const
+        {
+            return *status;
+        }
 
         void DisconnectAll() const;
         [[nodiscard]]
         bool IsDisconnected() const;
 
+        /// @brief Callback is called by DisconnectAll(), or at once if it was called already. It
+        /// replaces the previous one, nullptr removes it.
+        void SetOnDisconnect(std::function<void()> callback) const;
+
+        /// @brief Lines after the reader's cursor are kept until it reads them, see
+        /// FanOutBuffer::attach().
+        void AttachReader(const std::size_t &readCursor) const;
+        void DetachReader(const std::size_t &readCursor) const;
+
+        [[nodiscard]]
+        std::optional<std::string> GetStringForUser(std::size_t &readCursor) const;
+
+        /// @returns true if generation is over and the reader got everything.
+        [[nodiscard]]
+        bool IsDrained(std::size_t readCursor) const;
+
+        /// @returns true if lines starting from the cursor are kept.
+        [[nodiscard]]
+        bool CanReplayFrom(std::size_t readCursor) const;
+
+        /// @returns Lines of the answer which are kept, all of them if CanReplayFrom(0). Pings are
+        /// skipped.
         [[nodiscard]]
-        std::optional<std::string> GetStringForUser() const;
+        std::vector<std::string> GetAllSentToUser() const;
 
       private:
-        using TQueue = SafeQueue<std::string>;
-        std::unique_ptr<TQueue> ollamaToUser;
+        struct TDisconnectHook
+        {
+            std::mutex mutex;
+            std::function<void()> callback;
+        };
+
+        struct TLine
+        {
+            std::string text;
+            bool isPing{false};
+        };
+
+        void Push(TLine line) const;
+
+        using TBuffer = FanOutBuffer<TLine>;
+        std::unique_ptr<TBuffer> ollamaToUser;
         std::unique_ptr<std::atomic<bool>> disconnectAll;
+        std::unique_ptr<TStreamStatus> status;
+        std::unique_ptr<TDisconnectHook> onDisconnect;
     };
 
     class CPinger
@@ -75,32 +334,38 @@ class CChunkedContentProvider
             Finish();
         }
 
+        // Commands ping from the executor threads, so all is under the lock.
         template <typename... taAny>
         void Ping(taAny &&...any) const
         {
+            const std::lock_guard lock(mutex);
             if (ping)
             {
-                comm.SendToUser(ping->GeneratePingResponse(std::forward<taAny>(any)...));
+                comm.GetStatus().SetState(EStreamState::Pinging);
+                comm.SendPingToUser(ping->GeneratePingResponse(std::forward<taAny>(any)...));
             }
         }
 
         template <typename... taAny>
         void Finish(taAny &&...any)
         {
+            const std::lock_guard lock(mutex);
             if (ping)
             {
-                comm.SendToUser(ping->FinishPingsIfAny(std::forward<taAny>(any)...));
+                comm.SendPingToUser(ping->FinishPingsIfAny(std::forward<taAny>(any)...));
             }
             ping = std::nullopt;
         }
 
         void Restart(std::string model)
         {
+            const std::lock_guard lock(mutex);
             ping.emplace(std::move(model));
         }
 
       private:
         const TCommObject &comm;
+        mutable std::mutex mutex;
         std::optional<CUserPingGenerator> ping;
     };
 
@@ -109,11 +374,21 @@ class CChunkedContentProvider
     TCommandResutl MakeResponseForOllama(CContentRestorator::TDetected aiCommand,
                                          const CPinger &pingUser) const;
     ollama::request MakeResponseForOllama(std::string plainText) const;
-    void MakeCommandsAvailForAi();
+    void SelectModel(CModelFallback &modelFallback);
+    /// @brief Accounts Ollama call aborted by the leaving user or the deadline.
+    void OnUpstreamAborted(const CUpstreamChat &upstreamChat) const;
+    /// @brief Callables are invoked only if message is logged, so costly values can be deferred.
     template <typename taAny>
     static auto DebugConvert(taAny anything)
     {
-        return std::forward<taAny>(anything);
+        if constexpr (std::is_invocable_v<taAny>)
+        {
+            return anything();
+        }
+        else
+        {
+            return std::forward<taAny>(anything);
+        }
     }
 
     static auto DebugConvert(const ollama::response &anything)
@@ -129,7 +404,7 @@ class CChunkedContentProvider
     template <typename... taAny>
     void DebugDump(taAny &&...anything) const
     {
-        proxyConfig.get().ExecIfFittingVerbosity(EOllamaProxyVerbosity::Debug, [&](auto &os) {
+        proxyConfig.get().ExecIfFittingVerbosity<EOllamaProxyVerbosity::Debug>([&](auto &os) {
             os << "[DEBUG] ";
             ((os << DebugConvert(std::forward<taAny>(anything))), ...);
             os << std::endl;
@@ -139,6 +414,24 @@ class CChunkedContentProvider
   private:
     TUserRequest userRequest;
     TCommObject commObject;
+    std::uint64_t streamId;
+    std::string resumeToken;
+    std::chrono::steady_clock::time_point createdAt;
     std::reference_wrapper<const TOllamaProxyConfig> proxyConfig;
+    CModelFallback::TTicketPtr modelTicket;
+    std::optional<std::string> canonicalRequest;
+    CTraceExporter::TTracePtr trace;
+    TOnCompleted onCompleted;
+    TOnUsage onUsage;
+    TOnAbandoned onAbandoned;
+    TOnTurnCompleted onTurnCompleted;
+    CStreamCapture *capture;
+    utility::CThreadPool *executor;
+    utility::CTimerWheel *timerWheel;
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    bool isStreamedToUser;
+    std::promise<std::optional<std::string>> aggregated;
+    // Coalesced users can try to start the same generation concurrently.
+    std::unique_ptr<std::once_flag> startOnce;
     std::shared_ptr<std::thread> ollamaThread;
 };
@@ -0,0 +1,210 @@
+#include "embed_batcher.hpp" // IWYU pragma: keep
+
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+constexpr auto kInputKey = "input";
+constexpr auto kEmbeddingsKey = "embeddings";
+
+/// @returns Single input of the request, std::nullopt if there are many or none.
+std::optional<std::string> GetSingleInput(const nlohmann::json &request)
+{
+    if (!request.contains(kInputKey))
+    {
+        return std::nullopt;
+    }
+    const auto &input = request[kInputKey];
+    if (input.is_string())
+    {
+        return input.get<std::string>();
+    }
+    if (input.is_array() && input.size() == 1 && input[0].is_string())
+    {
+        return input[0].get<std::string>();
+    }
+    return std::nullopt;
+}
+
+CEmbedBatcher::TReply MakeError(int status, const std::string &message)
+{
+    nlohmann::json js;
+    js["error"] = message;
+    return {status, js.dump()};
+}
+} // namespace
+
+CEmbedBatcher::CEmbedBatcher(const TEmbedBatchConfig &config, TUpstream upstream) :
+    config(config),
+    upstream(std::move(upstream)),
+    // Batches already taken from the queue are sent, so their waiters get replies.
+    upstreamPool(config.maxBatchSize > 1 ? config.maxConcurrentBatches : 0,
+                 utility::EShutdownMode::Drain)
+{
+    if (IsEnabled())
+    {
+        dispatcher = std::thread([this]() {
+            DispatchLoop();
+        });
+    }
+}
+
+CEmbedBatcher::~CEmbedBatcher()
+{
+    {
+        const std::lock_guard lock(mutex);
+        isStopping = true;
+    }
+    wakeUp.notify_all();
+    if (dispatcher.joinable())
+    {
+        dispatcher.join();
+    }
+}
+
+bool CEmbedBatcher::IsEnabled() const
+{
+    return config.maxBatchSize > 1 && config.maxConcurrentBatches > 0;
+}
+
+std::optional<std::future<CEmbedBatcher::TReply>>
+CEmbedBatcher::Submit(const nlohmann::json &request)
+{
+    if (!IsEnabled() || !request.is_object())
+    {
+        return std::nullopt;
+    }
+    auto input = GetSingleInput(request);
+    if (!input)
+    {
+        return std::nullopt;
+    }
+
+    auto params = request;
+    params.erase(kInputKey);
+    auto key = params.dump();
+
+    TPending pending{std::move(*input), {}};
+    auto future = pending.reply.get_future();
+    {
+        const std::lock_guard lock(mutex);
+        if (isStopping)
+        {
+            return std::nullopt;
+        }
+        auto &batch = batches[std::move(key)];
+        if (batch.pending.empty())
+        {
+            batch.params = std::move(params);
+            batch.deadline = std::chrono::steady_clock::now() + config.maxWait;
+        }
+        batch.pending.emplace_back(std::move(pending));
+        pendingInputsCount.fetch_add(1, std::memory_order_relaxed);
+    }
+    wakeUp.notify_one();
+    return future;
+}
+
+void CEmbedBatcher::DispatchLoop()
+{
+    std::unique_lock lock(mutex);
+    while (!isStopping)
+    {
+        auto nextDeadline = std::chrono::steady_clock::time_point::max();
+        const auto now = std::chrono::steady_clock::now();
+        for (auto it = batches.begin(); it != batches.end();)
+        {
+            auto &batch = it->second;
+            if (batch.pending.size() < config.maxBatchSize && batch.deadline > now)
+            {
+                nextDeadline = std::min(nextDeadline, batch.deadline);
+                ++it;
+                continue;
+            }
+            auto ready = std::make_shared<TBatch>(std::move(batch));
+            it = batches.erase(it);
+            pendingInputsCount.fetch_sub(ready->pending.size(), std::memory_order_relaxed);
+            upstreamPool.enqueue([this, ready = std::move(ready)](const auto &) {
+                Execute(*ready);
+            });
+        }
+        // Size limit is checked on each Submit() wake up.
+        if (batches.empty())
+        {
+            wakeUp.wait(lock);
+            continue;
+        }
+        wakeUp.wait_until(lock, nextDeadline);
+    }
+
+    // Nobody will flush remaining ones.
+    for (auto &[key, batch] : batches)
+    {
+        for (auto &pending : batch.pending)
+        {
+            pending.reply.set_value(MakeError(503, "Proxy is stopping."));
+        }
+    }
+    batches.clear();
+    pendingInputsCount.store(0, std::memory_order_relaxed);
+}
+
+void CEmbedBatcher::Execute(TBatch &batch)
+{
+    auto request = std::move(batch.params);
+    auto &inputs = request[kInputKey];
+    inputs = nlohmann::json::array();
+    for (const auto &pending : batch.pending)
+    {
+        inputs.push_back(pending.input);
+    }
+    batchesCount.fetch_add(1, std::memory_order_relaxed);
+    batchedInputsCount.fetch_add(batch.pending.size(), std::memory_order_relaxed);
+
+    const auto replyToAll = [&batch](const TReply &reply) {
+        for (auto &pending : batch.pending)
+        {
+            pending.reply.set_value(reply);
+        }
+    };
+
+    try
+    {
+        const auto reply = upstream(request.dump());
+        if (reply.status != 200)
+        {
+            replyToAll(reply);
+            return;
+        }
+
+        auto parsed = nlohmann::json::parse(reply.body);
+        auto embeddings = std::move(parsed[kEmbeddingsKey]);
+        if (!embeddings.is_array() || embeddings.size() != batch.pending.size())
+        {
+            replyToAll(MakeError(502, "Unexpected embeddings count from Ollama."));
+            return;
+        }
+        // Durations and counters are shared by the batch, each caller gets them as is.
+        for (std::size_t i = 0; i < batch.pending.size(); ++i)
+        {
+            parsed[kEmbeddingsKey] = nlohmann::json::array({std::move(embeddings[i])});
+            batch.pending[i].reply.set_value({reply.status, parsed.dump()});
+        }
+    }
+    catch (std::exception &e)
+    {
+        replyToAll(MakeError(502, std::string("Batched embedding failed: ") + e.what()));
+    }
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <common/threads_pool.hpp>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Coalesces concurrent single-input /api/embed requests for the same model into one
+/// upstream call and splits returned vectors back to each caller.
+class CEmbedBatcher
+{
+  public:
+    /// @brief Reply of the upstream or of the batcher to the single caller.
+    struct TReply
+    {
+        int status;
+        std::string body;
+    };
+
+    /// @brief Sends /api/embed request body to Ollama and returns its reply.
+    using TUpstream = std::function<TReply(const std::string &requestBody)>;
+
+    NO_COPYMOVE(CEmbedBatcher);
+    CEmbedBatcher() = delete;
+    ~CEmbedBatcher();
+    CEmbedBatcher(const TEmbedBatchConfig &config, TUpstream upstream);
+
+    /// @brief Queues single-input request to the batch.
+    /// @returns std::nullopt if request cannot be batched, it must be proxied as is then.
+    [[nodiscard]]
+    std::optional<std::future<TReply>> Submit(const nlohmann::json &request);
+
+    /// @returns Number of upstream calls made.
+    [[nodiscard]]
+    std::size_t GetBatchesCount() const
+    {
+        return batchesCount.load(std::memory_order_relaxed);
+    }
+
+    /// @returns Number of inputs sent upstream within batches.
+    [[nodiscard]]
+    std::size_t GetBatchedInputsCount() const
+    {
+        return batchedInputsCount.load(std::memory_order_relaxed);
+    }
+
+    /// @returns Number of inputs waiting for their batch to be flushed.
+    [[nodiscard]]
+    std::size_t GetPendingInputsCount() const
+    {
+        return pendingInputsCount.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct TPending
+    {
+        std::string input;
+        std::promise<TReply> reply;
+    };
+
+    struct TBatch
+    {
+        // Request without "input", the same for all pending ones.
+        nlohmann::json params;
+        std::vector<TPending> pending;
+        std::chrono::steady_clock::time_point deadline;
+    };
+
+    [[nodiscard]]
+    bool IsEnabled() const;
+    void DispatchLoop();
+    void Execute(TBatch &batch);
+
+    const TEmbedBatchConfig &config;
+    TUpstream upstream;
+
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    // Key is model and all other parameters except input.
+    std::unordered_map<std::string, TBatch> batches;
+    bool isStopping{false};
+
+    std::atomic<std::size_t> batchesCount{0};
+    std::atomic<std::size_t> batchedInputsCount{0};
+    std::atomic<std::size_t> pendingInputsCount{0};
+
+    // Upstream calls are made by pool, so slow one does not delay next batches.
+    utility::CThreadPool upstreamPool;
+    std::thread dispatcher;
+};
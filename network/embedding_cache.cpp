@@ -0,0 +1,295 @@
+#include "embedding_cache.hpp" // IWYU pragma: keep
+
+#include <network/ollama_proxy_config.hpp>
+#include <network/request_key.hpp>
+#include <ollama/json.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+
+// Slots live in the mapped file, hash is published by atomic store after the rest is set. Other
+// fields are atomic too, as the slot can be reused after clearing while the reader looks at it.
+struct CEmbeddingCache::TSlot
+{
+    std::atomic<std::uint64_t> hash;
+    std::atomic<std::uint64_t> offset;
+    std::atomic<std::uint64_t> keyLength;
+    std::atomic<std::uint64_t> dimensions;
+};
+
+namespace {
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+              "Lock-free readers need lock-free atomics in the shared memory.");
+
+// Store layout: header, slots table, records data.
+// Header: magic, slots count, data capacity (bytes), data used (bytes), used slots, epoch.
+// Record: key bytes followed by the float32 values of the vector.
+constexpr char kMagic[8] = {'O', 'M', 'I', 'T', 'M', 'E', 'C', '2'};
+constexpr std::size_t kSlotsCountOffset = 8;
+constexpr std::size_t kDataCapacityOffset = 16;
+constexpr std::size_t kDataUsedOffset = 24;
+constexpr std::size_t kUsedSlotsOffset = 32;
+// Odd epoch means the store is being cleared, each clearing advances it by 2.
+constexpr std::size_t kEpochOffset = 40;
+constexpr std::size_t kHeaderSize = 64;
+// Table is never filled more than this, so probing stays short.
+constexpr std::size_t kMaxLoadPercent = 75;
+// 0 marks empty slot.
+constexpr std::uint64_t kEmptyHash = 0;
+
+std::size_t RoundUpToPowerOf2(std::size_t value)
+{
+    std::size_t result = 1;
+    while (result < value)
+    {
+        result <<= 1u;
+    }
+    return result;
+}
+
+std::uint64_t HashKey(const std::string &key)
+{
+    const auto hash = HashFnv1a(key);
+    return hash == kEmptyHash ? hash + 1 : hash;
+}
+} // namespace
+
+CEmbeddingCache::CEmbeddingCache(const TEmbeddingCacheConfig &config) :
+    config(config),
+    slotsCount(RoundUpToPowerOf2(std::max<std::size_t>(config.maxVectors, 16)))
+{
+    if (config.path.empty())
+    {
+        return;
+    }
+
+    fd = ::open(config.path.c_str(), O_RDWR | O_CREAT, 0644); // NOLINT
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open embedding cache store " + config.path);
+    }
+
+    char header[kHeaderSize] = {};
+    std::uint64_t storedSlots{0};
+    std::uint64_t storedCapacity{0};
+    std::uint64_t storedEpoch{0};
+    const bool hasHeader = ::pread(fd, header, kHeaderSize, 0) == static_cast<ssize_t>(kHeaderSize);
+    std::memcpy(&storedSlots, header + kSlotsCountOffset, sizeof(storedSlots));
+    std::memcpy(&storedCapacity, header + kDataCapacityOffset, sizeof(storedCapacity));
+    std::memcpy(&storedEpoch, header + kEpochOffset, sizeof(storedEpoch));
+    // Store left in the middle of clearing by crash is started anew.
+    const bool isValid = hasHeader && std::equal(std::begin(kMagic), std::end(kMagic), header)
+                         && storedSlots == slotsCount && storedCapacity == config.maxBytes
+                         && storedEpoch % 2 == 0;
+
+    if ((!isValid && ::ftruncate(fd, 0) != 0)
+        || ::ftruncate(fd, static_cast<off_t>(MappedSize())) != 0)
+    {
+        Close();
+        throw std::runtime_error("Failed to resize embedding cache store " + config.path);
+    }
+    void *ptr = ::mmap(nullptr, MappedSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) // NOLINT
+    {
+        Close();
+        throw std::runtime_error("Failed to mmap embedding cache store " + config.path);
+    }
+    mapped = static_cast<char *>(ptr);
+
+    if (!isValid)
+    {
+        // Fresh file is zero filled, so all slots are empty already.
+        std::memcpy(mapped, kMagic, sizeof(kMagic));
+        const std::uint64_t capacity = config.maxBytes;
+        const std::uint64_t slots = slotsCount;
+        std::memcpy(mapped + kSlotsCountOffset, &slots, sizeof(slots));
+        std::memcpy(mapped + kDataCapacityOffset, &capacity, sizeof(capacity));
+    }
+}
+
+CEmbeddingCache::~CEmbeddingCache()
+{
+    Close();
+}
+
+void CEmbeddingCache::Close()
+{
+    if (mapped != nullptr)
+    {
+        ::munmap(mapped, MappedSize());
+        mapped = nullptr;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+std::size_t CEmbeddingCache::MappedSize() const
+{
+    return kHeaderSize + slotsCount * sizeof(TSlot) + config.maxBytes;
+}
+
+CEmbeddingCache::TSlot *CEmbeddingCache::Slots() const
+{
+    return reinterpret_cast<TSlot *>(mapped + kHeaderSize); // NOLINT
+}
+
+char *CEmbeddingCache::Data() const
+{
+    return mapped + kHeaderSize + slotsCount * sizeof(TSlot);
+}
+
+std::atomic<std::uint64_t> &CEmbeddingCache::Epoch() const
+{
+    return *reinterpret_cast<std::atomic<std::uint64_t> *>(mapped + kEpochOffset); // NOLINT
+}
+
+std::string CEmbeddingCache::MakeKey(std::string_view route, const nlohmann::json &params,
+                                     std::string_view input)
+{
+    std::string composed(route);
+    composed += '\0';
+    composed += params.dump();
+    composed += '\0';
+    composed += input;
+    return composed;
+}
+
+std::optional<CEmbeddingCache::TVector> CEmbeddingCache::Lookup(const std::string &key) const
+{
+    if (!IsEnabled())
+    {
+        return std::nullopt;
+    }
+
+    // Seqlock: result is valid only if the store was not cleared while it was read.
+    const auto &epoch = Epoch();
+    const auto before = epoch.load(std::memory_order_acquire);
+    auto found = before % 2 == 0 ? Find(HashKey(key), key) : std::nullopt;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (!found || epoch.load(std::memory_order_relaxed) != before)
+    {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+    hits.fetch_add(1, std::memory_order_relaxed);
+    return found;
+}
+
+std::optional<CEmbeddingCache::TVector> CEmbeddingCache::Find(std::uint64_t hash,
+                                                              const std::string &key) const
+{
+    const auto mask = slotsCount - 1;
+    for (std::size_t i = hash & mask, probes = 0; probes < slotsCount; i = (i + 1) & mask, ++probes)
+    {
+        const auto &slot = Slots()[i];
+        const auto slotHash = slot.hash.load(std::memory_order_acquire);
+        if (slotHash == kEmptyHash)
+        {
+            break;
+        }
+        if (slotHash != hash)
+        {
+            continue;
+        }
+        const auto offset = slot.offset.load(std::memory_order_relaxed);
+        const auto keyLength = slot.keyLength.load(std::memory_order_relaxed);
+        const auto dimensions = slot.dimensions.load(std::memory_order_relaxed);
+        // Fields can be mixed from the old and reused slot, such result is discarded by the epoch.
+        if (keyLength != key.size() || offset > config.maxBytes
+            || dimensions > (config.maxBytes - offset - keyLength) / sizeof(float))
+        {
+            continue;
+        }
+        const char *record = Data() + offset;
+        if (std::memcmp(record, key.data(), keyLength) != 0)
+        {
+            continue;
+        }
+        TVector vector(dimensions);
+        std::memcpy(vector.data(), record + keyLength, dimensions * sizeof(float));
+        return vector;
+    }
+    return std::nullopt;
+}
+
+void CEmbeddingCache::Clear()
+{
+    auto &epoch = Epoch();
+    const auto current = epoch.load(std::memory_order_relaxed);
+    epoch.store(current + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < slotsCount; ++i)
+    {
+        Slots()[i].hash.store(kEmptyHash, std::memory_order_relaxed);
+    }
+    *reinterpret_cast<std::uint64_t *>(mapped + kDataUsedOffset) = 0;  // NOLINT
+    *reinterpret_cast<std::uint64_t *>(mapped + kUsedSlotsOffset) = 0; // NOLINT
+    epoch.store(current + 2, std::memory_order_release);
+    clears.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CEmbeddingCache::Store(const std::string &key, const TVector &vector)
+{
+    const auto size = key.size() + vector.size() * sizeof(float);
+    if (!IsEnabled() || vector.empty() || size > config.maxBytes)
+    {
+        return;
+    }
+
+    const auto hash = HashKey(key);
+    const std::lock_guard lock(writerMutex);
+    auto *dataUsed = reinterpret_cast<std::uint64_t *>(mapped + kDataUsedOffset);   // NOLINT
+    auto *usedSlots = reinterpret_cast<std::uint64_t *>(mapped + kUsedSlotsOffset); // NOLINT
+    if (*usedSlots * 100 >= slotsCount * kMaxLoadPercent || *dataUsed + size > config.maxBytes)
+    {
+        Clear();
+    }
+
+    const auto mask = slotsCount - 1;
+    auto i = hash & mask;
+    for (;; i = (i + 1) & mask)
+    {
+        const auto &slot = Slots()[i];
+        const auto slotHash = slot.hash.load(std::memory_order_relaxed);
+        if (slotHash == kEmptyHash)
+        {
+            break;
+        }
+        // Only this writer changes slots, so the key is compared without the epoch.
+        if (slotHash == hash && slot.keyLength.load(std::memory_order_relaxed) == key.size()
+            && std::memcmp(Data() + slot.offset.load(std::memory_order_relaxed), key.data(),
+                           key.size())
+                 == 0)
+        {
+            return;
+        }
+    }
+
+    const auto offset = *dataUsed;
+    std::memcpy(Data() + offset, key.data(), key.size());
+    std::memcpy(Data() + offset + key.size(), vector.data(), vector.size() * sizeof(float));
+    // Data is reserved before it becomes visible, so crash cannot make it reused.
+    *dataUsed = offset + size;
+    ++*usedSlots;
+
+    auto &slot = Slots()[i];
+    slot.offset.store(offset, std::memory_order_relaxed);
+    slot.keyLength.store(key.size(), std::memory_order_relaxed);
+    slot.dimensions.store(vector.size(), std::memory_order_relaxed);
+    slot.hash.store(hash, std::memory_order_release);
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/// @brief Persistent content-addressed cache of the embedding vectors. Each vector is stored with
+/// its key in the memory-mapped file with open addressing hash table in front of them. Lookups do
+/// not take any locks, inserts are serialized. When store is full, it is cleared and filled anew,
+/// lookups which overlap the clearing miss.
+class CEmbeddingCache
+{
+  public:
+    using TVector = std::vector<float>;
+
+    NO_COPYMOVE(CEmbeddingCache);
+    CEmbeddingCache() = delete;
+    ~CEmbeddingCache();
+
+    /// @brief Opens or creates the store. Cache is disabled if config has empty path.
+    /// @throws std::runtime_error if store cannot be opened.
+    explicit CEmbeddingCache(const TEmbeddingCacheConfig &config);
+
+    /// @param route endpoint, different endpoints return differently normalized vectors.
+    /// @param params request without inputs, it includes model and options.
+    /// @param input single text to embed.
+    /// @returns Key of the vector. Key is stored with the vector and compared on lookup, its hash
+    /// only finds the slot.
+    [[nodiscard]]
+    static std::string MakeKey(std::string_view route, const nlohmann::json &params,
+                               std::string_view input);
+
+    [[nodiscard]]
+    bool IsEnabled() const
+    {
+        return mapped != nullptr;
+    }
+
+    /// @brief Lock-free lookup.
+    /// @returns Stored vector, std::nullopt on miss.
+    [[nodiscard]]
+    std::optional<TVector> Lookup(const std::string &key) const;
+
+    /// @brief Stores vector unless it is stored already. Full store is cleared first.
+    void Store(const std::string &key, const TVector &vector);
+
+    [[nodiscard]]
+    std::size_t GetHits() const
+    {
+        return hits.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]]
+    std::size_t GetMisses() const
+    {
+        return misses.load(std::memory_order_relaxed);
+    }
+
+    /// @returns How many times full store was cleared.
+    [[nodiscard]]
+    std::size_t GetClears() const
+    {
+        return clears.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct TSlot;
+
+    /// @returns Vector stored for the key, std::nullopt if there is none or slot is being reused.
+    [[nodiscard]]
+    std::optional<TVector> Find(std::uint64_t hash, const std::string &key) const;
+    /// @brief Drops all vectors. Lookups started before it is done are discarded by the epoch.
+    void Clear();
+    [[nodiscard]]
+    TSlot *Slots() const;
+    [[nodiscard]]
+    char *Data() const;
+    [[nodiscard]]
+    std::atomic<std::uint64_t> &Epoch() const;
+    [[nodiscard]]
+    std::size_t MappedSize() const;
+    void Close();
+
+    const TEmbeddingCacheConfig &config;
+    std::size_t slotsCount{0};
+    int fd{-1};
+    char *mapped{nullptr};
+    std::mutex writerMutex;
+
+    mutable std::atomic<std::size_t> hits{0};
+    mutable std::atomic<std::size_t> misses{0};
+    std::atomic<std::size_t> clears{0};
+};
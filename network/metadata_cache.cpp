@@ -0,0 +1,126 @@
+#include "metadata_cache.hpp" // IWYU pragma: keep
+
+#include <network/ollama_proxy_config.hpp>
+#include <network/request_key.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace {
+// Requests for the different /api/show bodies could grow cache without limit.
+constexpr std::size_t kMaxEntries = 1024;
+
+std::string_view Trim(std::string_view str)
+{
+    const auto begin = str.find_first_not_of(" \t");
+    if (begin == std::string_view::npos)
+    {
+        return {};
+    }
+    const auto end = str.find_last_not_of(" \t");
+    return str.substr(begin, end - begin + 1);
+}
+} // namespace
+
+CMetadataCache::CMetadataCache(const TMetadataCacheConfig &config) :
+    config(config)
+{
+}
+
+std::chrono::milliseconds CMetadataCache::GetTtl(const std::string &path) const
+{
+    const auto it = config.ttlPerPath.find(path);
+    return it == config.ttlPerPath.end() ? std::chrono::milliseconds{0} : it->second;
+}
+
+bool CMetadataCache::IsInvalidatingPath(const std::string &path)
+{
+    return path == "/api/pull" || path == "/api/create" || path == "/api/copy"
+           || path == "/api/delete";
+}
+
+CMetadataCache::TResponsePtr CMetadataCache::Lookup(const std::string &key) const
+{
+    {
+        const std::shared_lock lock(mutex);
+        const auto it = entries.find(key);
+        if (it != entries.end() && it->second.expiresAt > std::chrono::steady_clock::now())
+        {
+            hits.fetch_add(1, std::memory_order_relaxed);
+            return it->second.response;
+        }
+    }
+    misses.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+CMetadataCache::TResponsePtr CMetadataCache::Store(const std::string &key,
+                                                   std::chrono::milliseconds ttl, int status,
+                                                   std::string body, std::string contentType)
+{
+    auto etag = MakeETag(body);
+    auto response = std::make_shared<const TResponse>(
+      TResponse{status, std::move(body), std::move(contentType), std::move(etag)});
+    const auto now = std::chrono::steady_clock::now();
+
+    const std::unique_lock lock(mutex);
+    if (entries.size() >= kMaxEntries)
+    {
+        for (auto it = entries.begin(); it != entries.end();)
+        {
+            it = it->second.expiresAt <= now ? entries.erase(it) : std::next(it);
+        }
+        if (entries.size() >= kMaxEntries)
+        {
+            entries.clear();
+        }
+    }
+    entries[key] = TEntry{response, now + ttl};
+    return response;
+}
+
+void CMetadataCache::Invalidate()
+{
+    const std::unique_lock lock(mutex);
+    entries.clear();
+}
+
+std::string CMetadataCache::MakeETag(std::string_view body)
+{
+    char buffer[24] = {};
+    std::snprintf(buffer, sizeof(buffer), "\"%016llx\"",
+                  static_cast<unsigned long long>(HashFnv1a(body))); // NOLINT
+    return buffer;
+}
+
+bool CMetadataCache::IsETagMatching(std::string_view ifNoneMatch, std::string_view etag)
+{
+    while (!ifNoneMatch.empty())
+    {
+        const auto comma = ifNoneMatch.find(',');
+        auto candidate = Trim(ifNoneMatch.substr(0, comma));
+        // Weak comparison is fine for GET-like requests.
+        if (candidate.substr(0, 2) == "W/")
+        {
+            candidate.remove_prefix(2);
+        }
+        if (candidate == "*" || candidate == etag)
+        {
+            return true;
+        }
+        if (comma == std::string_view::npos)
+        {
+            break;
+        }
+        ifNoneMatch.remove_prefix(comma + 1);
+    }
+    return false;
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/ollama_proxy_config.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+/// @brief Short-living cache of Ollama's metadata responses (/api/tags, /api/show etc.) which IDE
+/// plugins poll all the time. Stored responses are immutable, readers share them without copying.
+class CMetadataCache
+{
+  public:
+    struct TResponse
+    {
+        int status;
+        std::string body;
+        std::string contentType;
+        std::string etag;
+    };
+    using TResponsePtr = std::shared_ptr<const TResponse>;
+
+    NO_COPYMOVE(CMetadataCache);
+    CMetadataCache() = delete;
+    ~CMetadataCache() = default;
+    explicit CMetadataCache(const TMetadataCacheConfig &config);
+
+    /// @returns How long response of the endpoint can be cached, zero if it must not be.
+    [[nodiscard]]
+    std::chrono::milliseconds GetTtl(const std::string &path) const;
+
+    /// @returns true if forwarding request to the path changes the models list.
+    [[nodiscard]]
+    static bool IsInvalidatingPath(const std::string &path);
+
+    /// @returns Cached response if it is not expired, nullptr otherwise.
+    [[nodiscard]]
+    TResponsePtr Lookup(const std::string &key) const;
+
+    /// @brief Stores the response for the time given.
+    /// @returns Stored response.
+    TResponsePtr Store(const std::string &key, std::chrono::milliseconds ttl, int status,
+                       std::string body, std::string contentType);
+
+    /// @brief Drops everything stored.
+    void Invalidate();
+
+    /// @returns Strong ETag of the body.
+    [[nodiscard]]
+    static std::string MakeETag(std::string_view body);
+
+    /// @returns true if "If-None-Match" header value matches the ETag.
+    [[nodiscard]]
+    static bool IsETagMatching(std::string_view ifNoneMatch, std::string_view etag);
+
+    [[nodiscard]]
+    std::size_t GetHits() const
+    {
+        return hits.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]]
+    std::size_t GetMisses() const
+    {
+        return misses.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct TEntry
+    {
+        TResponsePtr response;
+        std::chrono::steady_clock::time_point expiresAt;
+    };
+
+    const TMetadataCacheConfig &config;
+    mutable std::shared_mutex mutex;
+    std::unordered_map<std::string, TEntry> entries;
+
+    mutable std::atomic<std::size_t> hits{0};
+    mutable std::atomic<std::size_t> misses{0};
+};
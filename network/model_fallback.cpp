@@ -0,0 +1,113 @@
+#include "model_fallback.hpp" // IWYU pragma: keep
+
+#include <network/ollama_proxy_config.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace {
+// Weight of the newest sample in the averaged latency, 1/kLatencyWeightDiv.
+constexpr std::int64_t kLatencyWeightDiv = 4;
+} // namespace
+
+CModelFallback::TTicket::TTicket(std::string model, bool isFallback, TModelLoad &load) :
+    model(std::move(model)),
+    isFallback(isFallback),
+    load(load),
+    startedAt(std::chrono::steady_clock::now())
+{
+    ++load.inFlight;
+}
+
+CModelFallback::TTicket::~TTicket()
+{
+    --load.inFlight;
+}
+
+void CModelFallback::TTicket::MarkFirstToken()
+{
+    if (firstTokenSeen)
+    {
+        return;
+    }
+    firstTokenSeen = true;
+
+    const std::int64_t sample = std::chrono::duration_cast<std::chrono::microseconds>(
+                                  std::chrono::steady_clock::now() - startedAt)
+                                  .count();
+    // Lost update is not a problem here, it is an estimation anyway.
+    const auto prev = load.latencyUs.load(std::memory_order_relaxed);
+    const auto next = prev == 0 ? sample : prev + (sample - prev) / kLatencyWeightDiv;
+    load.latencyUs.store(next, std::memory_order_relaxed);
+}
+
+std::chrono::microseconds CModelFallback::TTicket::GetExpectedFirstToken() const
+{
+    return std::chrono::microseconds(load.latencyUs.load(std::memory_order_relaxed));
+}
+
+CModelFallback::CModelFallback(const TModelFallbackConfig &config) :
+    config(config)
+{
+}
+
+bool CModelFallback::IsSaturated(const TModelLoad &load) const
+{
+    const auto inFlight = load.inFlight.load(std::memory_order_relaxed);
+    if (config.maxQueueDepth > 0 && inFlight >= config.maxQueueDepth)
+    {
+        return true;
+    }
+    // Latency is considered only while model has queue, otherwise once we fallback the model would
+    // never receive new samples and would stay "slow" forever.
+    const auto latency = std::chrono::microseconds(load.latencyUs.load(std::memory_order_relaxed));
+    return config.maxLatency.count() > 0 && inFlight > 0 && latency > config.maxLatency;
+}
+
+CModelFallback::TModelLoad &CModelFallback::GetLoad(const std::string &model)
+{
+    auto &ptr = loads[model];
+    if (!ptr)
+    {
+        ptr = std::make_unique<TModelLoad>();
+    }
+    return *ptr;
+}
+
+CModelFallback::TTicketPtr CModelFallback::Acquire(const std::string &requestedModel)
+{
+    const std::lock_guard lock(mutex);
+    auto &requestedLoad = GetLoad(requestedModel);
+    const auto it = config.fallbacks.find(requestedModel);
+    if (it == config.fallbacks.end() || !IsSaturated(requestedLoad))
+    {
+        return TTicketPtr(new TTicket(requestedModel, false, requestedLoad));
+    }
+
+    ++fallbackCounts[{requestedModel, it->second}];
+    return TTicketPtr(new TTicket(it->second, true, GetLoad(it->second)));
+}
+
+CModelFallback::TFallbackCounts CModelFallback::GetFallbackCounts() const
+{
+    const std::lock_guard lock(mutex);
+    return fallbackCounts;
+}
+
+std::map<std::string, std::size_t> CModelFallback::GetInFlightCounts() const
+{
+    std::map<std::string, std::size_t> result;
+    const std::lock_guard lock(mutex);
+    for (const auto &[model, load] : loads)
+    {
+        result.emplace(model, load->inFlight.load(std::memory_order_relaxed));
+    }
+    return result;
+}
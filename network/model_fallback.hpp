@@ -0,0 +1,102 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/ollama_proxy_config.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+/// @brief Load-shedding for big models. Tracks live queue depth and time to first token per model
+/// and replaces saturated model by the configured smaller one.
+class CModelFallback
+{
+  private:
+    struct TModelLoad
+    {
+        std::atomic<std::size_t> inFlight{0};
+        // Exponentially weighted average of the time to first token, microseconds.
+        std::atomic<std::int64_t> latencyUs{0};
+    };
+
+  public:
+    /// @brief Marks request as in-flight for the selected model while it exists.
+    class TTicket
+    {
+      public:
+        NO_COPYMOVE(TTicket);
+        TTicket() = delete;
+        ~TTicket();
+
+        /// @returns Model which must be used for the request.
+        [[nodiscard]]
+        const std::string &Model() const
+        {
+            return model;
+        }
+
+        /// @returns true if model was replaced by the fallback.
+        [[nodiscard]]
+        bool IsFallback() const
+        {
+            return isFallback;
+        }
+
+        /// @brief Reports time to first token of the selected model. Only first call matters.
+        void MarkFirstToken();
+
+        /// @returns Averaged time to first token of the selected model, 0 if it is unknown yet.
+        [[nodiscard]]
+        std::chrono::microseconds GetExpectedFirstToken() const;
+
+      private:
+        friend class CModelFallback;
+        TTicket(std::string model, bool isFallback, TModelLoad &load);
+
+        std::string model;
+        bool isFallback;
+        TModelLoad &load;
+        std::chrono::steady_clock::time_point startedAt;
+        bool firstTokenSeen{false};
+    };
+    using TTicketPtr = std::unique_ptr<TTicket>;
+
+    // (requested model, used model) -> count of the fallbacks made.
+    using TFallbackCounts = std::map<std::pair<std::string, std::string>, std::size_t>;
+
+    NO_COPYMOVE(CModelFallback);
+    CModelFallback() = delete;
+    ~CModelFallback() = default;
+    explicit CModelFallback(const TModelFallbackConfig &config);
+
+    /// @brief Selects model to use for the request and marks it in-flight.
+    /// @param requestedModel model user asked for.
+    /// @returns ticket which keeps model in-flight until destroyed.
+    [[nodiscard]]
+    TTicketPtr Acquire(const std::string &requestedModel);
+
+    /// @returns How many times each fallback was used so far.
+    [[nodiscard]]
+    TFallbackCounts GetFallbackCounts() const;
+
+    /// @returns Count of the requests in-flight per model.
+    [[nodiscard]]
+    std::map<std::string, std::size_t> GetInFlightCounts() const;
+
+  private:
+    [[nodiscard]]
+    bool IsSaturated(const TModelLoad &load) const;
+    TModelLoad &GetLoad(const std::string &model);
+
+    const TModelFallbackConfig &config;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, std::unique_ptr<TModelLoad>> loads;
+    TFallbackCounts fallbackCounts;
+};
@@ -1,25 +1,223 @@
 #include "ollama_proxy.hpp" // IWYU pragma: keep
 
+#include "admission_control.hpp"      // IWYU pragma: keep
 #include "chunkedcontentprovider.hpp" // IWYU pragma: keep
+#include "embedding_cache.hpp"        // IWYU pragma: keep
+#include "metadata_cache.hpp"         // IWYU pragma: keep
 #include "ollama_proxy_config.hpp"    // IWYU pragma: keep
+#include "proxy_metrics.hpp"          // IWYU pragma: keep
+#include "request_key.hpp"            // IWYU pragma: keep
+#include "request_trace.hpp"          // IWYU pragma: keep
+#include "response_cache.hpp"         // IWYU pragma: keep
+#include "stream_capture.hpp"         // IWYU pragma: keep
+#include "token_ledger.hpp"           // IWYU pragma: keep
 
+#include <common/async_logger.h>
+#include <common/metrics.h>
 #include <ollama/httplib.h>
+#include <ollama/json.hpp>
 
+#include <algorithm>
+#include <cctype>
+#include <chrono>
 #include <cstddef>
+#include <cstdint>
 #include <exception>
 #include <memory>
+#include <optional>
 #include <ostream>
+#include <sstream>
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
+
+namespace {
+// Names model which actually served the chat, it differs from requested one on fallback.
+constexpr auto kModelUsedHeader = "X-Ollama-Mitm-Model";
+// Tells if deterministic response was taken from the cache: "hit" or "miss".
+constexpr auto kCacheHeader = "X-Ollama-Mitm-Cache";
+constexpr auto kEmbedPath = "/api/embed";
+// Id of the chat stream, it is used by /debug/streams. User sends it back to resume the stream.
+constexpr auto kStreamIdHeader = "X-Ollama-Mitm-Stream";
+// Secret of the stream given to the user who started it, resuming needs it besides the id.
+constexpr auto kResumeTokenHeader = "X-Ollama-Mitm-Resume-Token";
+// Number of lines of the resumed stream which the user got already.
+constexpr auto kStreamOffsetHeader = "X-Ollama-Mitm-Offset";
+// Optional name of the client for the token ledger, remote address is used if it is not set.
+constexpr auto kClientHeader = "X-Ollama-Mitm-Client";
+// Optional time in milliseconds since the chat was received after which its generation is aborted.
+constexpr auto kDeadlineHeader = "X-Ollama-Mitm-Deadline-Ms";
+// Session the chat belongs to, "new" starts one. Chat of the session has only the new messages.
+constexpr auto kSessionHeader = "X-Ollama-Mitm-Session";
+constexpr auto kNewSession = "new";
+// "off" forwards the chat to Ollama as it is, if the config allows it.
+constexpr auto kInterceptHeader = "X-Ollama-Mitm-Intercept";
+
+// Set by the pre-routing handler, before the body is read, on the thread which then runs handler.
+thread_local std::chrono::steady_clock::time_point requestReceivedAt;
+
+/// @returns Value of the "stream" field, Ollama streams if it is not set.
+bool IsStreamRequested(const nlohmann::json &request)
+{
+    constexpr auto kStreamKey = "stream";
+    return !request.contains(kStreamKey) || !request[kStreamKey].is_boolean()
+           || request[kStreamKey].get<bool>();
+}
+
+/// @returns Value of the "model" field, empty if there is no such.
+std::string GetModelName(const nlohmann::json &request)
+{
+    constexpr auto kModelKey = "model";
+    if (!request.is_object() || !request.contains(kModelKey) || !request[kModelKey].is_string())
+    {
+        return {};
+    }
+    return request[kModelKey].get<std::string>();
+}
+
+void CountRequest(const std::string &path, const std::string &model)
+{
+    proxy_metrics::Requests(proxy_metrics::NormalizeRoute(path), model).Add();
+}
+
+/// @brief Sends request to Ollama recording time until response headers are received.
+void SendToOllama(httplib::Client &client, httplib::Request &request, httplib::Response &response,
+                  httplib::Error &error)
+{
+    auto &connectTime = proxy_metrics::UpstreamConnect(proxy_metrics::NormalizeRoute(request.path));
+    const auto startedAt = std::chrono::steady_clock::now();
+    request.response_handler = [&connectTime, startedAt](const httplib::Response &) {
+        connectTime.Record(proxy_metrics::MicrosecondsSince(startedAt));
+        return true;
+    };
+    client.send(request, response, error);
+}
+
+/// @returns Name of the client for the accounting.
+std::string GetClientName(const httplib::Request &request)
+{
+    return request.has_header(kClientHeader) ? request.get_header_value(kClientHeader)
+                                             : request.remote_addr;
+}
+
+/// @returns Deadline asked by the user, std::nullopt if it is not set.
+/// @throws std::invalid_argument if it is not a positive number of milliseconds up to a day.
+std::optional<std::chrono::steady_clock::time_point>
+GetClientDeadline(const httplib::Request &request)
+{
+    // Longer deadline means no deadline at all, the bound keeps the time point from overflowing.
+    constexpr std::chrono::milliseconds kMaxDeadline = std::chrono::hours{24};
+    if (!request.has_header(kDeadlineHeader))
+    {
+        return std::nullopt;
+    }
+    const auto value = request.get_header_value(kDeadlineHeader);
+    const auto maxLength = std::to_string(kMaxDeadline.count()).size();
+    // Digits only, so signs and spaces accepted by std::stoll are rejected and it cannot throw.
+    const bool isNumber = !value.empty() && value.size() <= maxLength
+                          && std::all_of(value.begin(), value.end(), [](unsigned char c) {
+                                 return std::isdigit(c) != 0;
+                             });
+    const auto milliseconds = isNumber ? std::stoll(value) : 0;
+    if (milliseconds <= 0 || milliseconds > kMaxDeadline.count())
+    {
+        throw std::invalid_argument(std::string(kDeadlineHeader)
+                                    + " must be a positive number of milliseconds up to "
+                                    + std::to_string(kMaxDeadline.count()) + ".");
+    }
+    return requestReceivedAt + std::chrono::milliseconds{milliseconds};
+}
+
+/// @brief Parses query parameters of /debug/usage.
+/// @throws std::invalid_argument if time is not a number.
+CTokenLedger::TQuery ParseUsageQuery(const httplib::Request &request)
+{
+    CTokenLedger::TQuery query;
+    query.model = request.get_param_value("model");
+    query.client = request.get_param_value("client");
+    // Unix time in seconds.
+    const auto parseTime =
+      [&request](const char *key) -> std::optional<CTokenLedger::TClock::time_point> {
+        if (!request.has_param(key))
+        {
+            return std::nullopt;
+        }
+        const auto seconds = std::stoll(request.get_param_value(key));
+        // Negative hours would wrap in the ledger, too big ones overflow the clock.
+        constexpr auto kMaxSeconds =
+          std::chrono::duration_cast<std::chrono::seconds>(CTokenLedger::TClock::duration::max());
+        if (seconds < 0 || seconds > kMaxSeconds.count())
+        {
+            throw std::out_of_range(std::string("Usage query ") + key + " is out of range.");
+        }
+        return CTokenLedger::TClock::time_point{std::chrono::seconds{seconds}};
+    };
+    query.from = parseTime("from");
+    query.to = parseTime("to");
+    // Comma separated subset of "model,client,hour".
+    if (request.has_param("group_by"))
+    {
+        const auto groupBy = "," + request.get_param_value("group_by") + ",";
+        query.isGroupedByModel = groupBy.find(",model,") != std::string::npos;
+        query.isGroupedByClient = groupBy.find(",client,") != std::string::npos;
+        query.isGroupedByHour = groupBy.find(",hour,") != std::string::npos;
+    }
+    return query;
+}
+} // namespace
 
 COllamaProxyServer::COllamaProxyServer(TOllamaProxyConfig config) :
-    config{std::move(config)}
+    config{std::move(config)},
+    modelFallback{this->config.modelFallback},
+    responseCache{this->config.responseCache},
+    embedBatcher{this->config.embedBatch,
+                 [this](const std::string &requestBody) {
+                     return PostToOllama(kEmbedPath, requestBody);
+                 }},
+    embeddingCache{this->config.embeddingCache},
+    metadataCache{this->config.metadataCache},
+    tokenLedger{this->config.tokenLedger},
+    streamCapture{this->config.streamCapture},
+    admissionControl{this->config.serverLimits, this->config.metadataCache},
+    sessionStore{this->config.sessions},
+    passthroughPolicy{this->config.passthrough},
+    timerWheel{this->config.streamTimers.tick},
+    streamRegistry{timerWheel, this->config.streamResume},
+    executor{utility::TThreadPoolSizing{
+               std::min(this->config.executor.minWorkerThreads,
+                        this->config.executor.maxWorkerThreads),
+               this->config.executor.maxWorkerThreads, this->config.executor.targetQueueWait,
+               this->config.executor.idleTimeout},
+             utility::EShutdownMode::Drain},
+    traceExporter{std::make_shared<CTraceExporter>(this->config.tracing)},
+    metricsCollectorId{0}
 {
     if (!this->config.Validate())
     {
         throw std::invalid_argument("Invalid configuration for ollama proxy server passed.");
     }
+    for (const auto &[model, fallback] : this->config.modelFallback.fallbacks)
+    {
+        proxy_metrics::AddKnownModel(model);
+        proxy_metrics::AddKnownModel(fallback);
+    }
+    for (const auto &model : this->config.passthrough.models)
+    {
+        proxy_metrics::AddKnownModel(model);
+    }
+    metricsCollectorId = proxy_metrics::GetRegistry().AddCollector([this](std::ostream &os) {
+        CollectMetrics(os);
+    });
+}
+
+COllamaProxyServer::~COllamaProxyServer()
+{
+    // Parked streams use the executor and the timer wheel.
+    streamRegistry.ReleaseParked();
+    proxy_metrics::GetRegistry().RemoveCollector(metricsCollectorId);
+    // Configured streams can be gone after the server.
+    logging::CAsyncLogger::Instance().Flush();
 }
 
 void COllamaProxyServer::Start(int listenOnPort)
@@ -28,6 +226,22 @@ void COllamaProxyServer::Start(int listenOnPort)
     server.listen("0.0.0.0", listenOnPort);
 }
 
+int COllamaProxyServer::BindToAnyPort(const std::string &host)
+{
+    InstallHandlers();
+    const int port = server.bind_to_any_port(host);
+    if (port < 0)
+    {
+        throw std::runtime_error("Proxy failed to bind any port of " + host);
+    }
+    return port;
+}
+
+void COllamaProxyServer::ListenAfterBind()
+{
+    server.listen_after_bind();
+}
+
 void COllamaProxyServer::Stop()
 {
     server.stop();
@@ -35,13 +249,80 @@ void COllamaProxyServer::Stop()
 
 void COllamaProxyServer::InstallHandlers()
 {
+    server.new_task_queue = [this]() {
+        return admissionControl.CreateTaskQueue();
+    };
+    server.set_pre_routing_handler([this](const httplib::Request &request,
+                                          httplib::Response &response) {
+        requestReceivedAt = std::chrono::steady_clock::now();
+        if (!admissionControl.Admit(request.path))
+        {
+            admissionControl.Reject(response);
+            return httplib::Server::HandlerResponse::Handled;
+        }
+        return httplib::Server::HandlerResponse::Unhandled;
+    });
+    // Logger is called once the response is written, streamed ones included.
+    server.set_logger([this](const httplib::Request &, const httplib::Response &) {
+        admissionControl.Finish();
+    });
+
     // Just pass everything to ollama as-is.
     const auto handleAll = [this](const httplib::Request &request, httplib::Response &response) {
+        CountRequest(request.path, {});
         DefaultProxyEverything(request, response);
     };
     server.Post("/api/chat", [this](const auto &req, auto &resp) {
         HandlePostApiChat(req, resp);
     });
+    server.Post("/api/generate", [this](const auto &req, auto &resp) {
+        HandlePostApiGenerate(req, resp);
+    });
+    server.Post(kEmbedPath, [this](const auto &req, auto &resp) {
+        HandlePostApiEmbed(req, resp);
+    });
+    server.Post("/api/embeddings", [this](const auto &req, auto &resp) {
+        HandlePostApiEmbeddings(req, resp);
+    });
+    server.Get("/metrics", &COllamaProxyServer::HandleGetMetrics);
+    if (config.debugEndpoints.isEnabled)
+    {
+        server.Get("/debug/streams", [this](const auto &req, auto &resp) {
+            HandleGetDebugStreams(req, resp);
+        });
+        const auto handleCancel = [this](const httplib::Request &request,
+                                         httplib::Response &response) {
+            HandleCancelDebugStream(request, response);
+        };
+        server.Post(R"(/debug/streams/(\d+)/cancel)", handleCancel);
+        server.Delete(R"(/debug/streams/(\d+))", handleCancel);
+        server.Get("/debug/usage", [this](const auto &req, auto &resp) {
+            HandleGetDebugUsage(req, resp);
+        });
+    }
+    const auto handleMetadata = [this](const httplib::Request &request,
+                                       httplib::Response &response) {
+        CountRequest(request.path, {});
+        HandleMetadata(request, response);
+    };
+    for (const auto &[path, ttl] : config.metadataCache.ttlPerPath)
+    {
+        // /api/show is POST, others are GET.
+        server.Get(path, handleMetadata);
+        server.Post(path, handleMetadata);
+    }
+    const auto handleModelsChange = [this](const httplib::Request &request,
+                                           httplib::Response &response) {
+        CountRequest(request.path, {});
+        DefaultProxyEverything(request, response);
+        metadataCache.Invalidate();
+    };
+    for (const auto *path : {"/api/pull", "/api/create", "/api/copy", "/api/delete"})
+    {
+        server.Post(path, handleModelsChange);
+        server.Delete(path, handleModelsChange);
+    }
+
     server.Get(R"(/(.+))", handleAll);
     server.Post(R"(/(.+))", handleAll);
     server.Put(R"(/(.+))", handleAll);
@@ -77,7 +358,7 @@ void COllamaProxyServer::DefaultProxyEverything(const httplib::Request &request,
     httpOllamaCli.set_follow_location(true); // follow redirects
     httplib::Error error{httplib::Error::Unknown};
     httplib::Request copy = request;
-    httpOllamaCli.send(copy, response, error);
+    SendToOllama(httpOllamaCli, copy, response, error);
 
     if (httplib::Error::Success != error)
     {
@@ -88,7 +369,7 @@ void COllamaProxyServer::DefaultProxyEverything(const httplib::Request &request,
 // Handles POST /api/chat. This is a special case because it requires streaming responses back to
 // the client and we will handle userRequest to the web here.
 void COllamaProxyServer::HandlePostApiChat(const httplib::Request &userRequest,
-                                           httplib::Response &responseToUser) const
+                                           httplib::Response &responseToUser)
 {
     config.ExecIfFittingVerbosity(EOllamaProxyVerbosity::Debug, [&userRequest](auto &ostream) {
         ostream << "[DEBUG] HandlePostApiChat(): " << userRequest.method << " " << userRequest.path
@@ -100,6 +381,45 @@ void COllamaProxyServer::HandlePostApiChat(const httplib::Request &userRequest,
         }
     });
 
+    if (userRequest.has_header(kStreamIdHeader))
+    {
+        ResumeChat(userRequest, responseToUser);
+        return;
+    }
+    // Session keeps the history of intercepted chats only.
+    if (!userRequest.has_header(kSessionHeader))
+    {
+        const auto decision = passthroughPolicy.Decide(
+          userRequest.get_header_value(kInterceptHeader), userRequest.body);
+        if (decision.route != CPassthroughPolicy::ERoute::Intercepted)
+        {
+            ForwardChat(userRequest, responseToUser, decision);
+            return;
+        }
+    }
+
+    std::optional<std::chrono::steady_clock::time_point> deadline;
+    try
+    {
+        deadline = GetClientDeadline(userRequest);
+    }
+    catch (std::exception &e)
+    {
+        responseToUser.status = 400;
+        responseToUser.set_content(nlohmann::json{{"error", e.what()}}.dump(), "application/json");
+        return;
+    }
+    std::optional<CSessionStore::TTurn> turn;
+    if (userRequest.has_header(kSessionHeader))
+    {
+        turn = StartSessionTurn(userRequest, responseToUser);
+        if (!turn)
+        {
+            return;
+        }
+    }
+    const bool isSessionTurn = turn.has_value();
+
     responseToUser.status = 504;
     responseToUser.body = "Invalid content type. Expected application/json from user.";
     static constexpr auto kHeaderKey = "content-type";
@@ -111,12 +431,115 @@ void COllamaProxyServer::HandlePostApiChat(const httplib::Request &userRequest,
             responseToUser.status = 200;
             responseToUser.body = "";
 
+            const auto trace = traceExporter->StartTrace(
+              userRequest.method + " " + userRequest.path, requestReceivedAt);
+            if (trace)
+            {
+                trace->AddSpan("receive", requestReceivedAt, std::chrono::steady_clock::now());
+            }
+            nlohmann::json userJson = [&]() {
+                const CRequestTrace::CSpan span(trace, "parse");
+                return turn ? std::move(turn->chat) : nlohmann::json::parse(userRequest.body);
+            }();
+            // Joined user would get the deadline of the leader, so chats with own one run alone.
+            // Single response and the turn of the session are not shared either.
+            std::optional<std::string> flightKey;
+            const bool isStreamed = userJson.is_object() && userJson.contains("stream")
+                                    && userJson["stream"] == true;
+            if (config.coalesceDeterministicChats && !deadline && !isSessionTurn && isStreamed)
+            {
+                // The same chat of the user makes the same request to Ollama, so the flight is
+                // found before anything is built for this user.
+                flightKey = MakeCanonicalRequest(userJson);
+                if (auto joined = flightKey ? singleFlight.Find(*flightKey) : nullptr)
+                {
+                    ServeJoinedChat(userRequest, std::move(joined), trace, responseToUser);
+                    return;
+                }
+            }
+            auto candidate = std::make_shared<CChunkedContentProvider>(
+              userRequest, std::move(userJson), turn && turn->hasAiCommands, config, modelFallback,
+              trace);
+            CountRequest(userRequest.path, candidate->GetModel());
+            if (trace)
+            {
+                trace->AddArg("model", candidate->GetModel());
+            }
+            responseToUser.set_header(kModelUsedHeader, candidate->GetModel());
+            if (tokenLedger.IsEnabled())
+            {
+                candidate->SetOnUsage([this, model = candidate->GetModel(),
+                                       client = GetClientName(userRequest)](const auto &usage) {
+                    tokenLedger.Record(model, client, usage);
+                });
+            }
+            candidate->SetCapture(&streamCapture);
+            candidate->SetExecutor(config.executor.maxWorkerThreads > 0 ? &executor : nullptr);
+            candidate->SetTimerWheel(&timerWheel);
+            if (deadline)
+            {
+                candidate->SetDeadline(*deadline);
+            }
+            candidate->SetOnAbandoned([this](auto provider) {
+                streamRegistry.Park(std::move(provider));
+            });
+            // Cached answer and the joined chat would not complete the turn of the session, and
+            // they are replayed as the stream only.
+            const bool isAlone = isSessionTurn || !candidate->IsStreamedToUser();
+            if (isSessionTurn)
+            {
+                responseToUser.set_header(kSessionHeader, turn->id);
+                candidate->SetOnTurnCompleted([this, started = std::move(*turn)](auto messages) {
+                    if (!sessionStore.Commit(started, std::move(messages)))
+                    {
+                        config.LogFields(EOllamaProxyVerbosity::Warning,
+                                         "[WARNING] Session turn is not stored, session was "
+                                         "changed or evicted meanwhile.",
+                                         [&started](auto &record) {
+                                             record.Add("session", started.id);
+                                         });
+                    }
+                });
+            }
+            if (!isAlone && ServeCachedChat(*candidate, responseToUser))
+            {
+                return;
+            }
+
             // This is last one, now control is moved to the chunked content provider which can
             // "write" only to the user or disconnect.
-            auto ptr = std::make_shared<CChunkedContentProvider>(userRequest, config);
+            const auto *candidateRaw = candidate.get();
+            auto ptr = std::move(candidate);
+            if (flightKey)
+            {
+                // Other user could start the same chat meanwhile.
+                ptr = singleFlight.Lead(*flightKey, std::move(ptr));
+                if (trace && ptr.get() != candidateRaw)
+                {
+                    trace->AddArg("coalesced", true);
+                }
+            }
+            streamRegistry.Register(ptr);
+            responseToUser.set_header(kStreamIdHeader, std::to_string(ptr->GetStreamId()));
+            responseToUser.set_header(kResumeTokenHeader, ptr->GetResumeToken());
+            ptr->Start();
+            if (!ptr->IsStreamedToUser())
+            {
+                if (auto aggregated = ptr->WaitAggregated(userRequest.is_connection_closed))
+                {
+                    responseToUser.set_content(std::move(*aggregated), "application/json");
+                    return;
+                }
+                responseToUser.status = 502;
+                responseToUser.set_content(
+                  nlohmann::json{{"error", "Chat failed or was cancelled."}}.dump(),
+                  "application/json");
+                return;
+            }
             httplib::ContentProviderWithoutLength contentProvider =
-              [ptr = std::move(ptr)](size_t offset, httplib::DataSink &sink) {
-                  return (*ptr)(offset, sink);
+              [subscription = std::make_shared<CChunkedContentProvider::CSubscription>(
+                 std::move(ptr), 0, trace)](size_t /*offset*/, httplib::DataSink &sink) {
+                  return (*subscription)(sink);
               };
             responseToUser.set_chunked_content_provider("application/json",
                                                         std::move(contentProvider));
@@ -137,3 +560,655 @@ void COllamaProxyServer::HandlePostApiChat(const httplib::Request &userRequest,
                 << ", body: " << responseToUser.body << std::endl;
     });
 }
+
+void COllamaProxyServer::ForwardChat(const httplib::Request &userRequest,
+                                     httplib::Response &responseToUser,
+                                     const CPassthroughPolicy::TDecision &decision)
+{
+    // Model is the user's string, the metric turns unknown ones into the bounded label.
+    CountRequest(userRequest.path, decision.model);
+    proxy_metrics::PassedThroughChats(CPassthroughPolicy::ToString(decision.route)).Add();
+    if (decision.route == CPassthroughPolicy::ERoute::Buffered)
+    {
+        DefaultProxyEverything(userRequest, responseToUser);
+        return;
+    }
+    // Status is sent before Ollama is called, so its errors are relayed in the stream as they are.
+    responseToUser.status = 200;
+    httplib::ContentProviderWithoutLength contentProvider =
+      [this, upstreamRequest = std::make_shared<httplib::Request>(userRequest)](
+        size_t /*offset*/, httplib::DataSink &sink) {
+          upstreamRequest->content_receiver = [&sink](const char *data, std::size_t length,
+                                                      std::uint64_t, std::uint64_t) {
+              return sink.write(data, length);
+          };
+          auto client = CreateOllamaHttpClient();
+          httplib::Response upstreamResponse;
+          httplib::Error error{httplib::Error::Unknown};
+          SendToOllama(client, *upstreamRequest, upstreamResponse, error);
+          // Canceled means the user left, the upstream call is dropped with it.
+          if (error != httplib::Error::Success && error != httplib::Error::Canceled)
+          {
+              config.LogFields(EOllamaProxyVerbosity::Warning,
+                               "[WARNING] Forwarded chat failed.", [error](auto &record) {
+                                   record.Add("error", httplib::to_string(error));
+                               });
+          }
+          sink.done();
+          return true;
+      };
+    responseToUser.set_chunked_content_provider("application/x-ndjson",
+                                                std::move(contentProvider));
+}
+
+std::optional<CSessionStore::TTurn>
+COllamaProxyServer::StartSessionTurn(const httplib::Request &userRequest,
+                                     httplib::Response &responseToUser)
+{
+    const auto reject = [&responseToUser](int status, const std::string &error) {
+        responseToUser.status = status;
+        responseToUser.set_content(nlohmann::json{{"error", error}}.dump(), "application/json");
+    };
+    if (!sessionStore.IsEnabled())
+    {
+        reject(400, "Sessions are disabled.");
+        return std::nullopt;
+    }
+    try
+    {
+        auto chat = nlohmann::json::parse(userRequest.body);
+        const auto id = userRequest.get_header_value(kSessionHeader);
+        if (id == kNewSession)
+        {
+            return sessionStore.Create(std::move(chat));
+        }
+        auto turn = sessionStore.Continue(id, std::move(chat));
+        if (!turn)
+        {
+            // Client has the whole conversation, it starts the session anew with it.
+            reject(404, "Session is unknown, expired or its first turn did not complete, send "
+                        "the whole conversation with session \"new\".");
+        }
+        return turn;
+    }
+    catch (std::exception &e)
+    {
+        reject(400, e.what());
+    }
+    return std::nullopt;
+}
+
+void COllamaProxyServer::ServeJoinedChat(const httplib::Request &userRequest,
+                                         std::shared_ptr<CChunkedContentProvider> flight,
+                                         const CTraceExporter::TTracePtr &trace,
+                                         httplib::Response &responseToUser)
+{
+    CountRequest(userRequest.path, flight->GetModel());
+    if (trace)
+    {
+        trace->AddArg("model", flight->GetModel());
+        trace->AddArg("coalesced", true);
+    }
+    responseToUser.set_header(kModelUsedHeader, flight->GetModel());
+    responseToUser.set_header(kStreamIdHeader, std::to_string(flight->GetStreamId()));
+    responseToUser.set_header(kResumeTokenHeader, flight->GetResumeToken());
+    httplib::ContentProviderWithoutLength contentProvider =
+      [subscription = std::make_shared<CChunkedContentProvider::CSubscription>(
+         std::move(flight), 0, trace)](size_t /*offset*/, httplib::DataSink &sink) {
+          return (*subscription)(sink);
+      };
+    responseToUser.set_chunked_content_provider("application/json", std::move(contentProvider));
+}
+
+void COllamaProxyServer::ResumeChat(const httplib::Request &userRequest,
+                                    httplib::Response &responseToUser)
+{
+    std::uint64_t streamId = 0;
+    std::size_t offset = 0;
+    const auto resumeToken = userRequest.get_header_value(kResumeTokenHeader);
+    try
+    {
+        if (resumeToken.empty())
+        {
+            throw std::invalid_argument(std::string(kResumeTokenHeader) + " is required.");
+        }
+        streamId = std::stoull(userRequest.get_header_value(kStreamIdHeader));
+        if (userRequest.has_header(kStreamOffsetHeader))
+        {
+            offset = std::stoull(userRequest.get_header_value(kStreamOffsetHeader));
+        }
+    }
+    catch (std::exception &e)
+    {
+        responseToUser.status = 400;
+        responseToUser.set_content(nlohmann::json{{"error", e.what()}}.dump(), "application/json");
+        return;
+    }
+
+    // Wrong token answers as the gone stream, so it does not tell which ids are alive.
+    auto provider = streamRegistry.Resume(streamId, resumeToken);
+    if (!provider || !provider->CanResumeFrom(offset))
+    {
+        proxy_metrics::StreamResumes("gone").Add();
+        // Resuming user has the part of the answer, so new generation is not started silently.
+        responseToUser.status = 410;
+        responseToUser.set_content(
+          nlohmann::json{{"error", "Stream cannot be resumed from this offset, start new chat."}}
+            .dump(),
+          "application/json");
+        return;
+    }
+    proxy_metrics::StreamResumes("resumed").Add();
+    config.LogFields(EOllamaProxyVerbosity::Debug, "[DEBUG] Stream is resumed.",
+                     [streamId, offset](auto &record) {
+                         record.Add("stream", streamId).Add("offset", offset);
+                     });
+    responseToUser.status = 200;
+    responseToUser.set_header(kModelUsedHeader, provider->GetModel());
+    responseToUser.set_header(kStreamIdHeader, std::to_string(streamId));
+    httplib::ContentProviderWithoutLength contentProvider =
+      [subscription = std::make_shared<CChunkedContentProvider::CSubscription>(
+         std::move(provider), offset)](size_t /*offset*/, httplib::DataSink &sink) {
+          return (*subscription)(sink);
+      };
+    responseToUser.set_chunked_content_provider("application/json", std::move(contentProvider));
+}
+
+bool COllamaProxyServer::ServeCachedChat(CChunkedContentProvider &candidate,
+                                         httplib::Response &responseToUser)
+{
+    const auto &canonicalRequest = candidate.GetCanonicalRequest();
+    if (!canonicalRequest || !responseCache.IsEnabled())
+    {
+        return false;
+    }
+
+    // Chat is always streamed to the user.
+    const auto cacheKey = CResponseCache::MakeKey("/api/chat", true, *canonicalRequest);
+    auto lines = responseCache.Lookup(cacheKey);
+    if (!lines)
+    {
+        responseToUser.set_header(kCacheHeader, "miss");
+        candidate.SetOnCompleted([this, cacheKey](std::vector<std::string> linesSentToUser) {
+            responseCache.Store(cacheKey, linesSentToUser);
+        });
+        return false;
+    }
+
+    responseToUser.set_header(kCacheHeader, "hit");
+    httplib::ContentProviderWithoutLength contentProvider =
+      [lines = std::move(*lines), index = std::size_t{0}](size_t /*offset*/,
+                                                          httplib::DataSink &sink) mutable {
+          for (; index < lines.size(); ++index)
+          {
+              if (!sink.is_writable())
+              {
+                  return false;
+              }
+              CChunkedContentProvider::WriteLineToUser(lines[index], sink);
+          }
+          sink.done();
+          return true;
+      };
+    responseToUser.set_chunked_content_provider("application/json", std::move(contentProvider));
+    return true;
+}
+
+void COllamaProxyServer::HandlePostApiGenerate(const httplib::Request &request,
+                                               httplib::Response &response)
+{
+    const auto json = nlohmann::json::parse(request.body, nullptr, false);
+    CountRequest(request.path, GetModelName(json));
+
+    std::optional<std::string> cacheKey;
+    bool isStream = true;
+    if (responseCache.IsEnabled())
+    {
+        const auto canonicalRequest =
+          json.is_discarded() ? std::nullopt : MakeCanonicalRequest(json);
+        if (canonicalRequest)
+        {
+            isStream = IsStreamRequested(json);
+            cacheKey = CResponseCache::MakeKey(request.path, isStream, *canonicalRequest);
+        }
+    }
+
+    if (cacheKey)
+    {
+        if (const auto lines = responseCache.Lookup(*cacheKey); lines && !lines->empty())
+        {
+            response.status = 200;
+            response.set_header(kCacheHeader, "hit");
+            response.set_content(lines->front(),
+                                 isStream ? "application/x-ndjson" : "application/json");
+            return;
+        }
+    }
+
+    DefaultProxyEverything(request, response);
+    if (response.status == 200)
+    {
+        proxy_metrics::AddKnownModel(GetModelName(json));
+    }
+
+    if (cacheKey && response.status == 200)
+    {
+        response.set_header(kCacheHeader, "miss");
+        responseCache.Store(*cacheKey, {response.body});
+    }
+}
+
+void COllamaProxyServer::HandlePostApiEmbed(const httplib::Request &request,
+                                            httplib::Response &response)
+{
+    auto json = nlohmann::json::parse(request.body, nullptr, false);
+    const auto model = GetModelName(json);
+    CountRequest(request.path, model);
+    if (json.is_discarded() || !json.is_object())
+    {
+        DefaultProxyEverything(request, response);
+        return;
+    }
+
+    try
+    {
+        const auto reply = embeddingCache.IsEnabled() ? EmbedWithCache(std::move(json))
+                                                      : ForwardEmbed(json);
+        response.status = reply.status;
+        response.set_content(reply.body, "application/json");
+        if (reply.status == 200)
+        {
+            proxy_metrics::AddKnownModel(model);
+        }
+    }
+    catch (std::exception &e)
+    {
+        response.status = 502;
+        config.ExecIfFittingVerbosity(EOllamaProxyVerbosity::Error, [&e](auto &ostream) {
+            ostream << "[ERROR] HandlePostApiEmbed() exception: " << e.what() << std::endl;
+        });
+    }
+}
+
+CEmbedBatcher::TReply COllamaProxyServer::PostToOllama(const std::string &path,
+                                                       const std::string &body) const
+{
+    auto httpOllamaCli = CreateOllamaHttpClient();
+    httplib::Request request;
+    request.method = "POST";
+    request.path = path;
+    request.body = body;
+    request.set_header("Content-Type", "application/json");
+    httplib::Response response;
+    httplib::Error error{httplib::Error::Unknown};
+    SendToOllama(httpOllamaCli, request, response, error);
+    if (httplib::Error::Success != error)
+    {
+        return {502, {}};
+    }
+    return {response.status, response.body};
+}
+
+CEmbedBatcher::TReply COllamaProxyServer::ForwardEmbed(const nlohmann::json &request)
+{
+    if (auto futureReply = embedBatcher.Submit(request))
+    {
+        return futureReply->get();
+    }
+    return PostToOllama(kEmbedPath, request.dump());
+}
+
+CEmbedBatcher::TReply COllamaProxyServer::EmbedWithCache(nlohmann::json request)
+{
+    constexpr auto kInputKey = "input";
+    constexpr auto kEmbeddingsKey = "embeddings";
+
+    std::vector<std::string> inputs;
+    if (request.contains(kInputKey) && request[kInputKey].is_string())
+    {
+        inputs.push_back(request[kInputKey].get<std::string>());
+    }
+    else if (request.contains(kInputKey) && request[kInputKey].is_array()
+             && std::all_of(request[kInputKey].begin(), request[kInputKey].end(),
+                            [](const auto &input) {
+                                return input.is_string();
+                            }))
+    {
+        inputs = request[kInputKey].get<std::vector<std::string>>();
+    }
+    if (inputs.empty())
+    {
+        return ForwardEmbed(request);
+    }
+
+    auto params = std::move(request);
+    params.erase(kInputKey);
+
+    std::vector<std::string> keys;
+    std::vector<std::optional<CEmbeddingCache::TVector>> vectors;
+    std::vector<std::size_t> missing;
+    keys.reserve(inputs.size());
+    vectors.reserve(inputs.size());
+    for (std::size_t i = 0; i < inputs.size(); ++i)
+    {
+        keys.push_back(CEmbeddingCache::MakeKey(kEmbedPath, params, inputs[i]));
+        vectors.push_back(embeddingCache.Lookup(keys.back()));
+        if (!vectors.back())
+        {
+            missing.push_back(i);
+        }
+    }
+
+    nlohmann::json reply;
+    reply["model"] = params["model"];
+    if (!missing.empty())
+    {
+        // Only missing inputs go upstream.
+        auto upstreamRequest = params;
+        auto &missingInputs = upstreamRequest[kInputKey];
+        for (const auto index : missing)
+        {
+            missingInputs.push_back(inputs[index]);
+        }
+        const auto upstreamReply = ForwardEmbed(upstreamRequest);
+        if (upstreamReply.status != 200)
+        {
+            return upstreamReply;
+        }
+        reply = nlohmann::json::parse(upstreamReply.body);
+        const auto &embeddings = reply[kEmbeddingsKey];
+        if (!embeddings.is_array() || embeddings.size() != missing.size())
+        {
+            return {502, R"({"error":"Unexpected embeddings count from Ollama."})"};
+        }
+        for (std::size_t i = 0; i < missing.size(); ++i)
+        {
+            auto &vector = vectors[missing[i]];
+            vector = embeddings[i].get<CEmbeddingCache::TVector>();
+            embeddingCache.Store(keys[missing[i]], *vector);
+        }
+    }
+
+    auto &embeddings = reply[kEmbeddingsKey];
+    embeddings = nlohmann::json::array();
+    for (auto &vector : vectors)
+    {
+        embeddings.push_back(std::move(*vector));
+    }
+    return {200, reply.dump()};
+}
+
+void COllamaProxyServer::HandlePostApiEmbeddings(const httplib::Request &request,
+                                                 httplib::Response &response)
+{
+    constexpr auto kPromptKey = "prompt";
+    constexpr auto kEmbeddingKey = "embedding";
+
+    auto params = nlohmann::json::parse(request.body, nullptr, false);
+    CountRequest(request.path, GetModelName(params));
+    if (!embeddingCache.IsEnabled() || !params.is_object() || !params.contains(kPromptKey)
+        || !params[kPromptKey].is_string())
+    {
+        DefaultProxyEverything(request, response);
+        return;
+    }
+
+    const auto prompt = params[kPromptKey].get<std::string>();
+    params.erase(kPromptKey);
+    const auto key = CEmbeddingCache::MakeKey(request.path, params, prompt);
+    if (auto vector = embeddingCache.Lookup(key))
+    {
+        nlohmann::json reply;
+        reply[kEmbeddingKey] = std::move(*vector);
+        response.status = 200;
+        response.set_content(reply.dump(), "application/json");
+        return;
+    }
+
+    DefaultProxyEverything(request, response);
+    if (response.status == 200)
+    {
+        const auto reply = nlohmann::json::parse(response.body, nullptr, false);
+        if (reply.is_object() && reply.contains(kEmbeddingKey) && reply[kEmbeddingKey].is_array())
+        {
+            embeddingCache.Store(key, reply[kEmbeddingKey].get<CEmbeddingCache::TVector>());
+        }
+    }
+}
+
+void COllamaProxyServer::HandleMetadata(const httplib::Request &request,
+                                        httplib::Response &response)
+{
+    static constexpr auto kETagHeader = "ETag";
+    static constexpr auto kIfNoneMatchHeader = "If-None-Match";
+    static constexpr auto kContentTypeHeader = "Content-Type";
+
+    const auto ttl = metadataCache.GetTtl(request.path);
+    const auto key = request.method + " " + request.path + "\n" + request.body;
+    const auto cached = metadataCache.Lookup(key);
+    if (!cached)
+    {
+        DefaultProxyEverything(request, response);
+        if (response.status == 200 && ttl.count() > 0)
+        {
+            const auto stored =
+              metadataCache.Store(key, ttl, response.status, response.body,
+                                  response.get_header_value(kContentTypeHeader));
+            response.set_header(kETagHeader, stored->etag);
+        }
+        return;
+    }
+
+    response.set_header(kETagHeader, cached->etag);
+    if (CMetadataCache::IsETagMatching(request.get_header_value(kIfNoneMatchHeader),
+                                       cached->etag))
+    {
+        response.status = 304;
+        return;
+    }
+    response.status = cached->status;
+    response.set_content(cached->body, cached->contentType);
+}
+
+void COllamaProxyServer::HandleGetMetrics(const httplib::Request & /*request*/,
+                                          httplib::Response &response)
+{
+    std::ostringstream os;
+    proxy_metrics::GetRegistry().Render(os);
+    response.status = 200;
+    response.set_content(os.str(), "text/plain; version=0.0.4");
+}
+
+void COllamaProxyServer::CollectMetrics(std::ostream &os) const
+{
+    using metrics::CRegistry;
+    using metrics::MakeLabels;
+
+    CRegistry::WriteHeader(os, "ollama_mitm_model_fallbacks_total",
+                           "Requests served by the fallback model.", "counter");
+    for (const auto &[models, count] : modelFallback.GetFallbackCounts())
+    {
+        os << "ollama_mitm_model_fallbacks_total"
+           << CRegistry::Braces(MakeLabels({{"from", models.first}, {"to", models.second}})) << ' '
+           << count << '\n';
+    }
+    CRegistry::WriteHeader(os, "ollama_mitm_model_in_flight",
+                           "Requests queued or generated by model.", "gauge");
+    for (const auto &[model, count] : modelFallback.GetInFlightCounts())
+    {
+        os << "ollama_mitm_model_in_flight" << CRegistry::Braces(MakeLabels({{"model", model}}))
+           << ' ' << count << '\n';
+    }
+
+    const auto writeValue = [&os](const char *name, const char *help, const char *type,
+                                  std::size_t value) {
+        CRegistry::WriteHeader(os, name, help, type);
+        os << name << ' ' << value << '\n';
+    };
+    writeValue("ollama_mitm_coalesced_chats_total", "Chats joined to identical one in flight.",
+               "counter", singleFlight.GetCoalescedCount());
+    writeValue("ollama_mitm_response_cache_hits_total",
+               "Deterministic responses served from cache.", "counter", responseCache.GetHits());
+    writeValue("ollama_mitm_response_cache_misses_total", "Deterministic responses not in cache.",
+               "counter", responseCache.GetMisses());
+    writeValue("ollama_mitm_response_cache_evictions_total", "Responses evicted from the cache.",
+               "counter", responseCache.GetEvictions());
+    writeValue("ollama_mitm_response_cache_used_bytes", "Bytes used by the response cache.",
+               "gauge", responseCache.GetUsedBytes());
+    writeValue("ollama_mitm_embed_batches_total", "Batched /api/embed calls sent to Ollama.",
+               "counter", embedBatcher.GetBatchesCount());
+    writeValue("ollama_mitm_embed_batched_inputs_total", "Inputs sent to Ollama within batches.",
+               "counter", embedBatcher.GetBatchedInputsCount());
+    writeValue("ollama_mitm_embed_pending_inputs", "Inputs waiting for their batch.", "gauge",
+               embedBatcher.GetPendingInputsCount());
+    writeValue("ollama_mitm_embedding_cache_hits_total", "Embeddings served from the cache.",
+               "counter", embeddingCache.GetHits());
+    writeValue("ollama_mitm_embedding_cache_misses_total", "Embeddings not found in the cache.",
+               "counter", embeddingCache.GetMisses());
+    writeValue("ollama_mitm_embedding_cache_clears_total", "Full embedding cache clearings.",
+               "counter", embeddingCache.GetClears());
+    writeValue("ollama_mitm_metadata_cache_hits_total", "Metadata responses served from cache.",
+               "counter", metadataCache.GetHits());
+    writeValue("ollama_mitm_metadata_cache_misses_total", "Metadata responses not in cache.",
+               "counter", metadataCache.GetMisses());
+    CRegistry::WriteHeader(os, "ollama_mitm_server_in_flight", "Requests in flight by route.",
+                           "gauge");
+    for (std::size_t i = 0; i < CAdmissionControl::kRoutesCount; ++i)
+    {
+        const auto route = static_cast<CAdmissionControl::ERoute>(i);
+        os << "ollama_mitm_server_in_flight"
+           << CRegistry::Braces(MakeLabels({{"route", CAdmissionControl::GetRouteName(route)}}))
+           << ' ' << admissionControl.GetInFlight(route) << '\n';
+    }
+    CRegistry::WriteHeader(os, "ollama_mitm_server_rejected_total",
+                           "Requests rejected with 503 by route limits.", "counter");
+    for (std::size_t i = 0; i < CAdmissionControl::kRoutesCount; ++i)
+    {
+        const auto route = static_cast<CAdmissionControl::ERoute>(i);
+        os << "ollama_mitm_server_rejected_total"
+           << CRegistry::Braces(MakeLabels({{"route", CAdmissionControl::GetRouteName(route)}}))
+           << ' ' << admissionControl.GetRejected(route) << '\n';
+    }
+    writeValue("ollama_mitm_server_queued_connections", "Connections waiting for the worker.",
+               "gauge", admissionControl.GetQueuedConnections());
+    writeValue("ollama_mitm_server_shed_connections_total",
+               "Connections above the queue bound answered with 503.", "counter",
+               admissionControl.GetShedConnections());
+    writeValue("ollama_mitm_server_dropped_connections_total",
+               "Connections closed without response under overload.", "counter",
+               admissionControl.GetDroppedConnections());
+
+    const auto executorStats = executor.stats();
+    writeValue("ollama_mitm_executor_workers", "Workers of the executor.", "gauge",
+               executorStats.workers);
+    writeValue("ollama_mitm_executor_idle_workers", "Workers of the executor waiting for tasks.",
+               "gauge", executorStats.idleWorkers);
+    writeValue("ollama_mitm_executor_queued_tasks", "Commands and jobs waiting for the executor.",
+               "gauge", executorStats.queued);
+    writeValue("ollama_mitm_executor_oldest_queued_microseconds",
+               "How long the oldest queued task waits.", "gauge",
+               static_cast<std::size_t>(executorStats.oldestQueuedWait.count()));
+    writeValue("ollama_mitm_executor_started_tasks_total", "Tasks started by the executor.",
+               "counter", executorStats.startedTasks);
+    writeValue("ollama_mitm_executor_queue_wait_microseconds_total",
+               "Time started tasks spent in the queue.", "counter",
+               static_cast<std::size_t>(executorStats.totalQueueWait.count()));
+    writeValue("ollama_mitm_executor_spawned_workers_total", "Workers added by the executor.",
+               "counter", executorStats.spawnedWorkers);
+    writeValue("ollama_mitm_executor_retired_workers_total", "Idle workers retired.", "counter",
+               executorStats.retiredWorkers);
+    writeValue("ollama_mitm_timer_wheel_timers", "Stream timers armed on the timer wheel.",
+               "gauge", timerWheel.pending());
+    writeValue("ollama_mitm_sessions", "Chat sessions kept in memory.", "gauge",
+               sessionStore.GetSessionsCount());
+    writeValue("ollama_mitm_session_evictions_total", "Sessions evicted from memory.", "counter",
+               sessionStore.GetEvictions());
+    writeValue("ollama_mitm_session_restores_total", "Evicted sessions read back from disk.",
+               "counter", sessionStore.GetRestores());
+    writeValue("ollama_mitm_token_ledger_dropped_total", "Chats not recorded, ledger is full.",
+               "counter", tokenLedger.GetDroppedCount());
+}
+
+bool COllamaProxyServer::IsDebugAllowed(const httplib::Request &request,
+                                        httplib::Response &response) const
+{
+    const auto &address = request.remote_addr;
+    const bool isLoopback =
+      address == "127.0.0.1" || address == "::1" || address == "::ffff:127.0.0.1";
+    if (config.debugEndpoints.isLocalOnly && !isLoopback)
+    {
+        response.status = 403;
+        return false;
+    }
+    return true;
+}
+
+void COllamaProxyServer::HandleGetDebugStreams(const httplib::Request &request,
+                                               httplib::Response &response)
+{
+    if (!IsDebugAllowed(request, response))
+    {
+        return;
+    }
+    response.status = 200;
+    response.set_content(streamRegistry.Describe().dump(), "application/json");
+}
+
+void COllamaProxyServer::HandleCancelDebugStream(const httplib::Request &request,
+                                                 httplib::Response &response)
+{
+    if (!IsDebugAllowed(request, response))
+    {
+        return;
+    }
+    std::uint64_t streamId = 0;
+    try
+    {
+        // Route matches digits only, but they can overflow.
+        streamId = std::stoull(request.matches[1].str());
+    }
+    catch (std::exception &)
+    {
+        response.status = 400;
+        response.set_content(R"({"error":"Invalid stream id."})", "application/json");
+        return;
+    }
+    if (!streamRegistry.Cancel(streamId))
+    {
+        response.status = 404;
+        response.set_content(R"({"error":"No such stream."})", "application/json");
+        return;
+    }
+    config.LogFields(EOllamaProxyVerbosity::Warning, "[WARNING] Stream cancelled by admin.",
+                     [&](auto &record) {
+                         record.Add("stream", streamId).Add("client", request.remote_addr);
+                     });
+    response.status = 200;
+    response.set_content(R"({"cancelled":true})", "application/json");
+}
+
+void COllamaProxyServer::HandleGetDebugUsage(const httplib::Request &request,
+                                             httplib::Response &response)
+{
+    if (!IsDebugAllowed(request, response))
+    {
+        return;
+    }
+    if (!tokenLedger.IsEnabled())
+    {
+        response.status = 404;
+        response.set_content(R"({"error":"Token ledger is disabled."})", "application/json");
+        return;
+    }
+    try
+    {
+        response.status = 200;
+        response.set_content(tokenLedger.Query(ParseUsageQuery(request)).dump(),
+                             "application/json");
+    }
+    catch (std::exception &e)
+    {
+        response.status = 400;
+        response.set_content(nlohmann::json{{"error", e.what()}}.dump(), "application/json");
+    }
+}
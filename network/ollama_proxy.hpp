@@ -1,21 +1,50 @@
 #pragma once
 
+#include "admission_control.hpp"   // IWYU pragma: keep
+#include "embed_batcher.hpp"       // IWYU pragma: keep
+#include "embedding_cache.hpp"     // IWYU pragma: keep
+#include "metadata_cache.hpp"      // IWYU pragma: keep
+#include "model_fallback.hpp"      // IWYU pragma: keep
 #include "ollama_proxy_config.hpp" // IWYU pragma: keep
+#include "passthrough_policy.hpp"  // IWYU pragma: keep
+#include "proxy_metrics.hpp"       // IWYU pragma: keep
+#include "request_trace.hpp"       // IWYU pragma: keep
+#include "response_cache.hpp"      // IWYU pragma: keep
+#include "session_store.hpp"       // IWYU pragma: keep
+#include "single_flight.hpp"       // IWYU pragma: keep
+#include "stream_capture.hpp"      // IWYU pragma: keep
+#include "stream_registry.hpp"     // IWYU pragma: keep
+#include "token_ledger.hpp"        // IWYU pragma: keep
 
 #include <common/cm_ctors.h>
+#include <common/threads_pool.hpp>
+#include <common/timer_wheel.hpp>
+#include <network/chunkedcontentprovider.hpp>
 #include <ollama/httplib.h>
 #include <ollama/ollama.hpp>
 
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <ostream>
+#include <string>
+
 class COllamaProxyServer
 {
   public:
     NO_COPYMOVE(COllamaProxyServer);
     COllamaProxyServer();
-    ~COllamaProxyServer() = default;
+    ~COllamaProxyServer();
     explicit COllamaProxyServer(TOllamaProxyConfig config);
 
     /// @brief Starts the proxy server on a specified port.
     void Start(int listenOnPort);
+    /// @brief Binds any free port, so clients can connect before ListenAfterBind() is called.
+    /// @returns Port which is bound.
+    /// @throws std::runtime_error if no port can be bound.
+    int BindToAnyPort(const std::string &host = "127.0.0.1");
+    /// @brief Serves the port bound by BindToAnyPort() until Stop(), blocks.
+    void ListenAfterBind();
     /// @brief Stops the proxy server.
     void Stop();
 
@@ -30,10 +59,73 @@ class COllamaProxyServer
     Ollama CreateOllamaObject() const;
 
     void DefaultProxyEverything(const httplib::Request &request, httplib::Response &response) const;
-    void HandlePostApiChat(const httplib::Request &userRequest,
-                           httplib::Response &responseToUser) const;
+    void HandlePostApiChat(const httplib::Request &userRequest, httplib::Response &responseToUser);
+    /// @brief Forwards the chat to Ollama as it is, the stream is relayed on the connection thread.
+    void ForwardChat(const httplib::Request &userRequest, httplib::Response &responseToUser,
+                     const CPassthroughPolicy::TDecision &decision);
+    /// @brief Subscribes the user to the running generation of the same chat.
+    void ServeJoinedChat(const httplib::Request &userRequest,
+                         std::shared_ptr<CChunkedContentProvider> flight,
+                         const CTraceExporter::TTracePtr &trace, httplib::Response &responseToUser);
+    /// @brief Sends the rest of the chat stream to the user who lost the connection.
+    void ResumeChat(const httplib::Request &userRequest, httplib::Response &responseToUser);
+    /// @brief Creates or continues the session the chat belongs to.
+    /// @returns std::nullopt and sets the error response if the turn cannot be started.
+    [[nodiscard]]
+    std::optional<CSessionStore::TTurn> StartSessionTurn(const httplib::Request &userRequest,
+                                                         httplib::Response &responseToUser);
+    void HandlePostApiGenerate(const httplib::Request &request, httplib::Response &response);
+    void HandlePostApiEmbed(const httplib::Request &request, httplib::Response &response);
+    void HandlePostApiEmbeddings(const httplib::Request &request, httplib::Response &response);
+    /// @brief Serves metadata endpoints from the short TTL cache.
+    void HandleMetadata(const httplib::Request &request, httplib::Response &response);
+    /// @brief Lists active streams as JSON.
+    void HandleGetDebugStreams(const httplib::Request &request, httplib::Response &response);
+    /// @brief Cancels stream with the id from the path.
+    void HandleCancelDebugStream(const httplib::Request &request, httplib::Response &response);
+    /// @brief Returns token usage totals from the ledger as JSON.
+    void HandleGetDebugUsage(const httplib::Request &request, httplib::Response &response);
+    /// @returns false and sets response if the client may not use debug endpoints.
+    [[nodiscard]]
+    bool IsDebugAllowed(const httplib::Request &request, httplib::Response &response) const;
+    /// @brief Serves metrics in Prometheus text format.
+    static void HandleGetMetrics(const httplib::Request &request, httplib::Response &response);
+    /// @brief Writes counters of the proxy components, called on each /metrics scrape.
+    void CollectMetrics(std::ostream &os) const;
+
+    /// @brief Posts JSON body to Ollama and @returns its reply.
+    [[nodiscard]]
+    CEmbedBatcher::TReply PostToOllama(const std::string &path, const std::string &body) const;
+    /// @brief Sends /api/embed to Ollama, through the batcher if request is single-input.
+    CEmbedBatcher::TReply ForwardEmbed(const nlohmann::json &request);
+    /// @brief Answers /api/embed from the cache, only missing inputs are sent to Ollama.
+    CEmbedBatcher::TReply EmbedWithCache(nlohmann::json request);
+
+    /// @brief Replays cached answer if it is deterministic chat which was answered before.
+    /// Otherwise arranges candidate to store its answer once completed.
+    /// @returns true if response was set from the cache.
+    bool ServeCachedChat(CChunkedContentProvider &candidate, httplib::Response &responseToUser);
 
     /// @brief handles incoming user's requests.
     httplib::Server server;
     const TOllamaProxyConfig config;
+    CModelFallback modelFallback;
+    CSingleFlight singleFlight;
+    CResponseCache responseCache;
+    CEmbedBatcher embedBatcher;
+    CEmbeddingCache embeddingCache;
+    CMetadataCache metadataCache;
+    CTokenLedger tokenLedger;
+    CStreamCapture streamCapture;
+    CAdmissionControl admissionControl;
+    CSessionStore sessionStore;
+    CPassthroughPolicy passthroughPolicy;
+    // Drives timers of all streams.
+    utility::CTimerWheel timerWheel;
+    // Parks streams on the timer wheel.
+    CStreamRegistry streamRegistry;
+    // Tasks use members above, so it is destroyed first.
+    utility::CThreadPool executor;
+    std::shared_ptr<CTraceExporter> traceExporter;
+    std::size_t metricsCollectorId;
 };
@@ -1,12 +1,19 @@
 #pragma once
 
 #include <commands/ollama_commands.hpp>
+#include <common/async_logger.h>
 
 #include <cctype>
+#include <chrono>
+#include <cstddef>
 #include <cstdint>
 #include <iostream>
 #include <ostream>
+#include <sstream>
 #include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
 
 enum class EOllamaProxyVerbosity : std::uint8_t {
     Silent = 0,
@@ -15,6 +22,210 @@ enum class EOllamaProxyVerbosity : std::uint8_t {
     Debug = 0xFF,
 };
 
+#ifndef OLLAMA_MITM_MAX_VERBOSITY
+    #define OLLAMA_MITM_MAX_VERBOSITY 0xFF
+#endif
+
+/// @brief Messages above this level are removed at compile time.
+constexpr auto kMaxCompiledVerbosity =
+  static_cast<EOllamaProxyVerbosity>(OLLAMA_MITM_MAX_VERBOSITY);
+
+/// @returns true if messages of that level are not removed at compile time.
+constexpr bool IsCompiledVerbosity(const EOllamaProxyVerbosity value)
+{
+    return static_cast<std::uint8_t>(value) <= static_cast<std::uint8_t>(kMaxCompiledVerbosity);
+}
+
+/// @brief Load-shedding: when a model is saturated, requests are served by the smaller one.
+struct TModelFallbackConfig
+{
+    /// @brief Maps saturated model to its fallback, e.g. "llama3:70b" -> "llama3:8b".
+    std::unordered_map<std::string, std::string> fallbacks;
+    /// @brief Model is saturated when that many chats are in flight to it. 0 disables the check.
+    std::size_t maxQueueDepth{0};
+    /// @brief Model is saturated when its averaged time to first token exceeds this value while it
+    /// still has chats in flight. 0 disables the check.
+    std::chrono::milliseconds maxLatency{0};
+};
+
+/// @brief Persistent cache of the deterministic (temperature 0 with seed) chat and generate
+/// responses. Opt-in.
+struct TResponseCacheConfig
+{
+    /// @brief File of the store. Empty path disables the cache.
+    std::string path;
+    /// @brief Size of the store file. Least recently used responses are dropped to fit it.
+    std::size_t maxBytes{256u * 1024u * 1024u};
+    /// @brief Responses bigger than this are not stored.
+    std::size_t maxEntryBytes{4u * 1024u * 1024u};
+};
+
+/// @brief Micro-batching of the single-input /api/embed requests.
+struct TEmbedBatchConfig
+{
+    /// @brief Batch is sent when it has that many inputs. 0 or 1 disables batching.
+    std::size_t maxBatchSize{16};
+    /// @brief Batch is sent when its first input waited that long.
+    std::chrono::microseconds maxWait{1000};
+    /// @brief How many batches can be in flight to Ollama at once.
+    std::size_t maxConcurrentBatches{4};
+};
+
+/// @brief Persistent cache of the embedding vectors for /api/embed and /api/embeddings. Opt-in.
+struct TEmbeddingCacheConfig
+{
+    /// @brief File of the store. Empty path disables the cache.
+    std::string path;
+    /// @brief How many vectors can be stored, rounded up to the power of 2.
+    std::size_t maxVectors{1u << 17u};
+    /// @brief How many bytes all stored vectors and their keys can take in total. File of the store
+    /// is this big, it is cleared and reused once it is full.
+    std::size_t maxBytes{256u * 1024u * 1024u};
+};
+
+/// @brief Short TTL cache of the metadata endpoints. Everything is dropped when models are pulled,
+/// created, copied or deleted through the proxy.
+struct TMetadataCacheConfig
+{
+    /// @brief Endpoints to cache and time to keep their responses. Missing endpoint is not cached.
+    std::unordered_map<std::string, std::chrono::milliseconds> ttlPerPath{
+      {"/api/tags", std::chrono::seconds{5}},
+      {"/api/ps", std::chrono::seconds{1}},
+      {"/api/show", std::chrono::seconds{30}},
+      {"/api/version", std::chrono::seconds{60}},
+    };
+};
+
+/// @brief Per-request trace spans exported as Chrome trace events (JSON). Opt-in.
+struct TTracingConfig
+{
+    /// @brief Share of the requests traced, from 0 (tracing is disabled) to 1 (every request).
+    double sampleRate{0.0};
+    /// @brief File where trace events are appended. Empty path disables file export.
+    std::string path;
+    /// @brief Collector which receives batches of events as JSON array by POST, like
+    /// "http://localhost:9411/traces". Empty URL disables it.
+    std::string collectorUrl;
+};
+
+/// @brief Introspection endpoints under /debug, like the list of active streams.
+struct TDebugEndpointsConfig
+{
+    bool isEnabled{true};
+    /// @brief Only loopback clients can use the endpoints.
+    bool isLocalOnly{true};
+};
+
+/// @brief Records raw upstream chat streams with their timings for the replay. Opt-in.
+struct TStreamCaptureConfig
+{
+    /// @brief File where streams are appended. Empty path disables the capture.
+    std::string path;
+    /// @brief Streams are not captured once file has that size.
+    std::size_t maxBytes{1024u * 1024u * 1024u};
+};
+
+/// @brief Limits of the proxy's own HTTP server. Requests above them get 503 with Retry-After at
+/// once instead of waiting in the invisible queue.
+struct TServerLimitsConfig
+{
+    /// @brief Workers serving connections, each one serves a single connection at a time.
+    std::size_t workerThreads{64};
+    /// @brief Accepted connections waiting for the worker, 0 is unbounded.
+    std::size_t maxQueuedConnections{128};
+    /// @brief Requests in flight per route. 0 is unlimited. Chat and embed limits together are
+    /// kept below workerThreads, the rest of the workers serve metadata calls and idle keep-alive
+    /// connections. Pulls and other forwarded routes are rare, so they are not limited.
+    std::size_t maxChatRequests{32};
+    std::size_t maxEmbedRequests{16};
+    std::size_t maxMetadataRequests{0};
+    std::size_t maxOtherRequests{0};
+    /// @brief Value of the Retry-After header of the rejected requests.
+    std::chrono::seconds retryAfter{1};
+};
+
+/// @brief Shared pool of the proxy for backend commands and background jobs. Commands can block
+/// on disk or local services, so pool grows while its queue is late and shrinks when idle.
+struct TExecutorConfig
+{
+    /// @brief Workers kept even when idle.
+    std::size_t minWorkerThreads{2};
+    /// @brief Upper limit of workers. 0 executes everything on the threads of the streams.
+    std::size_t maxWorkerThreads{32};
+    /// @brief Worker is added once the oldest queued task waits longer.
+    std::chrono::milliseconds targetQueueWait{20};
+    /// @brief Worker above the minimum exits after being idle that long.
+    std::chrono::milliseconds idleTimeout{60000};
+};
+
+/// @brief Timers of the chat streams. All streams share single timer wheel of the proxy.
+struct TStreamTimersConfig
+{
+    /// @brief Resolution of the timer wheel.
+    std::chrono::milliseconds tick{10};
+    /// @brief User gets the chunk without content when it did not receive anything that long
+    /// while Ollama evaluates the prompt or command executes. Interval is half of the model's
+    /// averaged time to first token, bounded by these values, so slow models keep the connection
+    /// long before client's timeout.
+    std::chrono::milliseconds minHeartbeat{2000};
+    std::chrono::milliseconds maxHeartbeat{15000};
+    /// @brief Stream is cancelled once Ollama stops sending chunks of the answer that long. 0
+    /// disables the check.
+    std::chrono::milliseconds stallTimeout{120000};
+    /// @brief Stream is cancelled once users do not take its output that long. 0 disables the
+    /// check.
+    std::chrono::milliseconds idleTimeout{300000};
+    /// @brief Stream is cancelled once it lasts that long. 0 disables the deadline. Users can
+    /// ask for the shorter one with X-Ollama-Mitm-Deadline-Ms header, up to a day.
+    std::chrono::milliseconds deadline{0};
+};
+
+/// @brief Chat streams which users can resume after the lost connection instead of regenerating
+/// them. User sends X-Ollama-Mitm-Stream header with the id of the stream and
+/// X-Ollama-Mitm-Offset header with the number of lines it got.
+struct TStreamResumeConfig
+{
+    /// @brief How many latest lines of each stream are kept for the replay. 0 keeps all of them.
+    /// Lines which connected users did not read yet are kept above that, so slow users never lose
+    /// them.
+    std::size_t replayLines{4096};
+    /// @brief Stream which the last user left unread keeps generating that long waiting for the
+    /// user to come back, then it is cancelled. 0 cancels it at once, so only streams still read by
+    /// others can be resumed.
+    std::chrono::milliseconds linger{0};
+};
+
+/// @brief Chats forwarded to Ollama as they are, without backend commands and other interception.
+struct TPassthroughConfig
+{
+    /// @brief False forwards every chat.
+    bool isChatIntercepted{true};
+    /// @brief Models which chats are forwarded, like the ones not trained to use commands.
+    std::unordered_set<std::string> models;
+    /// @brief Client can ask to forward its chat with "X-Ollama-Mitm-Intercept: off".
+    bool isHeaderHonored{true};
+};
+
+/// @brief Conversations kept by the proxy, so clients send only the new messages of each turn.
+struct TSessionConfig
+{
+    /// @brief How many sessions are kept in memory. 0 disables sessions.
+    std::size_t maxSessions{1024};
+    /// @brief Total size of the kept conversations as JSON.
+    std::size_t maxBytes{256 * 1024 * 1024};
+    /// @brief Evicted sessions are written there and read back once continued. Empty drops them.
+    std::string spillDirectory;
+};
+
+/// @brief Persistent per-chat token usage for capacity planning. Opt-in.
+struct TTokenLedgerConfig
+{
+    /// @brief File of the ledger. Empty path disables the ledger.
+    std::string path;
+    /// @brief How many chats can be recorded, 192 bytes each. Ledger never shrinks.
+    std::size_t maxRecords{1u << 20u};
+};
+
 struct TOllamaProxyConfig
 {
     EOllamaProxyVerbosity verbosity{EOllamaProxyVerbosity::Silent};
@@ -22,12 +233,35 @@ struct TOllamaProxyConfig
     int ollamaPort{11434};
     std::ostream &outStream{std::cout};
     std::ostream &errorStream{std::cerr};
+    /// @brief Log is written by the background thread, so callers never wait for the streams.
+    /// Streams must outlive the logger or logging::CAsyncLogger::Flush() must be called.
+    bool asyncLogging{true};
+    logging::ELogFormat logFormat{logging::ELogFormat::Text};
+    TModelFallbackConfig modelFallback{};
+    /// @brief Identical deterministic chats (temperature 0 with seed) in flight share single
+    /// generation.
+    bool coalesceDeterministicChats{true};
+    TResponseCacheConfig responseCache{};
+    TEmbedBatchConfig embedBatch{};
+    TEmbeddingCacheConfig embeddingCache{};
+    TMetadataCacheConfig metadataCache{};
+    TTracingConfig tracing{};
+    TDebugEndpointsConfig debugEndpoints{};
+    TTokenLedgerConfig tokenLedger{};
+    TStreamCaptureConfig streamCapture{};
+    TExecutorConfig executor{};
+    TServerLimitsConfig serverLimits{};
+    TStreamTimersConfig streamTimers{};
+    TStreamResumeConfig streamResume{};
+    TSessionConfig sessions{};
+    TPassthroughConfig passthrough{};
 
     /// @brief Checks if the verbosity level is fitting.
     [[nodiscard]]
     bool IsFittingVerbosity(const EOllamaProxyVerbosity value) const
     {
-        return static_cast<std::uint8_t>(verbosity) >= static_cast<std::uint8_t>(value);
+        return IsCompiledVerbosity(value)
+               && static_cast<std::uint8_t>(verbosity) >= static_cast<std::uint8_t>(value);
     }
 
     /// @brief Executes the given function if the verbosity level is fitting. Usable for logging.
@@ -39,12 +273,46 @@ struct TOllamaProxyConfig
     template <typename taFunc>
     void ExecIfFittingVerbosity(const EOllamaProxyVerbosity value, const taFunc &func) const
     {
-        if (IsFittingVerbosity(value))
+        if (!IsFittingVerbosity(value))
+        {
+            return;
+        }
+        if (!asyncLogging)
+        {
+            func(GetLogStream(value));
+            return;
+        }
+        std::ostringstream os;
+        func(os);
+        Submit(MakeLogRecord(value, os.str()));
+    }
+
+    /// @brief The same as above, but the call is removed at compile time if level is compiled out.
+    template <EOllamaProxyVerbosity taValue, typename taFunc>
+    void ExecIfFittingVerbosity(const taFunc &func) const
+    {
+        if constexpr (IsCompiledVerbosity(taValue))
         {
-            func(value == EOllamaProxyVerbosity::Error ? errorStream : outStream);
+            ExecIfFittingVerbosity(taValue, func);
         }
     }
 
+    /// @brief Logs structured record.
+    /// @param addFields called with logging::TLogRecord& to add key/value fields, only if level
+    /// is fitting.
+    template <typename taFunc>
+    void LogFields(const EOllamaProxyVerbosity value, std::string message,
+                   const taFunc &addFields) const
+    {
+        if (!IsFittingVerbosity(value))
+        {
+            return;
+        }
+        auto record = MakeLogRecord(value, std::move(message));
+        addFields(record);
+        Submit(std::move(record));
+    }
+
     /// @brief Checks if the configuration is valid.
     [[nodiscard]]
     bool Validate() const
@@ -72,10 +340,47 @@ struct TOllamaProxyConfig
         return "http://" + ollamaHost + ":" + std::to_string(ollamaPort);
     }
 
+    /// @returns Stream for messages of the level.
+    [[nodiscard]]
+    std::ostream &GetLogStream(const EOllamaProxyVerbosity value) const
+    {
+        return value == EOllamaProxyVerbosity::Error ? errorStream : outStream;
+    }
+
     /// @returns A reference to the list of AI commands.
     [[nodiscard]]
     const TAiCommands &GetAiCommands() const
     {
         return GetAiCommandsList();
     }
+
+  private:
+    [[nodiscard]]
+    logging::TLogRecord MakeLogRecord(const EOllamaProxyVerbosity value, std::string message) const
+    {
+        logging::TLogRecord record;
+        record.time = std::chrono::system_clock::now();
+        record.level = static_cast<std::uint8_t>(value);
+        record.destination = &GetLogStream(value);
+        record.format = logFormat;
+        record.message = std::move(message);
+        return record;
+    }
+
+    void Submit(logging::TLogRecord record) const
+    {
+        if (asyncLogging)
+        {
+            logging::CAsyncLogger::Instance().Submit(std::move(record));
+            return;
+        }
+        if (logFormat == logging::ELogFormat::Binary)
+        {
+            logging::CAsyncLogger::WriteBinary(*record.destination, record);
+        }
+        else
+        {
+            logging::CAsyncLogger::WriteText(*record.destination, record);
+        }
+    }
 };
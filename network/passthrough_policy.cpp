@@ -0,0 +1,77 @@
+#include "passthrough_policy.hpp" // IWYU pragma: keep
+
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <string>
+
+namespace {
+constexpr auto kModelKey = "model";
+constexpr auto kStreamKey = "stream";
+constexpr auto kInterceptionOff = "off";
+
+/// @returns Object with the top level "model" and "stream" of the chat only, messages are skipped
+/// while parsing instead of being built.
+nlohmann::json ParseChatHead(const std::string &body)
+{
+    return nlohmann::json::parse(
+      body,
+      [](int depth, nlohmann::json::parse_event_t event, nlohmann::json &parsed) {
+          if (event == nlohmann::json::parse_event_t::key)
+          {
+              return depth == 1 && (parsed == kModelKey || parsed == kStreamKey);
+          }
+          return true;
+      },
+      false);
+}
+} // namespace
+
+CPassthroughPolicy::CPassthroughPolicy(const TPassthroughConfig &config) :
+    config(config)
+{
+}
+
+CPassthroughPolicy::TDecision CPassthroughPolicy::Decide(const std::string &interceptHeader,
+                                                         const std::string &body) const
+{
+    TDecision decision;
+    const bool isHeaderOff = config.isHeaderHonored && interceptHeader == kInterceptionOff;
+    // Intercepted chat is parsed by the pipeline anyway, so it is not parsed twice.
+    if (config.isChatIntercepted && !isHeaderOff && config.models.empty())
+    {
+        return decision;
+    }
+    const auto head = ParseChatHead(body);
+    if (head.is_discarded() || !head.is_object())
+    {
+        return decision;
+    }
+    if (head.contains(kModelKey) && head[kModelKey].is_string())
+    {
+        decision.model = head[kModelKey].get<std::string>();
+    }
+    // Ollama streams unless it is told otherwise.
+    const bool isStream = !head.contains(kStreamKey) || head[kStreamKey] != false;
+    const bool isForwarded =
+      !config.isChatIntercepted || isHeaderOff || config.models.count(decision.model) > 0;
+    if (isForwarded)
+    {
+        decision.route = isStream ? ERoute::Streamed : ERoute::Buffered;
+    }
+    return decision;
+}
+
+const char *CPassthroughPolicy::ToString(ERoute route)
+{
+    switch (route)
+    {
+        case ERoute::Intercepted:
+            return "intercepted";
+        case ERoute::Streamed:
+            return "streamed";
+        case ERoute::Buffered:
+            return "buffered";
+    }
+    return "unknown";
+}
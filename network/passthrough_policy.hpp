@@ -0,0 +1,48 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/ollama_proxy_config.hpp>
+
+#include <cstdint>
+#include <string>
+
+/// @brief Decides per model and client if the chat needs interception, others are forwarded to
+/// Ollama as they are.
+class CPassthroughPolicy
+{
+  public:
+    /// @brief How the chat is served.
+    enum class ERoute : std::uint8_t {
+        /// @brief Full pipeline with backend commands.
+        Intercepted,
+        /// @brief Forwarded, the stream is relayed while Ollama writes it.
+        Streamed,
+        /// @brief Forwarded, the single response of "stream": false is relayed once received.
+        Buffered,
+    };
+
+    struct TDecision
+    {
+        ERoute route{ERoute::Intercepted};
+        /// @brief Requested model, empty if the chat has none or no rule could forward it, so
+        /// the body was not read.
+        std::string model;
+    };
+
+    NO_COPYMOVE(CPassthroughPolicy);
+    CPassthroughPolicy() = delete;
+    ~CPassthroughPolicy() = default;
+    explicit CPassthroughPolicy(const TPassthroughConfig &config);
+
+    /// @param interceptHeader value of the X-Ollama-Mitm-Intercept header, empty if it is not set.
+    /// @param body chat as sent by the user, only its top level fields are read. Malformed one is
+    /// intercepted, so the pipeline reports the error.
+    [[nodiscard]]
+    TDecision Decide(const std::string &interceptHeader, const std::string &body) const;
+
+    [[nodiscard]]
+    static const char *ToString(ERoute route);
+
+  private:
+    const TPassthroughConfig &config;
+};
@@ -0,0 +1,194 @@
+#include "proxy_metrics.hpp" // IWYU pragma: keep
+
+#include <common/metrics.h>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+
+namespace proxy_metrics {
+
+namespace {
+constexpr double kMicrosecondsInSecond = 1e6;
+constexpr auto kOtherLabel = "other";
+// Each model label costs a few histograms which are never freed.
+constexpr std::size_t kMaxKnownModels = 256;
+
+struct TKnownModels
+{
+    std::mutex mutex;
+    std::unordered_set<std::string> names;
+};
+
+TKnownModels &GetKnownModels()
+{
+    static TKnownModels known;
+    return known;
+}
+} // namespace
+
+metrics::CRegistry &GetRegistry()
+{
+    static metrics::CRegistry registry;
+    return registry;
+}
+
+std::string NormalizeRoute(const std::string &path)
+{
+    static constexpr std::string_view kApiPrefix = "/api/";
+    static constexpr std::size_t kMaxRouteLength = 32;
+    if (path.size() > kMaxRouteLength || path.rfind(kApiPrefix, 0) != 0)
+    {
+        return kOtherLabel;
+    }
+    for (std::size_t i = kApiPrefix.size(); i < path.size(); ++i)
+    {
+        if (path[i] < 'a' || path[i] > 'z')
+        {
+            return kOtherLabel;
+        }
+    }
+    return path;
+}
+
+void AddKnownModel(const std::string &model)
+{
+    if (model.empty())
+    {
+        return;
+    }
+    auto &known = GetKnownModels();
+    const std::lock_guard lock(known.mutex);
+    if (known.names.size() < kMaxKnownModels)
+    {
+        known.names.insert(model);
+    }
+}
+
+std::string NormalizeModel(const std::string &model)
+{
+    // Requests without model keep the empty label.
+    if (model.empty())
+    {
+        return model;
+    }
+    auto &known = GetKnownModels();
+    const std::lock_guard lock(known.mutex);
+    return known.names.count(model) > 0 ? model : kOtherLabel;
+}
+
+std::uint64_t MicrosecondsSince(std::chrono::steady_clock::time_point since)
+{
+    const auto passed = std::chrono::steady_clock::now() - since;
+    return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(passed).count());
+}
+
+metrics::CCounter &Requests(const std::string &route, const std::string &model)
+{
+    return GetRegistry().GetCounter("ollama_mitm_requests_total",
+                                    "Requests received from the users.",
+                                    metrics::MakeLabels(
+                                      {{"route", route}, {"model", NormalizeModel(model)}}));
+}
+
+metrics::CHistogram &TimeToFirstToken(const std::string &model)
+{
+    return GetRegistry().GetHistogram("ollama_mitm_time_to_first_token_seconds",
+                                      "Time from chat start until Ollama sent the first chunk.",
+                                      metrics::MakeLabels({{"model", NormalizeModel(model)}}),
+                                      kMicrosecondsInSecond);
+}
+
+metrics::CHistogram &TokensPerSecond(const std::string &model)
+{
+    return GetRegistry().GetHistogram("ollama_mitm_tokens_per_second",
+                                      "Generation speed reported by Ollama in the final chunk.",
+                                      metrics::MakeLabels({{"model", NormalizeModel(model)}}));
+}
+
+metrics::CHistogram &UpstreamConnect(const std::string &route)
+{
+    return GetRegistry().GetHistogram(
+      "ollama_mitm_upstream_connect_seconds",
+      "Time to connect to Ollama and receive its response headers.",
+      metrics::MakeLabels({{"route", route}}), kMicrosecondsInSecond);
+}
+
+metrics::CCounter &CommandRoundTrips(const std::string &keyword)
+{
+    return GetRegistry().GetCounter("ollama_mitm_command_round_trips_total",
+                                    "Backend commands requested by the model.",
+                                    metrics::MakeLabels({{"keyword", keyword}}));
+}
+
+metrics::CHistogram &CommandRoundTripLatency(const std::string &keyword)
+{
+    return GetRegistry().GetHistogram(
+      "ollama_mitm_command_round_trip_seconds",
+      "Time from command detection until its result was answered by Ollama or sent to the user.",
+      metrics::MakeLabels({{"keyword", keyword}}), kMicrosecondsInSecond);
+}
+
+metrics::CHistogram &RestoratorBufferingDelay(const std::string &model)
+{
+    return GetRegistry().GetHistogram(
+      "ollama_mitm_restorator_buffering_seconds",
+      "Time text was held back while checking it for backend commands.",
+      metrics::MakeLabels({{"model", NormalizeModel(model)}}), kMicrosecondsInSecond);
+}
+
+metrics::CGauge &ActiveStreams()
+{
+    return GetRegistry().GetGauge("ollama_mitm_active_streams",
+                                  "Chats currently generated by Ollama.");
+}
+
+metrics::CCounter &Heartbeats(const std::string &model)
+{
+    return GetRegistry().GetCounter("ollama_mitm_stream_heartbeats_total",
+                                    "Keep-alive chunks sent while Ollama or command was silent.",
+                                    metrics::MakeLabels({{"model", NormalizeModel(model)}}));
+}
+
+metrics::CCounter &StreamTimeouts(const std::string &reason)
+{
+    return GetRegistry().GetCounter("ollama_mitm_stream_timeouts_total",
+                                    "Streams cancelled by the stream timers.",
+                                    metrics::MakeLabels({{"reason", reason}}));
+}
+
+metrics::CCounter &StreamResumes(const std::string &outcome)
+{
+    return GetRegistry().GetCounter("ollama_mitm_stream_resumes_total",
+                                    "Users who asked to resume the lost chat stream.",
+                                    metrics::MakeLabels({{"outcome", outcome}}));
+}
+
+metrics::CCounter &PassedThroughChats(const std::string &route)
+{
+    return GetRegistry().GetCounter("ollama_mitm_chat_passthrough_total",
+                                    "Chats forwarded to Ollama without interception.",
+                                    metrics::MakeLabels({{"route", route}}));
+}
+
+metrics::CCounter &UpstreamAborts(const std::string &model)
+{
+    return GetRegistry().GetCounter("ollama_mitm_upstream_aborted_total",
+                                    "Ollama calls aborted because the user left or time ran out.",
+                                    metrics::MakeLabels({{"model", NormalizeModel(model)}}));
+}
+
+metrics::CHistogram &UpstreamSavedGpuTime(const std::string &model)
+{
+    return GetRegistry().GetHistogram(
+      "ollama_mitm_upstream_saved_gpu_seconds",
+      "Expected prompt evaluation time left when Ollama call was aborted.",
+      metrics::MakeLabels({{"model", NormalizeModel(model)}}), kMicrosecondsInSecond);
+}
+
+} // namespace proxy_metrics
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <common/metrics.h>
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+/// @brief Metrics of the proxy pipeline exported by /metrics. Getters take a lock to find the
+/// labeled series, so hot paths resolve them once per request and then only update them.
+namespace proxy_metrics {
+
+/// @returns Registry shared by the whole process.
+metrics::CRegistry &GetRegistry();
+
+/// @returns Route label for the path, unknown paths are collapsed to keep cardinality bounded.
+std::string NormalizeRoute(const std::string &path);
+
+/// @brief Allows the model as the label. Configured models and models which Ollama served are
+/// known, the number of them is bounded.
+void AddKnownModel(const std::string &model);
+
+/// @returns Model label, unknown models are collapsed to "other", so clients sending random names
+/// cannot grow the registry. Getters below apply it themselves.
+std::string NormalizeModel(const std::string &model);
+
+/// @returns Microseconds passed since the time point.
+std::uint64_t MicrosecondsSince(std::chrono::steady_clock::time_point since);
+
+metrics::CCounter &Requests(const std::string &route, const std::string &model);
+metrics::CHistogram &TimeToFirstToken(const std::string &model);
+metrics::CHistogram &TokensPerSecond(const std::string &model);
+/// @brief Connect to Ollama plus time until its response headers are received.
+metrics::CHistogram &UpstreamConnect(const std::string &route);
+metrics::CCounter &CommandRoundTrips(const std::string &keyword);
+/// @brief From the moment command was detected until Ollama answered its result.
+metrics::CHistogram &CommandRoundTripLatency(const std::string &keyword);
+/// @brief How long CContentRestorator held text back while looking for commands.
+metrics::CHistogram &RestoratorBufferingDelay(const std::string &model);
+metrics::CGauge &ActiveStreams();
+/// @brief Pings sent to the users waiting for the first token or command.
+metrics::CCounter &Heartbeats(const std::string &model);
+/// @brief Streams cancelled by the stall, idle or deadline timer.
+metrics::CCounter &StreamTimeouts(const std::string &reason);
+/// @brief Attempts to resume the stream, outcome is "resumed" or "gone".
+metrics::CCounter &StreamResumes(const std::string &outcome);
+/// @brief Chats forwarded to Ollama without interception, route is "streamed" or "buffered".
+metrics::CCounter &PassedThroughChats(const std::string &route);
+/// @brief Ollama calls aborted because the user left or the deadline passed.
+metrics::CCounter &UpstreamAborts(const std::string &model);
+/// @brief Expected rest of prompt evaluation which Ollama did not spend on aborted calls.
+metrics::CHistogram &UpstreamSavedGpuTime(const std::string &model);
+
+} // namespace proxy_metrics
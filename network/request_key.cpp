@@ -0,0 +1,56 @@
+#include "request_key.hpp" // IWYU pragma: keep
+
+#include <ollama/json.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+namespace {
+constexpr std::uint64_t kFnvOffsetBasis = 14695981039346656037ull;
+constexpr std::uint64_t kFnvPrime = 1099511628211ull;
+
+// Fields of the request which do not change generated text.
+constexpr const char *kIgnoredFields[] = {"stream", "keep_alive"};
+} // namespace
+
+std::uint64_t HashFnv1a(std::string_view data)
+{
+    std::uint64_t hash = kFnvOffsetBasis;
+    for (const char ch : data)
+    {
+        hash ^= static_cast<unsigned char>(ch);
+        hash *= kFnvPrime;
+    }
+    return hash;
+}
+
+bool IsDeterministicRequest(const nlohmann::json &request)
+{
+    constexpr auto kOptionsKey = "options";
+    if (!request.contains(kOptionsKey) || !request[kOptionsKey].is_object())
+    {
+        return false;
+    }
+    const auto &options = request[kOptionsKey];
+    const auto temperature = options.find("temperature");
+    const auto seed = options.find("seed");
+    return temperature != options.end() && temperature->is_number() && *temperature == 0
+           && seed != options.end() && seed->is_number_integer();
+}
+
+std::optional<std::string> MakeCanonicalRequest(const nlohmann::json &request)
+{
+    if (!IsDeterministicRequest(request))
+    {
+        return std::nullopt;
+    }
+    auto normalized = request;
+    for (const auto *field : kIgnoredFields)
+    {
+        normalized.erase(field);
+    }
+    // nlohmann::json keeps object keys sorted, so dump() is canonical already.
+    return normalized.dump();
+}
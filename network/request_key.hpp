@@ -0,0 +1,20 @@
+#pragma once
+
+#include <ollama/json.hpp>
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/// @returns 64-bit FNV-1a hash of the data. It is stable between runs and platforms.
+std::uint64_t HashFnv1a(std::string_view data);
+
+/// @brief Checks if request asks for deterministic output, i.e. it has "temperature" set to 0 and
+/// fixed "seed" in the "options".
+bool IsDeterministicRequest(const nlohmann::json &request);
+
+/// @brief Builds canonical form of the request which produces deterministic output. Fields which do
+/// not affect generated text (like "stream" or "keep_alive") are ignored, object keys are sorted.
+/// @returns std::nullopt if request is not deterministic.
+std::optional<std::string> MakeCanonicalRequest(const nlohmann::json &request);
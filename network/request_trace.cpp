@@ -0,0 +1,236 @@
+#include "request_trace.hpp" // IWYU pragma: keep
+
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/httplib.h>
+#include <ollama/json.hpp>
+
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+
+std::int64_t ToMicroseconds(CTraceExporter::TClock::time_point time)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(time.time_since_epoch()).count();
+}
+
+/// @returns Lane of the current thread in the trace viewer.
+std::size_t GetThreadLane()
+{
+    return std::hash<std::thread::id>{}(std::this_thread::get_id()) % 100000;
+}
+
+} // namespace
+
+CTraceExporter::CTraceExporter(const TTracingConfig &config) :
+    config(config)
+{
+    if (!IsEnabled())
+    {
+        return;
+    }
+    if (!config.path.empty())
+    {
+        file.open(config.path, std::ios::out | std::ios::app);
+        // JSON array format, the closing bracket is optional for the viewers, so file can be
+        // appended forever.
+        if (file && file.tellp() == 0)
+        {
+            file << "[\n";
+        }
+    }
+    writer = std::thread([this]() {
+        WriterLoop();
+    });
+}
+
+CTraceExporter::~CTraceExporter()
+{
+    {
+        const std::lock_guard lock(mutex);
+        isStopping = true;
+    }
+    wakeUp.notify_all();
+    if (writer.joinable())
+    {
+        writer.join();
+    }
+}
+
+bool CTraceExporter::IsEnabled() const
+{
+    return config.sampleRate > 0 && (!config.path.empty() || !config.collectorUrl.empty());
+}
+
+bool CTraceExporter::IsSampled()
+{
+    // Deterministic sampling: exactly rate * N of N requests are traced.
+    const auto before = std::floor(static_cast<double>(requestsCount) * config.sampleRate);
+    ++requestsCount;
+    return std::floor(static_cast<double>(requestsCount) * config.sampleRate) > before;
+}
+
+CTraceExporter::TTracePtr CTraceExporter::StartTrace(const std::string &name,
+                                                     TClock::time_point startedAt)
+{
+    if (!IsEnabled())
+    {
+        return nullptr;
+    }
+    std::uint64_t traceId = 0;
+    {
+        const std::lock_guard lock(mutex);
+        if (!IsSampled())
+        {
+            return nullptr;
+        }
+        traceId = ++lastTraceId;
+    }
+    return std::make_shared<CRequestTrace>(shared_from_this(), traceId, name, startedAt);
+}
+
+void CTraceExporter::Export(std::vector<nlohmann::json> events)
+{
+    {
+        const std::lock_guard lock(mutex);
+        if (isStopping)
+        {
+            return;
+        }
+        queuedCount += events.size();
+        for (auto &event : events)
+        {
+            queue.emplace_back(std::move(event));
+        }
+    }
+    wakeUp.notify_all();
+}
+
+void CTraceExporter::Flush()
+{
+    std::unique_lock lock(mutex);
+    const auto target = queuedCount;
+    written.wait(lock, [&]() {
+        return writtenCount >= target || isStopping;
+    });
+}
+
+void CTraceExporter::WriterLoop()
+{
+    std::vector<nlohmann::json> batch;
+    std::unique_lock lock(mutex);
+    while (true)
+    {
+        wakeUp.wait(lock, [this]() {
+            return isStopping || !queue.empty();
+        });
+        if (queue.empty() && isStopping)
+        {
+            break;
+        }
+        batch.swap(queue);
+        lock.unlock();
+        Write(batch);
+        lock.lock();
+        writtenCount += batch.size();
+        batch.clear();
+        written.notify_all();
+    }
+}
+
+void CTraceExporter::Write(const std::vector<nlohmann::json> &events)
+{
+    if (file)
+    {
+        for (const auto &event : events)
+        {
+            file << event.dump() << ",\n";
+        }
+        file.flush();
+    }
+
+    if (!config.collectorUrl.empty())
+    {
+        const auto schemeEnd = config.collectorUrl.find("://");
+        const auto pathBegin = config.collectorUrl.find(
+          '/', schemeEnd == std::string::npos ? 0 : schemeEnd + 3);
+        const auto hostPort = config.collectorUrl.substr(0, pathBegin);
+        const auto path =
+          pathBegin == std::string::npos ? "/" : config.collectorUrl.substr(pathBegin);
+        httplib::Client client(hostPort);
+        // Collector is optional, failures are not retried.
+        client.Post(path, nlohmann::json(events).dump(), "application/json");
+    }
+}
+
+CRequestTrace::CRequestTrace(std::shared_ptr<CTraceExporter> exporter, std::uint64_t traceId,
+                             std::string name, TClock::time_point startedAt) :
+    exporter(std::move(exporter)),
+    traceId(traceId),
+    name(std::move(name)),
+    startedAt(startedAt),
+    args(nlohmann::json::object())
+{
+}
+
+CRequestTrace::~CRequestTrace()
+{
+    // Whole request is the root span, process name groups spans of the request in the viewer.
+    AddSpan(name, startedAt, TClock::now(), std::move(args));
+    nlohmann::json processName;
+    processName["name"] = "process_name";
+    processName["ph"] = "M";
+    processName["pid"] = traceId;
+    processName["args"]["name"] = name + " #" + std::to_string(traceId);
+    events.emplace_back(std::move(processName));
+    exporter->Export(std::move(events));
+}
+
+void CRequestTrace::AddSpan(const std::string &spanName, TClock::time_point begin,
+                            TClock::time_point end, nlohmann::json spanArgs)
+{
+    nlohmann::json event;
+    event["name"] = spanName;
+    event["cat"] = "ollama_mitm";
+    event["ph"] = "X";
+    event["ts"] = ToMicroseconds(begin);
+    event["dur"] = ToMicroseconds(end) - ToMicroseconds(begin);
+    event["pid"] = traceId;
+    event["tid"] = GetThreadLane();
+    event["args"] = std::move(spanArgs);
+
+    const std::lock_guard lock(mutex);
+    events.emplace_back(std::move(event));
+}
+
+void CRequestTrace::AddArg(const std::string &key, nlohmann::json value)
+{
+    const std::lock_guard lock(mutex);
+    args[key] = std::move(value);
+}
+
+CRequestTrace::CSpan::CSpan(const std::shared_ptr<CRequestTrace> &trace, std::string name) :
+    trace(trace.get()),
+    name(std::move(name)),
+    startedAt(trace ? TClock::now() : TClock::time_point{}),
+    args(nlohmann::json::object())
+{
+}
+
+CRequestTrace::CSpan::~CSpan()
+{
+    if (trace)
+    {
+        trace->AddSpan(name, startedAt, TClock::now(), std::move(args));
+    }
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class CRequestTrace;
+
+/// @brief Samples requests for tracing and writes finished traces as Chrome trace events (the
+/// "traceEvents" JSON format understood by chrome://tracing and Perfetto) to the file and/or
+/// collector. Writing is done by the background thread.
+class CTraceExporter : public std::enable_shared_from_this<CTraceExporter>
+{
+  public:
+    using TClock = std::chrono::steady_clock;
+    using TTracePtr = std::shared_ptr<CRequestTrace>;
+
+    NO_COPYMOVE(CTraceExporter);
+    CTraceExporter() = delete;
+    ~CTraceExporter();
+    explicit CTraceExporter(const TTracingConfig &config);
+
+    /// @brief Decides if request is sampled and starts its trace. Exporter must be owned by
+    /// std::shared_ptr.
+    /// @param name name of the trace, like "POST /api/chat".
+    /// @param startedAt when request was received.
+    /// @returns nullptr if request is not traced.
+    [[nodiscard]]
+    TTracePtr StartTrace(const std::string &name, TClock::time_point startedAt);
+
+    /// @brief Queues events of the finished trace.
+    void Export(std::vector<nlohmann::json> events);
+
+    /// @brief Blocks until everything exported before is written.
+    void Flush();
+
+  private:
+    [[nodiscard]]
+    bool IsEnabled() const;
+    [[nodiscard]]
+    bool IsSampled();
+    void WriterLoop();
+    void Write(const std::vector<nlohmann::json> &events);
+
+    const TTracingConfig &config;
+    std::mutex mutex;
+    std::condition_variable wakeUp;
+    std::condition_variable written;
+    std::vector<nlohmann::json> queue;
+    std::size_t queuedCount{0};
+    std::size_t writtenCount{0};
+    bool isStopping{false};
+    std::uint64_t requestsCount{0};
+    std::uint64_t lastTraceId{0};
+    std::ofstream file;
+    std::thread writer;
+};
+
+/// @brief Spans of the single request. It is exported when the last owner releases it. Spans can be
+/// added from any thread.
+class CRequestTrace
+{
+  public:
+    using TClock = CTraceExporter::TClock;
+
+    /// @brief Records span from construction to destruction.
+    class CSpan
+    {
+      public:
+        NO_COPYMOVE(CSpan);
+        CSpan() = delete;
+        ~CSpan();
+
+        /// @param trace can be nullptr, span does nothing then. Trace must outlive the span.
+        CSpan(const std::shared_ptr<CRequestTrace> &trace, std::string name);
+
+        /// @brief Attaches value shown with the span.
+        template <typename taValue>
+        CSpan &Arg(const std::string &key, taValue &&value)
+        {
+            if (trace)
+            {
+                args[key] = std::forward<taValue>(value);
+            }
+            return *this;
+        }
+
+      private:
+        CRequestTrace *trace;
+        std::string name;
+        TClock::time_point startedAt;
+        nlohmann::json args;
+    };
+
+    NO_COPYMOVE(CRequestTrace);
+    CRequestTrace() = delete;
+    ~CRequestTrace();
+    CRequestTrace(std::shared_ptr<CTraceExporter> exporter, std::uint64_t traceId,
+                  std::string name, TClock::time_point startedAt);
+
+    /// @brief Adds finished span.
+    void AddSpan(const std::string &spanName, TClock::time_point begin, TClock::time_point end,
+                 nlohmann::json spanArgs = nlohmann::json::object());
+
+    /// @brief Attaches value to the whole request.
+    void AddArg(const std::string &key, nlohmann::json value);
+
+    [[nodiscard]]
+    std::uint64_t GetId() const
+    {
+        return traceId;
+    }
+
+  private:
+    std::shared_ptr<CTraceExporter> exporter;
+    const std::uint64_t traceId;
+    const std::string name;
+    const TClock::time_point startedAt;
+    std::mutex mutex;
+    std::vector<nlohmann::json> events;
+    nlohmann::json args;
+};
@@ -0,0 +1,363 @@
+#include "response_cache.hpp" // IWYU pragma: keep
+
+#include <network/ollama_proxy_config.hpp>
+#include <network/request_key.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace {
+// Store layout: header, then records appended one by one.
+// Header: magic, capacity, used bytes (offset of the first free byte).
+// Record: hash of the key, key length and bytes, lines count, then each line as length and bytes.
+// All integers are uint64_t.
+constexpr char kMagic[8] = {'O', 'M', 'I', 'T', 'M', 'R', 'C', '2'};
+constexpr std::size_t kCapacityOffset = sizeof(kMagic);
+constexpr std::size_t kUsedOffset = kCapacityOffset + sizeof(std::uint64_t);
+constexpr std::size_t kHeaderSize = 64;
+constexpr std::size_t kMinStoreSize = 64 * 1024;
+
+// Index file contains triplets hash, offset, size for each stored record.
+struct TIndexRecord
+{
+    std::uint64_t hash;
+    std::uint64_t offset;
+    std::uint64_t size;
+};
+
+std::uint64_t ReadU64(const char *from)
+{
+    std::uint64_t value{0};
+    std::memcpy(&value, from, sizeof(value));
+    return value;
+}
+
+char *WriteU64(char *to, std::uint64_t value)
+{
+    std::memcpy(to, &value, sizeof(value));
+    return to + sizeof(value);
+}
+
+std::string IndexPath(const std::string &storePath)
+{
+    return storePath + ".idx";
+}
+
+char *MapStore(int fd, std::size_t size)
+{
+    void *ptr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) // NOLINT
+    {
+        throw std::runtime_error("Failed to mmap response cache store.");
+    }
+    return static_cast<char *>(ptr);
+}
+
+void InitHeader(char *mapped, std::size_t capacity)
+{
+    std::memset(mapped, 0, kHeaderSize);
+    std::memcpy(mapped, kMagic, sizeof(kMagic));
+    WriteU64(mapped + kCapacityOffset, capacity);
+    WriteU64(mapped + kUsedOffset, kHeaderSize);
+}
+} // namespace
+
+CResponseCache::CResponseCache(const TResponseCacheConfig &config) :
+    config(config)
+{
+    if (config.path.empty())
+    {
+        return;
+    }
+    if (config.maxBytes < kMinStoreSize)
+    {
+        throw std::runtime_error("Response cache store is too small.");
+    }
+    Open();
+}
+
+CResponseCache::~CResponseCache()
+{
+    Close();
+}
+
+std::string CResponseCache::MakeKey(std::string_view route, bool isStream,
+                                    std::string_view canonicalRequest)
+{
+    std::string composed(route);
+    composed += isStream ? ":stream:" : ":single:";
+    composed += canonicalRequest;
+    return composed;
+}
+
+void CResponseCache::Open()
+{
+    fd = ::open(config.path.c_str(), O_RDWR | O_CREAT, 0644); // NOLINT
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open response cache store " + config.path);
+    }
+
+    char header[kHeaderSize] = {};
+    const bool isValid =
+      ::pread(fd, header, kHeaderSize, 0) == static_cast<ssize_t>(kHeaderSize)
+      && std::equal(std::begin(kMagic), std::end(kMagic), header)
+      && ReadU64(header + kCapacityOffset) == config.maxBytes
+      && ReadU64(header + kUsedOffset) <= config.maxBytes;
+
+    if ((!isValid && ::ftruncate(fd, 0) != 0)
+        || ::ftruncate(fd, static_cast<off_t>(config.maxBytes)) != 0)
+    {
+        Close();
+        throw std::runtime_error("Failed to resize response cache store " + config.path);
+    }
+    try
+    {
+        mapped = MapStore(fd, config.maxBytes);
+    }
+    catch (...)
+    {
+        Close();
+        throw;
+    }
+
+    if (isValid)
+    {
+        LoadIndex();
+        return;
+    }
+    InitHeader(mapped, config.maxBytes);
+    RewriteIndex();
+}
+
+void CResponseCache::Close()
+{
+    if (mapped != nullptr)
+    {
+        ::munmap(mapped, config.maxBytes);
+        mapped = nullptr;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+std::uint64_t &CResponseCache::UsedBytes() const
+{
+    // Header is page aligned, so it is properly aligned too.
+    return *reinterpret_cast<std::uint64_t *>(mapped + kUsedOffset); // NOLINT
+}
+
+std::size_t CResponseCache::GetUsedBytes() const
+{
+    const std::lock_guard lock(mutex);
+    return mapped != nullptr ? UsedBytes() : 0;
+}
+
+bool CResponseCache::IsStoredFor(const TEntry &entry, const std::string &key) const
+{
+    const char *ptr = mapped + entry.offset + sizeof(std::uint64_t);
+    const auto length = ReadU64(ptr);
+    return length == key.size()
+           && std::memcmp(ptr + sizeof(std::uint64_t), key.data(), key.size()) == 0;
+}
+
+void CResponseCache::LoadIndex()
+{
+    std::ifstream index(IndexPath(config.path), std::ios::binary);
+    TIndexRecord record{};
+    const auto used = UsedBytes();
+    while (index.read(reinterpret_cast<char *>(&record), sizeof(record))) // NOLINT
+    {
+        // Record could be not completely written on crash.
+        if (record.offset < kHeaderSize || record.offset + record.size > used
+            || ReadU64(mapped + record.offset) != record.hash)
+        {
+            continue;
+        }
+        if (const auto it = entries.find(record.hash); it != entries.end())
+        {
+            lru.erase(it->second.lruPosition);
+            entries.erase(it);
+        }
+        lru.push_front(record.hash);
+        entries.emplace(record.hash, TEntry{record.offset, record.size, lru.begin()});
+    }
+}
+
+void CResponseCache::AppendIndex(std::uint64_t hash, const TEntry &entry) const
+{
+    std::ofstream index(IndexPath(config.path), std::ios::binary | std::ios::app);
+    const TIndexRecord record{hash, entry.offset, entry.size};
+    index.write(reinterpret_cast<const char *>(&record), sizeof(record)); // NOLINT
+}
+
+void CResponseCache::RewriteIndex() const
+{
+    std::ofstream index(IndexPath(config.path), std::ios::binary | std::ios::trunc);
+    // Least recently used first, so loading restores the order.
+    for (auto it = lru.rbegin(); it != lru.rend(); ++it)
+    {
+        const auto &entry = entries.at(*it);
+        const TIndexRecord record{*it, entry.offset, entry.size};
+        index.write(reinterpret_cast<const char *>(&record), sizeof(record)); // NOLINT
+    }
+}
+
+void CResponseCache::Touch(TEntry &entry)
+{
+    lru.splice(lru.begin(), lru, entry.lruPosition);
+}
+
+void CResponseCache::Compact(std::size_t needBytes)
+{
+    const std::string tmpPath = config.path + ".tmp";
+    const int tmpFd = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644); // NOLINT
+    if (tmpFd < 0 || ::ftruncate(tmpFd, static_cast<off_t>(config.maxBytes)) != 0)
+    {
+        if (tmpFd >= 0)
+        {
+            ::close(tmpFd);
+        }
+        return;
+    }
+    char *tmpMapped = nullptr;
+    try
+    {
+        tmpMapped = MapStore(tmpFd, config.maxBytes);
+    }
+    catch (...)
+    {
+        ::close(tmpFd);
+        return;
+    }
+    InitHeader(tmpMapped, config.maxBytes);
+
+    // Leaving half of the store free, so compaction does not repeat on each store.
+    const std::size_t budget = config.maxBytes / 2;
+    std::uint64_t used = kHeaderSize;
+    decltype(entries) keptEntries;
+    decltype(lru) keptLru;
+    for (const auto hash : lru)
+    {
+        const auto &entry = entries.at(hash);
+        if (used + entry.size + needBytes > budget)
+        {
+            evictions.fetch_add(entries.size() - keptEntries.size(), std::memory_order_relaxed);
+            break;
+        }
+        std::memcpy(tmpMapped + used, mapped + entry.offset, entry.size);
+        keptLru.push_back(hash);
+        keptEntries.emplace(hash, TEntry{used, entry.size, std::prev(keptLru.end())});
+        used += entry.size;
+    }
+    WriteU64(tmpMapped + kUsedOffset, used);
+
+    Close();
+    std::rename(tmpPath.c_str(), config.path.c_str());
+    fd = tmpFd;
+    mapped = tmpMapped;
+    entries = std::move(keptEntries);
+    lru = std::move(keptLru);
+    RewriteIndex();
+}
+
+std::optional<CResponseCache::TLines> CResponseCache::Lookup(const std::string &key)
+{
+    const std::lock_guard lock(mutex);
+    if (mapped == nullptr)
+    {
+        return std::nullopt;
+    }
+    const auto it = entries.find(HashFnv1a(key));
+    if (it == entries.end() || !IsStoredFor(it->second, key))
+    {
+        misses.fetch_add(1, std::memory_order_relaxed);
+        return std::nullopt;
+    }
+    Touch(it->second);
+    hits.fetch_add(1, std::memory_order_relaxed);
+
+    const char *ptr = mapped + it->second.offset + 2 * sizeof(std::uint64_t) + key.size();
+    const auto count = ReadU64(ptr);
+    ptr += sizeof(std::uint64_t);
+
+    TLines lines;
+    lines.reserve(count);
+    for (std::uint64_t i = 0; i < count; ++i)
+    {
+        const auto length = ReadU64(ptr);
+        ptr += sizeof(std::uint64_t);
+        lines.emplace_back(ptr, length);
+        ptr += length;
+    }
+    return lines;
+}
+
+void CResponseCache::Store(const std::string &key, const TLines &lines)
+{
+    if (!IsEnabled())
+    {
+        return;
+    }
+
+    std::size_t size = 3 * sizeof(std::uint64_t) + key.size();
+    for (const auto &line : lines)
+    {
+        size += sizeof(std::uint64_t) + line.size();
+    }
+    if (size > config.maxEntryBytes || size > config.maxBytes / 2)
+    {
+        return;
+    }
+
+    const auto hash = HashFnv1a(key);
+    const std::lock_guard lock(mutex);
+    if (mapped == nullptr || entries.count(hash) > 0)
+    {
+        return;
+    }
+    if (UsedBytes() + size > config.maxBytes)
+    {
+        Compact(size);
+        if (mapped == nullptr || UsedBytes() + size > config.maxBytes)
+        {
+            return;
+        }
+    }
+
+    const auto offset = UsedBytes();
+    char *ptr = WriteU64(mapped + offset, hash);
+    ptr = WriteU64(ptr, key.size());
+    std::memcpy(ptr, key.data(), key.size());
+    ptr += key.size();
+    ptr = WriteU64(ptr, lines.size());
+    for (const auto &line : lines)
+    {
+        ptr = WriteU64(ptr, line.size());
+        std::memcpy(ptr, line.data(), line.size());
+        ptr += line.size();
+    }
+    // Record becomes visible only after it is completely written.
+    UsedBytes() = offset + size;
+
+    lru.push_front(hash);
+    const auto &entry = entries.emplace(hash, TEntry{offset, size, lru.begin()}).first->second;
+    AppendIndex(hash, entry);
+}
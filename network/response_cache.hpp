@@ -0,0 +1,110 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/ollama_proxy_config.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Persistent cache of the deterministic responses. Stored responses are kept in the
+/// append-only memory-mapped file, small index file next to it lets start without reading the
+/// store. When store is full, least recently used responses are dropped by compaction.
+class CResponseCache
+{
+  public:
+    using TLines = std::vector<std::string>;
+
+    NO_COPYMOVE(CResponseCache);
+    CResponseCache() = delete;
+    ~CResponseCache();
+
+    /// @brief Opens or creates the store. Cache is disabled if config has empty path.
+    /// @throws std::runtime_error if store cannot be opened.
+    explicit CResponseCache(const TResponseCacheConfig &config);
+
+    /// @returns Cache key of the deterministic request made to the route. Key is stored with the
+    /// response and compared on lookup, its hash only finds the record.
+    [[nodiscard]]
+    static std::string MakeKey(std::string_view route, bool isStream,
+                               std::string_view canonicalRequest);
+
+    [[nodiscard]]
+    bool IsEnabled() const
+    {
+        return !config.path.empty();
+    }
+
+    /// @returns Stored lines of the response, std::nullopt on miss.
+    [[nodiscard]]
+    std::optional<TLines> Lookup(const std::string &key);
+
+    /// @brief Stores response lines if they fit limits. Existing entry is kept as is, even if it
+    /// was stored for other key with the same hash.
+    void Store(const std::string &key, const TLines &lines);
+
+    [[nodiscard]]
+    std::size_t GetHits() const
+    {
+        return hits.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]]
+    std::size_t GetMisses() const
+    {
+        return misses.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]]
+    std::size_t GetEvictions() const
+    {
+        return evictions.load(std::memory_order_relaxed);
+    }
+
+    /// @returns Bytes used by live and dropped-but-not-compacted responses.
+    [[nodiscard]]
+    std::size_t GetUsedBytes() const;
+
+  private:
+    struct TEntry
+    {
+        std::uint64_t offset;
+        std::uint64_t size;
+        std::list<std::uint64_t>::iterator lruPosition;
+    };
+
+    void Open();
+    void Close();
+    void LoadIndex();
+    void AppendIndex(std::uint64_t hash, const TEntry &entry) const;
+    void RewriteIndex() const;
+    /// @brief Keeps most recently used responses which fit half of the store and drops others.
+    void Compact(std::size_t needBytes);
+    void Touch(TEntry &entry);
+    [[nodiscard]]
+    std::uint64_t &UsedBytes() const;
+    /// @returns true if the record was stored for the key, not just for its hash.
+    [[nodiscard]]
+    bool IsStoredFor(const TEntry &entry, const std::string &key) const;
+
+    const TResponseCacheConfig &config;
+    mutable std::mutex mutex;
+    int fd{-1};
+    // Store is remapped by compaction, so it is accessed under the mutex only.
+    char *mapped{nullptr};
+    // Hash of the key to its record.
+    std::unordered_map<std::uint64_t, TEntry> entries;
+    // Most recently used first.
+    std::list<std::uint64_t> lru;
+
+    std::atomic<std::size_t> hits{0};
+    std::atomic<std::size_t> misses{0};
+    std::atomic<std::size_t> evictions{0};
+};
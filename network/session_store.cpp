@@ -0,0 +1,204 @@
+#include "session_store.hpp" // IWYU pragma: keep
+
+#include <common/random_token.h>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace {
+constexpr auto kMessagesKey = "messages";
+constexpr auto kModelKey = "model";
+constexpr auto kVersionKey = "version";
+// Id is the token of 128 bits from the CSPRNG, so it is not guessable and is safe as file name.
+constexpr std::size_t kIdLength = 32;
+
+bool IsValidId(const std::string &id)
+{
+    return id.size() == kIdLength && std::all_of(id.begin(), id.end(), [](char ch) {
+               return (ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f');
+           });
+}
+} // namespace
+
+CSessionStore::CSessionStore(const TSessionConfig &config) :
+    config(config)
+{
+}
+
+CSessionStore::TTurn CSessionStore::Create(nlohmann::json chat)
+{
+    if (!chat.is_object() || !chat.contains(kModelKey) || !chat[kModelKey].is_string())
+    {
+        throw std::invalid_argument("Expected 'model' field to be a string.");
+    }
+    TSession session;
+    session.model = chat[kModelKey].get<std::string>();
+
+    const std::lock_guard lock(mutex);
+    std::string id;
+    do
+    {
+        id = utility::MakeRandomToken();
+    } while (sessions.count(id) > 0);
+    Insert(id, std::move(session));
+    return {id, 0, std::move(chat), false};
+}
+
+std::optional<CSessionStore::TTurn> CSessionStore::Continue(const std::string &id,
+                                                            nlohmann::json delta)
+{
+    if (!delta.is_object() || !delta.contains(kMessagesKey) || !delta[kMessagesKey].is_array())
+    {
+        throw std::invalid_argument("Expected 'messages' field to be an array.");
+    }
+    auto newMessages = std::move(delta[kMessagesKey]);
+
+    const std::lock_guard lock(mutex);
+    auto *session = Find(id);
+    // History of the session whose first turn failed is unknown, the delta alone would lose it.
+    if (!session || session->version == 0)
+    {
+        return std::nullopt;
+    }
+    Touch(*session);
+    TTurn turn{id, session->version, std::move(delta), !session->messages.empty()};
+    if (!turn.chat.contains(kModelKey))
+    {
+        turn.chat[kModelKey] = session->model;
+    }
+    // Copy of the parsed history is much cheaper than parsing it again.
+    auto &messages = turn.chat[kMessagesKey];
+    messages = session->messages;
+    for (auto &message : newMessages)
+    {
+        messages.push_back(std::move(message));
+    }
+    return turn;
+}
+
+bool CSessionStore::Commit(const TTurn &turn, nlohmann::json messages)
+{
+    const auto bytes = messages.dump().size();
+    const std::lock_guard lock(mutex);
+    auto *session = Find(turn.id);
+    if (!session || session->version != turn.version)
+    {
+        return false;
+    }
+    usedBytes = usedBytes - session->bytes + bytes;
+    session->messages = std::move(messages);
+    session->bytes = bytes;
+    ++session->version;
+    Touch(*session);
+    EvictAboveLimits();
+    return true;
+}
+
+std::size_t CSessionStore::GetSessionsCount() const
+{
+    const std::lock_guard lock(mutex);
+    return sessions.size();
+}
+
+CSessionStore::TSession *CSessionStore::Find(const std::string &id)
+{
+    if (const auto it = sessions.find(id); it != sessions.end())
+    {
+        return &it->second;
+    }
+    if (!IsValidId(id))
+    {
+        return nullptr;
+    }
+    auto restored = Restore(id);
+    if (!restored)
+    {
+        return nullptr;
+    }
+    restores.fetch_add(1, std::memory_order_relaxed);
+    Insert(id, std::move(*restored));
+    const auto it = sessions.find(id);
+    return it != sessions.end() ? &it->second : nullptr;
+}
+
+void CSessionStore::Insert(const std::string &id, TSession session)
+{
+    lru.push_front(id);
+    session.lruPosition = lru.begin();
+    usedBytes += session.bytes;
+    sessions.emplace(id, std::move(session));
+    EvictAboveLimits();
+}
+
+void CSessionStore::Touch(TSession &session)
+{
+    lru.splice(lru.begin(), lru, session.lruPosition);
+}
+
+void CSessionStore::EvictAboveLimits()
+{
+    // The most recently used session is kept even if it is above the limits alone.
+    while ((sessions.size() > config.maxSessions || usedBytes > config.maxBytes) && lru.size() > 1)
+    {
+        const auto it = sessions.find(lru.back());
+        Spill(it->first, it->second);
+        usedBytes -= it->second.bytes;
+        sessions.erase(it);
+        lru.pop_back();
+        evictions.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+std::optional<CSessionStore::TSession> CSessionStore::Restore(const std::string &id) const
+{
+    if (config.spillDirectory.empty())
+    {
+        return std::nullopt;
+    }
+    const auto path = SpillPath(id);
+    std::ifstream file(path);
+    if (!file)
+    {
+        return std::nullopt;
+    }
+    auto stored = nlohmann::json::parse(file, nullptr, false);
+    file.close();
+    // Session lives in memory again, it is spilled anew once evicted.
+    std::remove(path.c_str());
+    if (stored.is_discarded() || !stored.contains(kMessagesKey) || !stored.contains(kModelKey))
+    {
+        return std::nullopt;
+    }
+    TSession session;
+    session.model = stored[kModelKey].get<std::string>();
+    session.version = stored.value(kVersionKey, std::uint64_t{0});
+    session.messages = std::move(stored[kMessagesKey]);
+    session.bytes = session.messages.dump().size();
+    return session;
+}
+
+void CSessionStore::Spill(const std::string &id, const TSession &session) const
+{
+    if (config.spillDirectory.empty())
+    {
+        return;
+    }
+    std::ofstream file(SpillPath(id), std::ios::trunc);
+    file << nlohmann::json{{kModelKey, session.model},
+                           {kVersionKey, session.version},
+                           {kMessagesKey, session.messages}};
+}
+
+std::string CSessionStore::SpillPath(const std::string &id) const
+{
+    return config.spillDirectory + "/" + id + ".json";
+}
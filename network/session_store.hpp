@@ -0,0 +1,114 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+
+/// @brief Conversations kept by the proxy, so the client sends only new messages of each turn.
+/// Least recently used conversations are evicted from memory, they are spilled to the directory if
+/// it is configured and read back once the client continues them.
+class CSessionStore
+{
+  public:
+    /// @brief Chat of the single turn of the session.
+    struct TTurn
+    {
+        std::string id;
+        /// @brief Version of the history the turn is based on.
+        std::uint64_t version{0};
+        /// @brief Stored history followed by the new messages, with model and options of the turn.
+        nlohmann::json chat;
+        /// @brief History has the system message with backend commands already.
+        bool hasAiCommands{false};
+    };
+
+    NO_COPYMOVE(CSessionStore);
+    CSessionStore() = delete;
+    ~CSessionStore() = default;
+    explicit CSessionStore(const TSessionConfig &config);
+
+    [[nodiscard]]
+    bool IsEnabled() const
+    {
+        return config.maxSessions > 0;
+    }
+
+    /// @brief Creates empty session, chat of its first turn is the whole conversation.
+    /// @throws std::invalid_argument if chat has no model.
+    [[nodiscard]]
+    TTurn Create(nlohmann::json chat);
+
+    /// @brief Begins the next turn of the session.
+    /// @param delta chat with the new messages only, model can be omitted.
+    /// @returns std::nullopt if session is unknown or its first turn was not committed.
+    /// @throws std::invalid_argument if delta has no messages.
+    [[nodiscard]]
+    std::optional<TTurn> Continue(const std::string &id, nlohmann::json delta);
+
+    /// @brief Stores the conversation once the turn is completed.
+    /// @param messages all messages sent to Ollama in the turn and its answer.
+    /// @returns false if another turn was committed since this one began or session is gone.
+    bool Commit(const TTurn &turn, nlohmann::json messages);
+
+    /// @returns Number of sessions kept in memory.
+    [[nodiscard]]
+    std::size_t GetSessionsCount() const;
+
+    [[nodiscard]]
+    std::size_t GetEvictions() const
+    {
+        return evictions.load(std::memory_order_relaxed);
+    }
+
+    [[nodiscard]]
+    std::size_t GetRestores() const
+    {
+        return restores.load(std::memory_order_relaxed);
+    }
+
+  private:
+    struct TSession
+    {
+        std::string model;
+        nlohmann::json messages = nlohmann::json::array();
+        std::uint64_t version{0};
+        /// @brief Size of the messages as JSON.
+        std::size_t bytes{0};
+        std::list<std::string>::iterator lruPosition;
+    };
+
+    /// @returns Session kept in memory or restored from the spill directory, nullptr if unknown.
+    [[nodiscard]]
+    TSession *Find(const std::string &id);
+    /// @brief Adds the session and evicts least recently used ones above the limits.
+    void Insert(const std::string &id, TSession session);
+    /// @brief Moves session to the front of the LRU list.
+    void Touch(TSession &session);
+    /// @brief Evicts least recently used sessions, the most recent one is always kept.
+    void EvictAboveLimits();
+    /// @returns Session read back from the spill directory.
+    [[nodiscard]]
+    std::optional<TSession> Restore(const std::string &id) const;
+    void Spill(const std::string &id, const TSession &session) const;
+    [[nodiscard]]
+    std::string SpillPath(const std::string &id) const;
+
+    const TSessionConfig &config;
+    mutable std::mutex mutex;
+    std::unordered_map<std::string, TSession> sessions;
+    // Most recently used first.
+    std::list<std::string> lru;
+    std::size_t usedBytes{0};
+
+    std::atomic<std::size_t> evictions{0};
+    std::atomic<std::size_t> restores{0};
+};
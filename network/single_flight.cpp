@@ -0,0 +1,65 @@
+#include "single_flight.hpp" // IWYU pragma: keep
+
+#include "chunkedcontentprovider.hpp" // IWYU pragma: keep
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace {
+/// @returns true if the new user can still get the whole answer from the flight.
+bool IsJoinable(const CChunkedContentProvider &flight)
+{
+    return flight.IsInFlight() && flight.CanResumeFrom(0);
+}
+} // namespace
+
+CSingleFlight::TProviderPtr CSingleFlight::Find(const std::string &canonicalRequest)
+{
+    const std::lock_guard lock(mutex);
+    return FindLocked(canonicalRequest);
+}
+
+CSingleFlight::TProviderPtr CSingleFlight::Lead(const std::string &canonicalRequest,
+                                                TProviderPtr candidate)
+{
+    const std::lock_guard lock(mutex);
+    if (auto existing = FindLocked(canonicalRequest))
+    {
+        return existing;
+    }
+    flights[canonicalRequest] = candidate;
+    return candidate;
+}
+
+CSingleFlight::TProviderPtr CSingleFlight::FindLocked(const std::string &canonicalRequest)
+{
+    RemoveFinished();
+    const auto it = flights.find(canonicalRequest);
+    if (it == flights.end())
+    {
+        return nullptr;
+    }
+    auto existing = it->second.lock();
+    if (!existing)
+    {
+        return nullptr;
+    }
+    ++coalescedCount;
+    return existing;
+}
+
+void CSingleFlight::RemoveFinished()
+{
+    for (auto it = flights.begin(); it != flights.end();)
+    {
+        const auto flight = it->second.lock();
+        if (!flight || !IsJoinable(*flight))
+        {
+            it = flights.erase(it);
+            continue;
+        }
+        ++it;
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class CChunkedContentProvider;
+
+/// @brief Coalesces identical deterministic chats. While generation is in flight, the same request
+/// attaches to it as an extra subscriber instead of starting a new generation on the GPU. Flights
+/// are found by the canonical request of the user (see MakeCanonicalRequest()), so requests are
+/// compared as a whole and nothing is built for the request which joins.
+class CSingleFlight
+{
+  public:
+    using TProviderPtr = std::shared_ptr<CChunkedContentProvider>;
+
+    NO_COPYMOVE(CSingleFlight);
+    CSingleFlight() = default;
+    ~CSingleFlight() = default;
+
+    /// @returns Running generation of the same request, nullptr if there is none or it dropped
+    /// its first lines already, so the joined user would not get the whole answer.
+    [[nodiscard]]
+    TProviderPtr Find(const std::string &canonicalRequest);
+
+    /// @brief Registers the candidate as the flight of the request, unless other user started the
+    /// same one meanwhile.
+    /// @param candidate not started yet provider made for the user's request.
+    /// @returns Provider which the user must subscribe to. Caller must Start() it, it does nothing
+    /// if provider is running already.
+    [[nodiscard]]
+    TProviderPtr Lead(const std::string &canonicalRequest, TProviderPtr candidate);
+
+    /// @returns How many requests were attached to other's generations so far.
+    [[nodiscard]]
+    std::size_t GetCoalescedCount() const
+    {
+        return coalescedCount.load(std::memory_order_relaxed);
+    }
+
+  private:
+    /// @returns Joinable flight, nullptr if there is none. Must be called under the lock.
+    TProviderPtr FindLocked(const std::string &canonicalRequest);
+    void RemoveFinished();
+
+    std::mutex mutex;
+    std::unordered_map<std::string, std::weak_ptr<CChunkedContentProvider>> flights;
+    std::atomic<std::size_t> coalescedCount{0};
+};
@@ -0,0 +1,174 @@
+#include "stream_capture.hpp" // IWYU pragma: keep
+
+#include <network/ollama_proxy_config.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <ios>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace {
+constexpr char kMagic[8] = {'O', 'M', 'I', 'T', 'M', 'C', 'P', '1'};
+constexpr unsigned kVarintPayloadBits = 7;
+constexpr std::uint8_t kVarintPayloadMask = 0x7F;
+constexpr std::uint8_t kVarintContinuation = 0x80;
+
+void AppendVarint(std::string &out, std::uint64_t value)
+{
+    while (value >= kVarintContinuation)
+    {
+        out.push_back(static_cast<char>((value & kVarintPayloadMask) | kVarintContinuation));
+        value >>= kVarintPayloadBits;
+    }
+    out.push_back(static_cast<char>(value));
+}
+
+void AppendString(std::string &out, const std::string &value)
+{
+    AppendVarint(out, value.size());
+    out += value;
+}
+
+/// @brief Reads encoded values from the loaded file.
+class CReader
+{
+  public:
+    explicit CReader(const std::string &data) :
+        data(data)
+    {
+    }
+
+    [[nodiscard]]
+    bool IsEnd() const
+    {
+        return position >= data.size();
+    }
+
+    std::uint64_t ReadVarint()
+    {
+        std::uint64_t value = 0;
+        for (unsigned shift = 0; shift < 64; shift += kVarintPayloadBits)
+        {
+            const auto byte = static_cast<std::uint8_t>(Take(1)[0]);
+            value |= static_cast<std::uint64_t>(byte & kVarintPayloadMask) << shift;
+            if ((byte & kVarintContinuation) == 0)
+            {
+                return value;
+            }
+        }
+        throw std::runtime_error("Capture has too long varint.");
+    }
+
+    std::string ReadString()
+    {
+        const auto size = ReadVarint();
+        return std::string(Take(size), size);
+    }
+
+    const char *Take(std::size_t size)
+    {
+        if (size > data.size() - position)
+        {
+            throw std::runtime_error("Capture is truncated.");
+        }
+        const auto *begin = data.data() + position;
+        position += size;
+        return begin;
+    }
+
+  private:
+    const std::string &data;
+    std::size_t position{0};
+};
+} // namespace
+
+CStreamCapture::CStreamCapture(const TStreamCaptureConfig &config) :
+    config(config),
+    isEnabled(!config.path.empty())
+{
+    if (!isEnabled)
+    {
+        return;
+    }
+    file.open(config.path, std::ios::binary | std::ios::app);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open capture file " + config.path);
+    }
+    writtenBytes = static_cast<std::size_t>(file.tellp());
+    if (writtenBytes == 0)
+    {
+        file.write(kMagic, sizeof(kMagic));
+        writtenBytes = sizeof(kMagic);
+    }
+}
+
+void CStreamCapture::Write(const TCapturedStream &stream)
+{
+    if (!isEnabled || stream.lines.empty())
+    {
+        return;
+    }
+    std::string encoded;
+    AppendString(encoded, stream.model);
+    AppendVarint(encoded, stream.lines.size());
+    for (const auto &line : stream.lines)
+    {
+        AppendVarint(encoded, static_cast<std::uint64_t>(line.delay.count()));
+        AppendString(encoded, line.text);
+    }
+
+    const std::lock_guard lock(mutex);
+    if (writtenBytes + encoded.size() > config.maxBytes)
+    {
+        return;
+    }
+    file.write(encoded.data(), static_cast<std::streamsize>(encoded.size()));
+    file.flush();
+    writtenBytes += encoded.size();
+}
+
+std::vector<TCapturedStream> CStreamCapture::ReadAll(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+    {
+        throw std::runtime_error("Failed to open capture file " + path);
+    }
+    const std::string data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    CReader reader(data);
+    if (data.compare(0, sizeof(kMagic), kMagic, sizeof(kMagic)) != 0)
+    {
+        throw std::runtime_error("File is not a capture " + path);
+    }
+    reader.Take(sizeof(kMagic));
+
+    std::vector<TCapturedStream> streams;
+    try
+    {
+        while (!reader.IsEnd())
+        {
+            TCapturedStream stream;
+            stream.model = reader.ReadString();
+            const auto linesCount = reader.ReadVarint();
+            for (std::uint64_t i = 0; i < linesCount; ++i)
+            {
+                const auto delay = std::chrono::microseconds(reader.ReadVarint());
+                stream.lines.push_back({delay, reader.ReadString()});
+            }
+            streams.emplace_back(std::move(stream));
+        }
+    }
+    catch (const std::runtime_error &)
+    {
+        // Stream which was being written when proxy was killed is dropped.
+    }
+    return streams;
+}
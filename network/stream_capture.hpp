@@ -0,0 +1,62 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/ollama_proxy_config.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// @brief Single upstream round trip: NDJSON lines of Ollama with their arrival times.
+struct TCapturedStream
+{
+    struct TLine
+    {
+        /// @brief Time since the previous line, the first one counts from the request.
+        std::chrono::microseconds delay;
+        std::string text;
+    };
+
+    std::string model;
+    std::vector<TLine> lines;
+};
+
+/// @brief Appends captured upstream streams to the compact binary file, so real traffic can be
+/// replayed without GPU. File is magic followed by streams, each stream is the model and lines,
+/// all sizes and delays are varints.
+class CStreamCapture
+{
+  public:
+    NO_COPYMOVE(CStreamCapture);
+    CStreamCapture() = delete;
+    ~CStreamCapture() = default;
+
+    /// @brief Opens file for appending. Capture is disabled if config has empty path.
+    /// @throws std::runtime_error if file cannot be opened.
+    explicit CStreamCapture(const TStreamCaptureConfig &config);
+
+    [[nodiscard]]
+    bool IsEnabled() const
+    {
+        return isEnabled;
+    }
+
+    /// @brief Appends stream, it is dropped once file reached the configured size.
+    void Write(const TCapturedStream &stream);
+
+    /// @returns All streams of the capture file, truncated tail is ignored.
+    /// @throws std::runtime_error if file cannot be read or it is not a capture.
+    [[nodiscard]]
+    static std::vector<TCapturedStream> ReadAll(const std::string &path);
+
+  private:
+    const TStreamCaptureConfig &config;
+    bool isEnabled{false};
+    std::mutex mutex;
+    std::ofstream file;
+    std::size_t writtenBytes{0};
+};
@@ -0,0 +1,240 @@
+#include "stream_registry.hpp" // IWYU pragma: keep
+
+#include "chunkedcontentprovider.hpp" // IWYU pragma: keep
+
+#include <common/random_token.h>
+#include <common/timer_wheel.hpp>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+CStreamRegistry::CStreamRegistry(utility::CTimerWheel &timerWheel,
+                                 const TStreamResumeConfig &config) :
+    timerWheel(timerWheel),
+    config(config)
+{
+}
+
+CStreamRegistry::~CStreamRegistry()
+{
+    ReleaseParked();
+}
+
+void CStreamRegistry::Register(const TProviderPtr &provider)
+{
+    // Declared before the lock, so released streams are destroyed without it.
+    std::vector<TProviderPtr> released;
+    const std::lock_guard lock(mutex);
+    RemoveFinished(released);
+    streams.emplace(provider->GetStreamId(), provider);
+}
+
+void CStreamRegistry::Park(TProviderPtr provider)
+{
+    if (config.linger.count() == 0)
+    {
+        return;
+    }
+    const auto streamId = provider->GetStreamId();
+    std::vector<TProviderPtr> released;
+    const std::lock_guard lock(mutex);
+    RemoveFinished(released);
+    // Stream joined by a coalesced user can be parked again, its previous timer is ignored then.
+    auto &entry = parked[streamId];
+    entry.provider = std::move(provider);
+    entry.isExpired = false;
+    entry.expiresAt = std::chrono::steady_clock::now() + config.linger;
+    entry.timer = timerWheel.Schedule(config.linger, [this, streamId]() {
+        OnLingerExpired(streamId);
+    });
+}
+
+CStreamRegistry::TProviderPtr CStreamRegistry::Resume(std::uint64_t streamId,
+                                                      const std::string &resumeToken)
+{
+    const auto isOwnedBy = [&resumeToken](const TProviderPtr &provider) {
+        return provider && utility::IsSameToken(provider->GetResumeToken(), resumeToken);
+    };
+    std::vector<TProviderPtr> released;
+    TProviderPtr provider;
+    auto timer = utility::CTimerWheel::kInvalidTimer;
+    {
+        const std::lock_guard lock(mutex);
+        // Stranger must not unpark the stream, otherwise it would cancel it.
+        if (const auto it = parked.find(streamId);
+            it != parked.end() && isOwnedBy(it->second.provider))
+        {
+            timer = it->second.timer;
+            provider = std::move(it->second.provider);
+            const bool isExpired = it->second.isExpired;
+            parked.erase(it);
+            // Expired stream was cancelled, unless somebody joined it meanwhile.
+            if (isExpired && !provider->IsInFlight())
+            {
+                released.push_back(std::move(provider));
+            }
+        }
+        else if (const auto active = streams.find(streamId); active != streams.end())
+        {
+            provider = active->second.lock();
+            if (!isOwnedBy(provider))
+            {
+                // Released after the lock, it can be the last reference.
+                released.push_back(std::move(provider));
+            }
+        }
+        // After the lookup, so the expired parked stream is not found as an active one.
+        RemoveFinished(released);
+    }
+    // Firing timer takes the lock, so it is cancelled without the lock.
+    if (timer != utility::CTimerWheel::kInvalidTimer)
+    {
+        timerWheel.Cancel(timer);
+    }
+    return provider;
+}
+
+void CStreamRegistry::ReleaseParked()
+{
+    std::vector<TProviderPtr> released;
+    std::vector<utility::CTimerWheel::TTimerId> timers;
+    {
+        const std::lock_guard lock(mutex);
+        for (auto &[id, entry] : parked)
+        {
+            timers.push_back(entry.timer);
+            released.push_back(std::move(entry.provider));
+        }
+        parked.clear();
+    }
+    for (const auto timer : timers)
+    {
+        timerWheel.Cancel(timer);
+    }
+}
+
+nlohmann::json CStreamRegistry::Describe()
+{
+    // Stream released here may be destroyed, it must not happen under the lock.
+    std::vector<TProviderPtr> released;
+    std::map<std::uint64_t, std::weak_ptr<CChunkedContentProvider>> snapshot;
+    std::set<std::uint64_t> parkedIds;
+    {
+        const std::lock_guard lock(mutex);
+        RemoveFinished(released);
+        snapshot = streams;
+        for (const auto &[id, entry] : parked)
+        {
+            parkedIds.insert(id);
+        }
+    }
+
+    auto result = nlohmann::json::array();
+    for (const auto &[id, weak] : snapshot)
+    {
+        const auto provider = weak.lock();
+        if (!provider)
+        {
+            continue;
+        }
+        const auto info = provider->GetInfo();
+        nlohmann::json stream;
+        stream["id"] = info.id;
+        stream["model"] = info.model;
+        stream["state"] = CChunkedContentProvider::ToString(info.state);
+        stream["age_ms"] = info.age.count();
+        stream["idle_ms"] = info.idle.count();
+        stream["subscribers"] = info.subscribers;
+        stream["parked"] = parkedIds.count(id) > 0;
+        stream["bytes_produced"] = info.bytesProduced;
+        stream["bytes_written"] = info.bytesWritten;
+        // Each subscriber has to get everything produced.
+        const auto bytesOwed = info.bytesProduced * info.subscribers;
+        stream["bytes_queued"] = bytesOwed > info.bytesWritten ? bytesOwed - info.bytesWritten : 0;
+        result.push_back(std::move(stream));
+    }
+    return result;
+}
+
+bool CStreamRegistry::Cancel(std::uint64_t streamId)
+{
+    TProviderPtr provider;
+    TProviderPtr parkedProvider;
+    auto timer = utility::CTimerWheel::kInvalidTimer;
+    {
+        const std::lock_guard lock(mutex);
+        const auto it = streams.find(streamId);
+        if (it == streams.end())
+        {
+            return false;
+        }
+        provider = it->second.lock();
+        // Cancelled stream cannot be resumed, parking reference would only keep it alive.
+        if (const auto parkedIt = parked.find(streamId); parkedIt != parked.end())
+        {
+            timer = parkedIt->second.timer;
+            parkedProvider = std::move(parkedIt->second.provider);
+            parked.erase(parkedIt);
+        }
+    }
+    if (timer != utility::CTimerWheel::kInvalidTimer)
+    {
+        timerWheel.Cancel(timer);
+    }
+    if (!provider)
+    {
+        return false;
+    }
+    provider->Cancel();
+    return true;
+}
+
+void CStreamRegistry::OnLingerExpired(std::uint64_t streamId)
+{
+    const std::lock_guard lock(mutex);
+    const auto it = parked.find(streamId);
+    if (it == parked.end() || it->second.isExpired
+        || std::chrono::steady_clock::now() < it->second.expiresAt)
+    {
+        return;
+    }
+    it->second.isExpired = true;
+    auto &provider = *it->second.provider;
+    // Stream joined by a coalesced user is not cancelled, only the parking reference is dropped.
+    if (provider.IsInFlight() && provider.GetInfo().subscribers == 0)
+    {
+        provider.Cancel();
+    }
+}
+
+void CStreamRegistry::RemoveFinished(std::vector<TProviderPtr> &released)
+{
+    for (auto it = parked.begin(); it != parked.end();)
+    {
+        if (it->second.isExpired)
+        {
+            released.push_back(std::move(it->second.provider));
+            it = parked.erase(it);
+            continue;
+        }
+        ++it;
+    }
+    for (auto it = streams.begin(); it != streams.end();)
+    {
+        if (it->second.expired())
+        {
+            it = streams.erase(it);
+            continue;
+        }
+        ++it;
+    }
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <common/timer_wheel.hpp>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class CChunkedContentProvider;
+
+/// @brief Active chat streams for the introspection and resuming. Keeps weak references only, so
+/// finished streams disappear on their own. Stream abandoned by its users is parked: kept alive
+/// for the configured time, so the user who lost the connection can resume it.
+class CStreamRegistry
+{
+  public:
+    using TProviderPtr = std::shared_ptr<CChunkedContentProvider>;
+
+    NO_COPYMOVE(CStreamRegistry);
+    CStreamRegistry() = delete;
+    /// @brief Cancels timers of the parked streams.
+    ~CStreamRegistry();
+
+    /// @param timerWheel and config must outlive the registry.
+    CStreamRegistry(utility::CTimerWheel &timerWheel, const TStreamResumeConfig &config);
+
+    /// @brief Adds stream, registering the same stream again does nothing.
+    void Register(const TProviderPtr &provider);
+
+    /// @brief Keeps the stream until somebody resumes it or the linger time passes, then the
+    /// stream is cancelled. Does nothing if lingering is disabled.
+    void Park(TProviderPtr provider);
+
+    /// @param resumeToken token given to the user who started the stream. Stream is left as it is
+    /// if the token does not match.
+    /// @returns Stream to resume, nullptr if it is gone, was cancelled while parked or the token
+    /// does not match.
+    [[nodiscard]]
+    TProviderPtr Resume(std::uint64_t streamId, const std::string &resumeToken);
+
+    /// @brief Releases parked streams, must be called while the components they use are alive.
+    void ReleaseParked();
+
+    /// @returns Array with the state of each active stream.
+    [[nodiscard]]
+    nlohmann::json Describe();
+
+    /// @brief Cancels the stream: its users are disconnected and the upstream request is aborted,
+    /// so Ollama stops generating it and frees the slot. Parked stream is released too.
+    /// @returns false if there is no such stream.
+    bool Cancel(std::uint64_t streamId);
+
+  private:
+    struct TParked
+    {
+        TProviderPtr provider;
+        utility::CTimerWheel::TTimerId timer{utility::CTimerWheel::kInvalidTimer};
+        std::chrono::steady_clock::time_point expiresAt;
+        /// @brief Nobody resumed the stream in time, it is released by the next sweep. Streams are
+        /// not released on the timer thread, because destruction waits for their threads.
+        bool isExpired{false};
+    };
+
+    /// @brief Called on the timer wheel thread.
+    void OnLingerExpired(std::uint64_t streamId);
+    /// @param released gets expired parked streams, they must be released without the lock.
+    void RemoveFinished(std::vector<TProviderPtr> &released);
+
+    utility::CTimerWheel &timerWheel;
+    const TStreamResumeConfig &config;
+    std::mutex mutex;
+    std::map<std::uint64_t, std::weak_ptr<CChunkedContentProvider>> streams;
+    std::map<std::uint64_t, TParked> parked;
+};
@@ -0,0 +1,187 @@
+#include "stream_watchdog.hpp" // IWYU pragma: keep
+
+#include <common/timer_wheel.hpp>
+#include <network/ollama_proxy_config.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+namespace {
+// Inactive check looks again after half of its timeout, so it is late by half of it at most.
+constexpr int kInactiveRecheckDiv = 2;
+// Heartbeat interval is this part of the averaged time to first token.
+constexpr int kHeartbeatFirstTokenDiv = 2;
+} // namespace
+
+CStreamWatchdog::CStreamWatchdog(utility::CTimerWheel &wheel, const TStreamTimersConfig &config,
+                                 std::optional<TClock::time_point> deadline,
+                                 THandlers handlers) :
+    wheel(wheel),
+    config(config),
+    handlers(std::move(handlers))
+{
+    const std::lock_guard lock(mutex);
+    Arm(Heartbeat, GetHeartbeatInterval(config, this->handlers.expectedFirstToken()));
+    if (config.stallTimeout.count() > 0 || config.idleTimeout.count() > 0)
+    {
+        // The first check finds out when the next one is due.
+        Arm(Health, TClock::duration::zero());
+    }
+    std::optional<TClock::duration> left;
+    if (config.deadline.count() > 0)
+    {
+        left = config.deadline;
+    }
+    if (deadline)
+    {
+        const auto untilDeadline = std::max(*deadline - TClock::now(), TClock::duration::zero());
+        left = std::min(left.value_or(untilDeadline), untilDeadline);
+    }
+    if (left)
+    {
+        Arm(Deadline, *left);
+    }
+}
+
+CStreamWatchdog::~CStreamWatchdog()
+{
+    std::array<utility::CTimerWheel::TTimerId, TimersCount> armed{};
+    {
+        const std::lock_guard lock(mutex);
+        isStopped = true;
+        armed = timers;
+    }
+    // Running handler can rearm only before isStopped was set, so armed has its new timer.
+    for (const auto id : armed)
+    {
+        if (id != utility::CTimerWheel::kInvalidTimer)
+        {
+            wheel.Cancel(id);
+        }
+    }
+}
+
+CStreamWatchdog::TClock::duration
+CStreamWatchdog::GetHeartbeatInterval(const TStreamTimersConfig &config,
+                                      const std::chrono::microseconds expectedFirstToken)
+{
+    // Unknown model is expected to be slow.
+    if (expectedFirstToken.count() == 0)
+    {
+        return config.maxHeartbeat;
+    }
+    return std::clamp<TClock::duration>(expectedFirstToken / kHeartbeatFirstTokenDiv,
+                                        config.minHeartbeat,
+                                        std::max(config.minHeartbeat, config.maxHeartbeat));
+}
+
+const char *CStreamWatchdog::ToString(EExpiry expiry)
+{
+    switch (expiry)
+    {
+        case EExpiry::Stalled:
+            return "stalled";
+        case EExpiry::Idle:
+            return "idle";
+        case EExpiry::DeadlineExceeded:
+            break;
+    }
+    return "deadline";
+}
+
+void CStreamWatchdog::Arm(ETimer timer, TClock::duration delay)
+{
+    if (isStopped)
+    {
+        return;
+    }
+    timers.at(timer) = wheel.Schedule(delay, [this, timer] {
+        switch (timer)
+        {
+            case Heartbeat:
+                OnHeartbeat();
+                break;
+            case Health:
+                OnHealth();
+                break;
+            case Deadline:
+            case TimersCount:
+                Expire(EExpiry::DeadlineExceeded);
+                break;
+        }
+    });
+}
+
+void CStreamWatchdog::OnHeartbeat()
+{
+    const auto interval = GetHeartbeatInterval(config, handlers.expectedFirstToken());
+    const auto probe = handlers.probe();
+    const auto silence = TClock::now() - probe.lastSentToUser;
+    auto next = interval - silence;
+    if (probe.isSilent && silence >= interval)
+    {
+        handlers.heartbeat();
+        next = interval;
+    }
+    else if (next <= TClock::duration::zero())
+    {
+        next = interval;
+    }
+    const std::lock_guard lock(mutex);
+    Arm(Heartbeat, next);
+}
+
+void CStreamWatchdog::OnHealth()
+{
+    const auto probe = handlers.probe();
+    const auto now = TClock::now();
+    std::optional<TClock::duration> next;
+    const auto check = [&](const std::chrono::milliseconds timeout, const bool isActive,
+                           const TClock::time_point since) {
+        if (timeout.count() == 0)
+        {
+            return true;
+        }
+        const auto left = isActive ? since + timeout - now : timeout / kInactiveRecheckDiv;
+        if (left <= TClock::duration::zero())
+        {
+            return false;
+        }
+        next = std::min(next.value_or(left), left);
+        return true;
+    };
+    if (!check(config.stallTimeout, probe.isGenerating, probe.lastFromOllama))
+    {
+        Expire(EExpiry::Stalled);
+        return;
+    }
+    if (!check(config.idleTimeout, probe.hasUnwritten, probe.lastWritten))
+    {
+        Expire(EExpiry::Idle);
+        return;
+    }
+    const std::lock_guard lock(mutex);
+    Arm(Health, next.value_or(TClock::duration::zero()));
+}
+
+void CStreamWatchdog::Expire(EExpiry expiry)
+{
+    {
+        const std::lock_guard lock(mutex);
+        if (isStopped)
+        {
+            return;
+        }
+        isStopped = true;
+        for (const auto id : timers)
+        {
+            // Cancelling from the wheel thread does not wait, the firing timer is not pending.
+            wheel.Cancel(id);
+        }
+    }
+    handlers.expire(expiry);
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <common/timer_wheel.hpp>
+#include <network/ollama_proxy_config.hpp>
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+
+/// @brief Timers of the single stream on the shared timer wheel: heartbeats while the user sees
+/// nothing, stall and idle detection and the deadline. Timers are not rearmed on every chunk, each
+/// one samples the stream when it fires and sleeps exactly until its next possible due time.
+class CStreamWatchdog
+{
+  public:
+    using TClock = std::chrono::steady_clock;
+
+    enum class EExpiry : std::uint8_t {
+        Stalled,          ///< Ollama stopped sending chunks of the answer.
+        Idle,             ///< Users stopped taking the output.
+        DeadlineExceeded, ///< Stream lasts longer than allowed.
+    };
+
+    /// @brief State of the stream sampled when the timer fires.
+    struct TProbe
+    {
+        /// @brief User sees nothing while Ollama evaluates the prompt or command executes.
+        bool isSilent{false};
+        /// @brief Ollama is generating the answer, so its chunks are expected.
+        bool isGenerating{false};
+        /// @brief Some output was not taken by users yet.
+        bool hasUnwritten{false};
+        TClock::time_point lastSentToUser;
+        TClock::time_point lastFromOllama;
+        TClock::time_point lastWritten;
+    };
+
+    /// @brief Called on the thread of the timer wheel, so must be short.
+    struct THandlers
+    {
+        std::function<TProbe()> probe;
+        std::function<void()> heartbeat;
+        /// @brief Called once, timers are stopped afterwards.
+        std::function<void(EExpiry)> expire;
+        /// @returns Averaged time to first token of the model, 0 if it is unknown.
+        std::function<std::chrono::microseconds()> expectedFirstToken;
+    };
+
+    NO_COPYMOVE(CStreamWatchdog);
+    CStreamWatchdog() = delete;
+
+    /// @brief Arms the timers.
+    /// @param wheel and config must outlive the watchdog.
+    /// @param deadline asked by the user, the earlier of it and the configured one expires.
+    CStreamWatchdog(utility::CTimerWheel &wheel, const TStreamTimersConfig &config,
+                    std::optional<TClock::time_point> deadline, THandlers handlers);
+
+    /// @brief Disarms the timers and waits for the running handlers.
+    ~CStreamWatchdog();
+
+    /// @returns How long the user may see nothing before being pinged.
+    [[nodiscard]]
+    static TClock::duration GetHeartbeatInterval(const TStreamTimersConfig &config,
+                                                 std::chrono::microseconds expectedFirstToken);
+
+    [[nodiscard]]
+    static const char *ToString(EExpiry expiry);
+
+  private:
+    enum ETimer : std::uint8_t {
+        Heartbeat,
+        Health,
+        Deadline,
+        TimersCount,
+    };
+
+    void Arm(ETimer timer, TClock::duration delay);
+    void OnHeartbeat();
+    void OnHealth();
+    void Expire(EExpiry expiry);
+
+    utility::CTimerWheel &wheel;
+    const TStreamTimersConfig &config;
+    const THandlers handlers;
+    // Timers are rearmed from the wheel thread and disarmed by the owner.
+    std::mutex mutex;
+    std::array<utility::CTimerWheel::TTimerId, TimersCount> timers{};
+    bool isStopped{false};
+};
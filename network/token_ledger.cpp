@@ -0,0 +1,339 @@
+#include "token_ledger.hpp" // IWYU pragma: keep
+
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+
+namespace {
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free
+                && std::atomic<std::uint32_t>::is_always_lock_free,
+              "Lock-free writers need lock-free atomics in the shared memory.");
+
+constexpr char kMagic[8] = {'O', 'M', 'I', 'T', 'M', 'T', 'L', '1'};
+constexpr std::size_t kModelSize = 56;
+constexpr std::size_t kClientSize = 48;
+constexpr std::size_t kCapacityOffset = 8;
+// 0 marks record which is reserved but not written yet.
+constexpr std::uint32_t kUnpublishedHour = 0;
+
+std::uint32_t ToHour(CTokenLedger::TClock::time_point time)
+{
+    return static_cast<std::uint32_t>(
+      std::chrono::duration_cast<std::chrono::hours>(time.time_since_epoch()).count());
+}
+
+void CopyName(char *destination, std::size_t size, std::string_view name)
+{
+    // Record was never used before, so it is zero filled and terminated already.
+    std::memcpy(destination, name.data(), std::min(name.size(), size - 1));
+}
+
+std::string ReadName(const char *source, std::size_t size)
+{
+    return {source, ::strnlen(source, size)};
+}
+
+double ToSeconds(std::uint64_t value, double unitsInSecond)
+{
+    return static_cast<double>(value) / unitsInSecond;
+}
+} // namespace
+
+// Both live in the mapped file. Counters are atomics because writers do not lock.
+struct CTokenLedger::THeader
+{
+    char magic[8];
+    std::uint64_t capacity;
+    std::atomic<std::uint64_t> reserved;
+    std::atomic<std::uint64_t> dropped;
+    char padding[32];
+};
+
+// Hour is published by atomic store after the rest is set.
+struct CTokenLedger::TRecord
+{
+    std::atomic<std::uint32_t> hour;
+    std::uint32_t upstreamRoundTrips;
+    std::uint32_t commandRoundTrips;
+    std::uint32_t padding;
+    char model[kModelSize];
+    char client[kClientSize];
+    std::uint64_t promptTokens;
+    std::uint64_t evalTokens;
+    std::uint64_t promptEvalNs;
+    std::uint64_t evalNs;
+    std::uint64_t loadNs;
+    std::uint64_t totalNs;
+    std::uint64_t commandUs;
+    std::uint64_t timeToFirstTokenUs;
+    std::uint64_t wallUs;
+};
+
+void TTokenUsage::AddOllamaResponse(const nlohmann::json &response)
+{
+    if (!response.contains("done") || response["done"] != true)
+    {
+        return;
+    }
+    const auto get = [&response](const char *key) -> std::uint64_t {
+        return response.contains(key) && response[key].is_number_unsigned()
+                 ? response[key].get<std::uint64_t>()
+                 : 0;
+    };
+    ++upstreamRoundTrips;
+    promptTokens += get("prompt_eval_count");
+    evalTokens += get("eval_count");
+    promptEvalDuration += std::chrono::nanoseconds(get("prompt_eval_duration"));
+    evalDuration += std::chrono::nanoseconds(get("eval_duration"));
+    loadDuration += std::chrono::nanoseconds(get("load_duration"));
+    totalDuration += std::chrono::nanoseconds(get("total_duration"));
+}
+
+CTokenLedger::CTokenLedger(const TTokenLedgerConfig &config) :
+    capacity(std::max<std::size_t>(config.maxRecords, 1))
+{
+    static_assert(sizeof(THeader) == 64 && sizeof(TRecord) == 192,
+                  "Changing the file layout needs new magic.");
+    if (config.path.empty())
+    {
+        return;
+    }
+
+    fd = ::open(config.path.c_str(), O_RDWR | O_CREAT, 0644); // NOLINT
+    if (fd < 0)
+    {
+        throw std::runtime_error("Failed to open token ledger " + config.path);
+    }
+
+    char header[sizeof(THeader)] = {};
+    std::uint64_t storedCapacity{0};
+    const bool hasHeader =
+      ::pread(fd, header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    std::memcpy(&storedCapacity, header + kCapacityOffset, sizeof(storedCapacity));
+    const bool isValid = hasHeader && std::equal(std::begin(kMagic), std::end(kMagic), header);
+    // Ledger is never truncated, it can only grow.
+    if (isValid)
+    {
+        capacity = std::max<std::size_t>(capacity, storedCapacity);
+    }
+
+    if ((!isValid && ::ftruncate(fd, 0) != 0)
+        || ::ftruncate(fd, static_cast<off_t>(MappedSize())) != 0)
+    {
+        Close();
+        throw std::runtime_error("Failed to resize token ledger " + config.path);
+    }
+    void *ptr = ::mmap(nullptr, MappedSize(), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (ptr == MAP_FAILED) // NOLINT
+    {
+        Close();
+        throw std::runtime_error("Failed to mmap token ledger " + config.path);
+    }
+    mapped = static_cast<char *>(ptr);
+
+    std::memcpy(mapped, kMagic, sizeof(kMagic));
+    Header().capacity = capacity;
+}
+
+CTokenLedger::~CTokenLedger()
+{
+    Close();
+}
+
+void CTokenLedger::Close()
+{
+    if (mapped != nullptr)
+    {
+        ::munmap(mapped, MappedSize());
+        mapped = nullptr;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+std::size_t CTokenLedger::MappedSize() const
+{
+    return sizeof(THeader) + capacity * sizeof(TRecord);
+}
+
+CTokenLedger::THeader &CTokenLedger::Header() const
+{
+    return *reinterpret_cast<THeader *>(mapped); // NOLINT
+}
+
+CTokenLedger::TRecord *CTokenLedger::Records() const
+{
+    return reinterpret_cast<TRecord *>(mapped + sizeof(THeader)); // NOLINT
+}
+
+std::uint64_t CTokenLedger::GetDroppedCount() const
+{
+    return IsEnabled() ? Header().dropped.load(std::memory_order_relaxed) : 0;
+}
+
+void CTokenLedger::Record(std::string_view model, std::string_view client,
+                          const TTokenUsage &usage, TClock::time_point when)
+{
+    if (!IsEnabled())
+    {
+        return;
+    }
+    const auto index = Header().reserved.fetch_add(1, std::memory_order_relaxed);
+    if (index >= capacity)
+    {
+        Header().dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    auto &record = Records()[index];
+    CopyName(record.model, kModelSize, model);
+    CopyName(record.client, kClientSize, client);
+    record.upstreamRoundTrips = usage.upstreamRoundTrips;
+    record.commandRoundTrips = usage.commandRoundTrips;
+    record.promptTokens = usage.promptTokens;
+    record.evalTokens = usage.evalTokens;
+    record.promptEvalNs = usage.promptEvalDuration.count();
+    record.evalNs = usage.evalDuration.count();
+    record.loadNs = usage.loadDuration.count();
+    record.totalNs = usage.totalDuration.count();
+    record.commandUs = usage.commandDuration.count();
+    record.timeToFirstTokenUs = usage.timeToFirstToken.count();
+    record.wallUs = usage.wallDuration.count();
+    record.hour.store(std::max(ToHour(when), kUnpublishedHour + 1), std::memory_order_release);
+}
+
+nlohmann::json CTokenLedger::Query(const TQuery &query) const
+{
+    struct TTotals
+    {
+        std::uint64_t requests{0};
+        std::uint64_t upstreamRoundTrips{0};
+        std::uint64_t commandRoundTrips{0};
+        std::uint64_t promptTokens{0};
+        std::uint64_t evalTokens{0};
+        std::uint64_t promptEvalNs{0};
+        std::uint64_t evalNs{0};
+        std::uint64_t loadNs{0};
+        std::uint64_t totalNs{0};
+        std::uint64_t commandUs{0};
+        std::uint64_t timeToFirstTokenUs{0};
+        /// @brief Chats which produced a token, only they have time to the first one.
+        std::uint64_t firstTokens{0};
+        std::uint64_t wallUs{0};
+    };
+    std::map<std::tuple<std::string, std::string, std::uint32_t>, TTotals> groups;
+
+    // Hour index is unsigned, times before the epoch would wrap to the far future.
+    for (const auto &time : {query.from, query.to})
+    {
+        if (time && *time < TClock::time_point{})
+        {
+            throw std::invalid_argument("Usage query range starts before 1970.");
+        }
+    }
+    const auto fromHour = query.from ? ToHour(*query.from) : 0;
+    const auto toHour = query.to ? ToHour(*query.to) : std::numeric_limits<std::uint32_t>::max();
+    const auto used =
+      IsEnabled() ? std::min<std::uint64_t>(Header().reserved.load(std::memory_order_relaxed),
+                                            capacity)
+                  : 0;
+    for (std::uint64_t i = 0; i < used; ++i)
+    {
+        const auto &record = Records()[i];
+        const auto hour = record.hour.load(std::memory_order_acquire);
+        if (hour == kUnpublishedHour || hour < fromHour || hour > toHour)
+        {
+            continue;
+        }
+        auto model = ReadName(record.model, kModelSize);
+        auto client = ReadName(record.client, kClientSize);
+        if ((!query.model.empty() && model != query.model)
+            || (!query.client.empty() && client != query.client))
+        {
+            continue;
+        }
+
+        auto &totals =
+          groups[{query.isGroupedByModel ? std::move(model) : std::string{},
+                  query.isGroupedByClient ? std::move(client) : std::string{},
+                  query.isGroupedByHour ? hour : 0}];
+        ++totals.requests;
+        totals.upstreamRoundTrips += record.upstreamRoundTrips;
+        totals.commandRoundTrips += record.commandRoundTrips;
+        totals.promptTokens += record.promptTokens;
+        totals.evalTokens += record.evalTokens;
+        totals.promptEvalNs += record.promptEvalNs;
+        totals.evalNs += record.evalNs;
+        totals.loadNs += record.loadNs;
+        totals.totalNs += record.totalNs;
+        totals.commandUs += record.commandUs;
+        totals.timeToFirstTokenUs += record.timeToFirstTokenUs;
+        totals.firstTokens += record.timeToFirstTokenUs > 0 ? 1 : 0;
+        totals.wallUs += record.wallUs;
+    }
+
+    constexpr double kNanoseconds = 1e9;
+    constexpr double kMicroseconds = 1e6;
+    constexpr std::uint64_t kSecondsInHour = 3600;
+    nlohmann::json result;
+    result["totals"] = nlohmann::json::array();
+    for (const auto &[key, totals] : groups)
+    {
+        const auto &[model, client, hour] = key;
+        nlohmann::json group;
+        if (query.isGroupedByModel)
+        {
+            group["model"] = model;
+        }
+        if (query.isGroupedByClient)
+        {
+            group["client"] = client;
+        }
+        if (query.isGroupedByHour)
+        {
+            // Start of the hour as unix time.
+            group["hour"] = static_cast<std::uint64_t>(hour) * kSecondsInHour;
+        }
+        group["requests"] = totals.requests;
+        group["upstream_round_trips"] = totals.upstreamRoundTrips;
+        group["command_round_trips"] = totals.commandRoundTrips;
+        group["prompt_tokens"] = totals.promptTokens;
+        group["eval_tokens"] = totals.evalTokens;
+        group["prompt_eval_seconds"] = ToSeconds(totals.promptEvalNs, kNanoseconds);
+        group["eval_seconds"] = ToSeconds(totals.evalNs, kNanoseconds);
+        group["load_seconds"] = ToSeconds(totals.loadNs, kNanoseconds);
+        group["total_seconds"] = ToSeconds(totals.totalNs, kNanoseconds);
+        group["command_seconds"] = ToSeconds(totals.commandUs, kMicroseconds);
+        group["wall_seconds"] = ToSeconds(totals.wallUs, kMicroseconds);
+        // Null if no chat of the group produced a token.
+        group["avg_time_to_first_token_seconds"] = nullptr;
+        if (totals.firstTokens > 0)
+        {
+            group["avg_time_to_first_token_seconds"] =
+              ToSeconds(totals.timeToFirstTokenUs, kMicroseconds)
+              / static_cast<double>(totals.firstTokens);
+        }
+        result["totals"].emplace_back(std::move(group));
+    }
+    result["dropped"] = GetDroppedCount();
+    return result;
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/// @brief Resources spent by the single chat, summed over all its round trips to Ollama.
+struct TTokenUsage
+{
+    // Reported by Ollama in the final chunk of each round trip.
+    std::uint64_t promptTokens{0};
+    std::uint64_t evalTokens{0};
+    std::chrono::nanoseconds promptEvalDuration{0};
+    std::chrono::nanoseconds evalDuration{0};
+    std::chrono::nanoseconds loadDuration{0};
+    std::chrono::nanoseconds totalDuration{0};
+    // Measured by the proxy.
+    std::uint32_t upstreamRoundTrips{0};
+    std::uint32_t commandRoundTrips{0};
+    std::chrono::microseconds commandDuration{0};
+    std::chrono::microseconds timeToFirstToken{0};
+    std::chrono::microseconds wallDuration{0};
+
+    /// @brief Adds statistic from the final chunk of Ollama's response. Other chunks are ignored.
+    void AddOllamaResponse(const nlohmann::json &response);
+};
+
+/// @brief Append-only persistent ledger of the token usage. Each finished chat is appended as fixed
+/// size record to the memory-mapped file without locks. Queries scan the records and aggregate
+/// them per model, client and hour. When ledger is full new records are dropped and counted.
+class CTokenLedger
+{
+  public:
+    using TClock = std::chrono::system_clock;
+
+    /// @brief Selects records and defines how they are grouped. Empty strings match everything.
+    struct TQuery
+    {
+        std::string model;
+        std::string client;
+        std::optional<TClock::time_point> from;
+        std::optional<TClock::time_point> to;
+        bool isGroupedByModel{true};
+        bool isGroupedByClient{true};
+        bool isGroupedByHour{true};
+    };
+
+    NO_COPYMOVE(CTokenLedger);
+    CTokenLedger() = delete;
+    ~CTokenLedger();
+
+    /// @brief Opens or creates the ledger. Ledger is disabled if config has empty path.
+    /// @throws std::runtime_error if ledger cannot be opened.
+    explicit CTokenLedger(const TTokenLedgerConfig &config);
+
+    [[nodiscard]]
+    bool IsEnabled() const
+    {
+        return mapped != nullptr;
+    }
+
+    /// @brief Appends usage of the chat, lock-free. Too long names are truncated.
+    void Record(std::string_view model, std::string_view client, const TTokenUsage &usage,
+                TClock::time_point when = TClock::now());
+
+    /// @returns JSON object with "totals" array, one element per group, and dropped records count.
+    /// @throws std::invalid_argument if the range starts or ends before the epoch.
+    [[nodiscard]]
+    nlohmann::json Query(const TQuery &query) const;
+
+    /// @returns How many records did not fit the ledger since it was created.
+    [[nodiscard]]
+    std::uint64_t GetDroppedCount() const;
+
+  private:
+    struct TRecord;
+    struct THeader;
+
+    [[nodiscard]]
+    THeader &Header() const;
+    [[nodiscard]]
+    TRecord *Records() const;
+    [[nodiscard]]
+    std::size_t MappedSize() const;
+    void Close();
+
+    std::size_t capacity{0};
+    int fd{-1};
+    char *mapped{nullptr};
+};
@@ -0,0 +1,141 @@
+#include "upstream_chat.hpp" // IWYU pragma: keep
+
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/httplib.h>
+#include <ollama/json.hpp>
+#include <ollama/ollama.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+
+namespace {
+// The same as Ollama::chat() waits for the next chunk.
+constexpr std::chrono::seconds kReadTimeout{120};
+} // namespace
+
+CUpstreamChat::TState::TState(const TOllamaProxyConfig &config) :
+    client(config.ollamaHost, config.ollamaPort)
+{
+    client.set_read_timeout(kReadTimeout);
+}
+
+CUpstreamChat::CUpstreamChat(const TOllamaProxyConfig &config) :
+    config(config),
+    state(std::make_shared<TState>(config))
+{
+}
+
+CUpstreamChat::EResult CUpstreamChat::Chat(ollama::request request,
+                                           const TOnResponse &onResponse)
+{
+    const auto startedAt = std::chrono::steady_clock::now();
+    hasResponded = false;
+    elapsed = {};
+    request["stream"] = true;
+
+    httplib::Request upstream;
+    upstream.method = "POST";
+    upstream.path = "/api/chat";
+    upstream.set_header("Content-Type", "application/json");
+    // Body is written once the socket is connected and the call is in flight, so the abort which
+    // came before that is seen here, and the one after it shuts the socket down.
+    const auto body = request.dump();
+    upstream.content_length_ = body.size();
+    upstream.content_provider_ = [this, &body](std::size_t offset, std::size_t length,
+                                               httplib::DataSink &sink) {
+        return !state->isAborted.load() && sink.write(body.data() + offset, length);
+    };
+
+    std::string pending;
+    std::string upstreamError;
+    upstream.content_receiver = [&](const char *data, std::size_t length, std::uint64_t,
+                                    std::uint64_t) {
+        if (state->isAborted.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+        pending.append(data, length);
+        for (auto end = pending.find('\n'); end != std::string::npos; end = pending.find('\n'))
+        {
+            const auto line = pending.substr(0, end);
+            pending.erase(0, end + 1);
+            if (!nlohmann::json::accept(line))
+            {
+                continue;
+            }
+            hasResponded = true;
+            const ollama::response response(line, ollama::message_type::chat);
+            if (response.has_error())
+            {
+                upstreamError = response.get_error();
+                return false;
+            }
+            if (!onResponse(response, line))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    {
+        const std::lock_guard lock(state->mutex);
+        if (state->isAborted)
+        {
+            return EResult::Aborted;
+        }
+        state->isInFlight = true;
+        state->chatThread = std::this_thread::get_id();
+    }
+    httplib::Response response;
+    httplib::Error error{httplib::Error::Unknown};
+    const bool isSent = state->client.send(upstream, response, error);
+    {
+        const std::lock_guard lock(state->mutex);
+        state->isInFlight = false;
+    }
+    elapsed = std::chrono::steady_clock::now() - startedAt;
+
+    if (state->isAborted)
+    {
+        return EResult::Aborted;
+    }
+    // Callback refused the next chunk, that is how the answer is stopped on purpose.
+    const bool isStopped = !isSent && httplib::Error::Canceled == error;
+    if (upstreamError.empty() && (isStopped || (isSent && response.status == 200)))
+    {
+        return EResult::Completed;
+    }
+    config.get().LogFields(EOllamaProxyVerbosity::Warning, "[WARNING] Ollama chat failed.",
+                           [&](auto &record) {
+                               record.Add("status", response.status)
+                                 .Add("error", upstreamError.empty() ? httplib::to_string(error)
+                                                                     : upstreamError);
+                           });
+    return EResult::Failed;
+}
+
+std::function<void()> CUpstreamChat::GetAborter() const
+{
+    return [state = state]() {
+        const std::lock_guard lock(state->mutex);
+        if (state->isInFlight && state->chatThread == std::this_thread::get_id())
+        {
+            return;
+        }
+        state->isAborted = true;
+        // Shuts the socket down under the reading thread. Call which is still connecting is
+        // stopped before its body is sent.
+        if (state->isInFlight)
+        {
+            state->client.stop();
+        }
+    };
+}
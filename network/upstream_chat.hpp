@@ -0,0 +1,80 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/httplib.h>
+#include <ollama/ollama.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// @brief Streams /api/chat of Ollama like Ollama::chat(), but the call can be aborted from any
+/// thread. Abort shuts the upstream socket down at once, so Ollama stops evaluating the prompt
+/// instead of waiting for the next chunk to be refused.
+class CUpstreamChat
+{
+  public:
+    /// @brief Gets the parsed line of the answer and the line as Ollama sent it.
+    /// @returns false to stop reading the answer.
+    using TOnResponse = std::function<bool(const ollama::response &, const std::string &)>;
+
+    enum class EResult : std::uint8_t {
+        Completed, ///< Ollama sent everything or the callback stopped reading.
+        Aborted,   ///< Aborter was called.
+        Failed,    ///< Ollama could not be reached or replied with an error.
+    };
+
+    NO_COPYMOVE(CUpstreamChat);
+    CUpstreamChat() = delete;
+    ~CUpstreamChat() = default;
+
+    /// @param config must outlive the object.
+    explicit CUpstreamChat(const TOllamaProxyConfig &config);
+
+    /// @brief Sends the request and passes each NDJSON line of the answer to the callback. Blocks
+    /// until the answer is over.
+    EResult Chat(ollama::request request, const TOnResponse &onResponse);
+
+    /// @returns Callable which aborts the current and all following calls. It may outlive the
+    /// object. It does nothing if called by the callback, which stops the call by returning false.
+    [[nodiscard]]
+    std::function<void()> GetAborter() const;
+
+    /// @returns true if the last call got at least one line of the answer.
+    [[nodiscard]]
+    bool HasResponded() const
+    {
+        return hasResponded;
+    }
+
+    /// @returns Duration of the last call.
+    [[nodiscard]]
+    std::chrono::steady_clock::duration GetElapsed() const
+    {
+        return elapsed;
+    }
+
+  private:
+    /// @brief Shared with the aborters.
+    struct TState
+    {
+        explicit TState(const TOllamaProxyConfig &config);
+
+        std::mutex mutex;
+        httplib::Client client;
+        bool isInFlight{false};
+        std::thread::id chatThread;
+        std::atomic<bool> isAborted{false};
+    };
+
+    std::reference_wrapper<const TOllamaProxyConfig> config;
+    std::shared_ptr<TState> state;
+    bool hasResponded{false};
+    std::chrono::steady_clock::duration elapsed{};
+};
@@ -0,0 +1,153 @@
+#include <network/admission_control.hpp>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/httplib.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <memory>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using ERoute = CAdmissionControl::ERoute;
+
+class AdmissionControlTest : public ::testing::Test
+{
+  public:
+    void SetUp() override
+    {
+        limits.maxChatRequests = 2;
+        limits.maxEmbedRequests = 1;
+        limits.maxMetadataRequests = 0;
+        limits.retryAfter = std::chrono::seconds{3};
+    }
+
+    /// @brief Admits on own thread, like httplib does for each connection.
+    bool AdmitOnThread(CAdmissionControl &control, const char *path)
+    {
+        bool isAdmitted = false;
+        std::thread([&]() {
+            isAdmitted = control.Admit(path);
+        }).join();
+        return isAdmitted;
+    }
+
+    TServerLimitsConfig limits;
+    TMetadataCacheConfig metadata;
+};
+
+TEST_F(AdmissionControlTest, ClassifiesRoutes)
+{
+    const CAdmissionControl control(limits, metadata);
+    EXPECT_EQ(control.Classify("/api/chat"), ERoute::Chat);
+    EXPECT_EQ(control.Classify("/api/generate"), ERoute::Chat);
+    EXPECT_EQ(control.Classify("/api/embed"), ERoute::Embed);
+    EXPECT_EQ(control.Classify("/api/tags"), ERoute::Metadata);
+    EXPECT_EQ(control.Classify("/metrics"), ERoute::Metadata);
+    EXPECT_EQ(control.Classify("/debug/streams"), ERoute::Metadata);
+    EXPECT_EQ(control.Classify("/api/pull"), ERoute::Other);
+}
+
+TEST_F(AdmissionControlTest, RejectsOverRouteLimit)
+{
+    CAdmissionControl control(limits, metadata);
+    EXPECT_TRUE(AdmitOnThread(control, "/api/chat"));
+    EXPECT_TRUE(AdmitOnThread(control, "/api/chat"));
+    EXPECT_FALSE(AdmitOnThread(control, "/api/chat"));
+    EXPECT_EQ(control.GetInFlight(ERoute::Chat), 2u);
+    EXPECT_EQ(control.GetRejected(ERoute::Chat), 1u);
+
+    // Chats do not starve other routes.
+    for (int i = 0; i < 100; ++i)
+    {
+        EXPECT_TRUE(AdmitOnThread(control, "/api/tags"));
+    }
+    EXPECT_TRUE(AdmitOnThread(control, "/api/embed"));
+    EXPECT_FALSE(AdmitOnThread(control, "/api/embed"));
+}
+
+TEST_F(AdmissionControlTest, FinishReleasesRequestOfThread)
+{
+    limits.maxChatRequests = 1;
+    CAdmissionControl control(limits, metadata);
+    ASSERT_TRUE(control.Admit("/api/chat"));
+    EXPECT_FALSE(AdmitOnThread(control, "/api/chat"));
+    control.Finish();
+    EXPECT_EQ(control.GetInFlight(ERoute::Chat), 0u);
+    // Finishing twice does nothing.
+    control.Finish();
+    EXPECT_EQ(control.GetInFlight(ERoute::Chat), 0u);
+
+    // Next request of keep-alive connection releases the previous one if it was not finished.
+    ASSERT_TRUE(control.Admit("/api/chat"));
+    ASSERT_TRUE(control.Admit("/api/chat"));
+    EXPECT_EQ(control.GetInFlight(ERoute::Chat), 1u);
+    control.Finish();
+}
+
+TEST_F(AdmissionControlTest, RejectsWithRetryAfter)
+{
+    const CAdmissionControl control(limits, metadata);
+    httplib::Response response;
+    control.Reject(response);
+    EXPECT_EQ(response.status, 503);
+    EXPECT_EQ(response.get_header_value("Retry-After"), "3");
+    EXPECT_EQ(response.get_header_value("Connection"), "close");
+}
+
+TEST_F(AdmissionControlTest, DefaultsLeaveWorkersForMetadata)
+{
+    const TServerLimitsConfig defaults;
+    EXPECT_LT(defaults.maxChatRequests + defaults.maxEmbedRequests, defaults.workerThreads);
+    EXPECT_GT(defaults.maxChatRequests, 0u);
+    EXPECT_GT(defaults.maxEmbedRequests, 0u);
+    // Pulls and passthrough routes are not throttled.
+    EXPECT_EQ(defaults.maxOtherRequests, 0u);
+}
+
+TEST_F(AdmissionControlTest, ShedsConnectionsAboveQueueBound)
+{
+    limits.workerThreads = 1;
+    limits.maxQueuedConnections = 1;
+    CAdmissionControl control(limits, metadata);
+    std::unique_ptr<httplib::TaskQueue> queue(control.CreateTaskQueue());
+
+    std::atomic<bool> isReleased{false};
+    std::atomic<std::size_t> admittedCount{0};
+    std::atomic<std::size_t> rejectedCount{0};
+    const auto connection = [&]() {
+        while (!isReleased)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1}); // NOLINT
+        }
+        if (control.Admit("/api/tags"))
+        {
+            ++admittedCount;
+            control.Finish();
+        }
+        else
+        {
+            ++rejectedCount;
+        }
+    };
+    // Worker is busy with the first one, second one waits, third one is shed.
+    EXPECT_TRUE(queue->enqueue(connection));
+    while (control.GetQueuedConnections() != 0)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds{1}); // NOLINT
+    }
+    EXPECT_TRUE(queue->enqueue(connection));
+    EXPECT_TRUE(queue->enqueue(connection));
+    EXPECT_EQ(control.GetQueuedConnections(), 1u);
+    EXPECT_EQ(control.GetShedConnections(), 1u);
+
+    isReleased = true;
+    queue->shutdown();
+    EXPECT_EQ(admittedCount.load(), 2u);
+    EXPECT_EQ(rejectedCount.load(), 1u);
+}
+
+} // namespace Testing
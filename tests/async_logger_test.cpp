@@ -0,0 +1,134 @@
+#include <common/async_logger.h>
+
+#include <chrono>
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class AsyncLoggerTest : public ::testing::Test
+{
+  public:
+    static logging::TLogRecord MakeRecord(std::ostream &os, std::string message,
+                                          logging::ELogFormat format = logging::ELogFormat::Text)
+    {
+        logging::TLogRecord record;
+        record.time = std::chrono::system_clock::now();
+        record.level = 0x20;
+        record.destination = &os;
+        record.format = format;
+        record.message = std::move(message);
+        return record;
+    }
+};
+
+TEST_F(AsyncLoggerTest, RingKeepsOrderAndCapacity)
+{
+    logging::CSpscRing<int> ring(2);
+    int value = 1;
+    EXPECT_TRUE(ring.TryPush(value));
+    value = 2;
+    EXPECT_TRUE(ring.TryPush(value));
+    value = 3;
+    EXPECT_FALSE(ring.TryPush(value));
+    EXPECT_EQ(ring.TryPop(), 1);
+    EXPECT_TRUE(ring.TryPush(value));
+    EXPECT_EQ(ring.TryPop(), 2);
+    EXPECT_EQ(ring.TryPop(), 3);
+    EXPECT_FALSE(ring.TryPop().has_value());
+    EXPECT_TRUE(ring.IsEmpty());
+}
+
+TEST_F(AsyncLoggerTest, TextFieldsAreQuotedWhenNeeded)
+{
+    std::ostringstream os;
+    auto record = MakeRecord(os, "[WARNING] Fallback.");
+    record.Add("model", "llama3:8b").Add("reason", "too \"slow\"").Add("depth", 3);
+    logging::CAsyncLogger::WriteText(os, record);
+    EXPECT_EQ(os.str(), "[WARNING] Fallback. model=llama3:8b reason=\"too \\\"slow\\\"\" depth=3\n");
+}
+
+TEST_F(AsyncLoggerTest, StreamMessageKeepsSingleNewLine)
+{
+    std::ostringstream os;
+    logging::CAsyncLogger::WriteText(os, MakeRecord(os, "[DEBUG] line\n"));
+    EXPECT_EQ(os.str(), "[DEBUG] line\n");
+}
+
+TEST_F(AsyncLoggerTest, BinaryRecordRoundTrips)
+{
+    std::stringstream stream;
+    auto record = MakeRecord(stream, "message", logging::ELogFormat::Binary);
+    record.Add("key", "value").Add("empty", "");
+    logging::CAsyncLogger::WriteBinary(stream, record);
+    logging::CAsyncLogger::WriteBinary(stream, MakeRecord(stream, "second"));
+
+    const auto first = logging::CAsyncLogger::ReadBinary(stream);
+    ASSERT_TRUE(first.has_value());
+    EXPECT_EQ(first->message, "message");
+    EXPECT_EQ(first->level, record.level);
+    EXPECT_EQ(first->time, record.time);
+    EXPECT_EQ(first->fields, record.fields);
+    const auto second = logging::CAsyncLogger::ReadBinary(stream);
+    ASSERT_TRUE(second.has_value());
+    EXPECT_EQ(second->message, "second");
+    EXPECT_FALSE(logging::CAsyncLogger::ReadBinary(stream).has_value());
+}
+
+TEST_F(AsyncLoggerTest, FlushWritesRecordsOfAllThreads)
+{
+    std::ostringstream os;
+    constexpr std::size_t kThreads = 4;
+    constexpr std::size_t kRecords = 100;
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < kThreads; ++i)
+    {
+        threads.emplace_back([&os]() {
+            for (std::size_t j = 0; j < kRecords; ++j)
+            {
+                logging::CAsyncLogger::Instance().Submit(MakeRecord(os, "line"));
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    logging::CAsyncLogger::Instance().Flush();
+
+    std::istringstream lines(os.str());
+    std::size_t count = 0;
+    for (std::string line; std::getline(lines, line);)
+    {
+        EXPECT_EQ(line, "line");
+        ++count;
+    }
+    EXPECT_EQ(count, kThreads * kRecords);
+}
+
+TEST_F(AsyncLoggerTest, ExitedThreadsRingIsReused)
+{
+    std::ostringstream os;
+    auto &logger = logging::CAsyncLogger::Instance();
+    const auto logOnNewThread = [&]() {
+        std::thread([&]() {
+            logger.Submit(MakeRecord(os, "line"));
+        }).join();
+        logger.Flush();
+    };
+    logOnNewThread();
+    const auto ringsCount = logger.GetRingsCount();
+    constexpr std::size_t kThreads = 20;
+    for (std::size_t i = 0; i < kThreads; ++i)
+    {
+        logOnNewThread();
+    }
+    EXPECT_EQ(logger.GetRingsCount(), ringsCount);
+}
+
+} // namespace Testing
@@ -0,0 +1,70 @@
+#include <network/chat_aggregator.hpp>
+#include <network/token_ledger.hpp>
+#include <ollama/json.hpp>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using namespace std::chrono_literals;
+
+class ChatAggregatorTest : public ::testing::Test
+{
+  public:
+    static std::string MakeLine(const std::string &content, bool isDone)
+    {
+        nlohmann::json line;
+        line["model"] = "mock:latest";
+        line["created_at"] = isDone ? "2025-01-01T00:00:01Z" : "2025-01-01T00:00:00Z";
+        line["message"] = {{"role", "assistant"}, {"content", content}};
+        line["done"] = isDone;
+        if (isDone)
+        {
+            line["done_reason"] = "length";
+            // Stats of the last round trip only, the summed ones are reported instead.
+            line["eval_count"] = 1;
+        }
+        return line.dump();
+    }
+};
+
+TEST_F(ChatAggregatorTest, JoinsContentAndReportsSummedStats)
+{
+    const std::vector<std::string> lines = {MakeLine("Hello", false), MakeLine(", ", false),
+                                            "", MakeLine("world", true)};
+    TTokenUsage usage;
+    usage.promptTokens = 30;
+    usage.evalTokens = 12;
+    usage.promptEvalDuration = 3ms;
+    usage.evalDuration = 5ms;
+    usage.loadDuration = 1ms;
+    usage.totalDuration = 10ms;
+
+    const auto response = nlohmann::json::parse(AggregateChatResponse(lines, usage));
+    EXPECT_EQ(response["model"], "mock:latest");
+    EXPECT_EQ(response["created_at"], "2025-01-01T00:00:01Z");
+    EXPECT_EQ(response["message"]["role"], "assistant");
+    EXPECT_EQ(response["message"]["content"], "Hello, world");
+    EXPECT_EQ(response["done"], true);
+    EXPECT_EQ(response["done_reason"], "length");
+    EXPECT_EQ(response["prompt_eval_count"], 30);
+    EXPECT_EQ(response["eval_count"], 12);
+    EXPECT_EQ(response["prompt_eval_duration"], 3'000'000);
+    EXPECT_EQ(response["eval_duration"], 5'000'000);
+    EXPECT_EQ(response["load_duration"], 1'000'000);
+    EXPECT_EQ(response["total_duration"], 10'000'000);
+}
+
+TEST_F(ChatAggregatorTest, EmptyAnswerIsStillResponse)
+{
+    const auto response = nlohmann::json::parse(AggregateChatResponse({}, {}));
+    EXPECT_EQ(response["message"]["content"], "");
+    EXPECT_EQ(response["done"], true);
+    EXPECT_EQ(response["done_reason"], "stop");
+}
+
+} // namespace Testing
@@ -0,0 +1,194 @@
+#include <network/ollama_proxy.hpp>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/httplib.h>
+#include <ollama/json.hpp>
+#include <tools/mock_ollama.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using namespace std::chrono_literals;
+
+/// @brief Chats through the real proxy to the mock Ollama which asks for the backend command on
+/// the first turn of each chat.
+class CommandRoundTripTest : public ::testing::Test
+{
+  public:
+    static constexpr auto kKeyword = "AI_DATE_TIME_NOW";
+
+    void SetUp() override
+    {
+        mockConfig.timeToFirstToken = 0ms;
+        mockConfig.tokensPerSecond = 0;
+        mockConfig.tokensCount = 2;
+        mockConfig.scriptedKeyword = kKeyword;
+    }
+
+    static std::string MakeChat(bool isStream = true)
+    {
+        nlohmann::json chat;
+        chat["model"] = "mock:latest";
+        chat["stream"] = isStream;
+        chat["messages"] = nlohmann::json::array();
+        chat["messages"].push_back({{"role", "user"}, {"content", "What time is it?"}});
+        return chat.dump();
+    }
+
+    TMockOllamaConfig mockConfig;
+};
+
+TEST_F(CommandRoundTripTest, ProxyAddsLessThanMillisecondPerCommand)
+{
+    constexpr std::size_t kChats = 25;
+    constexpr std::int64_t kMaxOverheadUs = 1000;
+
+    CMockOllama mock(mockConfig);
+    TOllamaProxyConfig config;
+    config.ollamaHost = "127.0.0.1";
+    config.ollamaPort = mock.Start();
+    config.coalesceDeterministicChats = false;
+    COllamaProxyServer proxy(config);
+    const auto port = proxy.BindToAnyPort();
+    std::thread listener([&proxy]() {
+        proxy.ListenAfterBind();
+    });
+
+    std::vector<std::string> answers;
+    {
+        httplib::Client client("127.0.0.1", port);
+        for (std::size_t i = 0; i < kChats; ++i)
+        {
+            const auto result = client.Post("/api/chat", MakeChat(), "application/json");
+            answers.push_back(result && result->status == 200 ? result->body : std::string{});
+        }
+    }
+    proxy.Stop();
+    listener.join();
+
+    for (const auto &answer : answers)
+    {
+        // The follow-up answer reached the user, the keyword did not.
+        EXPECT_NE(answer.find("tok1"), std::string::npos);
+        EXPECT_EQ(answer.find(kKeyword), std::string::npos);
+    }
+    const auto timings = mock.GetGenerationTimings();
+    ASSERT_EQ(timings.size(), 2 * kChats);
+    std::vector<std::int64_t> overheads;
+    for (std::size_t i = 0; i < kChats; ++i)
+    {
+        const auto &keywordTurn = timings[2 * i];
+        const auto &followUp = timings[2 * i + 1];
+        ASSERT_GT(keywordTurn.lastSentAtUs, 0);
+        // Proxy reads the keyword, executes the command and sends the follow-up to Ollama.
+        overheads.push_back(followUp.receivedAtUs - keywordTurn.lastSentAtUs);
+    }
+    // Median, single scheduling hiccup of the test machine must not fail the test.
+    std::nth_element(overheads.begin(), overheads.begin() + kChats / 2, overheads.end());
+    EXPECT_LT(overheads[kChats / 2], kMaxOverheadUs);
+}
+
+TEST_F(CommandRoundTripTest, SingleResponseIsAggregated)
+{
+    CMockOllama mock(mockConfig);
+    TOllamaProxyConfig config;
+    config.ollamaHost = "127.0.0.1";
+    config.ollamaPort = mock.Start();
+    config.coalesceDeterministicChats = false;
+    COllamaProxyServer proxy(config);
+    const auto port = proxy.BindToAnyPort();
+    std::thread listener([&proxy]() {
+        proxy.ListenAfterBind();
+    });
+
+    httplib::Client client("127.0.0.1", port);
+    const auto result = client.Post("/api/chat", MakeChat(false), "application/json");
+    proxy.Stop();
+    listener.join();
+
+    ASSERT_TRUE(result);
+    EXPECT_EQ(result->status, 200);
+    const auto answer = nlohmann::json::parse(result->body);
+    EXPECT_TRUE(answer["done"].get<bool>());
+    // Single answer of the follow-up, the keyword did not reach the user.
+    const auto content = answer["message"]["content"].get<std::string>();
+    EXPECT_NE(content.find("tok1"), std::string::npos);
+    EXPECT_EQ(content.find(kKeyword), std::string::npos);
+    EXPECT_EQ(mock.GetGenerationTimings().size(), 2u);
+}
+
+TEST_F(CommandRoundTripTest, LeftUserCancelsSingleResponse)
+{
+    mockConfig.scriptedKeyword.clear();
+    mockConfig.tokensPerSecond = 20;
+    mockConfig.tokensCount = 200;
+    CMockOllama mock(mockConfig);
+    TOllamaProxyConfig config;
+    config.ollamaHost = "127.0.0.1";
+    config.ollamaPort = mock.Start();
+    config.coalesceDeterministicChats = false;
+    COllamaProxyServer proxy(config);
+    const auto port = proxy.BindToAnyPort();
+    std::thread listener([&proxy]() {
+        proxy.ListenAfterBind();
+    });
+
+    {
+        httplib::Client client("127.0.0.1", port);
+        client.set_read_timeout(500ms);
+        const auto result = client.Post("/api/chat", MakeChat(false), "application/json");
+        EXPECT_FALSE(result);
+    }
+    const auto leftAt = CMockOllama::NowMicroseconds();
+    std::this_thread::sleep_for(1s);
+    const auto timings = mock.GetGenerationTimings();
+    proxy.Stop();
+    listener.join();
+
+    // Ollama stopped soon after the user left instead of finishing 10 seconds long answer.
+    ASSERT_EQ(timings.size(), 1u);
+    EXPECT_GT(timings[0].lastSentAtUs, 0);
+    EXPECT_LT(timings[0].lastSentAtUs, leftAt + 500000);
+}
+
+TEST_F(CommandRoundTripTest, BadDeadlineIsRejected)
+{
+    CMockOllama mock(mockConfig);
+    TOllamaProxyConfig config;
+    config.ollamaHost = "127.0.0.1";
+    config.ollamaPort = mock.Start();
+    COllamaProxyServer proxy(config);
+    const auto port = proxy.BindToAnyPort();
+    std::thread listener([&proxy]() {
+        proxy.ListenAfterBind();
+    });
+
+    std::vector<int> statuses;
+    {
+        httplib::Client client("127.0.0.1", port);
+        for (const auto *deadline : {"-5", "0", "5s", " 5", "86400001", "99999999999999999999"})
+        {
+            const auto result = client.Post("/api/chat", {{"X-Ollama-Mitm-Deadline-Ms", deadline}},
+                                            MakeChat(), "application/json");
+            statuses.push_back(result ? result->status : 0);
+        }
+    }
+    proxy.Stop();
+    listener.join();
+
+    for (const auto status : statuses)
+    {
+        EXPECT_EQ(status, 400);
+    }
+    EXPECT_TRUE(mock.GetGenerationTimings().empty());
+}
+
+} // namespace Testing
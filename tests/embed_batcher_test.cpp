@@ -0,0 +1,172 @@
+#include <network/embed_batcher.hpp>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <atomic>
+#include <chrono> // IWYU pragma: keep
+#include <cstddef>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using namespace std::chrono_literals;
+
+class EmbedBatcherTest : public ::testing::Test
+{
+  public:
+    /// @brief Mock Ollama: each input is embedded as vector of its length, each call costs some
+    /// fixed time like real GPU would.
+    CEmbedBatcher::TUpstream MakeMockBackend()
+    {
+        return [this](const std::string &body) {
+            ++upstreamCalls;
+            std::this_thread::sleep_for(kBackendLatency);
+            const auto request = nlohmann::json::parse(body);
+            nlohmann::json reply;
+            reply["model"] = request["model"];
+            reply["embeddings"] = nlohmann::json::array();
+            for (const auto &input : request["input"])
+            {
+                reply["embeddings"].push_back({input.get<std::string>().size(), 1.0});
+            }
+            return CEmbedBatcher::TReply{200, reply.dump()};
+        };
+    }
+
+    static nlohmann::json MakeRequest(const std::string &input)
+    {
+        nlohmann::json request;
+        request["model"] = "nomic-embed-text";
+        request["input"] = input;
+        return request;
+    }
+
+    /// @returns Embeddings per second for concurrent single-input callers.
+    double RunConcurrentCallers(CEmbedBatcher &batcher, std::size_t callers)
+    {
+        const auto startedAt = std::chrono::steady_clock::now();
+        std::vector<std::thread> threads;
+        threads.reserve(callers);
+        for (std::size_t i = 0; i < callers; ++i)
+        {
+            threads.emplace_back([&batcher, i] {
+                const std::string input(i + 1, 'x');
+                auto reply = batcher.Submit(MakeRequest(input));
+                ASSERT_TRUE(reply.has_value());
+                const auto result = reply->get();
+                ASSERT_EQ(result.status, 200);
+                const auto parsed = nlohmann::json::parse(result.body);
+                ASSERT_EQ(parsed["embeddings"].size(), 1u);
+                EXPECT_EQ(parsed["embeddings"][0][0].get<std::size_t>(), input.size());
+            });
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+        const std::chrono::duration<double> spent = std::chrono::steady_clock::now() - startedAt;
+        return static_cast<double>(callers) / spent.count();
+    }
+
+    static constexpr auto kBackendLatency = 5ms;
+    std::atomic<std::size_t> upstreamCalls{0};
+};
+
+TEST_F(EmbedBatcherTest, NotBatchableRequestsAreRejected)
+{
+    TEmbedBatchConfig config;
+    CEmbedBatcher batcher(config, MakeMockBackend());
+
+    auto request = MakeRequest("a");
+    request["input"] = {"a", "b"};
+    EXPECT_FALSE(batcher.Submit(request).has_value());
+
+    config.maxBatchSize = 1;
+    CEmbedBatcher disabled(config, MakeMockBackend());
+    EXPECT_FALSE(disabled.Submit(MakeRequest("a")).has_value());
+}
+
+TEST_F(EmbedBatcherTest, SingleRequestIsSentAfterWait)
+{
+    TEmbedBatchConfig config;
+    CEmbedBatcher batcher(config, MakeMockBackend());
+    auto reply = batcher.Submit(MakeRequest("abc"));
+    ASSERT_TRUE(reply.has_value());
+    ASSERT_EQ(reply->wait_for(1s), std::future_status::ready);
+    EXPECT_EQ(nlohmann::json::parse(reply->get().body)["embeddings"][0][0], 3);
+    EXPECT_EQ(upstreamCalls.load(), 1u);
+}
+
+TEST_F(EmbedBatcherTest, DifferentModelsAreNotMixed)
+{
+    TEmbedBatchConfig config;
+    CEmbedBatcher batcher(config, MakeMockBackend());
+    auto other = MakeRequest("a");
+    other["model"] = "all-minilm";
+    auto first = batcher.Submit(MakeRequest("a"));
+    auto second = batcher.Submit(other);
+    ASSERT_TRUE(first.has_value() && second.has_value());
+    EXPECT_EQ(nlohmann::json::parse(first->get().body)["model"], "nomic-embed-text");
+    EXPECT_EQ(nlohmann::json::parse(second->get().body)["model"], "all-minilm");
+    EXPECT_EQ(batcher.GetBatchesCount(), 2u);
+}
+
+TEST_F(EmbedBatcherTest, UpstreamErrorIsPassedToAll)
+{
+    TEmbedBatchConfig config;
+    CEmbedBatcher batcher(config, [](const std::string &) {
+        return CEmbedBatcher::TReply{404, R"({"error":"model not found"})"};
+    });
+    auto first = batcher.Submit(MakeRequest("a"));
+    auto second = batcher.Submit(MakeRequest("b"));
+    EXPECT_EQ(first->get().status, 404);
+    EXPECT_EQ(second->get().status, 404);
+}
+
+TEST_F(EmbedBatcherTest, ConcurrentCallersAreCoalesced)
+{
+    constexpr std::size_t kCallers = 256;
+    TEmbedBatchConfig config;
+    config.maxBatchSize = 32;
+    config.maxWait = 2000us;
+    CEmbedBatcher batcher(config, MakeMockBackend());
+
+    const auto batchedRate = RunConcurrentCallers(batcher, kCallers);
+    EXPECT_LT(upstreamCalls.load(), kCallers / 4);
+    EXPECT_EQ(batcher.GetBatchedInputsCount(), kCallers);
+
+    // Same load, one upstream call per input, limited by the same concurrency.
+    std::atomic<std::size_t> inFlight{0};
+    const auto unbatchedStartedAt = std::chrono::steady_clock::now();
+    {
+        std::vector<std::thread> threads;
+        for (std::size_t i = 0; i < config.maxConcurrentBatches; ++i)
+        {
+            threads.emplace_back([&] {
+                auto backend = MakeMockBackend();
+                while (inFlight++ < kCallers)
+                {
+                    backend(MakeRequest("x").dump());
+                }
+            });
+        }
+        for (auto &thread : threads)
+        {
+            thread.join();
+        }
+    }
+    const std::chrono::duration<double> unbatchedSpent =
+      std::chrono::steady_clock::now() - unbatchedStartedAt;
+    const auto unbatchedRate = static_cast<double>(kCallers) / unbatchedSpent.count();
+
+    RecordProperty("batched_embeddings_per_second", std::to_string(batchedRate));
+    RecordProperty("unbatched_embeddings_per_second", std::to_string(unbatchedRate));
+    EXPECT_GT(batchedRate, unbatchedRate);
+}
+
+} // namespace Testing
@@ -0,0 +1,131 @@
+#include <network/embedding_cache.hpp>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/json.hpp>
+
+#include <atomic>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class EmbeddingCacheTest : public ::testing::Test
+{
+  public:
+    void SetUp() override
+    {
+        config.path =
+          (std::filesystem::temp_directory_path() / "ollama_mitm_embedding_cache_test").string();
+        config.maxVectors = 64;
+        config.maxBytes = 4096;
+        std::filesystem::remove(config.path);
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove(config.path);
+    }
+
+    static CEmbeddingCache::TVector MakeVector(std::size_t seed)
+    {
+        return {static_cast<float>(seed), 0.5f, -1.25f};
+    }
+
+    static std::string MakeKey(std::size_t seed)
+    {
+        return "text " + std::to_string(seed);
+    }
+
+    TEmbeddingCacheConfig config;
+};
+
+TEST_F(EmbeddingCacheTest, KeyDependsOnEverything)
+{
+    const auto params = nlohmann::json::parse(R"({"model": "nomic-embed-text"})");
+    const auto other = nlohmann::json::parse(R"({"model": "all-minilm"})");
+    const auto key = CEmbeddingCache::MakeKey("/api/embed", params, "text");
+    EXPECT_EQ(key, CEmbeddingCache::MakeKey("/api/embed", params, "text"));
+    EXPECT_NE(key, CEmbeddingCache::MakeKey("/api/embed", params, "text2"));
+    EXPECT_NE(key, CEmbeddingCache::MakeKey("/api/embed", other, "text"));
+    EXPECT_NE(key, CEmbeddingCache::MakeKey("/api/embeddings", params, "text"));
+}
+
+TEST_F(EmbeddingCacheTest, StoresAndSurvivesRestart)
+{
+    {
+        CEmbeddingCache cache(config);
+        ASSERT_TRUE(cache.IsEnabled());
+        EXPECT_FALSE(cache.Lookup(MakeKey(42)).has_value());
+        cache.Store(MakeKey(42), MakeVector(42));
+        EXPECT_EQ(cache.Lookup(MakeKey(42)), MakeVector(42));
+        EXPECT_EQ(cache.GetHits(), 1u);
+        EXPECT_EQ(cache.GetMisses(), 1u);
+    }
+    const CEmbeddingCache cache(config);
+    EXPECT_EQ(cache.Lookup(MakeKey(42)), MakeVector(42));
+}
+
+TEST_F(EmbeddingCacheTest, ClearsAndRefillsWhenFull)
+{
+    CEmbeddingCache cache(config);
+    for (std::size_t key = 1; key <= config.maxVectors; ++key)
+    {
+        cache.Store(MakeKey(key), MakeVector(key));
+    }
+    EXPECT_EQ(cache.GetClears(), 1u);
+    // Vectors stored after clearing are kept, older ones are gone.
+    EXPECT_EQ(cache.Lookup(MakeKey(config.maxVectors)), MakeVector(config.maxVectors));
+    EXPECT_FALSE(cache.Lookup(MakeKey(1)).has_value());
+
+    // Too big data is cleared the same way.
+    cache.Store("big", CEmbeddingCache::TVector(config.maxBytes / sizeof(float) - 1));
+    EXPECT_EQ(cache.GetClears(), 2u);
+    EXPECT_TRUE(cache.Lookup("big").has_value());
+    // Vector bigger than the whole store is not cached at all.
+    cache.Store("huge", CEmbeddingCache::TVector(config.maxBytes));
+    EXPECT_EQ(cache.GetClears(), 2u);
+    EXPECT_FALSE(cache.Lookup("huge").has_value());
+}
+
+TEST_F(EmbeddingCacheTest, ReadersRunAlongsideWriter)
+{
+    constexpr std::size_t kKeys = 40;
+    CEmbeddingCache cache(config);
+    std::atomic<bool> isWriting{true};
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i)
+    {
+        readers.emplace_back([&] {
+            while (isWriting)
+            {
+                for (std::size_t key = 1; key <= kKeys; ++key)
+                {
+                    if (const auto vector = cache.Lookup(MakeKey(key)))
+                    {
+                        EXPECT_EQ(*vector, MakeVector(key));
+                    }
+                }
+            }
+        });
+    }
+    for (std::size_t key = 1; key <= kKeys; ++key)
+    {
+        cache.Store(MakeKey(key), MakeVector(key));
+    }
+    isWriting = false;
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+    for (std::size_t key = 1; key <= kKeys; ++key)
+    {
+        EXPECT_EQ(cache.Lookup(MakeKey(key)), MakeVector(key));
+    }
+}
+
+} // namespace Testing
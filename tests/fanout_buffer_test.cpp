@@ -0,0 +1,135 @@
+#include <common/fanout_buffer.h>
+
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class FanOutBufferTest : public ::testing::Test
+{
+  public:
+    using TBuffer = FanOutBuffer<std::string>;
+};
+
+TEST_F(FanOutBufferTest, EveryReaderGetsEverything)
+{
+    TBuffer buffer;
+    buffer.push("a");
+    buffer.push("b");
+
+    std::size_t first = 0;
+    std::size_t second = 0;
+    EXPECT_EQ(buffer.read(first), "a");
+    EXPECT_EQ(buffer.read(first), "b");
+    EXPECT_FALSE(buffer.read(first).has_value());
+
+    buffer.push("c");
+    EXPECT_EQ(buffer.read(second), "a");
+    EXPECT_EQ(buffer.read(second), "b");
+    EXPECT_EQ(buffer.read(second), "c");
+    EXPECT_EQ(buffer.read(first), "c");
+    EXPECT_EQ(first, 3u);
+    EXPECT_EQ(second, 3u);
+}
+
+TEST_F(FanOutBufferTest, ClosedBufferIgnoresPushes)
+{
+    TBuffer buffer;
+    buffer.push("a");
+    EXPECT_FALSE(buffer.closed());
+    buffer.close();
+    buffer.push("b");
+    EXPECT_TRUE(buffer.closed());
+    EXPECT_EQ(buffer.size(), 1u);
+}
+
+TEST_F(FanOutBufferTest, BoundedBufferKeepsLatestElements)
+{
+    TBuffer buffer(2);
+    buffer.push("a");
+    buffer.push("b");
+    std::size_t slow = 0;
+    EXPECT_EQ(buffer.read(slow), "a");
+
+    buffer.push("c");
+    buffer.push("d");
+    EXPECT_EQ(buffer.size(), 4u);
+    EXPECT_EQ(buffer.first(), 2u);
+    EXPECT_EQ(buffer.snapshot(), (std::vector<std::string>{"c", "d"}));
+    EXPECT_THROW((void)buffer.read(slow), std::out_of_range);
+
+    // Reader which resumes from the kept offset gets the tail.
+    std::size_t resumed = 3;
+    EXPECT_EQ(buffer.read(resumed), "d");
+    EXPECT_FALSE(buffer.read(resumed).has_value());
+}
+
+TEST_F(FanOutBufferTest, LaggingAttachedReaderGetsEverything)
+{
+    constexpr std::size_t kCapacity = 2;
+    constexpr std::size_t kItems = 10;
+    TBuffer buffer(kCapacity);
+    std::size_t lagging = 0;
+    std::size_t fast = 0;
+    buffer.attach(lagging);
+    buffer.attach(fast);
+    for (std::size_t i = 0; i < kItems; ++i)
+    {
+        buffer.push(std::to_string(i));
+        EXPECT_EQ(buffer.read(fast), std::to_string(i));
+    }
+    EXPECT_EQ(buffer.first(), 0u);
+    for (std::size_t i = 0; i < kItems; ++i)
+    {
+        EXPECT_EQ(buffer.read(lagging), std::to_string(i));
+    }
+
+    // Once all read, only the replay tail is kept.
+    buffer.push("last");
+    EXPECT_EQ(buffer.first(), kItems + 1 - kCapacity);
+    buffer.detach(lagging);
+    buffer.detach(fast);
+    buffer.push("after");
+    EXPECT_EQ(buffer.snapshot(), (std::vector<std::string>{"last", "after"}));
+}
+
+TEST_F(FanOutBufferTest, ConcurrentReaders)
+{
+    constexpr std::size_t kItems = 1000;
+    constexpr std::size_t kReaders = 4;
+    TBuffer buffer;
+    std::atomic<std::size_t> totalRead{0};
+
+    std::vector<std::thread> readers;
+    for (std::size_t i = 0; i < kReaders; ++i)
+    {
+        readers.emplace_back([&buffer, &totalRead] {
+            std::size_t cursor = 0;
+            while (cursor < kItems)
+            {
+                if (const auto item = buffer.read(cursor))
+                {
+                    EXPECT_EQ(*item, std::to_string(cursor - 1));
+                    ++totalRead;
+                }
+            }
+        });
+    }
+    for (std::size_t i = 0; i < kItems; ++i)
+    {
+        buffer.push(std::to_string(i));
+    }
+    for (auto &reader : readers)
+    {
+        reader.join();
+    }
+    EXPECT_EQ(totalRead.load(), kItems * kReaders);
+}
+
+} // namespace Testing
@@ -0,0 +1,64 @@
+#include <network/metadata_cache.hpp>
+#include <network/ollama_proxy_config.hpp>
+
+#include <chrono> // IWYU pragma: keep
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using namespace std::chrono_literals;
+
+class MetadataCacheTest : public ::testing::Test
+{
+  public:
+    TMetadataCacheConfig config;
+};
+
+TEST_F(MetadataCacheTest, TtlPerEndpoint)
+{
+    const CMetadataCache cache(config);
+    EXPECT_GT(cache.GetTtl("/api/tags").count(), 0);
+    EXPECT_EQ(cache.GetTtl("/api/chat").count(), 0);
+    EXPECT_TRUE(CMetadataCache::IsInvalidatingPath("/api/pull"));
+    EXPECT_FALSE(CMetadataCache::IsInvalidatingPath("/api/tags"));
+}
+
+TEST_F(MetadataCacheTest, ExpiresAndInvalidates)
+{
+    CMetadataCache cache(config);
+    EXPECT_EQ(cache.Lookup("GET /api/tags"), nullptr);
+
+    const auto stored = cache.Store("GET /api/tags", 30ms, 200, R"({"models":[]})", "json");
+    const auto found = cache.Lookup("GET /api/tags");
+    ASSERT_NE(found, nullptr);
+    EXPECT_EQ(found, stored);
+    EXPECT_EQ(found->body, R"({"models":[]})");
+
+    std::this_thread::sleep_for(40ms); // NOLINT
+    EXPECT_EQ(cache.Lookup("GET /api/tags"), nullptr);
+
+    cache.Store("GET /api/tags", 10s, 200, "{}", "json");
+    cache.Invalidate();
+    EXPECT_EQ(cache.Lookup("GET /api/tags"), nullptr);
+    EXPECT_EQ(cache.GetHits(), 1u);
+    EXPECT_EQ(cache.GetMisses(), 3u);
+}
+
+TEST_F(MetadataCacheTest, ETagMatching)
+{
+    const auto etag = CMetadataCache::MakeETag("body");
+    EXPECT_EQ(etag, CMetadataCache::MakeETag("body"));
+    EXPECT_NE(etag, CMetadataCache::MakeETag("body2"));
+    EXPECT_EQ(etag.front(), '"');
+    EXPECT_EQ(etag.back(), '"');
+
+    EXPECT_TRUE(CMetadataCache::IsETagMatching(etag, etag));
+    EXPECT_TRUE(CMetadataCache::IsETagMatching("\"x\", W/" + etag, etag));
+    EXPECT_TRUE(CMetadataCache::IsETagMatching("*", etag));
+    EXPECT_FALSE(CMetadataCache::IsETagMatching("", etag));
+    EXPECT_FALSE(CMetadataCache::IsETagMatching("\"x\"", etag));
+}
+
+} // namespace Testing
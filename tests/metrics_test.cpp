@@ -0,0 +1,122 @@
+#include <common/metrics.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class MetricsTest : public ::testing::Test
+{
+  public:
+    using CHistogram = metrics::CHistogram;
+
+    static std::string Render(const metrics::CRegistry &registry)
+    {
+        std::ostringstream os;
+        registry.Render(os);
+        return os.str();
+    }
+};
+
+TEST_F(MetricsTest, BucketsCoverValuesInOrder)
+{
+    for (std::uint64_t value = 0; value < 100000; ++value)
+    {
+        const auto index = CHistogram::BucketIndex(value);
+        ASSERT_LT(index, CHistogram::kBuckets);
+        ASSERT_LT(value, CHistogram::BucketUpperBound(index));
+        if (index > 0)
+        {
+            ASSERT_GE(value, CHistogram::BucketUpperBound(index - 1));
+        }
+    }
+    EXPECT_EQ(CHistogram::BucketIndex(~std::uint64_t{0}), CHistogram::kBuckets - 1);
+}
+
+TEST_F(MetricsTest, BucketRelativeErrorIsBounded)
+{
+    for (std::uint64_t value = CHistogram::kSubBuckets; value < 1000000; value += 7)
+    {
+        const auto upper = CHistogram::BucketUpperBound(CHistogram::BucketIndex(value));
+        ASSERT_LE(upper - value, value / CHistogram::kSubBuckets + 1);
+    }
+}
+
+TEST_F(MetricsTest, CounterSumsAllThreads)
+{
+    metrics::CCounter counter;
+    constexpr std::size_t kThreads = 8;
+    constexpr std::size_t kIncrements = 10000;
+    std::vector<std::thread> threads;
+    for (std::size_t i = 0; i < kThreads; ++i)
+    {
+        threads.emplace_back([&counter]() {
+            for (std::size_t j = 0; j < kIncrements; ++j)
+            {
+                counter.Add();
+            }
+        });
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    EXPECT_EQ(counter.Value(), kThreads * kIncrements);
+}
+
+TEST_F(MetricsTest, SameSeriesIsReturnedForSameLabels)
+{
+    metrics::CRegistry registry;
+    auto &first = registry.GetCounter("requests_total", "help", metrics::MakeLabels({{"a", "1"}}));
+    auto &second = registry.GetCounter("requests_total", "help", metrics::MakeLabels({{"a", "1"}}));
+    auto &other = registry.GetCounter("requests_total", "help", metrics::MakeLabels({{"a", "2"}}));
+    EXPECT_EQ(&first, &second);
+    EXPECT_NE(&first, &other);
+}
+
+TEST_F(MetricsTest, LabelsAreEscaped)
+{
+    EXPECT_EQ(metrics::MakeLabels({{"model", "a\"b\\c\n"}, {"route", "/api/chat"}}),
+              R"(model="a\"b\\c\n",route="/api/chat")");
+}
+
+TEST_F(MetricsTest, RendersPrometheusText)
+{
+    metrics::CRegistry registry;
+    registry.GetCounter("requests_total", "Requests.", metrics::MakeLabels({{"route", "x"}}))
+      .Add(3);
+    registry.GetGauge("active", "Active.").Add(2);
+    auto &histogram = registry.GetHistogram("latency_seconds", "Latency.", {}, 1e6);
+    histogram.Record(3);
+    histogram.Record(1500);
+
+    const auto text = Render(registry);
+    EXPECT_NE(text.find("# TYPE requests_total counter\nrequests_total{route=\"x\"} 3\n"),
+              std::string::npos);
+    EXPECT_NE(text.find("# TYPE active gauge\nactive 2\n"), std::string::npos);
+    EXPECT_NE(text.find("latency_seconds_bucket{le=\"2e-06\"} 0\n"), std::string::npos);
+    EXPECT_NE(text.find("latency_seconds_bucket{le=\"4e-06\"} 1\n"), std::string::npos);
+    EXPECT_NE(text.find("latency_seconds_bucket{le=\"0.002048\"} 2\n"), std::string::npos);
+    EXPECT_NE(text.find("latency_seconds_bucket{le=\"+Inf\"} 2\n"), std::string::npos);
+    EXPECT_NE(text.find("latency_seconds_sum 0.001503\n"), std::string::npos);
+    EXPECT_NE(text.find("latency_seconds_count 2\n"), std::string::npos);
+}
+
+TEST_F(MetricsTest, CollectorsAreCalledUntilRemoved)
+{
+    metrics::CRegistry registry;
+    const auto id = registry.AddCollector([](std::ostream &os) {
+        os << "custom 1\n";
+    });
+    EXPECT_NE(Render(registry).find("custom 1\n"), std::string::npos);
+    registry.RemoveCollector(id);
+    EXPECT_EQ(Render(registry).find("custom 1\n"), std::string::npos);
+}
+
+} // namespace Testing
@@ -0,0 +1,141 @@
+#include <ollama/httplib.h>
+#include <ollama/json.hpp>
+#include <tools/mock_ollama.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class MockOllamaTest : public ::testing::Test
+{
+  public:
+    void SetUp() override
+    {
+        config.timeToFirstToken = std::chrono::milliseconds{1};
+        config.tokensPerSecond = 0;
+        config.tokensCount = 4;
+    }
+
+    static std::vector<nlohmann::json> ReadLines(const std::string &body)
+    {
+        std::vector<nlohmann::json> lines;
+        std::istringstream stream(body);
+        std::string line;
+        while (std::getline(stream, line))
+        {
+            lines.push_back(nlohmann::json::parse(line));
+        }
+        return lines;
+    }
+
+    static std::string MakeChat(const std::vector<std::string> &roles)
+    {
+        nlohmann::json chat;
+        chat["model"] = "mock:latest";
+        chat["messages"] = nlohmann::json::array();
+        for (const auto &role : roles)
+        {
+            chat["messages"].push_back({{"role", role}, {"content", "text"}});
+        }
+        return chat.dump();
+    }
+
+    TMockOllamaConfig config;
+};
+
+TEST_F(MockOllamaTest, StreamsChatWithStatistic)
+{
+    CMockOllama mock(config);
+    httplib::Client client("127.0.0.1", mock.Start());
+    const auto result = client.Post("/api/chat", MakeChat({"user"}), "application/json");
+    ASSERT_TRUE(result);
+    EXPECT_EQ(result->status, 200);
+    const auto lines = ReadLines(result->body);
+    ASSERT_EQ(lines.size(), config.tokensCount + 1);
+    EXPECT_EQ(lines.front()["message"]["content"], "tok0 ");
+    EXPECT_TRUE(lines.front().contains(CMockOllama::kSentAtKey));
+    EXPECT_EQ(lines.back()["done"], true);
+    EXPECT_EQ(lines.back()["eval_count"], config.tokensCount);
+}
+
+TEST_F(MockOllamaTest, ScriptedKeywordOnlyOnFirstTurn)
+{
+    config.scriptedKeyword = "AI_DATE_TIME_NOW";
+    CMockOllama mock(config);
+    httplib::Client client("127.0.0.1", mock.Start());
+    const auto first = client.Post("/api/chat", MakeChat({"system", "user"}), "application/json");
+    ASSERT_TRUE(first);
+    EXPECT_EQ(ReadLines(first->body).front()["message"]["content"], config.scriptedKeyword);
+
+    const auto followUp =
+      client.Post("/api/chat", MakeChat({"system", "user", "user"}), "application/json");
+    ASSERT_TRUE(followUp);
+    EXPECT_EQ(ReadLines(followUp->body).size(), config.tokensCount + 1);
+}
+
+TEST_F(MockOllamaTest, StreamsConcurrentlyOnSingleThread)
+{
+    // Each stream lasts at least 200ms, sequential serving would take 6.4s.
+    constexpr std::size_t kStreams = 32;
+    config.timeToFirstToken = std::chrono::milliseconds{200};
+    CMockOllama mock(config);
+    const auto port = mock.Start();
+    std::atomic<std::size_t> completed{0};
+    const auto startedAt = std::chrono::steady_clock::now();
+    std::vector<std::thread> clients;
+    for (std::size_t i = 0; i < kStreams; ++i)
+    {
+        clients.emplace_back([&]() {
+            httplib::Client client("127.0.0.1", port);
+            const auto result = client.Post("/api/chat", MakeChat({"user"}), "application/json");
+            if (result && result->status == 200
+                && ReadLines(result->body).size() == config.tokensCount + 1)
+            {
+                ++completed;
+            }
+        });
+    }
+    for (auto &client : clients)
+    {
+        client.join();
+    }
+    EXPECT_EQ(completed, kStreams);
+    EXPECT_LT(std::chrono::steady_clock::now() - startedAt, std::chrono::seconds{3});
+}
+
+TEST_F(MockOllamaTest, InjectsErrors)
+{
+    config.errorRate = 1.0;
+    CMockOllama mock(config);
+    httplib::Client client("127.0.0.1", mock.Start());
+    const auto result = client.Post("/api/generate", R"({"prompt":"hi"})", "application/json");
+    ASSERT_TRUE(result);
+    EXPECT_EQ(result->status, 500);
+}
+
+TEST_F(MockOllamaTest, EmbedsDeterministically)
+{
+    CMockOllama mock(config);
+    httplib::Client client("127.0.0.1", mock.Start());
+    const auto embed = [&client]() {
+        const auto result =
+          client.Post("/api/embed", R"({"model":"m","input":["a","b"]})", "application/json");
+        return nlohmann::json::parse(result->body)["embeddings"];
+    };
+    const auto embeddings = embed();
+    ASSERT_EQ(embeddings.size(), 2u);
+    EXPECT_EQ(embeddings[0].size(), config.embeddingDimensions);
+    EXPECT_NE(embeddings[0], embeddings[1]);
+    EXPECT_EQ(embeddings, embed());
+    EXPECT_EQ(mock.GetRequestsCount(), 2u);
+}
+
+} // namespace Testing
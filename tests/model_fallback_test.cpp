@@ -0,0 +1,98 @@
+#include <network/model_fallback.hpp>
+#include <network/ollama_proxy_config.hpp>
+
+#include <chrono> // IWYU pragma: keep
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using namespace std::chrono_literals;
+
+class ModelFallbackTest : public ::testing::Test
+{
+  public:
+    inline static const std::string kBig = "llama3:70b";
+    inline static const std::string kSmall = "llama3:8b";
+
+    static TModelFallbackConfig MakeConfig(std::size_t depth, std::chrono::milliseconds latency)
+    {
+        TModelFallbackConfig config;
+        config.fallbacks = {{kBig, kSmall}};
+        config.maxQueueDepth = depth;
+        config.maxLatency = latency;
+        return config;
+    }
+};
+
+TEST_F(ModelFallbackTest, NoFallbackWhenDisabled)
+{
+    const auto config = MakeConfig(0, 0ms);
+    CModelFallback fallback(config);
+    const auto t1 = fallback.Acquire(kBig);
+    const auto t2 = fallback.Acquire(kBig);
+    EXPECT_EQ(t2->Model(), kBig);
+    EXPECT_FALSE(t2->IsFallback());
+    EXPECT_TRUE(fallback.GetFallbackCounts().empty());
+}
+
+TEST_F(ModelFallbackTest, FallbackOnQueueDepth)
+{
+    const auto config = MakeConfig(2, 0ms);
+    CModelFallback fallback(config);
+    const auto t1 = fallback.Acquire(kBig);
+    const auto t2 = fallback.Acquire(kBig);
+    {
+        const auto t3 = fallback.Acquire(kBig);
+        EXPECT_TRUE(t3->IsFallback());
+        EXPECT_EQ(t3->Model(), kSmall);
+    }
+    const auto counts = fallback.GetFallbackCounts();
+    ASSERT_EQ(counts.size(), 1u);
+    EXPECT_EQ(counts.begin()->first, std::make_pair(kBig, kSmall));
+    EXPECT_EQ(counts.begin()->second, 1u);
+}
+
+TEST_F(ModelFallbackTest, QueueDepthIsReleasedByTicket)
+{
+    const auto config = MakeConfig(1, 0ms);
+    CModelFallback fallback(config);
+    {
+        const auto t1 = fallback.Acquire(kBig);
+        EXPECT_FALSE(t1->IsFallback());
+    }
+    const auto t2 = fallback.Acquire(kBig);
+    EXPECT_FALSE(t2->IsFallback());
+}
+
+TEST_F(ModelFallbackTest, FallbackOnLatencyOnlyWhileBusy)
+{
+    const auto config = MakeConfig(0, 10ms);
+    CModelFallback fallback(config);
+    {
+        const auto slow = fallback.Acquire(kBig);
+        std::this_thread::sleep_for(20ms); // NOLINT
+        slow->MarkFirstToken();
+
+        const auto next = fallback.Acquire(kBig);
+        EXPECT_TRUE(next->IsFallback());
+    }
+    // Nothing is in flight anymore, big model must get a chance again.
+    const auto idle = fallback.Acquire(kBig);
+    EXPECT_FALSE(idle->IsFallback());
+}
+
+TEST_F(ModelFallbackTest, ModelWithoutFallbackIsKept)
+{
+    const auto config = MakeConfig(1, 0ms);
+    CModelFallback fallback(config);
+    const auto t1 = fallback.Acquire(kSmall);
+    const auto t2 = fallback.Acquire(kSmall);
+    EXPECT_EQ(t2->Model(), kSmall);
+    EXPECT_FALSE(t2->IsFallback());
+}
+
+} // namespace Testing
@@ -0,0 +1,75 @@
+#include <network/ollama_proxy_config.hpp>
+#include <network/passthrough_policy.hpp>
+#include <ollama/json.hpp>
+
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class PassthroughPolicyTest : public ::testing::Test
+{
+  public:
+    using ERoute = CPassthroughPolicy::ERoute;
+
+    static std::string MakeChat(const std::string &model, bool isStream)
+    {
+        nlohmann::json chat;
+        chat["model"] = model;
+        chat["stream"] = isStream;
+        chat["messages"] = nlohmann::json::array();
+        // Nested "model" must not be taken for the requested one.
+        chat["messages"].push_back({{"role", "user"}, {"content", "Hi"}, {"model", "nested"}});
+        return chat.dump();
+    }
+
+    TPassthroughConfig config;
+};
+
+TEST_F(PassthroughPolicyTest, InterceptsByDefault)
+{
+    const CPassthroughPolicy policy(config);
+    const auto decision = policy.Decide("", MakeChat("llama3", true));
+    EXPECT_EQ(decision.route, ERoute::Intercepted);
+    // Nothing could forward the chat, so the body is left for the pipeline to parse.
+    EXPECT_TRUE(decision.model.empty());
+    // Single response is aggregated from the intercepted stream.
+    EXPECT_EQ(policy.Decide("", MakeChat("llama3", false)).route, ERoute::Intercepted);
+}
+
+TEST_F(PassthroughPolicyTest, ForwardsConfiguredModels)
+{
+    config.models = {"plain"};
+    const CPassthroughPolicy policy(config);
+    const auto decision = policy.Decide("", MakeChat("plain", true));
+    EXPECT_EQ(decision.route, ERoute::Streamed);
+    EXPECT_EQ(decision.model, "plain");
+    EXPECT_EQ(policy.Decide("", MakeChat("nested", true)).route, ERoute::Intercepted);
+}
+
+TEST_F(PassthroughPolicyTest, HeaderIsHonoredIfAllowed)
+{
+    const CPassthroughPolicy policy(config);
+    EXPECT_EQ(policy.Decide("off", MakeChat("llama3", true)).route, ERoute::Streamed);
+    config.isHeaderHonored = false;
+    EXPECT_EQ(policy.Decide("off", MakeChat("llama3", true)).route, ERoute::Intercepted);
+}
+
+TEST_F(PassthroughPolicyTest, NonStreamingIsBuffered)
+{
+    config.isChatIntercepted = false;
+    const CPassthroughPolicy policy(config);
+    EXPECT_EQ(policy.Decide("", MakeChat("llama3", false)).route, ERoute::Buffered);
+    // Ollama streams if it is not told otherwise.
+    EXPECT_EQ(policy.Decide("", R"({"model":"llama3","messages":[]})").route, ERoute::Streamed);
+}
+
+TEST_F(PassthroughPolicyTest, MalformedChatIsIntercepted)
+{
+    config.isChatIntercepted = false;
+    const CPassthroughPolicy policy(config);
+    EXPECT_EQ(policy.Decide("off", "{not json").route, ERoute::Intercepted);
+}
+
+} // namespace Testing
@@ -0,0 +1,52 @@
+#include <network/proxy_metrics.hpp>
+
+#include <sstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class ProxyMetricsTest : public ::testing::Test
+{
+  public:
+    static std::string Render()
+    {
+        std::ostringstream os;
+        proxy_metrics::GetRegistry().Render(os);
+        return os.str();
+    }
+};
+
+TEST_F(ProxyMetricsTest, UnknownModelsShareOneLabel)
+{
+    auto &first = proxy_metrics::TimeToFirstToken("random-model-1");
+    auto &second = proxy_metrics::TimeToFirstToken("random-model-2");
+    EXPECT_EQ(&first, &second);
+    EXPECT_EQ(&proxy_metrics::Requests("/api/chat", "random-model-1"),
+              &proxy_metrics::Requests("/api/chat", "random-model-2"));
+    const auto text = Render();
+    EXPECT_EQ(text.find("random-model"), std::string::npos);
+    EXPECT_NE(text.find(R"(model="other")"), std::string::npos);
+}
+
+TEST_F(ProxyMetricsTest, KnownModelKeepsItsLabel)
+{
+    EXPECT_EQ(proxy_metrics::NormalizeModel("known:latest"), "other");
+    proxy_metrics::AddKnownModel("known:latest");
+    EXPECT_EQ(proxy_metrics::NormalizeModel("known:latest"), "known:latest");
+    EXPECT_NE(&proxy_metrics::TokensPerSecond("known:latest"),
+              &proxy_metrics::TokensPerSecond("unknown:latest"));
+    EXPECT_EQ(proxy_metrics::NormalizeModel(""), "");
+}
+
+TEST_F(ProxyMetricsTest, KnownModelsAreBounded)
+{
+    for (int i = 0; i < 1000; ++i)
+    {
+        proxy_metrics::AddKnownModel("learned-" + std::to_string(i));
+    }
+    EXPECT_EQ(proxy_metrics::NormalizeModel("learned-999"), "other");
+}
+
+} // namespace Testing
@@ -0,0 +1,64 @@
+#include <network/request_key.hpp>
+#include <ollama/json.hpp>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class RequestKeyTest : public ::testing::Test
+{
+  public:
+    static nlohmann::json MakeRequest()
+    {
+        return nlohmann::json::parse(R"({"model": "llama3:8b", "stream": true,
+            "messages": [{"role": "user", "content": "Hi"}],
+            "options": {"temperature": 0, "seed": 42}})");
+    }
+};
+
+TEST_F(RequestKeyTest, NonDeterministicHasNoCanonicalForm)
+{
+    auto request = MakeRequest();
+    request["options"]["temperature"] = 0.7;
+    EXPECT_FALSE(MakeCanonicalRequest(request).has_value());
+
+    request = MakeRequest();
+    request["options"].erase("seed");
+    EXPECT_FALSE(MakeCanonicalRequest(request).has_value());
+
+    request = MakeRequest();
+    request.erase("options");
+    EXPECT_FALSE(MakeCanonicalRequest(request).has_value());
+}
+
+TEST_F(RequestKeyTest, IgnoredFieldsDoNotChangeCanonicalForm)
+{
+    const auto request = MakeRequest();
+    auto other = MakeRequest();
+    other["stream"] = false;
+    other["keep_alive"] = "5m";
+
+    const auto canonical = MakeCanonicalRequest(request);
+    ASSERT_TRUE(canonical.has_value());
+    EXPECT_EQ(canonical, MakeCanonicalRequest(other));
+}
+
+TEST_F(RequestKeyTest, ContentChangesCanonicalForm)
+{
+    auto other = MakeRequest();
+    other["messages"][0]["content"] = "Hello";
+    EXPECT_NE(MakeCanonicalRequest(MakeRequest()), MakeCanonicalRequest(other));
+
+    other = MakeRequest();
+    other["options"]["seed"] = 43;
+    EXPECT_NE(MakeCanonicalRequest(MakeRequest()), MakeCanonicalRequest(other));
+}
+
+TEST_F(RequestKeyTest, HashIsStable)
+{
+    // Reference values of FNV-1a 64.
+    EXPECT_EQ(HashFnv1a(""), 0xcbf29ce484222325ull);
+    EXPECT_EQ(HashFnv1a("a"), 0xaf63dc4c8601ec8cull);
+}
+
+} // namespace Testing
@@ -0,0 +1,119 @@
+#include <network/ollama_proxy_config.hpp>
+#include <network/request_trace.hpp>
+#include <ollama/json.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <set>
+#include <sstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class RequestTraceTest : public ::testing::Test
+{
+  public:
+    void SetUp() override
+    {
+        config.path =
+          (std::filesystem::temp_directory_path() / "ollama_mitm_trace_test.json").string();
+        std::filesystem::remove(config.path);
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove(config.path);
+    }
+
+    /// @returns Events written to the file so far.
+    [[nodiscard]]
+    nlohmann::json ReadEvents() const
+    {
+        std::ifstream file(config.path);
+        std::stringstream content;
+        content << file.rdbuf();
+        // File is appended forever, so it has trailing comma instead of closing bracket.
+        auto text = content.str();
+        const auto lastComma = text.rfind(',');
+        if (lastComma != std::string::npos)
+        {
+            text.erase(lastComma);
+        }
+        return nlohmann::json::parse(text + "]");
+    }
+
+    TTracingConfig config;
+};
+
+TEST_F(RequestTraceTest, DisabledWithoutSampleRate)
+{
+    const auto exporter = std::make_shared<CTraceExporter>(config);
+    EXPECT_EQ(exporter->StartTrace("POST /api/chat", std::chrono::steady_clock::now()), nullptr);
+}
+
+TEST_F(RequestTraceTest, SamplesExactShareOfRequests)
+{
+    config.sampleRate = 0.25;
+    const auto exporter = std::make_shared<CTraceExporter>(config);
+    std::size_t traced = 0;
+    for (std::size_t i = 0; i < 100; ++i)
+    {
+        if (exporter->StartTrace("POST /api/chat", std::chrono::steady_clock::now()))
+        {
+            ++traced;
+        }
+    }
+    EXPECT_EQ(traced, 25u);
+}
+
+TEST_F(RequestTraceTest, WritesChromeTraceEvents)
+{
+    config.sampleRate = 1.0;
+    const auto exporter = std::make_shared<CTraceExporter>(config);
+    {
+        auto trace = exporter->StartTrace("POST /api/chat", std::chrono::steady_clock::now());
+        ASSERT_NE(trace, nullptr);
+        trace->AddArg("model", "llama3");
+        {
+            CRequestTrace::CSpan span(trace, "upstream");
+            span.Arg("eval_duration", 1000).Arg("prompt_eval_duration", 200);
+        }
+    }
+    exporter->Flush();
+
+    const auto events = ReadEvents();
+    ASSERT_TRUE(events.is_array());
+    std::set<std::string> names;
+    for (const auto &event : events)
+    {
+        names.insert(event["name"].get<std::string>());
+        EXPECT_EQ(event["pid"], 1);
+        if (event["name"] == "upstream")
+        {
+            EXPECT_EQ(event["ph"], "X");
+            EXPECT_EQ(event["args"]["eval_duration"], 1000);
+            EXPECT_EQ(event["args"]["prompt_eval_duration"], 200);
+            EXPECT_GE(event["dur"].get<std::int64_t>(), 0);
+        }
+        if (event["name"] == "POST /api/chat")
+        {
+            EXPECT_EQ(event["args"]["model"], "llama3");
+        }
+    }
+    EXPECT_EQ(names, (std::set<std::string>{"POST /api/chat", "upstream", "process_name"}));
+}
+
+TEST_F(RequestTraceTest, NullTraceSpanDoesNothing)
+{
+    const CTraceExporter::TTracePtr trace;
+    CRequestTrace::CSpan span(trace, "noop");
+    span.Arg("key", 1);
+}
+
+} // namespace Testing
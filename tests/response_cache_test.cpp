@@ -0,0 +1,133 @@
+#include <network/ollama_proxy_config.hpp>
+#include <network/response_cache.hpp>
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class ResponseCacheTest : public ::testing::Test
+{
+  public:
+    void SetUp() override
+    {
+        config.path = (std::filesystem::temp_directory_path() / "ollama_mitm_cache_test").string();
+        config.maxBytes = kStoreSize;
+        config.maxEntryBytes = kStoreSize / 4;
+        RemoveFiles();
+    }
+
+    void TearDown() override
+    {
+        RemoveFiles();
+    }
+
+    void RemoveFiles() const
+    {
+        std::filesystem::remove(config.path);
+        std::filesystem::remove(config.path + ".idx");
+        std::filesystem::remove(config.path + ".tmp");
+    }
+
+    static constexpr std::size_t kStoreSize = 64 * 1024;
+    TResponseCacheConfig config;
+};
+
+TEST_F(ResponseCacheTest, DisabledWithoutPath)
+{
+    const TResponseCacheConfig disabledConfig;
+    CResponseCache cache(disabledConfig);
+    EXPECT_FALSE(cache.IsEnabled());
+    cache.Store("a", {"a"});
+    EXPECT_FALSE(cache.Lookup("a").has_value());
+}
+
+TEST_F(ResponseCacheTest, StoresAndCountsHits)
+{
+    CResponseCache cache(config);
+    ASSERT_TRUE(cache.IsEnabled());
+    EXPECT_FALSE(cache.Lookup("one").has_value());
+
+    const CResponseCache::TLines lines = {R"({"done":false})", "", R"({"done":true})"};
+    cache.Store("one", lines);
+    const auto found = cache.Lookup("one");
+    ASSERT_TRUE(found.has_value());
+    EXPECT_EQ(*found, lines);
+    EXPECT_EQ(cache.GetHits(), 1u);
+    EXPECT_EQ(cache.GetMisses(), 1u);
+}
+
+TEST_F(ResponseCacheTest, SurvivesRestart)
+{
+    {
+        CResponseCache cache(config);
+        cache.Store("one", {"one"});
+        cache.Store("two", {"two", "lines"});
+    }
+    CResponseCache cache(config);
+    EXPECT_EQ(cache.Lookup("one"), CResponseCache::TLines{"one"});
+    const CResponseCache::TLines expected = {"two", "lines"};
+    EXPECT_EQ(cache.Lookup("two"), expected);
+}
+
+TEST_F(ResponseCacheTest, TooBigEntryIsNotStored)
+{
+    CResponseCache cache(config);
+    cache.Store("one", {std::string(kStoreSize / 2, 'x')});
+    EXPECT_FALSE(cache.Lookup("one").has_value());
+    // Key is stored with the response and counts too.
+    cache.Store(std::string(kStoreSize / 2, 'k'), {"one"});
+    EXPECT_FALSE(cache.Lookup(std::string(kStoreSize / 2, 'k')).has_value());
+}
+
+TEST_F(ResponseCacheTest, StoreMadeByOtherFormatIsDropped)
+{
+    {
+        CResponseCache cache(config);
+        cache.Store("one", {"one"});
+    }
+    // Store of the first format had no keys in the records.
+    {
+        std::fstream store(config.path, std::ios::binary | std::ios::in | std::ios::out);
+        store.seekp(7);
+        store.put('1');
+    }
+    CResponseCache cache(config);
+    EXPECT_FALSE(cache.Lookup("one").has_value());
+}
+
+TEST_F(ResponseCacheTest, LeastRecentlyUsedIsEvicted)
+{
+    CResponseCache cache(config);
+    const std::string payload(kStoreSize / 8, 'x');
+    cache.Store("0", {payload});
+    for (int key = 1; key < 16; ++key)
+    {
+        // Keeps the first one recently used.
+        EXPECT_TRUE(cache.Lookup("0").has_value());
+        cache.Store(std::to_string(key), {payload});
+    }
+    EXPECT_GT(cache.GetEvictions(), 0u);
+    EXPECT_LE(cache.GetUsedBytes(), kStoreSize);
+    EXPECT_TRUE(cache.Lookup("0").has_value());
+    EXPECT_TRUE(cache.Lookup("15").has_value());
+    EXPECT_FALSE(cache.Lookup("1").has_value());
+
+    // Compacted store is loaded properly.
+    CResponseCache reopened(config);
+    EXPECT_EQ(reopened.Lookup("15"), CResponseCache::TLines{payload});
+}
+
+TEST_F(ResponseCacheTest, KeysDependOnRouteAndStreaming)
+{
+    EXPECT_NE(CResponseCache::MakeKey("/api/chat", true, "{}"),
+              CResponseCache::MakeKey("/api/generate", true, "{}"));
+    EXPECT_NE(CResponseCache::MakeKey("/api/generate", true, "{}"),
+              CResponseCache::MakeKey("/api/generate", false, "{}"));
+}
+
+} // namespace Testing
@@ -0,0 +1,165 @@
+#include <network/ollama_proxy_config.hpp>
+#include <network/session_store.hpp>
+#include <ollama/json.hpp>
+
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class SessionStoreTest : public ::testing::Test
+{
+  public:
+    void SetUp() override
+    {
+        spillDirectory = std::filesystem::temp_directory_path() / "ollama_mitm_sessions_test";
+        std::filesystem::remove_all(spillDirectory);
+        std::filesystem::create_directories(spillDirectory);
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove_all(spillDirectory);
+    }
+
+    static nlohmann::json MakeMessage(const std::string &role, const std::string &content)
+    {
+        return {{"role", role}, {"content", content}};
+    }
+
+    static nlohmann::json MakeChat(const std::string &content)
+    {
+        nlohmann::json chat;
+        chat["model"] = "mock:latest";
+        chat["messages"] = nlohmann::json::array({MakeMessage("user", content)});
+        return chat;
+    }
+
+    /// @brief Commits the first turn of the new session with the given answer.
+    static std::string Converse(CSessionStore &store, const std::string &question,
+                                const std::string &answer)
+    {
+        auto turn = store.Create(MakeChat(question));
+        auto messages = turn.chat["messages"];
+        messages.push_back(MakeMessage("assistant", answer));
+        EXPECT_TRUE(store.Commit(turn, std::move(messages)));
+        return turn.id;
+    }
+
+    std::filesystem::path spillDirectory;
+};
+
+TEST_F(SessionStoreTest, ContinuedTurnHasWholeHistory)
+{
+    const TSessionConfig config;
+    CSessionStore store(config);
+    ASSERT_TRUE(store.IsEnabled());
+    const auto id = Converse(store, "Hi", "Hello");
+
+    nlohmann::json delta;
+    delta["messages"] = nlohmann::json::array({MakeMessage("user", "How are you?")});
+    const auto turn = store.Continue(id, delta);
+    ASSERT_TRUE(turn.has_value());
+    EXPECT_TRUE(turn->hasAiCommands);
+    EXPECT_EQ(turn->chat["model"], "mock:latest");
+    const auto &messages = turn->chat["messages"];
+    ASSERT_EQ(messages.size(), 3u);
+    EXPECT_EQ(messages[0]["content"], "Hi");
+    EXPECT_EQ(messages[1]["content"], "Hello");
+    EXPECT_EQ(messages[2]["content"], "How are you?");
+}
+
+TEST_F(SessionStoreTest, UncommittedSessionIsNotContinued)
+{
+    const TSessionConfig config;
+    CSessionStore store(config);
+    // First turn failed, so its history was never stored.
+    const auto id = store.Create(MakeChat("Hi")).id;
+
+    nlohmann::json delta;
+    delta["messages"] = nlohmann::json::array({MakeMessage("user", "How are you?")});
+    EXPECT_FALSE(store.Continue(id, delta).has_value());
+}
+
+TEST_F(SessionStoreTest, IdsAreRandomTokens)
+{
+    const TSessionConfig config;
+    CSessionStore store(config);
+    const auto first = store.Create(MakeChat("Hi")).id;
+    const auto second = store.Create(MakeChat("Hi")).id;
+    EXPECT_EQ(first.size(), 32u);
+    EXPECT_NE(first, second);
+    // Ids of the sequential sessions share no common prefix like counters or seeded engines do.
+    EXPECT_NE(first.substr(0, 8), second.substr(0, 8));
+}
+
+TEST_F(SessionStoreTest, ConcurrentTurnIsNotCommitted)
+{
+    const TSessionConfig config;
+    CSessionStore store(config);
+    const auto id = Converse(store, "Hi", "Hello");
+
+    nlohmann::json delta;
+    delta["messages"] = nlohmann::json::array({MakeMessage("user", "Next")});
+    const auto first = store.Continue(id, delta);
+    const auto second = store.Continue(id, delta);
+    ASSERT_TRUE(first.has_value() && second.has_value());
+    EXPECT_TRUE(store.Commit(*first, first->chat["messages"]));
+    EXPECT_FALSE(store.Commit(*second, second->chat["messages"]));
+}
+
+TEST_F(SessionStoreTest, EvictedSessionIsRestoredFromSpill)
+{
+    TSessionConfig config;
+    config.maxSessions = 1;
+    config.spillDirectory = spillDirectory.string();
+    CSessionStore store(config);
+    const auto first = Converse(store, "First", "One");
+    const auto second = Converse(store, "Second", "Two");
+    EXPECT_EQ(store.GetSessionsCount(), 1u);
+    EXPECT_EQ(store.GetEvictions(), 1u);
+
+    nlohmann::json delta;
+    delta["messages"] = nlohmann::json::array({MakeMessage("user", "Again")});
+    const auto turn = store.Continue(first, delta);
+    ASSERT_TRUE(turn.has_value());
+    EXPECT_EQ(store.GetRestores(), 1u);
+    EXPECT_EQ(turn->chat["messages"][1]["content"], "One");
+    // Restored session evicted the other one, it is committed on top of the spilled version.
+    EXPECT_TRUE(store.Commit(*turn, turn->chat["messages"]));
+    EXPECT_TRUE(store.Continue(second, delta).has_value());
+}
+
+TEST_F(SessionStoreTest, EvictedSessionIsDroppedWithoutSpill)
+{
+    TSessionConfig config;
+    config.maxSessions = 1;
+    CSessionStore store(config);
+    const auto first = Converse(store, "First", "One");
+    Converse(store, "Second", "Two");
+
+    nlohmann::json delta;
+    delta["messages"] = nlohmann::json::array();
+    EXPECT_FALSE(store.Continue(first, delta).has_value());
+}
+
+TEST_F(SessionStoreTest, RejectsUnknownAndMalformed)
+{
+    TSessionConfig config;
+    config.spillDirectory = spillDirectory.string();
+    CSessionStore store(config);
+    nlohmann::json delta;
+    delta["messages"] = nlohmann::json::array();
+    EXPECT_FALSE(store.Continue("0123456789abcdef0123456789abcdef", delta).has_value());
+    // Id is not used as a path unless it is the generated one.
+    EXPECT_FALSE(store.Continue("../../etc/passwd", delta).has_value());
+    EXPECT_THROW((void)store.Continue("0123456789abcdef0123456789abcdef", {{"model", "m"}}),
+                 std::invalid_argument);
+    EXPECT_THROW((void)store.Create({{"messages", nlohmann::json::array()}}),
+                 std::invalid_argument);
+}
+
+} // namespace Testing
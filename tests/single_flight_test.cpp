@@ -0,0 +1,89 @@
+#include <network/ollama_proxy.hpp>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/httplib.h>
+#include <ollama/json.hpp>
+#include <tools/mock_ollama.hpp>
+
+#include <chrono>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using namespace std::chrono_literals;
+
+/// @brief Identical deterministic chats sent at the same time through the real proxy.
+class SingleFlightTest : public ::testing::Test
+{
+  public:
+    void SetUp() override
+    {
+        mockConfig.timeToFirstToken = 200ms;
+        mockConfig.tokensPerSecond = 100;
+        mockConfig.tokensCount = 20;
+    }
+
+    static std::string MakeChat(const std::string &content)
+    {
+        nlohmann::json chat;
+        chat["model"] = "mock:latest";
+        chat["stream"] = true;
+        chat["options"] = {{"temperature", 0}, {"seed", 42}};
+        chat["messages"] = nlohmann::json::array();
+        chat["messages"].push_back({{"role", "user"}, {"content", content}});
+        return chat.dump();
+    }
+
+    /// @returns Answer of the single chat, empty if it failed.
+    static std::string Chat(int port, const std::string &content)
+    {
+        httplib::Client client("127.0.0.1", port);
+        const auto result = client.Post("/api/chat", MakeChat(content), "application/json");
+        return result && result->status == 200 ? result->body : std::string{};
+    }
+
+    TMockOllamaConfig mockConfig;
+};
+
+TEST_F(SingleFlightTest, IdenticalChatsShareGeneration)
+{
+    CMockOllama mock(mockConfig);
+    TOllamaProxyConfig config;
+    config.ollamaHost = "127.0.0.1";
+    config.ollamaPort = mock.Start();
+    COllamaProxyServer proxy(config);
+    const auto port = proxy.BindToAnyPort();
+    std::thread listener([&proxy]() {
+        proxy.ListenAfterBind();
+    });
+
+    std::string leader;
+    std::string joined;
+    std::string other;
+    std::thread first([&]() {
+        leader = Chat(port, "Count please.");
+    });
+    // Joins while the leader waits for the first token.
+    std::this_thread::sleep_for(50ms);
+    std::thread second([&]() {
+        joined = Chat(port, "Count please.");
+    });
+    std::thread third([&]() {
+        other = Chat(port, "Count again.");
+    });
+    first.join();
+    second.join();
+    third.join();
+    proxy.Stop();
+    listener.join();
+
+    EXPECT_NE(leader.find("tok19"), std::string::npos);
+    EXPECT_EQ(joined, leader);
+    EXPECT_NE(other.find("tok19"), std::string::npos);
+    // Different chat is not joined.
+    EXPECT_EQ(mock.GetGenerationTimings().size(), 2u);
+}
+
+} // namespace Testing
@@ -0,0 +1,94 @@
+#include <network/ollama_proxy_config.hpp>
+#include <network/stream_capture.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class StreamCaptureTest : public ::testing::Test
+{
+  public:
+    void SetUp() override
+    {
+        config.path =
+          (std::filesystem::temp_directory_path() / "ollama_mitm_stream_capture_test").string();
+        std::filesystem::remove(config.path);
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove(config.path);
+    }
+
+    static TCapturedStream MakeStream(const std::string &model, std::size_t linesCount)
+    {
+        TCapturedStream stream;
+        stream.model = model;
+        for (std::size_t i = 0; i < linesCount; ++i)
+        {
+            stream.lines.push_back({std::chrono::microseconds{i * 300}, R"({"done":false})"});
+        }
+        return stream;
+    }
+
+    TStreamCaptureConfig config;
+};
+
+TEST_F(StreamCaptureTest, ReadsWhatWasWritten)
+{
+    {
+        CStreamCapture capture(config);
+        ASSERT_TRUE(capture.IsEnabled());
+        capture.Write(MakeStream("llama3", 3));
+    }
+    {
+        // Reopened file is appended.
+        CStreamCapture capture(config);
+        capture.Write(MakeStream("qwen", 200));
+    }
+    const auto streams = CStreamCapture::ReadAll(config.path);
+    ASSERT_EQ(streams.size(), 2u);
+    EXPECT_EQ(streams[0].model, "llama3");
+    ASSERT_EQ(streams[0].lines.size(), 3u);
+    EXPECT_EQ(streams[0].lines[2].delay, std::chrono::microseconds{600});
+    EXPECT_EQ(streams[0].lines[2].text, R"({"done":false})");
+    EXPECT_EQ(streams[1].lines.size(), 200u);
+    EXPECT_EQ(streams[1].lines[199].delay, std::chrono::microseconds{199 * 300});
+}
+
+TEST_F(StreamCaptureTest, IgnoresTruncatedTail)
+{
+    {
+        CStreamCapture capture(config);
+        capture.Write(MakeStream("llama3", 3));
+        capture.Write(MakeStream("llama3", 3));
+    }
+    std::filesystem::resize_file(config.path, std::filesystem::file_size(config.path) - 2);
+    EXPECT_EQ(CStreamCapture::ReadAll(config.path).size(), 1u);
+}
+
+TEST_F(StreamCaptureTest, StopsAtMaxBytes)
+{
+    config.maxBytes = 64;
+    {
+        CStreamCapture capture(config);
+        capture.Write(MakeStream("llama3", 1));
+        capture.Write(MakeStream("llama3", 10));
+    }
+    EXPECT_EQ(CStreamCapture::ReadAll(config.path).size(), 1u);
+}
+
+TEST_F(StreamCaptureTest, RejectsOtherFiles)
+{
+    std::ofstream(config.path) << "not a capture";
+    EXPECT_THROW(static_cast<void>(CStreamCapture::ReadAll(config.path)), std::runtime_error);
+}
+
+} // namespace Testing
@@ -0,0 +1,209 @@
+#include <network/ollama_proxy.hpp>
+#include <network/ollama_proxy_config.hpp>
+#include <ollama/httplib.h>
+#include <ollama/json.hpp>
+#include <tools/mock_ollama.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using namespace std::chrono_literals;
+
+/// @brief User drops the chat stream in the middle and resumes it from the last line it got.
+class StreamResumeTest : public ::testing::Test
+{
+  public:
+    static constexpr auto kStreamIdHeader = "X-Ollama-Mitm-Stream";
+    static constexpr auto kOffsetHeader = "X-Ollama-Mitm-Offset";
+    static constexpr auto kTokenHeader = "X-Ollama-Mitm-Resume-Token";
+
+    /// @brief What the user got from the single connection.
+    struct TReceived
+    {
+        int status{0};
+        std::string streamId;
+        std::string resumeToken;
+        std::size_t lines{0};
+        std::string content;
+        bool isDone{false};
+    };
+
+    void SetUp() override
+    {
+        mockConfig.timeToFirstToken = 0ms;
+        mockConfig.tokensPerSecond = 100;
+        mockConfig.tokensCount = 30;
+    }
+
+    static std::string MakeChat()
+    {
+        nlohmann::json chat;
+        chat["model"] = "mock:latest";
+        chat["stream"] = true;
+        chat["messages"] = nlohmann::json::array();
+        chat["messages"].push_back({{"role", "user"}, {"content", "Count please."}});
+        return chat.dump();
+    }
+
+    /// @param maxLines connection is dropped after that many lines, 0 reads all.
+    static TReceived Chat(int port, const httplib::Headers &headers, std::size_t maxLines)
+    {
+        httplib::Client client("127.0.0.1", port);
+        httplib::Request request;
+        request.method = "POST";
+        request.path = "/api/chat";
+        request.headers = headers;
+        request.body = MakeChat();
+        request.set_header("Content-Type", "application/json");
+
+        TReceived received;
+        std::string pending;
+        request.response_handler = [&received](const httplib::Response &response) {
+            received.status = response.status;
+            received.streamId = response.get_header_value(kStreamIdHeader);
+            received.resumeToken = response.get_header_value(kTokenHeader);
+            return true;
+        };
+        request.content_receiver = [&](const char *data, std::size_t length, std::uint64_t,
+                                       std::uint64_t) {
+            pending.append(data, length);
+            for (auto end = pending.find('\n'); end != std::string::npos; end = pending.find('\n'))
+            {
+                const auto line = pending.substr(0, end);
+                pending.erase(0, end + 1);
+                // Lines which are not JSON (like chunk sizes) are skipped.
+                const auto chunk = nlohmann::json::parse(line, nullptr, false);
+                if (chunk.is_discarded() || !chunk.is_object())
+                {
+                    continue;
+                }
+                ++received.lines;
+                if (chunk.contains("message"))
+                {
+                    received.content += chunk["message"].value("content", "");
+                }
+                received.isDone = received.isDone || chunk.value("done", false);
+                if (maxLines > 0 && received.lines == maxLines)
+                {
+                    return false;
+                }
+            }
+            return true;
+        };
+        httplib::Response response;
+        httplib::Error error{httplib::Error::Unknown};
+        client.send(request, response, error);
+        return received;
+    }
+
+    TMockOllamaConfig mockConfig;
+};
+
+TEST_F(StreamResumeTest, ResumedStreamIsNotGeneratedAgain)
+{
+    CMockOllama mock(mockConfig);
+    TOllamaProxyConfig config;
+    config.ollamaHost = "127.0.0.1";
+    config.ollamaPort = mock.Start();
+    config.coalesceDeterministicChats = false;
+    config.streamResume.linger = 5s;
+    COllamaProxyServer proxy(config);
+    const auto port = proxy.BindToAnyPort();
+    std::thread listener([&proxy]() {
+        proxy.ListenAfterBind();
+    });
+
+    const auto dropped = Chat(port, {}, 3);
+    // Stranger knows the sequential id, but not the token.
+    const auto stranger =
+      Chat(port, {{kStreamIdHeader, dropped.streamId}, {kTokenHeader, std::string(32, '0')}}, 0);
+    const auto resumed = Chat(port,
+                              {{kStreamIdHeader, dropped.streamId},
+                               {kTokenHeader, dropped.resumeToken},
+                               {kOffsetHeader, std::to_string(dropped.lines)}},
+                              0);
+    const auto gone = Chat(port,
+                           {{kStreamIdHeader, "999999"},
+                            {kTokenHeader, dropped.resumeToken},
+                            {kOffsetHeader, "0"}},
+                           0);
+    const auto withoutToken = Chat(port, {{kStreamIdHeader, dropped.streamId}}, 0);
+    proxy.Stop();
+    listener.join();
+
+    ASSERT_EQ(dropped.status, 200);
+    ASSERT_FALSE(dropped.streamId.empty());
+    EXPECT_EQ(dropped.lines, 3u);
+    EXPECT_FALSE(dropped.isDone);
+    EXPECT_EQ(resumed.status, 200);
+    EXPECT_TRUE(resumed.isDone);
+    std::string expected;
+    for (std::size_t i = 0; i < mockConfig.tokensCount; ++i)
+    {
+        expected += "tok" + std::to_string(i) + " ";
+    }
+    EXPECT_EQ(dropped.content + resumed.content, expected);
+    EXPECT_EQ(mock.GetGenerationTimings().size(), 1u);
+    EXPECT_EQ(gone.status, 410);
+    EXPECT_EQ(dropped.resumeToken.size(), 32u);
+    EXPECT_EQ(stranger.status, 410);
+    EXPECT_EQ(stranger.lines, 0u);
+    EXPECT_EQ(withoutToken.status, 400);
+}
+
+TEST_F(StreamResumeTest, DebugCancelStopsParkedStream)
+{
+    mockConfig.tokensPerSecond = 20;
+    mockConfig.tokensCount = 200;
+    CMockOllama mock(mockConfig);
+    TOllamaProxyConfig config;
+    config.ollamaHost = "127.0.0.1";
+    config.ollamaPort = mock.Start();
+    config.coalesceDeterministicChats = false;
+    config.streamResume.linger = 30s;
+    COllamaProxyServer proxy(config);
+    const auto port = proxy.BindToAnyPort();
+    std::thread listener([&proxy]() {
+        proxy.ListenAfterBind();
+    });
+
+    const auto dropped = Chat(port, {}, 2);
+    httplib::Client client("127.0.0.1", port);
+    const auto listed = client.Get("/debug/streams");
+    const auto cancelPath = "/debug/streams/" + dropped.streamId + "/cancel";
+    const auto cancelled = client.Post(cancelPath, "", "application/json");
+    const auto cancelledAt = CMockOllama::NowMicroseconds();
+    std::this_thread::sleep_for(500ms);
+    const auto listedAfter = client.Get("/debug/streams");
+    const auto cancelledAgain = client.Post(cancelPath, "", "application/json");
+    const auto overflow = client.Post("/debug/streams/99999999999999999999999/cancel", "",
+                                      "application/json");
+    const auto timings = mock.GetGenerationTimings();
+    proxy.Stop();
+    listener.join();
+
+    ASSERT_TRUE(listed && cancelled && listedAfter && cancelledAgain && overflow);
+    const auto streams = nlohmann::json::parse(listed->body);
+    ASSERT_EQ(streams.size(), 1u);
+    EXPECT_EQ(std::to_string(streams[0]["id"].get<std::uint64_t>()), dropped.streamId);
+    EXPECT_TRUE(streams[0]["parked"].get<bool>());
+    EXPECT_EQ(cancelled->status, 200);
+    // Ollama stopped generating at once instead of finishing 10 seconds long answer.
+    ASSERT_EQ(timings.size(), 1u);
+    EXPECT_LT(timings[0].lastSentAtUs, cancelledAt + 200000);
+    for (const auto &stream : nlohmann::json::parse(listedAfter->body))
+    {
+        EXPECT_FALSE(stream["parked"].get<bool>());
+    }
+    EXPECT_EQ(cancelledAgain->status, 404);
+    EXPECT_EQ(overflow->status, 400);
+}
+
+} // namespace Testing
@@ -0,0 +1,182 @@
+#include <common/timer_wheel.hpp>
+#include <network/ollama_proxy_config.hpp>
+#include <network/stream_watchdog.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using namespace std::chrono_literals;
+
+class StreamWatchdogTest : public ::testing::Test
+{
+  public:
+    using TClock = CStreamWatchdog::TClock;
+
+    void SetUp() override
+    {
+        config.minHeartbeat = 20ms;
+        config.maxHeartbeat = 20ms;
+        config.stallTimeout = 0ms;
+        config.idleTimeout = 0ms;
+        config.deadline = 0ms;
+        probe.lastSentToUser = TClock::now();
+        probe.lastFromOllama = TClock::now();
+        probe.lastWritten = TClock::now();
+    }
+
+    CStreamWatchdog::THandlers MakeHandlers()
+    {
+        return {
+          [this] {
+              const std::lock_guard lock(mutex);
+              return probe;
+          },
+          [this] {
+              {
+                  const std::lock_guard lock(mutex);
+                  ++heartbeats;
+                  probe.lastSentToUser = TClock::now();
+              }
+              cv.notify_all();
+          },
+          [this](CStreamWatchdog::EExpiry reason) {
+              {
+                  const std::lock_guard lock(mutex);
+                  ++expiries;
+                  expiry = reason;
+              }
+              cv.notify_all();
+          },
+          [] {
+              return std::chrono::microseconds{0};
+          },
+        };
+    }
+
+    /// @returns false if the predicate did not become true in time.
+    template <typename taPredicate>
+    bool WaitFor(taPredicate predicate, std::chrono::milliseconds timeout = 2000ms)
+    {
+        std::unique_lock lock(mutex);
+        return cv.wait_for(lock, timeout, predicate);
+    }
+
+    utility::CTimerWheel wheel{1ms};
+    TStreamTimersConfig config;
+    std::mutex mutex;
+    std::condition_variable cv;
+    CStreamWatchdog::TProbe probe;
+    std::size_t heartbeats{0};
+    std::size_t expiries{0};
+    std::optional<CStreamWatchdog::EExpiry> expiry;
+};
+
+TEST_F(StreamWatchdogTest, HeartbeatsOnlyWhileUserSeesNothing)
+{
+    {
+        const CStreamWatchdog watchdog(wheel, config, std::nullopt, MakeHandlers());
+        std::this_thread::sleep_for(60ms);
+        {
+            const std::lock_guard lock(mutex);
+            EXPECT_EQ(heartbeats, 0u);
+            probe.isSilent = true;
+        }
+        EXPECT_TRUE(WaitFor([this] {
+            return heartbeats >= 3;
+        }));
+    }
+    const std::lock_guard lock(mutex);
+    EXPECT_EQ(expiries, 0u);
+    EXPECT_EQ(wheel.pending(), 0u);
+}
+
+TEST_F(StreamWatchdogTest, HeartbeatIntervalFollowsFirstToken)
+{
+    config.minHeartbeat = 2s;
+    config.maxHeartbeat = 15s;
+    EXPECT_EQ(CStreamWatchdog::GetHeartbeatInterval(config, 0us), 15s);
+    EXPECT_EQ(CStreamWatchdog::GetHeartbeatInterval(config, 200ms), 2s);
+    EXPECT_EQ(CStreamWatchdog::GetHeartbeatInterval(config, 10s), 5s);
+    EXPECT_EQ(CStreamWatchdog::GetHeartbeatInterval(config, 120s), 15s);
+}
+
+TEST_F(StreamWatchdogTest, DetectsStalledGeneration)
+{
+    config.stallTimeout = 30ms;
+    const CStreamWatchdog watchdog(wheel, config, std::nullopt, MakeHandlers());
+    std::this_thread::sleep_for(60ms);
+    {
+        // Waiting for the first token is not a stall.
+        const std::lock_guard lock(mutex);
+        EXPECT_EQ(expiries, 0u);
+        probe.isGenerating = true;
+        probe.lastFromOllama = TClock::now();
+    }
+    const auto generatingSince = TClock::now();
+    ASSERT_TRUE(WaitFor([this] {
+        return expiries > 0;
+    }));
+    EXPECT_GE(TClock::now() - generatingSince, 30ms);
+    EXPECT_EQ(expiry, CStreamWatchdog::EExpiry::Stalled);
+}
+
+TEST_F(StreamWatchdogTest, DetectsIdleUsers)
+{
+    config.idleTimeout = 30ms;
+    probe.hasUnwritten = true;
+    const CStreamWatchdog watchdog(wheel, config, std::nullopt, MakeHandlers());
+    ASSERT_TRUE(WaitFor([this] {
+        return expiries > 0;
+    }));
+    EXPECT_EQ(expiry, CStreamWatchdog::EExpiry::Idle);
+}
+
+TEST_F(StreamWatchdogTest, DeadlineExpiresOnce)
+{
+    config.deadline = 20ms;
+    config.stallTimeout = 20ms;
+    probe.isGenerating = true;
+    probe.isSilent = true;
+    const CStreamWatchdog watchdog(wheel, config, std::nullopt, MakeHandlers());
+    ASSERT_TRUE(WaitFor([this] {
+        return expiries > 0;
+    }));
+    std::this_thread::sleep_for(60ms);
+    const std::lock_guard lock(mutex);
+    EXPECT_EQ(expiries, 1u);
+    // Expired watchdog does not ping anymore.
+    EXPECT_LE(heartbeats, 1u);
+    EXPECT_EQ(wheel.pending(), 0u);
+}
+
+TEST_F(StreamWatchdogTest, UserDeadlineShortensConfiguredOne)
+{
+    config.deadline = 10s;
+    const auto startedAt = TClock::now();
+    const CStreamWatchdog watchdog(wheel, config, startedAt + 30ms, MakeHandlers());
+    ASSERT_TRUE(WaitFor([this] {
+        return expiries > 0;
+    }));
+    EXPECT_GE(TClock::now() - startedAt, 30ms);
+    EXPECT_EQ(expiry, CStreamWatchdog::EExpiry::DeadlineExceeded);
+}
+
+TEST_F(StreamWatchdogTest, PassedUserDeadlineExpiresAtOnce)
+{
+    const CStreamWatchdog watchdog(wheel, config, TClock::now() - 1s, MakeHandlers());
+    ASSERT_TRUE(WaitFor([this] {
+        return expiries > 0;
+    }));
+    EXPECT_EQ(expiry, CStreamWatchdog::EExpiry::DeadlineExceeded);
+}
+
+} // namespace Testing
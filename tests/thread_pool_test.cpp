@@ -2,8 +2,15 @@
 
 #include <atomic>
 #include <chrono> // IWYU pragma: keep
+#include <cstddef>
 #include <ctime>
+#include <future>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <vector>
 
 #include <gtest/gtest.h>
 
@@ -15,6 +22,16 @@ using namespace std::chrono_literals;
 class ThreadPoolTest : public ::testing::Test
 {
   public:
+    template <typename taPredicate>
+    static bool WaitFor(taPredicate &&predicate)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + 5s;
+        while (!predicate() && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(1ms); // NOLINT
+        }
+        return predicate();
+    }
 };
 
 TEST_F(ThreadPoolTest, PoolWorks)
@@ -73,4 +90,239 @@ TEST_F(ThreadPoolTest, PoolProperlyHandlesDestruction)
     EXPECT_LT(block_ended_at - started_at, 2000ms); // NOLINT
 }
 
+TEST_F(ThreadPoolTest, SubmitDeliversResultAndException)
+{
+    CThreadPool pool(2);
+    auto answer = pool.submit([](const auto &) {
+        return 42;
+    });
+    auto failure = pool.submit([](const auto &) -> std::string {
+        throw std::runtime_error("Task failed.");
+    });
+    EXPECT_EQ(answer.get(), 42);
+    EXPECT_THROW(failure.get(), std::runtime_error);
+}
+
+TEST_F(ThreadPoolTest, MostUrgentLaneGoesFirst)
+{
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    std::mutex orderMutex;
+    std::vector<ETaskPriority> order;
+
+    CThreadPool pool(1);
+    // Single worker is busy, so all lanes are filled before anything is taken.
+    pool.enqueue([released](const auto &) {
+        released.wait();
+    });
+    std::vector<CTaskHandle<void>> handles;
+    for (const auto priority :
+         {ETaskPriority::Background, ETaskPriority::Normal, ETaskPriority::Critical})
+    {
+        handles.emplace_back(pool.submit(
+          [&orderMutex, &order, priority](const auto &) {
+              const std::lock_guard lock(orderMutex);
+              order.push_back(priority);
+          },
+          priority));
+    }
+    release.set_value();
+    for (auto &handle : handles)
+    {
+        handle.get();
+    }
+    EXPECT_EQ(order, (std::vector<ETaskPriority>{ETaskPriority::Critical, ETaskPriority::Normal,
+                                                 ETaskPriority::Background}));
+}
+
+TEST_F(ThreadPoolTest, CancelsSingleTask)
+{
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    std::atomic<bool> isQueuedExecuted{false};
+
+    CThreadPool pool(1);
+    auto running = pool.submit([released](const auto &stopper) {
+        while (!(*stopper))
+        {
+            std::this_thread::sleep_for(1ms); // NOLINT
+        }
+        released.wait();
+        return true;
+    });
+    auto queued = pool.submit([&isQueuedExecuted](const auto &) {
+        isQueuedExecuted = true;
+    });
+    while (pool.queued() != 1)
+    {
+        std::this_thread::sleep_for(1ms); // NOLINT
+    }
+
+    EXPECT_TRUE(queued.Cancel());
+    EXPECT_THROW(queued.get(), CTaskCancelled);
+    // Running task is only notified by its stopper.
+    EXPECT_FALSE(running.Cancel());
+    release.set_value();
+    EXPECT_TRUE(running.get());
+    EXPECT_FALSE(isQueuedExecuted);
+}
+
+TEST_F(ThreadPoolTest, DropsQueuedTasksOnDestruction)
+{
+    std::optional<CTaskHandle<void>> queued;
+    {
+        CThreadPool pool(1);
+        pool.enqueue([](const auto &stopper) {
+            while (!(*stopper))
+            {
+                std::this_thread::sleep_for(1ms); // NOLINT
+            }
+        });
+        queued.emplace(pool.submit([](const auto &) {}));
+    }
+    EXPECT_THROW(queued->get(), CTaskCancelled);
+}
+
+TEST_F(ThreadPoolTest, DrainsQueuedTasksOnDestruction)
+{
+    constexpr int kTasks = 100;
+    std::atomic<int> counter{0};
+    {
+        CThreadPool pool(2, EShutdownMode::Drain);
+        for (int i = 0; i < kTasks; ++i)
+        {
+            pool.enqueue(
+              [&counter](const auto &stopper) {
+                  EXPECT_FALSE(*stopper);
+                  std::this_thread::sleep_for(100us); // NOLINT
+                  ++counter;
+              },
+              ETaskPriority::Background);
+        }
+    }
+    EXPECT_EQ(counter.load(), kTasks);
+}
+
+TEST_F(ThreadPoolTest, DrainingPoolRunsTasksOfItsTasksOnly)
+{
+    CThreadPool pool(1, EShutdownMode::Drain);
+    std::optional<CTaskHandle<int>> spawned;
+    pool.enqueue([&pool, &spawned](const auto &) {
+        std::this_thread::sleep_for(10ms); // NOLINT
+        spawned.emplace(pool.submit([](const auto &) {
+            return 42;
+        }));
+    });
+    pool.shutdown();
+    ASSERT_TRUE(spawned.has_value());
+    EXPECT_EQ(spawned->get(), 42);
+
+    // Nobody is left to execute it, so its future does not hang.
+    auto late = pool.submit([](const auto &) {
+        return 1;
+    });
+    ASSERT_EQ(late.wait_for(1s), std::future_status::ready);
+    EXPECT_THROW(late.get(), CTaskCancelled);
+}
+
+TEST_F(ThreadPoolTest, ElasticPoolGrowsWhenTasksWait)
+{
+    constexpr std::size_t kMaxThreads = 4;
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    std::atomic<std::size_t> finished{0};
+
+    TThreadPoolSizing sizing;
+    sizing.minThreads = 1;
+    sizing.maxThreads = kMaxThreads;
+    sizing.targetQueueWait = 1ms;
+    CThreadPool pool(sizing);
+    EXPECT_EQ(pool.stats().workers, 1u);
+    // Blocked tasks are like commands waiting on I/O, the queue moves only with new workers.
+    for (std::size_t i = 0; i < kMaxThreads + 2; ++i)
+    {
+        pool.enqueue([released, &finished](const auto &) {
+            released.wait();
+            ++finished;
+        });
+    }
+    EXPECT_TRUE(WaitFor([&pool] {
+        return pool.stats().workers == kMaxThreads;
+    }));
+    release.set_value();
+    EXPECT_TRUE(WaitFor([&finished] {
+        return finished == kMaxThreads + 2;
+    }));
+
+    const auto stats = pool.stats();
+    EXPECT_EQ(stats.workers, kMaxThreads);
+    EXPECT_EQ(stats.spawnedWorkers, kMaxThreads);
+    EXPECT_EQ(stats.startedTasks, kMaxThreads + 2);
+    EXPECT_GE(stats.totalQueueWait, 3ms);
+}
+
+TEST_F(ThreadPoolTest, LateTaskSpawnsSingleWorker)
+{
+    std::promise<void> release;
+    auto released = release.get_future().share();
+    std::atomic<std::size_t> started{0};
+
+    TThreadPoolSizing sizing;
+    sizing.minThreads = 1;
+    sizing.maxThreads = 8;
+    sizing.targetQueueWait = 1ms;
+    CThreadPool pool(sizing);
+    const auto blocker = [released, &started](const auto &) {
+        ++started;
+        released.wait();
+    };
+    pool.enqueue(blocker);
+    EXPECT_TRUE(WaitFor([&started] {
+        return started == 1;
+    }));
+    // The only worker is busy, so this task is late until the new worker takes it.
+    pool.enqueue(blocker);
+    EXPECT_TRUE(WaitFor([&started] {
+        return started == 2;
+    }));
+    std::this_thread::sleep_for(20ms);
+    EXPECT_EQ(pool.stats().spawnedWorkers, 2u);
+    EXPECT_EQ(pool.stats().workers, 2u);
+    release.set_value();
+}
+
+TEST_F(ThreadPoolTest, ElasticPoolRetiresIdleWorkers)
+{
+    std::promise<void> release;
+    auto released = release.get_future().share();
+
+    TThreadPoolSizing sizing;
+    sizing.minThreads = 1;
+    sizing.maxThreads = 3;
+    sizing.targetQueueWait = 1ms;
+    sizing.idleTimeout = 20ms;
+    CThreadPool pool(sizing);
+    for (int i = 0; i < 3; ++i)
+    {
+        pool.enqueue([released](const auto &) {
+            released.wait();
+        });
+    }
+    EXPECT_TRUE(WaitFor([&pool] {
+        return pool.stats().workers == 3;
+    }));
+    release.set_value();
+    EXPECT_TRUE(WaitFor([&pool] {
+        return pool.stats().workers == 1;
+    }));
+    EXPECT_EQ(pool.stats().retiredWorkers, 2u);
+
+    // Retired workers are replaced on demand.
+    EXPECT_EQ(pool.submit([](const auto &) {
+                      return 1;
+                  })
+                .get(),
+              1);
+}
+
 } // namespace Testing
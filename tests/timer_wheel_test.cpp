@@ -0,0 +1,137 @@
+#include <common/timer_wheel.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using namespace std::chrono_literals;
+
+class TimerWheelTest : public ::testing::Test
+{
+  public:
+    using TClock = utility::CTimerWheel::TClock;
+
+    /// @returns false if the predicate did not become true in time.
+    template <typename taPredicate>
+    bool WaitFor(taPredicate predicate, std::chrono::milliseconds timeout = 2000ms)
+    {
+        std::unique_lock lock(mutex);
+        return cv.wait_for(lock, timeout, predicate);
+    }
+
+    void Record(std::size_t index)
+    {
+        {
+            const std::lock_guard lock(mutex);
+            fired.emplace_back(index, TClock::now());
+        }
+        cv.notify_all();
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::pair<std::size_t, TClock::time_point>> fired;
+};
+
+TEST_F(TimerWheelTest, FiresInOrderAndNotEarlier)
+{
+    // 1ms tick, so 300ms timer goes through the second level.
+    utility::CTimerWheel wheel(1ms);
+    const auto scheduledAt = TClock::now();
+    const std::vector<std::chrono::milliseconds> delays{300ms, 5ms, 70ms, 0ms, 40ms};
+    for (std::size_t i = 0; i < delays.size(); ++i)
+    {
+        wheel.Schedule(delays[i], [this, i] {
+            Record(i);
+        });
+    }
+    ASSERT_TRUE(WaitFor([this] {
+        return fired.size() == 5;
+    }));
+    const std::vector<std::size_t> expectedOrder{3, 1, 4, 2, 0};
+    for (std::size_t i = 0; i < fired.size(); ++i)
+    {
+        EXPECT_EQ(fired[i].first, expectedOrder[i]);
+        EXPECT_GE(fired[i].second - scheduledAt, delays[fired[i].first]);
+    }
+    EXPECT_EQ(wheel.pending(), 0u);
+}
+
+TEST_F(TimerWheelTest, CancelledTimerDoesNotFire)
+{
+    utility::CTimerWheel wheel(1ms);
+    const auto cancelled = wheel.Schedule(20ms, [this] {
+        Record(0);
+    });
+    wheel.Schedule(40ms, [this] {
+        Record(1);
+    });
+    EXPECT_TRUE(wheel.Cancel(cancelled));
+    EXPECT_FALSE(wheel.Cancel(cancelled));
+    ASSERT_TRUE(WaitFor([this] {
+        return !fired.empty();
+    }));
+    EXPECT_EQ(fired.front().first, 1u);
+    EXPECT_EQ(fired.size(), 1u);
+}
+
+TEST_F(TimerWheelTest, CallbackReschedulesItself)
+{
+    utility::CTimerWheel wheel(1ms);
+    std::function<void()> heartbeat;
+    std::atomic<std::size_t> beats{0};
+    heartbeat = [&] {
+        Record(++beats);
+        if (beats < 5)
+        {
+            wheel.Schedule(2ms, heartbeat);
+        }
+    };
+    wheel.Schedule(2ms, heartbeat);
+    ASSERT_TRUE(WaitFor([this] {
+        return fired.size() == 5;
+    }));
+    EXPECT_EQ(wheel.pending(), 0u);
+}
+
+TEST_F(TimerWheelTest, CancelWaitsForRunningCallback)
+{
+    utility::CTimerWheel wheel(1ms);
+    std::atomic<bool> isRunning{false};
+    std::atomic<bool> isFinished{false};
+    const auto id = wheel.Schedule(1ms, [&] {
+        isRunning = true;
+        std::this_thread::sleep_for(50ms);
+        isFinished = true;
+    });
+    while (!isRunning)
+    {
+        std::this_thread::yield();
+    }
+    EXPECT_FALSE(wheel.Cancel(id));
+    EXPECT_TRUE(isFinished);
+}
+
+TEST_F(TimerWheelTest, PendingTimersAreDroppedOnDestruction)
+{
+    std::atomic<bool> isFired{false};
+    {
+        utility::CTimerWheel wheel;
+        wheel.Schedule(1h, [&] {
+            isFired = true;
+        });
+        EXPECT_EQ(wheel.pending(), 1u);
+    }
+    EXPECT_FALSE(isFired);
+}
+
+} // namespace Testing
@@ -0,0 +1,167 @@
+#include <network/ollama_proxy_config.hpp>
+#include <network/token_ledger.hpp>
+#include <ollama/json.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+class TokenLedgerTest : public ::testing::Test
+{
+  public:
+    void SetUp() override
+    {
+        config.path =
+          (std::filesystem::temp_directory_path() / "ollama_mitm_token_ledger_test").string();
+        config.maxRecords = 64;
+        std::filesystem::remove(config.path);
+    }
+
+    void TearDown() override
+    {
+        std::filesystem::remove(config.path);
+    }
+
+    static TTokenUsage MakeUsage(std::uint64_t promptTokens, std::uint64_t evalTokens)
+    {
+        TTokenUsage usage;
+        usage.AddOllamaResponse(nlohmann::json{{"done", true},
+                                               {"prompt_eval_count", promptTokens},
+                                               {"eval_count", evalTokens},
+                                               {"eval_duration", 2'000'000'000u}});
+        return usage;
+    }
+
+    static CTokenLedger::TClock::time_point AtHour(int hour)
+    {
+        return CTokenLedger::TClock::time_point{std::chrono::hours{hour}}
+               + std::chrono::minutes{30};
+    }
+
+    TTokenLedgerConfig config;
+};
+
+TEST_F(TokenLedgerTest, UsageTakesOnlyFinalChunks)
+{
+    TTokenUsage usage;
+    usage.AddOllamaResponse(nlohmann::json{{"done", false}, {"eval_count", 5u}});
+    EXPECT_EQ(usage.upstreamRoundTrips, 0u);
+    usage.AddOllamaResponse(nlohmann::json{{"done", true}, {"eval_count", 5u}});
+    usage.AddOllamaResponse(nlohmann::json{{"done", true}, {"eval_count", 7u}});
+    EXPECT_EQ(usage.upstreamRoundTrips, 2u);
+    EXPECT_EQ(usage.evalTokens, 12u);
+}
+
+TEST_F(TokenLedgerTest, AggregatesAndSurvivesRestart)
+{
+    {
+        CTokenLedger ledger(config);
+        ASSERT_TRUE(ledger.IsEnabled());
+        ledger.Record("llama3", "alice", MakeUsage(10, 20), AtHour(100));
+        ledger.Record("llama3", "alice", MakeUsage(1, 2), AtHour(100));
+        ledger.Record("llama3", "bob", MakeUsage(3, 4), AtHour(101));
+    }
+    const CTokenLedger ledger(config);
+    const auto all = ledger.Query({});
+    ASSERT_EQ(all["totals"].size(), 2u);
+    EXPECT_EQ(all["totals"][0]["client"], "alice");
+    EXPECT_EQ(all["totals"][0]["hour"], 100u * 3600u);
+    EXPECT_EQ(all["totals"][0]["requests"], 2u);
+    EXPECT_EQ(all["totals"][0]["prompt_tokens"], 11u);
+    EXPECT_EQ(all["totals"][0]["eval_tokens"], 22u);
+    EXPECT_DOUBLE_EQ(all["totals"][0]["eval_seconds"].get<double>(), 4.0);
+
+    CTokenLedger::TQuery perModel;
+    perModel.isGroupedByClient = false;
+    perModel.isGroupedByHour = false;
+    const auto byModel = ledger.Query(perModel);
+    ASSERT_EQ(byModel["totals"].size(), 1u);
+    EXPECT_FALSE(byModel["totals"][0].contains("client"));
+    EXPECT_EQ(byModel["totals"][0]["eval_tokens"], 26u);
+
+    CTokenLedger::TQuery filtered;
+    filtered.client = "bob";
+    filtered.from = AtHour(101);
+    EXPECT_EQ(ledger.Query(filtered)["totals"].size(), 1u);
+    filtered.from = AtHour(102);
+    EXPECT_TRUE(ledger.Query(filtered)["totals"].empty());
+}
+
+TEST_F(TokenLedgerTest, AverageTimeToFirstTokenSkipsChatsWithoutTokens)
+{
+    CTokenLedger ledger(config);
+    auto usage = MakeUsage(1, 1);
+    usage.timeToFirstToken = std::chrono::seconds{2};
+    ledger.Record("llama3", "client", usage, AtHour(100));
+    ledger.Record("llama3", "client", MakeUsage(1, 0), AtHour(100));
+    ledger.Record("llama3", "client", MakeUsage(1, 0), AtHour(101));
+    const auto totals = ledger.Query({})["totals"];
+    ASSERT_EQ(totals.size(), 2u);
+    EXPECT_EQ(totals[0]["requests"], 2u);
+    EXPECT_DOUBLE_EQ(totals[0]["avg_time_to_first_token_seconds"].get<double>(), 2.0);
+    EXPECT_TRUE(totals[1]["avg_time_to_first_token_seconds"].is_null());
+}
+
+TEST_F(TokenLedgerTest, RejectsRangeBeforeEpoch)
+{
+    const CTokenLedger ledger(config);
+    CTokenLedger::TQuery query;
+    query.from = CTokenLedger::TClock::time_point{std::chrono::hours{-1}};
+    EXPECT_THROW((void)ledger.Query(query), std::invalid_argument);
+    query.from.reset();
+    query.to = CTokenLedger::TClock::time_point{std::chrono::seconds{-1}};
+    EXPECT_THROW((void)ledger.Query(query), std::invalid_argument);
+}
+
+TEST_F(TokenLedgerTest, DropsWhenFull)
+{
+    CTokenLedger ledger(config);
+    std::vector<std::thread> writers;
+    for (int i = 0; i < 4; ++i)
+    {
+        writers.emplace_back([&ledger]() {
+            for (std::size_t j = 0; j < 20; ++j)
+            {
+                ledger.Record("llama3", "client", MakeUsage(1, 1));
+            }
+        });
+    }
+    for (auto &writer : writers)
+    {
+        writer.join();
+    }
+    CTokenLedger::TQuery query;
+    query.isGroupedByHour = false;
+    const auto result = ledger.Query(query);
+    ASSERT_EQ(result["totals"].size(), 1u);
+    EXPECT_EQ(result["totals"][0]["requests"], config.maxRecords);
+    EXPECT_EQ(result["dropped"], 80u - config.maxRecords);
+}
+
+TEST_F(TokenLedgerTest, TruncatesLongNames)
+{
+    CTokenLedger ledger(config);
+    ledger.Record(std::string(200, 'm'), "client", MakeUsage(1, 1));
+    const auto model = ledger.Query({})["totals"][0]["model"].get<std::string>();
+    EXPECT_LT(model.size(), 200u);
+    EXPECT_EQ(model, std::string(model.size(), 'm'));
+}
+
+TEST_F(TokenLedgerTest, DisabledWithoutPath)
+{
+    config.path.clear();
+    CTokenLedger ledger(config);
+    EXPECT_FALSE(ledger.IsEnabled());
+    ledger.Record("llama3", "client", MakeUsage(1, 1));
+    EXPECT_TRUE(ledger.Query({})["totals"].empty());
+}
+
+} // namespace Testing
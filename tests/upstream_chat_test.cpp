@@ -0,0 +1,148 @@
+#include <network/ollama_proxy_config.hpp>
+#include <network/upstream_chat.hpp>
+#include <ollama/json.hpp>
+#include <ollama/ollama.hpp>
+#include <tools/mock_ollama.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using namespace std::chrono_literals;
+
+class UpstreamChatTest : public ::testing::Test
+{
+  public:
+    void SetUp() override
+    {
+        mockConfig.timeToFirstToken = 0ms;
+        mockConfig.tokensPerSecond = 0;
+        mockConfig.tokensCount = 4;
+    }
+
+    static ollama::request MakeChat()
+    {
+        ollama::request request(ollama::message_type::chat);
+        request["model"] = "mock:latest";
+        request["messages"] = nlohmann::json::array();
+        request["messages"].push_back({{"role", "user"}, {"content", "Hello"}});
+        return request;
+    }
+
+    TOllamaProxyConfig MakeConfig(int port) const
+    {
+        TOllamaProxyConfig config;
+        config.ollamaHost = "127.0.0.1";
+        config.ollamaPort = port;
+        return config;
+    }
+
+    TMockOllamaConfig mockConfig;
+};
+
+TEST_F(UpstreamChatTest, StreamsAllLines)
+{
+    CMockOllama mock(mockConfig);
+    const auto config = MakeConfig(mock.Start());
+    CUpstreamChat chat(config);
+    std::size_t lines = 0;
+    bool isDone = false;
+    bool isLineKept = true;
+    const auto result =
+      chat.Chat(MakeChat(), [&](const ollama::response &response, const std::string &line) {
+          ++lines;
+          isDone = response.as_json().value("done", false);
+          isLineKept = isLineKept && nlohmann::json::parse(line) == response.as_json();
+          return true;
+      });
+    EXPECT_EQ(result, CUpstreamChat::EResult::Completed);
+    EXPECT_TRUE(chat.HasResponded());
+    EXPECT_TRUE(isDone);
+    EXPECT_TRUE(isLineKept);
+    EXPECT_GT(lines, mockConfig.tokensCount);
+}
+
+TEST_F(UpstreamChatTest, AbortDoesNotWaitForFirstToken)
+{
+    mockConfig.timeToFirstToken = 2s;
+    CMockOllama mock(mockConfig);
+    const auto config = MakeConfig(mock.Start());
+    CUpstreamChat chat(config);
+    std::thread aborter([abort = chat.GetAborter()]() {
+        std::this_thread::sleep_for(100ms);
+        abort();
+    });
+    const auto startedAt = std::chrono::steady_clock::now();
+    const auto result = chat.Chat(MakeChat(), [](const ollama::response &, const std::string &) {
+        return true;
+    });
+    const auto elapsed = std::chrono::steady_clock::now() - startedAt;
+    aborter.join();
+    EXPECT_EQ(result, CUpstreamChat::EResult::Aborted);
+    EXPECT_FALSE(chat.HasResponded());
+    EXPECT_LT(elapsed, 1s);
+}
+
+TEST_F(UpstreamChatTest, AbortWhileConnectingIsNotLost)
+{
+    // Abort races the call start, it must not wait for the first token whenever it lands.
+    constexpr int kAttempts = 20;
+    mockConfig.timeToFirstToken = 2s;
+    CMockOllama mock(mockConfig);
+    const auto config = MakeConfig(mock.Start());
+    for (int i = 0; i < kAttempts; ++i)
+    {
+        CUpstreamChat chat(config);
+        const auto delay = std::chrono::microseconds{i * 50};
+        std::thread aborter([abort = chat.GetAborter(), delay]() {
+            std::this_thread::sleep_for(delay);
+            abort();
+        });
+        const auto startedAt = std::chrono::steady_clock::now();
+        const auto result =
+          chat.Chat(MakeChat(), [](const ollama::response &, const std::string &) {
+              return true;
+          });
+        const auto elapsed = std::chrono::steady_clock::now() - startedAt;
+        aborter.join();
+        EXPECT_EQ(result, CUpstreamChat::EResult::Aborted);
+        EXPECT_FALSE(chat.HasResponded());
+        EXPECT_LT(elapsed, 1s);
+    }
+}
+
+TEST_F(UpstreamChatTest, AbortedChatIsNotSent)
+{
+    CMockOllama mock(mockConfig);
+    const auto config = MakeConfig(mock.Start());
+    CUpstreamChat chat(config);
+    chat.GetAborter()();
+    const auto result = chat.Chat(MakeChat(), [](const ollama::response &, const std::string &) {
+        return true;
+    });
+    EXPECT_EQ(result, CUpstreamChat::EResult::Aborted);
+    EXPECT_TRUE(mock.GetGenerationTimings().empty());
+}
+
+TEST_F(UpstreamChatTest, UnreachableOllamaFails)
+{
+    // Port of the stopped mock is not listened anymore.
+    int port = 0;
+    {
+        CMockOllama mock(mockConfig);
+        port = mock.Start();
+    }
+    const auto config = MakeConfig(port);
+    CUpstreamChat chat(config);
+    const auto result = chat.Chat(MakeChat(), [](const ollama::response &, const std::string &) {
+        return true;
+    });
+    EXPECT_EQ(result, CUpstreamChat::EResult::Failed);
+}
+
+} // namespace Testing
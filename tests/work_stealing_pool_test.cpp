@@ -0,0 +1,125 @@
+#include <common/work_stealing_pool.hpp>
+
+#include <atomic>
+#include <chrono> // IWYU pragma: keep
+#include <cstddef>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace Testing {
+
+using namespace utility;
+using namespace std::chrono_literals;
+
+class WorkStealingPoolTest : public ::testing::Test
+{
+  public:
+    template <typename taPredicate>
+    static bool WaitFor(taPredicate &&predicate)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + 5s;
+        while (!predicate() && std::chrono::steady_clock::now() < deadline)
+        {
+            std::this_thread::sleep_for(1ms); // NOLINT
+        }
+        return predicate();
+    }
+};
+
+TEST_F(WorkStealingPoolTest, ExecutesAllTasks)
+{
+    constexpr int kTasks = 10'000;
+    std::atomic<int> counter{0};
+    CWorkStealingThreadPool pool(4);
+    for (int i = 0; i < kTasks; ++i)
+    {
+        pool.enqueue([&counter](const auto &) {
+            ++counter;
+        });
+    }
+    EXPECT_TRUE(WaitFor([&counter] {
+        return counter == kTasks;
+    }));
+}
+
+TEST_F(WorkStealingPoolTest, SpawnedTasksAreStolen)
+{
+    // Whole tree is spawned from the single task, so other workers get work only by stealing.
+    constexpr std::size_t kDepth = 12;
+    std::atomic<std::size_t> leaves{0};
+    std::atomic<std::size_t> workersSeen{0};
+    // Declared before the pool, so it outlives tasks which are still returning from it.
+    std::function<void(std::size_t)> spawn;
+    CWorkStealingThreadPool pool(4);
+    spawn = [&](std::size_t depth) {
+        pool.enqueue([&, depth](const auto &) {
+            thread_local bool isSeen = false;
+            if (!isSeen)
+            {
+                isSeen = true;
+                ++workersSeen;
+            }
+            if (depth == 0)
+            {
+                std::this_thread::sleep_for(10us); // NOLINT
+                ++leaves;
+                return;
+            }
+            spawn(depth - 1);
+            spawn(depth - 1);
+        });
+    };
+    spawn(kDepth);
+    EXPECT_TRUE(WaitFor([&leaves] {
+        return leaves == (std::size_t{1} << kDepth);
+    }));
+    EXPECT_GT(workersSeen.load(), 1u);
+}
+
+TEST_F(WorkStealingPoolTest, SurvivesThrowingTask)
+{
+    std::atomic<bool> isExecuted{false};
+    CWorkStealingThreadPool pool(1);
+    pool.enqueue([](const auto &) {
+        throw std::runtime_error("Task failed.");
+    });
+    pool.enqueue([&isExecuted](const auto &) {
+        isExecuted = true;
+    });
+    EXPECT_TRUE(WaitFor([&isExecuted] {
+        return isExecuted.load();
+    }));
+}
+
+TEST_F(WorkStealingPoolTest, PoolProperlyHandlesDestruction)
+{
+    std::atomic<int> counter{0};
+    const int num_tasks = 10;
+    const int pool_size = 4;
+
+    auto task = [&counter](const auto &stopper) {
+        ++counter;
+        for (int i = 0; i < 1'000'000 && !(*stopper); ++i)
+        {
+            std::this_thread::sleep_for(75ms); // NOLINT
+        }
+    };
+    const auto started_at = std::chrono::system_clock::now();
+    {
+        CWorkStealingThreadPool pool(pool_size);
+        for (int i = 0; i < num_tasks; ++i)
+        {
+            pool.enqueue(task);
+        }
+        std::this_thread::sleep_for(1000ms); // NOLINT
+    }
+    const auto block_ended_at = std::chrono::system_clock::now();
+
+    EXPECT_EQ(counter.load(), pool_size);
+    EXPECT_LT(block_ended_at - started_at, 2000ms); // NOLINT
+}
+
+} // namespace Testing
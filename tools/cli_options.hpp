@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+
+/// @brief Command line of the tools in the form "--name=value" or "--flag".
+class CCliOptions
+{
+  public:
+    /// @throws std::invalid_argument if argument does not start with "--".
+    CCliOptions(int argc, char **argv)
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            const std::string argument = argv[i]; // NOLINT
+            if (argument.rfind("--", 0) != 0)
+            {
+                throw std::invalid_argument("Unexpected argument " + argument);
+            }
+            const auto equal = argument.find('=');
+            if (equal == std::string::npos)
+            {
+                values[argument.substr(2)] = "1";
+            }
+            else
+            {
+                values[argument.substr(2, equal - 2)] = argument.substr(equal + 1);
+            }
+        }
+    }
+
+    [[nodiscard]]
+    bool Has(const std::string &name) const
+    {
+        return values.count(name) > 0;
+    }
+
+    /// @returns Value of the option converted to the type of the default value.
+    /// @throws std::invalid_argument if value cannot be converted.
+    template <typename taValue>
+    [[nodiscard]]
+    taValue Get(const std::string &name, const taValue &defaultValue) const
+    {
+        const auto it = values.find(name);
+        if (it == values.end())
+        {
+            return defaultValue;
+        }
+        std::istringstream stream(it->second);
+        taValue value{};
+        stream >> value;
+        if (stream.fail() || !stream.eof())
+        {
+            throw std::invalid_argument("Invalid value of --" + name + ": " + it->second);
+        }
+        return value;
+    }
+
+    [[nodiscard]]
+    std::string Get(const std::string &name, const char *defaultValue) const
+    {
+        const auto it = values.find(name);
+        return it == values.end() ? std::string(defaultValue) : it->second;
+    }
+
+  private:
+    std::map<std::string, std::string> values;
+};
@@ -0,0 +1,174 @@
+#include "event_loop.hpp" // IWYU pragma: keep
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+/// @brief Id of the wake up eventfd, watch ids start from 1.
+constexpr std::uint64_t kWakeId = 0;
+constexpr int kMaxEvents = 256;
+} // namespace
+
+CEventLoop::CEventLoop() :
+    epollFd(::epoll_create1(EPOLL_CLOEXEC)),
+    wakeFd(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = kWakeId;
+    if (epollFd < 0 || wakeFd < 0 || ::epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event) != 0)
+    {
+        if (epollFd >= 0)
+        {
+            ::close(epollFd);
+        }
+        if (wakeFd >= 0)
+        {
+            ::close(wakeFd);
+        }
+        throw std::runtime_error("Failed to create event loop.");
+    }
+}
+
+CEventLoop::~CEventLoop()
+{
+    ::close(wakeFd);
+    ::close(epollFd);
+}
+
+CEventLoop::TWatchId CEventLoop::Watch(int fd, std::uint32_t events, TOnEvents onEvents)
+{
+    const auto id = ++lastWatchId;
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = id;
+    if (::epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event) != 0)
+    {
+        throw std::runtime_error("Failed to watch descriptor.");
+    }
+    watched[id] = {fd, std::make_shared<TOnEvents>(std::move(onEvents))};
+    return id;
+}
+
+void CEventLoop::Rewatch(TWatchId id, std::uint32_t events)
+{
+    const auto it = watched.find(id);
+    if (it == watched.end())
+    {
+        return;
+    }
+    epoll_event event{};
+    event.events = events;
+    event.data.u64 = id;
+    ::epoll_ctl(epollFd, EPOLL_CTL_MOD, it->second.fd, &event);
+}
+
+void CEventLoop::Unwatch(TWatchId id)
+{
+    const auto it = watched.find(id);
+    if (it == watched.end())
+    {
+        return;
+    }
+    ::epoll_ctl(epollFd, EPOLL_CTL_DEL, it->second.fd, nullptr);
+    watched.erase(it);
+}
+
+CEventLoop::TTimerId CEventLoop::Schedule(TClock::time_point at, std::function<void()> callback)
+{
+    const auto id = ++lastTimerId;
+    timers.emplace(std::make_pair(at, id), std::move(callback));
+    timersAt.emplace(id, at);
+    return id;
+}
+
+void CEventLoop::Cancel(TTimerId timer)
+{
+    const auto it = timersAt.find(timer);
+    if (it == timersAt.end())
+    {
+        return;
+    }
+    timers.erase(std::make_pair(it->second, timer));
+    timersAt.erase(it);
+}
+
+void CEventLoop::Run()
+{
+    std::array<epoll_event, kMaxEvents> events{};
+    while (!isStopped.load(std::memory_order_acquire))
+    {
+        int timeoutMs = -1;
+        if (!timers.empty())
+        {
+            const auto wait = timers.begin()->first.first - TClock::now();
+            // Rounded up, so the timer is due once epoll returns.
+            timeoutMs = static_cast<int>(std::max<std::int64_t>(
+              std::chrono::ceil<std::chrono::milliseconds>(wait).count(), 0));
+        }
+        const int count = ::epoll_wait(epollFd, events.data(), kMaxEvents, timeoutMs);
+        if (count < 0 && errno != EINTR)
+        {
+            throw std::runtime_error("Event loop failed to wait for events.");
+        }
+        for (int i = 0; i < count; ++i)
+        {
+            const auto id = events[i].data.u64;
+            if (id == kWakeId)
+            {
+                std::uint64_t value{0};
+                (void)::read(wakeFd, &value, sizeof(value));
+                continue;
+            }
+            // Callback may unwatch itself or others, so it is held by the copy.
+            const auto it = watched.find(id);
+            if (it == watched.end())
+            {
+                continue;
+            }
+            const auto onEvents = it->second.onEvents;
+            (*onEvents)(events[i].events);
+        }
+        FireDueTimers();
+    }
+}
+
+void CEventLoop::Stop()
+{
+    isStopped.store(true, std::memory_order_release);
+    const std::uint64_t value{1};
+    (void)::write(wakeFd, &value, sizeof(value));
+}
+
+void CEventLoop::FireDueTimers()
+{
+    const auto now = TClock::now();
+    while (!timers.empty() && timers.begin()->first.first <= now)
+    {
+        auto node = timers.extract(timers.begin());
+        timersAt.erase(node.key().second);
+        node.mapped()();
+    }
+}
+
+void RaiseOpenFilesLimit()
+{
+    rlimit limit{};
+    if (::getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max)
+    {
+        limit.rlim_cur = limit.rlim_max;
+        ::setrlimit(RLIMIT_NOFILE, &limit);
+    }
+}
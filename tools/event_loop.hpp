@@ -0,0 +1,74 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+
+/// @brief Single threaded epoll loop with one-shot timers, so the tools serve thousands of
+/// connections without a thread per connection. Everything except Stop() must be called on the
+/// thread which runs the loop, or before Run().
+class CEventLoop
+{
+  public:
+    using TClock = std::chrono::steady_clock;
+    /// @brief Gets ready epoll events of the descriptor, like EPOLLIN.
+    using TOnEvents = std::function<void(std::uint32_t events)>;
+    using TWatchId = std::uint64_t;
+    using TTimerId = std::uint64_t;
+
+    static constexpr TTimerId kInvalidTimer = 0;
+
+    NO_COPYMOVE(CEventLoop);
+    /// @throws std::runtime_error if epoll cannot be created.
+    CEventLoop();
+    ~CEventLoop();
+
+    /// @brief Starts watching the descriptor, it must be non-blocking.
+    /// @returns Id to change or stop watching. Events of the descriptor which is not watched
+    /// anymore are dropped, even if the descriptor was reused meanwhile.
+    TWatchId Watch(int fd, std::uint32_t events, TOnEvents onEvents);
+    void Rewatch(TWatchId id, std::uint32_t events);
+    /// @brief Stops watching, descriptor is not closed. Can be called by the callback.
+    void Unwatch(TWatchId id);
+
+    /// @brief Calls the callback once on the loop's thread at the given time or later.
+    TTimerId Schedule(TClock::time_point at, std::function<void()> callback);
+    /// @brief Does nothing if the timer fired already.
+    void Cancel(TTimerId timer);
+
+    /// @brief Dispatches events and timers until Stop() is called.
+    /// @throws std::runtime_error if epoll fails.
+    void Run();
+
+    /// @brief Makes Run() return, can be called from any thread.
+    void Stop();
+
+  private:
+    struct TWatched
+    {
+        int fd{-1};
+        std::shared_ptr<TOnEvents> onEvents;
+    };
+
+    void FireDueTimers();
+
+    int epollFd{-1};
+    /// @brief Eventfd which wakes the loop up on Stop().
+    int wakeFd{-1};
+    std::atomic<bool> isStopped{false};
+    TWatchId lastWatchId{0};
+    std::unordered_map<TWatchId, TWatched> watched;
+    TTimerId lastTimerId{kInvalidTimer};
+    std::map<std::pair<TClock::time_point, TTimerId>, std::function<void()>> timers;
+    std::unordered_map<TTimerId, TClock::time_point> timersAt;
+};
+
+/// @brief Raises the soft limit of open files to the hard one, each connection holds one.
+void RaiseOpenFilesLimit();
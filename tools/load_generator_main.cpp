@@ -0,0 +1,650 @@
+#include <common/cm_ctors.h>
+#include <tools/cli_options.hpp>
+#include <tools/event_loop.hpp>
+#include <tools/mock_ollama.hpp>
+
+#include <ollama/json.hpp>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace {
+using TClock = std::chrono::steady_clock;
+
+struct TLoadConfig
+{
+    std::string host{"127.0.0.1"};
+    int port{12345};
+    /// @brief Mock which the proxy forwards to, the same load is run straight against it first, so
+    /// the latency added by the proxy is the difference. Port 0 skips this baseline.
+    std::string mockHost{"127.0.0.1"};
+    int mockPort{0};
+    std::size_t clients{1000};
+    std::size_t requestsPerClient{1};
+    std::string model{"mock:latest"};
+    std::string prompt{"Hello"};
+    /// @brief Clients are started evenly during this time.
+    std::chrono::milliseconds ramp{1000};
+    /// @brief Process of the proxy for CPU and RSS, 0 skips them.
+    int proxyPid{0};
+    /// @brief Event loops which run the clients.
+    std::size_t threads{1};
+};
+
+/// @brief Samples of all clients, merged when client finishes.
+struct TSamples
+{
+    std::vector<std::int64_t> timeToFirstTokenUs;
+    /// @brief Time from the mock sending chunk until the client received it.
+    std::vector<std::int64_t> deliveryLatencyUs;
+    std::size_t succeeded{0};
+    std::size_t failed{0};
+    std::size_t chunks{0};
+    std::chrono::milliseconds elapsed{0};
+
+    void Merge(const TSamples &other)
+    {
+        timeToFirstTokenUs.insert(timeToFirstTokenUs.end(), other.timeToFirstTokenUs.begin(),
+                                  other.timeToFirstTokenUs.end());
+        deliveryLatencyUs.insert(deliveryLatencyUs.end(), other.deliveryLatencyUs.begin(),
+                                 other.deliveryLatencyUs.end());
+        succeeded += other.succeeded;
+        failed += other.failed;
+        chunks += other.chunks;
+    }
+};
+
+/// @returns CPU time (user + system) of the process, zero if it cannot be read.
+std::chrono::microseconds ReadCpuTime(int pid)
+{
+    std::ifstream stat("/proc/" + std::to_string(pid) + "/stat");
+    std::string content;
+    std::getline(stat, content);
+    // Command name can have spaces, fields are counted after it.
+    const auto nameEnd = content.rfind(')');
+    if (nameEnd == std::string::npos)
+    {
+        return std::chrono::microseconds{0};
+    }
+    std::istringstream fields(content.substr(nameEnd + 2));
+    std::string field;
+    std::uint64_t userTicks{0};
+    std::uint64_t systemTicks{0};
+    // utime and stime are 14th and 15th fields, state is the 3rd.
+    constexpr int kFieldsBeforeUserTime = 11;
+    for (int i = 0; i < kFieldsBeforeUserTime; ++i)
+    {
+        fields >> field;
+    }
+    fields >> userTicks >> systemTicks;
+    const auto ticksPerSecond = static_cast<std::uint64_t>(::sysconf(_SC_CLK_TCK));
+    return std::chrono::microseconds{(userTicks + systemTicks) * 1'000'000 / ticksPerSecond};
+}
+
+/// @returns Resident memory of the process in KiB, zero if it cannot be read.
+std::size_t ReadRssKiB(int pid)
+{
+    std::ifstream status("/proc/" + std::to_string(pid) + "/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.rfind("VmRSS:", 0) == 0)
+        {
+            return std::stoull(line.substr(6));
+        }
+    }
+    return 0;
+}
+
+std::int64_t Percentile(std::vector<std::int64_t> &values, double share)
+{
+    if (values.empty())
+    {
+        return 0;
+    }
+    const auto index = static_cast<std::size_t>(
+      std::ceil(share * static_cast<double>(values.size())) - 1);
+    std::nth_element(values.begin(), values.begin() + index, values.end());
+    return values[index];
+}
+
+nlohmann::json Summarize(std::vector<std::int64_t> &valuesUs)
+{
+    return {{"count", valuesUs.size()},
+            {"p50_us", Percentile(valuesUs, 0.5)},
+            {"p99_us", Percentile(valuesUs, 0.99)},
+            {"p999_us", Percentile(valuesUs, 0.999)}};
+}
+
+/// @returns Percentiles of the run through the proxy minus the ones of the direct run.
+nlohmann::json Subtract(const nlohmann::json &throughProxy, const nlohmann::json &direct)
+{
+    nlohmann::json difference;
+    for (const auto *key : {"p50_us", "p99_us", "p999_us"})
+    {
+        difference[key] = throughProxy[key].get<std::int64_t>() - direct[key].get<std::int64_t>();
+    }
+    return difference;
+}
+
+nlohmann::json Report(TSamples &samples)
+{
+    return {{"succeeded", samples.succeeded},
+            {"failed", samples.failed},
+            {"chunks", samples.chunks},
+            {"elapsed_ms", samples.elapsed.count()},
+            {"time_to_first_token", Summarize(samples.timeToFirstTokenUs)},
+            {"delivery_latency", Summarize(samples.deliveryLatencyUs)}};
+}
+
+/// @brief Part of the clients, all served by one event loop: each client streams its chats one
+/// after another, each chat on the new connection.
+class CClientsLoop
+{
+  public:
+    NO_COPYMOVE(CClientsLoop);
+    CClientsLoop() = delete;
+    ~CClientsLoop() = default;
+    CClientsLoop(const TLoadConfig &config, const sockaddr_storage &address,
+                 socklen_t addressLength, std::string request) :
+        config(config),
+        address(address),
+        addressLength(addressLength),
+        request(std::move(request))
+    {
+    }
+
+    /// @brief Starts the client at the given time, must be called before Run().
+    void AddClient(TClock::time_point startAt)
+    {
+        ++runningClients;
+        loop.Schedule(startAt, [this]() {
+            StartChat(config.requestsPerClient);
+        });
+    }
+
+    /// @brief Runs until all clients are done.
+    void Run()
+    {
+        if (runningClients > 0)
+        {
+            loop.Run();
+        }
+    }
+
+    [[nodiscard]]
+    const TSamples &GetSamples() const
+    {
+        return samples;
+    }
+
+  private:
+    struct TChat
+    {
+        int fd{-1};
+        std::uint64_t id{0};
+        CEventLoop::TWatchId watchId{0};
+        CEventLoop::TTimerId timeout{CEventLoop::kInvalidTimer};
+        /// @brief Chats left to the client, including this one.
+        std::size_t chatsLeft{0};
+        std::size_t sent{0};
+        bool isConnected{false};
+        TClock::time_point startedAt;
+
+        // Response.
+        std::string input;
+        bool isHeadParsed{false};
+        int status{0};
+        bool isChunked{false};
+        /// @brief Body bytes left, if neither chunked nor with length it lasts until close.
+        std::optional<std::size_t> bodyLeft;
+        std::string lines;
+        bool isFirst{true};
+        bool isDone{false};
+    };
+    using TChatPtr = std::shared_ptr<TChat>;
+
+    void StartChat(std::size_t chatsLeft)
+    {
+        if (chatsLeft == 0)
+        {
+            if (--runningClients == 0)
+            {
+                loop.Stop();
+            }
+            return;
+        }
+        auto chat = std::make_shared<TChat>();
+        chat->id = ++lastChatId;
+        chat->chatsLeft = chatsLeft;
+        chat->startedAt = TClock::now();
+        chat->fd = ::socket(address.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        const int yes = 1;
+        ::setsockopt(chat->fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+        const auto *to = reinterpret_cast<const sockaddr *>(&address); // NOLINT
+        if (chat->fd < 0 || (::connect(chat->fd, to, addressLength) != 0 && errno != EINPROGRESS))
+        {
+            Finish(chat, false);
+            return;
+        }
+        chat->watchId = loop.Watch(chat->fd, EPOLLIN | EPOLLOUT | EPOLLRDHUP,
+                                   [this, id = chat->id](std::uint32_t events) {
+                                       const auto it = chats.find(id);
+                                       if (it != chats.end())
+                                       {
+                                           // Copy, the chat can finish in the handler.
+                                           const auto held = it->second;
+                                           OnEvents(held, events);
+                                       }
+                                   });
+        chat->timeout = loop.Schedule(chat->startedAt + kChatTimeout, [this, id = chat->id]() {
+            const auto it = chats.find(id);
+            if (it != chats.end())
+            {
+                const auto held = it->second;
+                held->timeout = CEventLoop::kInvalidTimer;
+                Finish(held, false);
+            }
+        });
+        chats.emplace(chat->id, std::move(chat));
+    }
+
+    void Finish(const TChatPtr &chat, bool isSucceeded)
+    {
+        ++(isSucceeded ? samples.succeeded : samples.failed);
+        if (chat->fd >= 0)
+        {
+            loop.Unwatch(chat->watchId);
+            ::close(chat->fd);
+        }
+        loop.Cancel(chat->timeout);
+        chats.erase(chat->id);
+        // Next chat is started by the loop, so failing connects do not recurse.
+        loop.Schedule(TClock::now(), [this, chatsLeft = chat->chatsLeft - 1]() {
+            StartChat(chatsLeft);
+        });
+    }
+
+    void OnEvents(const TChatPtr &chat, std::uint32_t events)
+    {
+        if ((events & EPOLLERR) != 0)
+        {
+            Finish(chat, false);
+            return;
+        }
+        if ((events & EPOLLOUT) != 0 && !Send(chat))
+        {
+            Finish(chat, false);
+            return;
+        }
+        if ((events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP)) != 0)
+        {
+            Receive(chat);
+        }
+    }
+
+    /// @returns false if the request cannot be sent.
+    bool Send(const TChatPtr &chat)
+    {
+        while (chat->sent < request.size())
+        {
+            const auto written = ::send(chat->fd, request.data() + chat->sent,
+                                        request.size() - chat->sent, MSG_NOSIGNAL);
+            if (written > 0)
+            {
+                chat->sent += static_cast<std::size_t>(written);
+                continue;
+            }
+            return written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+        }
+        loop.Rewatch(chat->watchId, EPOLLIN | EPOLLRDHUP);
+        return true;
+    }
+
+    void Receive(const TChatPtr &chat)
+    {
+        char buffer[kReadBufferSize];
+        while (true)
+        {
+            const auto received = ::recv(chat->fd, buffer, sizeof(buffer), 0);
+            if (received < 0 && errno == EINTR)
+            {
+                continue;
+            }
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            {
+                return;
+            }
+            if (received <= 0)
+            {
+                // Body without length ends with the connection.
+                Finish(chat, received == 0 && chat->isHeadParsed && !chat->isChunked
+                               && !chat->bodyLeft && IsSucceeded(*chat));
+                return;
+            }
+            chat->input.append(buffer, static_cast<std::size_t>(received));
+            const auto isComplete = Parse(*chat);
+            if (!isComplete.has_value() || *isComplete)
+            {
+                Finish(chat, isComplete.has_value() && IsSucceeded(*chat));
+                return;
+            }
+        }
+    }
+
+    static bool IsSucceeded(const TChat &chat)
+    {
+        return chat.status == 200 && chat.isDone;
+    }
+
+    /// @brief Decodes the received part of the response.
+    /// @returns true once the response is complete, nullopt if it is malformed.
+    std::optional<bool> Parse(TChat &chat)
+    {
+        if (!chat.isHeadParsed)
+        {
+            const auto headEnd = chat.input.find("\r\n\r\n");
+            if (headEnd == std::string::npos)
+            {
+                return false;
+            }
+            ParseHead(chat, chat.input.substr(0, headEnd));
+            chat.input.erase(0, headEnd + 4);
+            chat.isHeadParsed = true;
+        }
+        if (!chat.isChunked)
+        {
+            const auto size = chat.bodyLeft ? std::min(*chat.bodyLeft, chat.input.size())
+                                            : chat.input.size();
+            AddBody(chat, chat.input.substr(0, size));
+            chat.input.erase(0, size);
+            if (chat.bodyLeft)
+            {
+                *chat.bodyLeft -= size;
+            }
+            return chat.bodyLeft == std::size_t{0};
+        }
+        while (true)
+        {
+            const auto sizeEnd = chat.input.find("\r\n");
+            if (sizeEnd == std::string::npos)
+            {
+                return false;
+            }
+            std::size_t size{0};
+            try
+            {
+                size = std::stoull(chat.input.substr(0, sizeEnd), nullptr, 16);
+            }
+            catch (const std::exception &)
+            {
+                return std::nullopt;
+            }
+            if (size == 0)
+            {
+                return true;
+            }
+            if (chat.input.size() < sizeEnd + 2 + size + 2)
+            {
+                return false;
+            }
+            AddBody(chat, chat.input.substr(sizeEnd + 2, size));
+            chat.input.erase(0, sizeEnd + 2 + size + 2);
+        }
+    }
+
+    static void ParseHead(TChat &chat, const std::string &head)
+    {
+        std::istringstream lines(head);
+        std::string line;
+        std::getline(lines, line);
+        std::istringstream(line) >> line >> chat.status;
+        while (std::getline(lines, line))
+        {
+            std::transform(line.begin(), line.end(), line.begin(), [](unsigned char c) {
+                return static_cast<char>(std::tolower(c));
+            });
+            if (line.rfind("transfer-encoding:", 0) == 0)
+            {
+                chat.isChunked = line.find("chunked") != std::string::npos;
+            }
+            else if (line.rfind("content-length:", 0) == 0)
+            {
+                chat.bodyLeft = std::stoull(line.substr(std::string("content-length:").size()));
+            }
+        }
+    }
+
+    void AddBody(TChat &chat, const std::string &data)
+    {
+        const auto receivedAt = CMockOllama::NowMicroseconds();
+        chat.lines += data;
+        for (auto end = chat.lines.find('\n'); end != std::string::npos;
+             end = chat.lines.find('\n'))
+        {
+            const auto line = chat.lines.substr(0, end);
+            chat.lines.erase(0, end + 1);
+            // The proxy frames each line with its size in hex (see WriteLineToUser), such lines
+            // are not JSON and are skipped.
+            const auto chunk = nlohmann::json::parse(line, nullptr, false);
+            if (chunk.is_discarded() || !chunk.is_object())
+            {
+                continue;
+            }
+            ++samples.chunks;
+            if (chat.isFirst)
+            {
+                chat.isFirst = false;
+                samples.timeToFirstTokenUs.push_back(
+                  std::chrono::duration_cast<std::chrono::microseconds>(TClock::now()
+                                                                        - chat.startedAt)
+                    .count());
+            }
+            if (chunk.contains(CMockOllama::kSentAtKey))
+            {
+                const auto sentAt = chunk[CMockOllama::kSentAtKey].get<std::int64_t>();
+                samples.deliveryLatencyUs.push_back(receivedAt - sentAt);
+            }
+            chat.isDone = chat.isDone || chunk.value("done", false);
+        }
+    }
+
+    static constexpr std::chrono::seconds kChatTimeout{60};
+    static constexpr std::size_t kReadBufferSize = 64 * 1024;
+
+    const TLoadConfig &config;
+    const sockaddr_storage address;
+    const socklen_t addressLength;
+    /// @brief Request of each chat, the same for all of them.
+    const std::string request;
+    CEventLoop loop;
+    TSamples samples;
+    std::size_t runningClients{0};
+    std::unordered_map<std::uint64_t, TChatPtr> chats;
+    std::uint64_t lastChatId{0};
+};
+
+/// @brief Runs all clients against the server, they are spread over config.threads loops.
+/// @throws std::runtime_error if the host cannot be resolved.
+TSamples RunLoad(const TLoadConfig &config, const std::string &host, int port)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo *resolved = nullptr;
+    if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &resolved) != 0)
+    {
+        throw std::runtime_error("Failed to resolve " + host);
+    }
+    sockaddr_storage address{};
+    std::copy_n(reinterpret_cast<const char *>(resolved->ai_addr), resolved->ai_addrlen, // NOLINT
+                reinterpret_cast<char *>(&address));                                     // NOLINT
+    const auto addressLength = resolved->ai_addrlen;
+    ::freeaddrinfo(resolved);
+
+    nlohmann::json body;
+    body["model"] = config.model;
+    body["stream"] = true;
+    body["messages"] = nlohmann::json::array({{{"role", "user"}, {"content", config.prompt}}});
+    const auto content = body.dump();
+    const auto request = "POST /api/chat HTTP/1.1\r\nHost: " + host + ":" + std::to_string(port)
+                         + "\r\nContent-Type: application/json\r\nContent-Length: "
+                         + std::to_string(content.size()) + "\r\nConnection: close\r\n\r\n"
+                         + content;
+
+    const auto threads = std::clamp<std::size_t>(config.threads, 1, config.clients);
+    std::vector<std::unique_ptr<CClientsLoop>> loops;
+    for (std::size_t i = 0; i < threads; ++i)
+    {
+        loops.push_back(std::make_unique<CClientsLoop>(config, address, addressLength, request));
+    }
+    const auto startedAt = TClock::now();
+    for (std::size_t i = 0; i < config.clients; ++i)
+    {
+        loops[i % threads]->AddClient(startedAt + config.ramp * i / config.clients);
+    }
+    std::vector<std::thread> runners;
+    for (auto &loop : loops)
+    {
+        runners.emplace_back([&loop]() {
+            loop->Run();
+        });
+    }
+    TSamples samples;
+    for (std::size_t i = 0; i < threads; ++i)
+    {
+        runners[i].join();
+        samples.Merge(loops[i]->GetSamples());
+    }
+    samples.elapsed =
+      std::chrono::duration_cast<std::chrono::milliseconds>(TClock::now() - startedAt);
+    return samples;
+}
+
+
+void PrintUsage()
+{
+    std::cout << "ollama_mitm_loadgen [options]\n"
+                 "  --host=127.0.0.1 --port=12345       proxy to load\n"
+                 "  --mock-host=127.0.0.1 --mock-port=0 mock behind the proxy, the same load is\n"
+                 "                                      run against it first as the baseline\n"
+                 "  --clients=1000 --requests=1         concurrent clients, chats per client\n"
+                 "  --model=mock:latest --prompt=Hello\n"
+                 "  --ramp-ms=1000                      time to start all clients\n"
+                 "  --threads=1                         event loops which run the clients\n"
+                 "  --proxy-pid=0                       measure CPU and RSS of the proxy\n"
+                 "  --out=report.json                   write report as JSON\n"
+                 "Run ollama_mock as Ollama so latency added by the proxy is measured.\n";
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    try
+    {
+        const CCliOptions options(argc, argv);
+        if (options.Has("help"))
+        {
+            PrintUsage();
+            return 0;
+        }
+        TLoadConfig config;
+        config.host = options.Get("host", "127.0.0.1");
+        config.port = options.Get("port", config.port);
+        config.mockHost = options.Get("mock-host", "127.0.0.1");
+        config.mockPort = options.Get("mock-port", config.mockPort);
+        config.clients = std::max<std::size_t>(options.Get("clients", config.clients), 1);
+        config.requestsPerClient = options.Get("requests", config.requestsPerClient);
+        config.model = options.Get("model", "mock:latest");
+        config.prompt = options.Get("prompt", "Hello");
+        config.ramp = std::chrono::milliseconds(options.Get<std::int64_t>("ramp-ms", 1000));
+        config.proxyPid = options.Get("proxy-pid", config.proxyPid);
+        config.threads = std::max<std::size_t>(options.Get("threads", config.threads), 1);
+
+        RaiseOpenFilesLimit();
+        nlohmann::json report;
+        report["clients"] = config.clients;
+        std::optional<TSamples> direct;
+        if (config.mockPort > 0)
+        {
+            direct = RunLoad(config, config.mockHost, config.mockPort);
+            report["direct"] = Report(*direct);
+        }
+
+        const auto rssBefore = config.proxyPid > 0 ? ReadRssKiB(config.proxyPid) : 0;
+        const auto cpuBefore =
+          config.proxyPid > 0 ? ReadCpuTime(config.proxyPid) : std::chrono::microseconds{0};
+        std::atomic<std::size_t> rssPeak{rssBefore};
+        std::atomic<bool> isRunning{true};
+        std::thread rssSampler([&]() {
+            while (config.proxyPid > 0 && isRunning)
+            {
+                const auto rss = ReadRssKiB(config.proxyPid);
+                if (rss > rssPeak)
+                {
+                    rssPeak = rss;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds{50}); // NOLINT
+            }
+        });
+        auto samples = RunLoad(config, config.host, config.port);
+        isRunning = false;
+        rssSampler.join();
+
+        report.update(Report(samples));
+        if (direct)
+        {
+            report["proxy_added_latency"] =
+              Subtract(report["delivery_latency"], report["direct"]["delivery_latency"]);
+            report["proxy_added_time_to_first_token"] =
+              Subtract(report["time_to_first_token"], report["direct"]["time_to_first_token"]);
+        }
+        const auto streams = std::max<std::size_t>(samples.succeeded + samples.failed, 1);
+        if (config.proxyPid > 0)
+        {
+            const auto cpu = ReadCpuTime(config.proxyPid) - cpuBefore;
+            report["proxy_cpu_us_per_stream"] = cpu.count() / static_cast<std::int64_t>(streams);
+            // Clients run concurrently, so peak is shared by all of them.
+            report["proxy_rss_kib_per_stream"] =
+              static_cast<double>(rssPeak - rssBefore) / static_cast<double>(config.clients);
+        }
+
+        std::cout << report.dump(2) << std::endl;
+        if (options.Has("out"))
+        {
+            std::ofstream(options.Get("out", "")) << report.dump(2) << std::endl;
+        }
+        return samples.failed == 0 && (!direct || direct->failed == 0) ? 0 : 2;
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        PrintUsage();
+        return 1;
+    }
+}
@@ -0,0 +1,907 @@
+#include "mock_ollama.hpp" // IWYU pragma: keep
+
+#include <ollama/json.hpp>
+#include <tools/event_loop.hpp>
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+constexpr double kNanosecondsInSecond = 1e9;
+// Rough estimation, Ollama's tokenizer is not available here.
+constexpr std::size_t kBytesPerPromptToken = 4;
+constexpr std::size_t kReadBufferSize = 64 * 1024;
+/// @brief Connection sending bigger request is closed.
+constexpr std::size_t kMaxRequestBytes = 64 * 1024 * 1024;
+constexpr auto kJsonType = "application/json";
+
+std::string GetUtcTime()
+{
+    const auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    std::tm utc{};
+    ::gmtime_r(&now, &utc);
+    char buffer[32] = {};
+    std::strftime(buffer, sizeof(buffer), "%FT%TZ", &utc);
+    return buffer;
+}
+
+/// @returns true if the last message is user's and it is not a follow-up after backend command.
+bool IsKeywordTurn(const nlohmann::json &request)
+{
+    constexpr auto kMessagesKey = "messages";
+    if (!request.contains(kMessagesKey) || !request[kMessagesKey].is_array()
+        || request[kMessagesKey].empty())
+    {
+        return false;
+    }
+    const auto &messages = request[kMessagesKey];
+    const auto isUser = [](const nlohmann::json &message) {
+        return message.value("role", "") == "user";
+    };
+    return isUser(messages.back())
+           && (messages.size() == 1 || !isUser(messages[messages.size() - 2]));
+}
+
+void SetText(nlohmann::json &chunk, bool isChat, const std::string &text)
+{
+    if (isChat)
+    {
+        chunk["message"]["role"] = "assistant";
+        chunk["message"]["content"] = text;
+    }
+    else
+    {
+        chunk["response"] = text;
+    }
+}
+
+const char *GetReason(int status)
+{
+    switch (status)
+    {
+    case 200:
+        return "OK";
+    case 400:
+        return "Bad Request";
+    case 404:
+        return "Not Found";
+    case 411:
+        return "Length Required";
+    default:
+        return "Internal Server Error";
+    }
+}
+
+std::string ToLower(std::string_view text)
+{
+    std::string lower(text);
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) {
+        return static_cast<char>(std::tolower(c));
+    });
+    return lower;
+}
+
+std::string_view Trim(std::string_view text)
+{
+    while (!text.empty() && (text.front() == ' ' || text.front() == '\t'))
+    {
+        text.remove_prefix(1);
+    }
+    while (!text.empty() && (text.back() == ' ' || text.back() == '\t' || text.back() == '\r'))
+    {
+        text.remove_suffix(1);
+    }
+    return text;
+}
+
+/// @brief Head of the HTTP request, only what the mock needs.
+struct THead
+{
+    std::string method;
+    std::string path;
+    std::size_t contentLength{0};
+    bool isChunked{false};
+    bool isKeepAlive{true};
+    bool isContinueExpected{false};
+};
+
+THead ParseHead(std::string_view head)
+{
+    THead parsed;
+    auto lineEnd = head.find("\r\n");
+    const auto requestLine = head.substr(0, lineEnd);
+    const auto methodEnd = requestLine.find(' ');
+    const auto pathEnd = requestLine.find(' ', methodEnd + 1);
+    if (methodEnd == std::string_view::npos || pathEnd == std::string_view::npos)
+    {
+        throw std::invalid_argument("Malformed request line.");
+    }
+    parsed.method = requestLine.substr(0, methodEnd);
+    const auto target = requestLine.substr(methodEnd + 1, pathEnd - methodEnd - 1);
+    parsed.path = target.substr(0, target.find('?'));
+    parsed.isKeepAlive = requestLine.substr(pathEnd + 1) != "HTTP/1.0";
+
+    while (lineEnd != std::string_view::npos)
+    {
+        const auto begin = lineEnd + 2;
+        lineEnd = head.find("\r\n", begin);
+        const auto line = head.substr(begin, lineEnd - begin);
+        const auto colon = line.find(':');
+        if (colon == std::string_view::npos)
+        {
+            continue;
+        }
+        const auto name = ToLower(Trim(line.substr(0, colon)));
+        const auto value = ToLower(Trim(line.substr(colon + 1)));
+        if (name == "content-length")
+        {
+            parsed.contentLength = std::stoull(value);
+        }
+        else if (name == "transfer-encoding")
+        {
+            parsed.isChunked = value.find("chunked") != std::string::npos;
+        }
+        else if (name == "connection")
+        {
+            parsed.isKeepAlive = value == "keep-alive" || (parsed.isKeepAlive && value != "close");
+        }
+        else if (name == "expect")
+        {
+            parsed.isContinueExpected = value == "100-continue";
+        }
+    }
+    return parsed;
+}
+
+void SetNonBlocking(int fd)
+{
+    ::fcntl(fd, F_SETFL, ::fcntl(fd, F_GETFL, 0) | O_NONBLOCK); // NOLINT
+}
+
+/// @returns Non-blocking socket listening the address.
+/// @throws std::runtime_error if the address cannot be bound.
+int Listen(const std::string &host, int port)
+{
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo *addresses = nullptr;
+    if (::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses) != 0)
+    {
+        return -1;
+    }
+    int fd = -1;
+    for (auto *address = addresses; address != nullptr && fd < 0; address = address->ai_next)
+    {
+        fd = ::socket(address->ai_family, address->ai_socktype | SOCK_CLOEXEC,
+                      address->ai_protocol);
+        if (fd < 0)
+        {
+            continue;
+        }
+        const int yes = 1;
+        ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+        if (::bind(fd, address->ai_addr, address->ai_addrlen) != 0 || ::listen(fd, SOMAXCONN) != 0)
+        {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+    ::freeaddrinfo(addresses);
+    if (fd >= 0)
+    {
+        SetNonBlocking(fd);
+    }
+    return fd;
+}
+
+int GetBoundPort(int fd)
+{
+    sockaddr_storage address{};
+    socklen_t length = sizeof(address);
+    ::getsockname(fd, reinterpret_cast<sockaddr *>(&address), &length); // NOLINT
+    if (address.ss_family == AF_INET6)
+    {
+        return ntohs(reinterpret_cast<const sockaddr_in6 &>(address).sin6_port); // NOLINT
+    }
+    return ntohs(reinterpret_cast<const sockaddr_in &>(address).sin_port); // NOLINT
+}
+
+std::vector<float> MakeEmbedding(const std::string &input, std::size_t dimensions)
+{
+    std::minstd_rand random(static_cast<std::uint32_t>(std::hash<std::string>{}(input)));
+    std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+    std::vector<float> embedding(dimensions);
+    for (auto &value : embedding)
+    {
+        value = distribution(random);
+    }
+    return embedding;
+}
+} // namespace
+
+struct CMockOllama::TConnection
+{
+    int fd{-1};
+    std::uint64_t id{0};
+    CEventLoop::TWatchId watchId{0};
+    std::string input;
+    std::string output;
+    /// @brief Request is answered, the next one waits in the input.
+    bool isResponding{false};
+    bool isKeepAlive{true};
+    bool isClosed{false};
+    /// @brief Pending token or answer of the request.
+    CEventLoop::TTimerId timer{CEventLoop::kInvalidTimer};
+};
+
+struct CMockOllama::TStream
+{
+    std::size_t timingIndex{0};
+    bool isChat{true};
+    std::string model;
+    std::vector<std::string> tokens;
+    std::size_t next{0};
+    std::size_t promptTokens{0};
+    bool isDisconnecting{false};
+    std::chrono::nanoseconds timeToFirstToken{0};
+    std::chrono::nanoseconds tokenInterval{0};
+    std::chrono::steady_clock::time_point nextAt;
+
+    [[nodiscard]]
+    nlohmann::json MakeChunk(const std::string &text) const
+    {
+        nlohmann::json chunk;
+        chunk["model"] = model;
+        chunk["created_at"] = GetUtcTime();
+        SetText(chunk, isChat, text);
+        chunk["done"] = false;
+        return chunk;
+    }
+
+    [[nodiscard]]
+    nlohmann::json MakeFinalChunk(const std::string &text) const
+    {
+        auto chunk = MakeChunk(text);
+        const auto evalDuration = tokenInterval * tokens.size();
+        chunk["done"] = true;
+        chunk["done_reason"] = "stop";
+        chunk["prompt_eval_count"] = promptTokens;
+        chunk["prompt_eval_duration"] = timeToFirstToken.count();
+        chunk["eval_count"] = tokens.size();
+        chunk["eval_duration"] = evalDuration.count();
+        chunk["load_duration"] = 0;
+        chunk["total_duration"] = (timeToFirstToken + evalDuration).count();
+        return chunk;
+    }
+};
+
+struct CMockOllama::TReplay
+{
+    const TCapturedStream *stream{nullptr};
+    std::size_t next{0};
+    std::chrono::steady_clock::time_point nextAt;
+    double speed{1.0};
+
+    void Advance()
+    {
+        if (next < stream->lines.size() && speed > 0)
+        {
+            nextAt += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+              stream->lines[next].delay / speed);
+        }
+    }
+};
+
+CMockOllama::CMockOllama(TMockOllamaConfig config) :
+    config(std::move(config)),
+    random(this->config.seed)
+{
+    if (!this->config.replayPath.empty())
+    {
+        replayStreams = CStreamCapture::ReadAll(this->config.replayPath);
+        if (replayStreams.empty())
+        {
+            throw std::runtime_error("Capture has no streams " + this->config.replayPath);
+        }
+    }
+}
+
+CMockOllama::~CMockOllama()
+{
+    Stop();
+}
+
+int CMockOllama::Start(const std::string &host, int port)
+{
+    listenFd = Listen(host, port);
+    if (listenFd < 0)
+    {
+        throw std::runtime_error("Mock Ollama failed to bind " + host + ":" + std::to_string(port));
+    }
+    loop.Watch(listenFd, EPOLLIN, [this](std::uint32_t /*events*/) {
+        Accept();
+    });
+    loopThread = std::thread([this]() {
+        loop.Run();
+    });
+    return GetBoundPort(listenFd);
+}
+
+void CMockOllama::Stop()
+{
+    loop.Stop();
+    if (loopThread.joinable())
+    {
+        loopThread.join();
+    }
+    for (const auto &[id, connection] : connections)
+    {
+        ::close(connection->fd);
+    }
+    connections.clear();
+    if (listenFd >= 0)
+    {
+        ::close(listenFd);
+        listenFd = -1;
+    }
+}
+
+std::int64_t CMockOllama::NowMicroseconds()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+std::vector<TMockGenerationTiming> CMockOllama::GetGenerationTimings() const
+{
+    const std::lock_guard lock(timingsMutex);
+    return timings;
+}
+
+std::size_t CMockOllama::RecordArrival()
+{
+    const auto now = NowMicroseconds();
+    const std::lock_guard lock(timingsMutex);
+    timings.push_back({now, 0});
+    return timings.size() - 1;
+}
+
+void CMockOllama::RecordSent(std::size_t timingIndex)
+{
+    const auto now = NowMicroseconds();
+    const std::lock_guard lock(timingsMutex);
+    timings.at(timingIndex).lastSentAtUs = now;
+}
+
+CMockOllama::EFault CMockOllama::DrawFault()
+{
+    std::uniform_real_distribution<double> distribution(0.0, 1.0);
+    auto draw = distribution(random);
+    for (const auto &[rate, fault] : {std::pair{config.errorRate, EFault::Error},
+                                      std::pair{config.disconnectRate, EFault::Disconnect},
+                                      std::pair{config.stallRate, EFault::Stall}})
+    {
+        if (draw < rate)
+        {
+            return fault;
+        }
+        draw -= rate;
+    }
+    return EFault::None;
+}
+
+void CMockOllama::Accept()
+{
+    while (true)
+    {
+        const int fd = ::accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+        {
+            return;
+        }
+        // Chunks are small, they must not wait for each other.
+        const int yes = 1;
+        ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &yes, sizeof(yes));
+
+        auto connection = std::make_shared<TConnection>();
+        connection->fd = fd;
+        connection->id = ++lastConnectionId;
+        try
+        {
+            connection->watchId = loop.Watch(
+              fd, EPOLLIN | EPOLLRDHUP, [this, id = connection->id](std::uint32_t events) {
+                  const auto it = connections.find(id);
+                  if (it != connections.end())
+                  {
+                      // Copy, so the connection outlives its closing by the handler.
+                      const auto held = it->second;
+                      OnEvents(held, events);
+                  }
+              });
+        }
+        catch (const std::exception &)
+        {
+            ::close(fd);
+            continue;
+        }
+        connections.emplace(connection->id, std::move(connection));
+    }
+}
+
+void CMockOllama::OnEvents(const TConnectionPtr &connection, std::uint32_t events)
+{
+    if ((events & (EPOLLERR | EPOLLHUP)) != 0)
+    {
+        Close(connection);
+        return;
+    }
+    if ((events & EPOLLOUT) != 0)
+    {
+        Write(connection, {});
+        if (connection->isClosed)
+        {
+            return;
+        }
+    }
+    if ((events & (EPOLLIN | EPOLLRDHUP)) == 0)
+    {
+        return;
+    }
+    char buffer[kReadBufferSize];
+    while (true)
+    {
+        const auto received = ::recv(connection->fd, buffer, sizeof(buffer), 0);
+        if (received > 0 && connection->input.size() <= kMaxRequestBytes)
+        {
+            connection->input.append(buffer, static_cast<std::size_t>(received));
+            continue;
+        }
+        if (received < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        // Client which left cancels its generation, like with Ollama.
+        Close(connection);
+        return;
+    }
+    ServeNext(connection);
+}
+
+void CMockOllama::ServeNext(const TConnectionPtr &connection)
+{
+    if (connection->isResponding || connection->isClosed)
+    {
+        return;
+    }
+    const auto headEnd = connection->input.find("\r\n\r\n");
+    if (headEnd == std::string::npos)
+    {
+        return;
+    }
+    THead head;
+    try
+    {
+        head = ParseHead(std::string_view(connection->input).substr(0, headEnd));
+    }
+    catch (const std::exception &)
+    {
+        connection->isKeepAlive = false;
+        connection->isResponding = true;
+        Respond(connection, 400, R"({"error":"malformed request"})");
+        return;
+    }
+    if (head.isChunked)
+    {
+        connection->isKeepAlive = false;
+        connection->isResponding = true;
+        Respond(connection, 411, R"({"error":"content length is required"})");
+        return;
+    }
+    const auto bodyBegin = headEnd + 4;
+    if (connection->input.size() < bodyBegin + head.contentLength)
+    {
+        if (head.isContinueExpected && connection->input.size() == bodyBegin)
+        {
+            Write(connection, "HTTP/1.1 100 Continue\r\n\r\n");
+        }
+        return;
+    }
+
+    TRequest request;
+    request.method = std::move(head.method);
+    request.path = std::move(head.path);
+    request.body = connection->input.substr(bodyBegin, head.contentLength);
+    connection->input.erase(0, bodyBegin + head.contentLength);
+    connection->isKeepAlive = head.isKeepAlive;
+    connection->isResponding = true;
+    try
+    {
+        Dispatch(connection, request);
+    }
+    catch (const std::exception &e)
+    {
+        if (!connection->isClosed)
+        {
+            Respond(connection, 500, nlohmann::json{{"error", e.what()}}.dump());
+        }
+    }
+}
+
+void CMockOllama::Dispatch(const TConnectionPtr &connection, const TRequest &request)
+{
+    const bool isPost = request.method == "POST";
+    if (isPost && request.path == "/api/chat")
+    {
+        HandleGeneration(connection, request, true);
+    }
+    else if (isPost && request.path == "/api/generate")
+    {
+        HandleGeneration(connection, request, false);
+    }
+    else if (isPost && request.path == "/api/embed")
+    {
+        HandleEmbed(connection, request);
+    }
+    else if (request.method == "GET" && request.path == "/api/tags")
+    {
+        HandleTags(connection);
+    }
+    else
+    {
+        Respond(connection, 404, R"({"error":"not found"})");
+    }
+}
+
+void CMockOllama::Write(const TConnectionPtr &connection, std::string data)
+{
+    if (connection->isClosed)
+    {
+        return;
+    }
+    const bool wasEmpty = connection->output.empty();
+    connection->output += data;
+    std::size_t sent = 0;
+    while (sent < connection->output.size())
+    {
+        const auto written = ::send(connection->fd, connection->output.data() + sent,
+                                    connection->output.size() - sent, MSG_NOSIGNAL);
+        if (written > 0)
+        {
+            sent += static_cast<std::size_t>(written);
+            continue;
+        }
+        if (written < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        {
+            break;
+        }
+        Close(connection);
+        return;
+    }
+    connection->output.erase(0, sent);
+
+    if (connection->output.empty() && !connection->isResponding && !connection->isKeepAlive)
+    {
+        Close(connection);
+        return;
+    }
+    if (wasEmpty != connection->output.empty())
+    {
+        loop.Rewatch(connection->watchId,
+                     EPOLLIN | EPOLLRDHUP | (connection->output.empty() ? 0U : EPOLLOUT));
+    }
+}
+
+void CMockOllama::Respond(const TConnectionPtr &connection, int status, const std::string &body)
+{
+    std::string response = "HTTP/1.1 " + std::to_string(status) + " " + GetReason(status)
+                           + "\r\nContent-Type: " + kJsonType
+                           + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n";
+    response += connection->isKeepAlive ? "\r\n" : "Connection: close\r\n\r\n";
+    response += body;
+    Write(connection, std::move(response));
+    EndResponse(connection);
+}
+
+void CMockOllama::StartStream(const TConnectionPtr &connection)
+{
+    Write(connection, std::string("HTTP/1.1 200 OK\r\nContent-Type: application/x-ndjson\r\n"
+                                  "Transfer-Encoding: chunked\r\n")
+                        + (connection->isKeepAlive ? "\r\n" : "Connection: close\r\n\r\n"));
+}
+
+void CMockOllama::WriteLine(const TConnectionPtr &connection, const std::string &line)
+{
+    char size[32] = {};
+    std::snprintf(size, sizeof(size), "%zx\r\n", line.size());
+    Write(connection, size + line + "\r\n");
+}
+
+void CMockOllama::EndResponse(const TConnectionPtr &connection)
+{
+    if (connection->isClosed)
+    {
+        return;
+    }
+    connection->isResponding = false;
+    if (!connection->isKeepAlive)
+    {
+        // Closed once the answer is flushed.
+        Write(connection, {});
+        return;
+    }
+    ServeNext(connection);
+}
+
+void CMockOllama::Close(const TConnectionPtr &connection)
+{
+    if (connection->isClosed)
+    {
+        return;
+    }
+    connection->isClosed = true;
+    loop.Cancel(connection->timer);
+    loop.Unwatch(connection->watchId);
+    ::close(connection->fd);
+    connections.erase(connection->id);
+}
+
+void CMockOllama::HandleGeneration(const TConnectionPtr &connection, const TRequest &request,
+                                   bool isChat)
+{
+    requestsCount.fetch_add(1, std::memory_order_relaxed);
+    const auto timingIndex = RecordArrival();
+    nlohmann::json body;
+    try
+    {
+        body = nlohmann::json::parse(request.body);
+    }
+    catch (const std::exception &e)
+    {
+        Respond(connection, 400, nlohmann::json{{"error", e.what()}}.dump());
+        return;
+    }
+
+    const auto fault = DrawFault();
+    if (fault == EFault::Error)
+    {
+        Respond(connection, 500, R"({"error":"mock fault"})");
+        return;
+    }
+
+    auto stream = std::make_shared<TStream>();
+    stream->timingIndex = timingIndex;
+    stream->isChat = isChat;
+    stream->model = body.value("model", config.models.front());
+    stream->promptTokens = request.body.size() / kBytesPerPromptToken + 1;
+    stream->isDisconnecting = fault == EFault::Disconnect;
+    if (isChat && !config.scriptedKeyword.empty() && IsKeywordTurn(body))
+    {
+        stream->tokens.push_back(config.scriptedKeyword);
+    }
+    else
+    {
+        for (std::size_t i = 0; i < config.tokensCount; ++i)
+        {
+            stream->tokens.push_back("tok" + std::to_string(i) + " ");
+        }
+    }
+    stream->timeToFirstToken = config.timeToFirstToken;
+    if (fault == EFault::Stall)
+    {
+        stream->timeToFirstToken += config.stallDuration;
+    }
+    if (config.tokensPerSecond > 0)
+    {
+        stream->tokenInterval =
+          std::chrono::nanoseconds(static_cast<std::int64_t>(kNanosecondsInSecond
+                                                             / config.tokensPerSecond));
+    }
+    stream->nextAt = std::chrono::steady_clock::now() + stream->timeToFirstToken;
+
+    const bool isStreaming = !body.contains("stream") || !body["stream"].is_boolean()
+                             || body["stream"].get<bool>();
+    if (isChat && isStreaming && !replayStreams.empty())
+    {
+        Replay(connection);
+        return;
+    }
+    if (!isStreaming)
+    {
+        const auto tokensAfterFirst = stream->tokens.empty() ? 0 : stream->tokens.size() - 1;
+        const std::weak_ptr<TConnection> weak = connection;
+        connection->timer =
+          loop.Schedule(stream->nextAt + stream->tokenInterval * tokensAfterFirst,
+                        [this, weak, stream]() {
+                            const auto connection = weak.lock();
+                            if (!connection || connection->isClosed)
+                            {
+                                return;
+                            }
+                            connection->timer = CEventLoop::kInvalidTimer;
+                            std::string text;
+                            for (const auto &token : stream->tokens)
+                            {
+                                text += token;
+                            }
+                            Respond(connection, 200, stream->MakeFinalChunk(text).dump());
+                        });
+        return;
+    }
+
+    StartStream(connection);
+    ScheduleToken(connection, stream);
+}
+
+void CMockOllama::ScheduleToken(const TConnectionPtr &connection,
+                                const std::shared_ptr<TStream> &stream)
+{
+    if (stream->next == stream->tokens.size())
+    {
+        SendToken(connection, stream);
+        return;
+    }
+    const std::weak_ptr<TConnection> weak = connection;
+    connection->timer = loop.Schedule(stream->nextAt, [this, weak, stream]() {
+        const auto connection = weak.lock();
+        if (connection && !connection->isClosed)
+        {
+            connection->timer = CEventLoop::kInvalidTimer;
+            SendToken(connection, stream);
+        }
+    });
+}
+
+void CMockOllama::SendToken(const TConnectionPtr &connection,
+                            const std::shared_ptr<TStream> &stream)
+{
+    if (stream->isDisconnecting && stream->next == stream->tokens.size() / 2)
+    {
+        Close(connection);
+        return;
+    }
+    const bool isLast = stream->next == stream->tokens.size();
+    auto chunk =
+      isLast ? stream->MakeFinalChunk("") : stream->MakeChunk(stream->tokens[stream->next]);
+    chunk[kSentAtKey] = NowMicroseconds();
+    WriteLine(connection, chunk.dump() + "\n");
+    if (connection->isClosed)
+    {
+        return;
+    }
+    RecordSent(stream->timingIndex);
+    if (isLast)
+    {
+        Write(connection, "0\r\n\r\n");
+        EndResponse(connection);
+        return;
+    }
+    ++stream->next;
+    stream->nextAt += stream->tokenInterval;
+    ScheduleToken(connection, stream);
+}
+
+void CMockOllama::Replay(const TConnectionPtr &connection)
+{
+    auto replay = std::make_shared<TReplay>();
+    replay->stream =
+      &replayStreams[nextReplay.fetch_add(1, std::memory_order_relaxed) % replayStreams.size()];
+    replay->nextAt = std::chrono::steady_clock::now();
+    replay->speed = config.replaySpeed;
+    replay->Advance();
+
+    StartStream(connection);
+    ReplayNext(connection, replay);
+}
+
+void CMockOllama::ReplayNext(const TConnectionPtr &connection,
+                             const std::shared_ptr<TReplay> &replay)
+{
+    if (replay->next == replay->stream->lines.size())
+    {
+        Write(connection, "0\r\n\r\n");
+        EndResponse(connection);
+        return;
+    }
+    const std::weak_ptr<TConnection> weak = connection;
+    connection->timer = loop.Schedule(replay->nextAt, [this, weak, replay]() {
+        const auto connection = weak.lock();
+        if (!connection || connection->isClosed)
+        {
+            return;
+        }
+        connection->timer = CEventLoop::kInvalidTimer;
+        const auto &text = replay->stream->lines[replay->next].text;
+        auto line = nlohmann::json::parse(text, nullptr, false);
+        if (line.is_object())
+        {
+            line[kSentAtKey] = NowMicroseconds();
+        }
+        WriteLine(connection, (line.is_object() ? line.dump() : text) + "\n");
+        if (connection->isClosed)
+        {
+            return;
+        }
+        ++replay->next;
+        replay->Advance();
+        ReplayNext(connection, replay);
+    });
+}
+
+void CMockOllama::HandleEmbed(const TConnectionPtr &connection, const TRequest &request)
+{
+    const auto body = nlohmann::json::parse(request.body, nullptr, false);
+    if (body.is_discarded() || !body.contains("input"))
+    {
+        Respond(connection, 400, R"({"error":"input is required"})");
+        return;
+    }
+    requestsCount.fetch_add(1, std::memory_order_relaxed);
+    const auto &input = body["input"];
+    std::vector<std::string> inputs;
+    if (input.is_string())
+    {
+        inputs.push_back(input.get<std::string>());
+    }
+    else
+    {
+        inputs = input.get<std::vector<std::string>>();
+    }
+
+    nlohmann::json result;
+    result["model"] = body.value("model", config.models.front());
+    result["embeddings"] = nlohmann::json::array();
+    for (const auto &text : inputs)
+    {
+        result["embeddings"].push_back(MakeEmbedding(text, config.embeddingDimensions));
+    }
+    result["prompt_eval_count"] = request.body.size() / kBytesPerPromptToken + 1;
+    Respond(connection, 200, result.dump());
+}
+
+void CMockOllama::HandleTags(const TConnectionPtr &connection)
+{
+    nlohmann::json result;
+    result["models"] = nlohmann::json::array();
+    for (const auto &model : config.models)
+    {
+        result["models"].push_back(
+          {{"name", model}, {"model", model}, {"size", 0}, {"digest", "mock"}});
+    }
+    Respond(connection, 200, result.dump());
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <common/cm_ctors.h>
+#include <network/stream_capture.hpp>
+#include <ollama/json.hpp>
+#include <tools/event_loop.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Behaviour of the mock Ollama server.
+struct TMockOllamaConfig
+{
+    std::chrono::milliseconds timeToFirstToken{50};
+    double tokensPerSecond{50.0};
+    /// @brief How many tokens each answer has.
+    std::size_t tokensCount{64};
+    /// @brief If set, the first answer to each chat is this keyword, like "AI_DATE_TIME_NOW", so
+    /// proxy executes command and asks again. Chat which ends with 2 user messages is such a
+    /// follow-up, it gets normal answer.
+    std::string scriptedKeyword;
+    std::size_t embeddingDimensions{8};
+    std::vector<std::string> models{"mock:latest"};
+
+    // Faults, share of requests from 0 to 1.
+    /// @brief Request fails with 500.
+    double errorRate{0.0};
+    /// @brief Connection is closed in the middle of the stream.
+    double disconnectRate{0.0};
+    /// @brief First token is delayed by stallDuration.
+    double stallRate{0.0};
+    std::chrono::milliseconds stallDuration{1000};
+    std::uint32_t seed{1};
+
+    /// @brief Capture of the real Ollama (see CStreamCapture). If set, streamed chats replay its
+    /// streams round-robin instead of generated text.
+    std::string replayPath;
+    /// @brief 1 replays with the original timings, 2 twice faster, 0 as fast as possible.
+    double replaySpeed{1.0};
+};
+
+/// @brief Timings of the single generation request, steady clock microseconds.
+struct TMockGenerationTiming
+{
+    std::int64_t receivedAtUs{0};
+    /// @brief When the last chunk was written to the socket, 0 if none was.
+    std::int64_t lastSentAtUs{0};
+};
+
+/// @brief Local server which speaks /api/chat, /api/generate, /api/embed and /api/tags like
+/// Ollama, but generates text with configured timings. Each streamed chunk has "mock_sent_at_us"
+/// field, steady clock time when it was sent, so the latency added by the proxy can be measured.
+/// All connections are served by the single event loop thread, streams wait on its timers, so
+/// thousands of them do not need thousands of threads.
+class CMockOllama
+{
+  public:
+    /// @brief Name of the chunk field with the send time.
+    static constexpr auto kSentAtKey = "mock_sent_at_us";
+
+    NO_COPYMOVE(CMockOllama);
+    CMockOllama() = delete;
+    ~CMockOllama();
+    explicit CMockOllama(TMockOllamaConfig config);
+
+    /// @brief Starts serving on the background thread.
+    /// @param port 0 selects any free port.
+    /// @returns Port which is listened.
+    /// @throws std::runtime_error if port cannot be bound.
+    int Start(const std::string &host = "127.0.0.1", int port = 0);
+    void Stop();
+
+    [[nodiscard]]
+    std::size_t GetRequestsCount() const
+    {
+        return requestsCount.load(std::memory_order_relaxed);
+    }
+
+    /// @returns Timings of the generation requests in order of arrival. Gap between the last chunk
+    /// of one request and arrival of the next one is the round trip through the client.
+    [[nodiscard]]
+    std::vector<TMockGenerationTiming> GetGenerationTimings() const;
+
+    /// @returns Steady clock time in microseconds, the same clock is used by kSentAtKey.
+    [[nodiscard]]
+    static std::int64_t NowMicroseconds();
+
+  private:
+    enum class EFault : std::uint8_t {
+        None,
+        Error,
+        Disconnect,
+        Stall,
+    };
+
+    struct TStream;
+    struct TReplay;
+    struct TConnection;
+    using TConnectionPtr = std::shared_ptr<TConnection>;
+
+    /// @brief Request parsed from the connection.
+    struct TRequest
+    {
+        std::string method;
+        std::string path;
+        std::string body;
+    };
+
+    /// @returns Index of the timing of the new request.
+    std::size_t RecordArrival();
+    void RecordSent(std::size_t timingIndex);
+
+    [[nodiscard]]
+    EFault DrawFault();
+
+    // Connections, called on the loop thread.
+    void Accept();
+    void OnEvents(const TConnectionPtr &connection, std::uint32_t events);
+    /// @brief Parses the next request, unless the previous one is still answered.
+    void ServeNext(const TConnectionPtr &connection);
+    void Dispatch(const TConnectionPtr &connection, const TRequest &request);
+    /// @brief Queues data and sends as much as the socket takes, the rest on EPOLLOUT.
+    void Write(const TConnectionPtr &connection, std::string data);
+    void Respond(const TConnectionPtr &connection, int status, const std::string &body);
+    /// @brief Sends headers of the chunked answer, lines follow with WriteLine().
+    void StartStream(const TConnectionPtr &connection);
+    void WriteLine(const TConnectionPtr &connection, const std::string &line);
+    /// @brief Completes the answer, the next request of the connection is served then.
+    void EndResponse(const TConnectionPtr &connection);
+    void Close(const TConnectionPtr &connection);
+
+    void HandleGeneration(const TConnectionPtr &connection, const TRequest &request, bool isChat);
+    /// @brief Sends the next token when it is due, the final chunk follows the last at once.
+    void ScheduleToken(const TConnectionPtr &connection, const std::shared_ptr<TStream> &stream);
+    void SendToken(const TConnectionPtr &connection, const std::shared_ptr<TStream> &stream);
+    void Replay(const TConnectionPtr &connection);
+    void ReplayNext(const TConnectionPtr &connection, const std::shared_ptr<TReplay> &replay);
+    void HandleEmbed(const TConnectionPtr &connection, const TRequest &request);
+    void HandleTags(const TConnectionPtr &connection);
+
+    const TMockOllamaConfig config;
+    CEventLoop loop;
+    int listenFd{-1};
+    std::thread loopThread;
+    /// @brief Open connections by their ids, used on the loop thread only.
+    std::unordered_map<std::uint64_t, TConnectionPtr> connections;
+    std::uint64_t lastConnectionId{0};
+    std::mt19937 random;
+    std::atomic<std::size_t> requestsCount{0};
+    mutable std::mutex timingsMutex;
+    std::vector<TMockGenerationTiming> timings;
+    std::vector<TCapturedStream> replayStreams;
+    std::atomic<std::size_t> nextReplay{0};
+};
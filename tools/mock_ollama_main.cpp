@@ -0,0 +1,87 @@
+#include <tools/cli_options.hpp>
+#include <tools/event_loop.hpp>
+#include <tools/mock_ollama.hpp>
+
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <thread>
+
+namespace {
+volatile std::sig_atomic_t isInterrupted = 0;
+
+void HandleSignal(int /*signum*/)
+{
+    isInterrupted = 1;
+}
+
+void PrintUsage()
+{
+    std::cout << "ollama_mock [options]\n"
+                 "  --host=127.0.0.1 --port=11434\n"
+                 "  --ttft-ms=50 --tokens-per-second=50 --tokens=64\n"
+                 "  --keyword=AI_DATE_TIME_NOW   first answer of each chat is the keyword\n"
+                 "  --embedding-dimensions=8 --model=mock:latest\n"
+                 "  --error-rate=0 --disconnect-rate=0 --stall-rate=0 --stall-ms=1000 --seed=1\n"
+                 "  --replay=capture.bin --replay-speed=1   stream captured chats, speed 0 is\n"
+                 "                                          as fast as possible\n";
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    using namespace std::chrono_literals;
+    try
+    {
+        const CCliOptions options(argc, argv);
+        if (options.Has("help"))
+        {
+            PrintUsage();
+            return 0;
+        }
+
+        TMockOllamaConfig config;
+        config.timeToFirstToken =
+          std::chrono::milliseconds(options.Get<std::int64_t>("ttft-ms", 50));
+        config.tokensPerSecond = options.Get("tokens-per-second", config.tokensPerSecond);
+        config.tokensCount = options.Get("tokens", config.tokensCount);
+        config.scriptedKeyword = options.Get("keyword", "");
+        config.embeddingDimensions =
+          options.Get("embedding-dimensions", config.embeddingDimensions);
+        config.models = {options.Get("model", "mock:latest")};
+        config.errorRate = options.Get("error-rate", config.errorRate);
+        config.disconnectRate = options.Get("disconnect-rate", config.disconnectRate);
+        config.stallRate = options.Get("stall-rate", config.stallRate);
+        config.stallDuration =
+          std::chrono::milliseconds(options.Get<std::int64_t>("stall-ms", 1000));
+        config.seed = options.Get("seed", config.seed);
+        config.replayPath = options.Get("replay", "");
+        config.replaySpeed = options.Get("replay-speed", config.replaySpeed);
+
+        RaiseOpenFilesLimit();
+        std::signal(SIGINT, HandleSignal);
+        std::signal(SIGTERM, HandleSignal);
+
+        CMockOllama mock(config);
+        const auto host = options.Get("host", "127.0.0.1");
+        const auto port = mock.Start(host, options.Get("port", 11434));
+        std::cout << "Mock Ollama listens on " << host << ":" << port << std::endl;
+        while (isInterrupted == 0)
+        {
+            std::this_thread::sleep_for(200ms); // NOLINT
+        }
+        mock.Stop();
+        std::cout << "Served " << mock.GetRequestsCount() << " requests." << std::endl;
+    }
+    catch (std::exception &e)
+    {
+        std::cerr << e.what() << std::endl;
+        PrintUsage();
+        return 1;
+    }
+    return 0;
+}